@@ -0,0 +1,74 @@
+// Copyright: ThoughtSpot Inc 2017
+
+#include "common/arena.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <new>
+
+namespace threadstacks {
+namespace common {
+
+// static
+constexpr size_t Arena::kDefaultBlockSize;
+
+Arena::Arena(size_t block_size) : block_size_(block_size) {}
+
+Arena::~Arena() { FreeBlocks(); }
+
+void* Arena::Allocate(size_t size, size_t alignment) {
+  ++num_allocations_;
+  bytes_allocated_ += size;
+  auto aligned = [&]() {
+    auto p = reinterpret_cast<uintptr_t>(ptr_);
+    return reinterpret_cast<char*>((p + alignment - 1) & ~(alignment - 1));
+  };
+  char* p = aligned();
+  if (head_ == nullptr || p + size > end_) {
+    AddBlock(size + alignment);
+    p = aligned();
+  }
+  ptr_ = p + size;
+  return p;
+}
+
+void Arena::Reset() {
+  num_allocations_ = 0;
+  bytes_allocated_ = 0;
+  if (head_ != nullptr && head_->next != nullptr) {
+    const auto capacity = capacity_;
+    FreeBlocks();
+    AddBlock(capacity);
+  }
+  if (head_ != nullptr) {
+    ptr_ = reinterpret_cast<char*>(head_ + 1);
+  }
+}
+
+void Arena::AddBlock(size_t min_size) {
+  const size_t size = std::max(min_size, block_size_);
+  auto* block = static_cast<Block*>(malloc(sizeof(Block) + size));
+  if (block == nullptr) {
+    throw std::bad_alloc();
+  }
+  ++num_blocks_allocated_;
+  block->next = head_;
+  block->size = size;
+  head_ = block;
+  ptr_ = reinterpret_cast<char*>(block + 1);
+  end_ = ptr_ + size;
+  capacity_ += size;
+}
+
+void Arena::FreeBlocks() {
+  while (head_ != nullptr) {
+    auto* next = head_->next;
+    free(head_);
+    head_ = next;
+  }
+  ptr_ = end_ = nullptr;
+  capacity_ = 0;
+}
+
+}  // namespace common
+}  // namespace threadstacks
@@ -0,0 +1,120 @@
+// Copyright: ThoughtSpot Inc 2017
+
+#ifndef COMMON_ARENA_H_
+#define COMMON_ARENA_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <set>
+#include <vector>
+
+namespace threadstacks {
+namespace common {
+
+// An Arena is a monotonic memory allocator. Allocations are carved out of
+// large blocks obtained from malloc(), and are never freed individually.
+// Instead, all allocations are released at once by Reset(), which keeps the
+// memory around for subsequent allocations. An Arena that is reset after each
+// round of some repetitive work (e.g. a stack trace collection) stops calling
+// malloc() altogether once it has grown to the size required by one round.
+//
+// Note: This class is not thread-safe.
+class Arena {
+ public:
+  static constexpr size_t kDefaultBlockSize = 64 * 1024;
+
+  explicit Arena(size_t block_size = kDefaultBlockSize);
+  ~Arena();
+
+  // Returns @size bytes of memory aligned to @alignment, which must be a power
+  // of two. Never returns null.
+  void* Allocate(size_t size, size_t alignment = alignof(std::max_align_t));
+  // Releases all the allocations made so far. If the allocations spanned more
+  // than one block, the blocks are coalesced into a single block large enough
+  // to serve the same allocations again without calling malloc().
+  void Reset();
+
+  // Number of Allocate(...) calls since the last Reset().
+  int64_t num_allocations() const { return num_allocations_; }
+  // Number of bytes handed out since the last Reset().
+  int64_t bytes_allocated() const { return bytes_allocated_; }
+  // Number of blocks obtained from malloc() over the lifetime of the arena.
+  int64_t num_blocks_allocated() const { return num_blocks_allocated_; }
+
+ private:
+  struct Block {
+    Block* next;
+    size_t size;
+  };
+
+  // Adds a new block which has at least @min_size usable bytes.
+  void AddBlock(size_t min_size);
+  // Frees all the blocks.
+  void FreeBlocks();
+
+  const size_t block_size_;
+  // Most recently added block, which is the one allocations are served from.
+  Block* head_ = nullptr;
+  // Next free byte, and end of usable memory, in @head_.
+  char* ptr_ = nullptr;
+  char* end_ = nullptr;
+  // Total usable bytes across all the blocks.
+  size_t capacity_ = 0;
+  int64_t num_allocations_ = 0;
+  int64_t bytes_allocated_ = 0;
+  int64_t num_blocks_allocated_ = 0;
+
+  // Disable copy c'tor and assignment operator.
+  Arena(const Arena&) = delete;
+  Arena& operator=(const Arena&) = delete;
+};
+
+// An STL compatible allocator that serves allocations from an Arena.
+// Deallocation is a no-op; memory is reclaimed when the arena is reset, so
+// containers using this allocator must not outlive the next Reset() of the
+// arena.
+template <typename T>
+class ArenaAllocator {
+ public:
+  using value_type = T;
+
+  explicit ArenaAllocator(Arena* arena) : arena_(arena) {}
+  template <typename U>
+  ArenaAllocator(const ArenaAllocator<U>& other) : arena_(other.arena()) {}
+
+  T* allocate(size_t n) {
+    return static_cast<T*>(arena_->Allocate(n * sizeof(T), alignof(T)));
+  }
+  void deallocate(T*, size_t) {}
+
+  Arena* arena() const { return arena_; }
+
+ private:
+  Arena* arena_;
+};
+
+template <typename T, typename U>
+bool operator==(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b) {
+  return a.arena() == b.arena();
+}
+
+template <typename T, typename U>
+bool operator!=(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b) {
+  return a.arena() != b.arena();
+}
+
+// Convenience aliases for arena backed STL containers.
+template <typename T>
+using ArenaVector = std::vector<T, ArenaAllocator<T>>;
+template <typename T, typename Compare = std::less<T>>
+using ArenaSet = std::set<T, Compare, ArenaAllocator<T>>;
+template <typename K, typename V, typename Compare = std::less<K>>
+using ArenaMap =
+    std::map<K, V, Compare, ArenaAllocator<std::pair<const K, V>>>;
+
+}  // namespace common
+}  // namespace threadstacks
+
+#endif  // COMMON_ARENA_H_
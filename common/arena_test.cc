@@ -0,0 +1,81 @@
+// Copyright: ThoughtSpot Inc 2017
+
+#include "common/arena.h"
+
+#include <cstdint>
+
+#include "gtest/gtest.h"
+
+namespace threadstacks {
+namespace common {
+namespace {
+
+TEST(Arena, Alignment) {
+  Arena arena(128);
+  for (size_t alignment : {1, 2, 4, 8, 16, 64}) {
+    arena.Allocate(1, 1);
+    auto p = reinterpret_cast<uintptr_t>(arena.Allocate(3, alignment));
+    EXPECT_EQ(0, p % alignment) << "alignment: " << alignment;
+  }
+}
+
+TEST(Arena, LargeAllocation) {
+  Arena arena(128);
+  auto* p = static_cast<char*>(arena.Allocate(1000));
+  // Whole allocation must be writable.
+  for (int i = 0; i < 1000; ++i) {
+    p[i] = 'x';
+  }
+  EXPECT_EQ(1, arena.num_allocations());
+  EXPECT_EQ(1000, arena.bytes_allocated());
+}
+
+TEST(Arena, ResetReusesMemory) {
+  Arena arena(256);
+  for (int i = 0; i < 100; ++i) {
+    arena.Allocate(100);
+  }
+  const auto num_blocks = arena.num_blocks_allocated();
+  EXPECT_GT(num_blocks, 1);
+  // The first reset coalesces all the blocks into one...
+  arena.Reset();
+  EXPECT_EQ(num_blocks + 1, arena.num_blocks_allocated());
+  EXPECT_EQ(0, arena.num_allocations());
+  // ... which is large enough to serve the same allocations from then on.
+  for (int round = 0; round < 3; ++round) {
+    for (int i = 0; i < 100; ++i) {
+      arena.Allocate(100);
+    }
+    arena.Reset();
+  }
+  EXPECT_EQ(num_blocks + 1, arena.num_blocks_allocated());
+}
+
+TEST(ArenaAllocator, Containers) {
+  Arena arena;
+  {
+    ArenaAllocator<int> alloc(&arena);
+    ArenaVector<int> v(alloc);
+    ArenaSet<int> s(alloc);
+    ArenaMap<int, ArenaVector<int>> m(alloc);
+    for (int i = 0; i < 1000; ++i) {
+      v.push_back(i);
+      s.insert(i % 10);
+      auto it = m.find(i % 7);
+      if (it == m.end()) {
+        it = m.emplace(i % 7, ArenaVector<int>(alloc)).first;
+      }
+      it->second.push_back(i);
+    }
+    EXPECT_EQ(1000, v.size());
+    EXPECT_EQ(10, s.size());
+    EXPECT_EQ(7, m.size());
+    EXPECT_EQ(143, m.at(0).size());
+  }
+  EXPECT_GT(arena.num_allocations(), 0);
+  EXPECT_EQ(1, arena.num_blocks_allocated());
+}
+
+}  // namespace
+}  // namespace common
+}  // namespace threadstacks
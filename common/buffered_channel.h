@@ -0,0 +1,120 @@
+// Copyright: ThoughtSpot Inc 2017
+
+#ifndef COMMON_BUFFERED_CHANNEL_H_
+#define COMMON_BUFFERED_CHANNEL_H_
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+#include "common/channel.h"
+#include "glog/logging.h"
+
+namespace threadstacks {
+namespace common {
+
+// A BufferedChannel holds up to a fixed number of values that have been
+// written, but not read yet. A writer blocks only when the channel is full to
+// its capacity, and a reader blocks only when the channel is empty. This makes
+// a BufferedChannel suitable for connecting the stages of a pipeline, where
+// the capacity bounds the amount of work queued in front of a slow stage
+// (back-pressure).
+template <typename ValueType>
+class BufferedChannel : public Channel<ValueType> {
+ public:
+  // Creates a channel that can hold up to @capacity values, which must be
+  // positive. Use UnbufferedChannel for a channel with 0 capacity.
+  explicit BufferedChannel(int capacity) : capacity_(capacity) {
+    CHECK(capacity_ > 0) << "Capacity must be positive, got: " << capacity_;
+  }
+  ~BufferedChannel() = default;
+
+  void Write(const ValueType& item) override {
+    bool timedout = false;
+    Write(item, kInifinity, &timedout);
+  }
+  void Write(const ValueType& item,
+             int64_t wait_duration,
+             bool* timedout) override {
+    std::unique_lock<std::mutex> l(m_);
+    auto success = not_full_.wait_for(
+        l,
+        std::chrono::microseconds(wait_duration),
+        [this]() {
+          return closed_ || static_cast<int>(items_.size()) < capacity_;
+        });
+    if (not success) {
+      *timedout = true;
+      return;
+    }
+    LOG_IF(FATAL, closed_) << "Can't write to a closed channel";
+    *timedout = false;
+    items_.push_back(item);
+    not_empty_.notify_one();
+  }
+
+  bool Read(ValueType* item) override {
+    bool timedout = false;
+    return Read(item, kInifinity, &timedout);
+  }
+  bool Read(ValueType* item, int64_t wait_duration, bool* timedout) override {
+    std::unique_lock<std::mutex> l(m_);
+    auto success = not_empty_.wait_for(
+        l,
+        std::chrono::microseconds(wait_duration),
+        [this]() { return closed_ || not items_.empty(); });
+    if (not success) {
+      *timedout = true;
+      return false;
+    }
+    *timedout = false;
+    if (items_.empty()) {
+      // The channel has been closed and drained.
+      *item = ValueType();
+      return false;
+    }
+    *item = items_.front();
+    items_.pop_front();
+    not_full_.notify_one();
+    return true;
+  }
+
+  void Close() override {
+    {
+      std::lock_guard<std::mutex> l(m_);
+      LOG_IF(FATAL, closed_) << "Can't close an already closed channel";
+      closed_ = true;
+    }
+    not_full_.notify_all();
+    not_empty_.notify_all();
+  }
+
+ private:
+  // See UnbufferedChannel::kInifinity.
+  static constexpr int64_t kInifinity{365LL * 24 * 3600 * 1000000LL};
+
+  const int capacity_;
+  std::mutex m_;
+  // True if the channel has been closed.
+  bool closed_ = false;
+  // Values written, but not read yet.
+  // INVARIANT: items_.size() <= capacity_.
+  std::deque<ValueType> items_;
+  // Signalled when a value is read from the channel.
+  std::condition_variable not_full_;
+  // Signalled when a value is written to the channel.
+  std::condition_variable not_empty_;
+
+  // Disable copy c'tor and assignment operator.
+  BufferedChannel(const BufferedChannel&) = delete;
+  BufferedChannel& operator=(const BufferedChannel&) = delete;
+};
+
+// static
+template <typename T>
+constexpr int64_t BufferedChannel<T>::kInifinity;
+
+}  // namespace common
+}  // namespace threadstacks
+
+#endif  // COMMON_BUFFERED_CHANNEL_H_
@@ -0,0 +1,117 @@
+// Copyright: ThoughtSpot Inc 2017
+
+#include "common/buffered_channel.h"
+
+#include <unistd.h>
+
+#include <atomic>
+#include <future>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace threadstacks {
+namespace common {
+namespace {
+
+// Verifies that values are read in the order they were written.
+TEST(BufferedChannel, Fifo) {
+  BufferedChannel<int> ch(3);
+  ch.Write(1);
+  ch.Write(2);
+  ch.Write(3);
+  int got = 0;
+  for (int i = 1; i <= 3; ++i) {
+    ASSERT_TRUE(ch.Read(&got));
+    EXPECT_EQ(i, got);
+  }
+}
+
+// Verifies that write blocks only once the channel is full.
+TEST(BufferedChannel, WriteBlocksWhenFull) {
+  BufferedChannel<int> ch(2);
+  bool timedout = false;
+  ch.Write(1, 1000, &timedout);
+  EXPECT_FALSE(timedout);
+  ch.Write(2, 1000, &timedout);
+  EXPECT_FALSE(timedout);
+  ch.Write(3, 1000, &timedout);
+  EXPECT_TRUE(timedout);
+
+  std::atomic<bool> signalled{false};
+  auto Reader = std::async(std::launch::async,
+                           [&ch, &signalled]() {
+                             // Give the blocking Write() an opportunity to
+                             // proceed, if it is unblocked.
+                             usleep(1000);
+                             signalled.store(true);
+                             int got = 0;
+                             EXPECT_TRUE(ch.Read(&got));
+                             return got;
+                           });
+  // This should block until a read.
+  ch.Write(3);
+  ASSERT_EQ(true, signalled.load());
+  EXPECT_EQ(1, Reader.get());
+}
+
+// Verifies that read blocks if the channel is empty.
+TEST(BufferedChannel, ReadBlocksUntilWrite) {
+  BufferedChannel<int> ch(1);
+  int got = 0;
+  bool timedout = false;
+  EXPECT_FALSE(ch.Read(&got, 1000, &timedout));
+  EXPECT_TRUE(timedout);
+  auto Writer = std::async(std::launch::async,
+                           [&ch]() {
+                             usleep(1000);
+                             ch.Write(314);
+                           });
+  ASSERT_TRUE(ch.Read(&got));
+  EXPECT_EQ(314, got);
+}
+
+// Verifies that values written before the channel was closed can still be
+// read, and that excess reads return the default value.
+TEST(BufferedChannel, ReadAfterClose) {
+  BufferedChannel<int> ch(2);
+  ch.Write(1);
+  ch.Write(2);
+  ch.Close();
+  int got = 0;
+  ASSERT_TRUE(ch.Read(&got));
+  EXPECT_EQ(1, got);
+  ASSERT_TRUE(ch.Read(&got));
+  EXPECT_EQ(2, got);
+  EXPECT_FALSE(ch.Read(&got));
+  EXPECT_EQ(int(), got);
+}
+
+TEST(BufferedChannel, Close_UnblocksAllReaders) {
+  constexpr int kNumReaders = 10;
+  BufferedChannel<int> ch(1);
+  std::vector<std::future<bool>> readers;
+  for (int i = 0; i < kNumReaders; ++i) {
+    readers.push_back(std::async(std::launch::async, [&ch]() {
+      int v = 0;
+      return ch.Read(&v);
+    }));
+  }
+  ch.Write(1);
+  ch.Close();
+  int num_read = 0;
+  for (auto& r : readers) {
+    num_read += r.get();
+  }
+  EXPECT_EQ(1, num_read);
+}
+
+TEST(BufferedChannelDeathTest, WriteAfterClose) {
+  BufferedChannel<int> ch(1);
+  ch.Close();
+  EXPECT_DEATH(ch.Write(1), "Can't write to a closed channel");
+}
+
+}  // namespace
+}  // namespace common
+}  // namespace threadstacks
@@ -0,0 +1,45 @@
+// Copyright: ThoughtSpot Inc 2017
+
+#include "common/cancellation.h"
+
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <iostream>
+
+namespace threadstacks {
+namespace common {
+
+CancellationToken::CancellationToken()
+    : fd_(eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) {
+  if (fd_ == -1) {
+    std::cerr << "Failed to create eventfd for cancellation token"
+              << std::endl;  // errno
+  }
+}
+
+CancellationToken::~CancellationToken() {
+  if (fd_ != -1) {
+    close(fd_);
+  }
+}
+
+void CancellationToken::Cancel() {
+  if (cancelled_.exchange(true)) {
+    return;
+  }
+  if (fd_ != -1) {
+    // Note that the counter is never read back, so the fd stays readable for
+    // the rest of the lifetime of the token.
+    const uint64_t one = 1;
+    if (sizeof(one) != write(fd_, &one, sizeof(one))) {
+      std::cerr << "Failed to signal cancellation eventfd" << std::endl;
+    }
+  }
+}
+
+bool CancellationToken::IsCancelled() const { return cancelled_.load(); }
+
+}  // namespace common
+}  // namespace threadstacks
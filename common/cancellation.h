@@ -0,0 +1,46 @@
+// Copyright: ThoughtSpot Inc 2017
+
+#ifndef COMMON_CANCELLATION_H_
+#define COMMON_CANCELLATION_H_
+
+#include <atomic>
+
+namespace threadstacks {
+namespace common {
+
+// A CancellationToken is used to abort a long running operation, e.g. an
+// in-flight stack trace collection, from another thread. A token starts out in
+// the non-cancelled state and cancellation is sticky - once cancelled, a token
+// stays cancelled for the rest of its lifetime.
+//
+// Note: All methods of this class are thread-safe.
+class CancellationToken {
+ public:
+  CancellationToken();
+  ~CancellationToken();
+
+  // Cancels the token and wakes up everyone waiting on fd(). Calling Cancel()
+  // on an already cancelled token is a no-op.
+  void Cancel();
+  // Returns true if Cancel() has been called on this token.
+  bool IsCancelled() const;
+  // Returns a file descriptor that becomes readable once the token is
+  // cancelled. This can be used to wait for cancellation along with other file
+  // descriptors in select(...). Returns -1 if the underlying eventfd couldn't
+  // be created, in which case cancellation is only observable via
+  // IsCancelled().
+  int fd() const { return fd_; }
+
+ private:
+  std::atomic<bool> cancelled_{false};
+  int fd_ = -1;
+
+  // Disable copy c'tor and assignment operator.
+  CancellationToken(const CancellationToken&) = delete;
+  CancellationToken& operator=(const CancellationToken&) = delete;
+};
+
+}  // namespace common
+}  // namespace threadstacks
+
+#endif  // COMMON_CANCELLATION_H_
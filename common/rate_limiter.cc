@@ -0,0 +1,56 @@
+// Copyright: ThoughtSpot Inc 2017
+
+#include "common/rate_limiter.h"
+
+#include <time.h>
+
+#include <algorithm>
+
+namespace threadstacks {
+namespace common {
+
+namespace {
+
+// Number of milliseconds in a minute, which is also the number of units that
+// make up a token.
+constexpr int64_t kMsPerMinute = 60 * 1000;
+
+}  // namespace
+
+RateLimiter::RateLimiter(int64_t min_interval_ms, int max_per_minute)
+    : min_interval_ms_(std::max<int64_t>(0, min_interval_ms)),
+      max_per_minute_(std::max(0, max_per_minute)),
+      // Start with a full bucket.
+      tokens_(max_per_minute_ * kMsPerMinute) {}
+
+// static
+int64_t RateLimiter::NowMs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<int64_t>(ts.tv_sec) * 1000 + ts.tv_nsec / 1000000;
+}
+
+bool RateLimiter::Admit(int64_t now_ms) {
+  if (last_admit_ms_ >= 0 && now_ms - last_admit_ms_ < min_interval_ms_) {
+    return false;
+  }
+  if (max_per_minute_ > 0) {
+    const int64_t capacity = max_per_minute_ * kMsPerMinute;
+    if (now_ms > last_refill_ms_) {
+      // Note that the elapsed time is capped, so that the refill can't
+      // overflow.
+      const auto elapsed = std::min(now_ms - last_refill_ms_, kMsPerMinute);
+      tokens_ = std::min(capacity, tokens_ + elapsed * max_per_minute_);
+      last_refill_ms_ = now_ms;
+    }
+    if (tokens_ < kMsPerMinute) {
+      return false;
+    }
+    tokens_ -= kMsPerMinute;
+  }
+  last_admit_ms_ = now_ms;
+  return true;
+}
+
+}  // namespace common
+}  // namespace threadstacks
@@ -0,0 +1,56 @@
+// Copyright: ThoughtSpot Inc 2017
+
+#ifndef COMMON_RATE_LIMITER_H_
+#define COMMON_RATE_LIMITER_H_
+
+#include <cstdint>
+
+namespace threadstacks {
+namespace common {
+
+// A RateLimiter decides which events of a stream to admit, so that admitted
+// events are at least a minimum interval apart, and no more than a maximum
+// number of them are admitted per minute. The latter is enforced using a token
+// bucket: the bucket holds up to a minute worth of tokens, refills
+// continuously, and every admitted event takes one token. So, after a quiet
+// period, a burst of up to @max_per_minute events is admitted, subject to the
+// minimum interval.
+//
+// Time is passed in explicitly, as milliseconds on a monotonic clock (see
+// NowMs()), which keeps the limiter deterministic.
+//
+// Note: This class is not thread-safe.
+class RateLimiter {
+ public:
+  // Creates a limiter that admits events at least @min_interval_ms apart, and
+  // at most @max_per_minute events per minute. A zero for either of them
+  // disables that limit.
+  RateLimiter(int64_t min_interval_ms, int max_per_minute);
+  ~RateLimiter() = default;
+
+  // Returns the current time in milliseconds on the monotonic clock.
+  static int64_t NowMs();
+
+  // Returns true iff an event at time @now_ms is admitted. Calls must be made
+  // with non-decreasing @now_ms.
+  bool Admit(int64_t now_ms);
+
+  int64_t min_interval_ms() const { return min_interval_ms_; }
+  int max_per_minute() const { return max_per_minute_; }
+
+ private:
+  const int64_t min_interval_ms_;
+  const int max_per_minute_;
+  // Tokens in the bucket, in units of 1/60000th of a token, so that the
+  // bucket gains exactly @max_per_minute_ units per millisecond.
+  int64_t tokens_;
+  // Time at which @tokens_ was last updated.
+  int64_t last_refill_ms_ = 0;
+  // Time at which the last event was admitted, or -1 if none was.
+  int64_t last_admit_ms_ = -1;
+};
+
+}  // namespace common
+}  // namespace threadstacks
+
+#endif  // COMMON_RATE_LIMITER_H_
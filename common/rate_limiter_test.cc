@@ -0,0 +1,70 @@
+// Copyright: ThoughtSpot Inc 2017
+
+#include "common/rate_limiter.h"
+
+#include "gtest/gtest.h"
+
+namespace threadstacks {
+namespace common {
+namespace {
+
+// Returns the number of events admitted by @limiter, out of events at times
+// [@start_ms, @end_ms) spaced @step_ms apart.
+int CountAdmitted(RateLimiter* limiter,
+                  int64_t start_ms,
+                  int64_t end_ms,
+                  int64_t step_ms) {
+  int admitted = 0;
+  for (auto t = start_ms; t < end_ms; t += step_ms) {
+    admitted += limiter->Admit(t) ? 1 : 0;
+  }
+  return admitted;
+}
+
+TEST(RateLimiter, Unlimited) {
+  RateLimiter limiter(0, 0);
+  EXPECT_EQ(1000, CountAdmitted(&limiter, 1000, 2000, 1));
+  // Events at the same time are all admitted too.
+  for (int i = 0; i < 10; ++i) {
+    EXPECT_TRUE(limiter.Admit(2000));
+  }
+}
+
+TEST(RateLimiter, MinInterval) {
+  RateLimiter limiter(100, 0);
+  EXPECT_TRUE(limiter.Admit(1000));
+  EXPECT_FALSE(limiter.Admit(1000));
+  EXPECT_FALSE(limiter.Admit(1099));
+  EXPECT_TRUE(limiter.Admit(1100));
+  // Rejected events don't push back the next admitted one.
+  EXPECT_FALSE(limiter.Admit(1150));
+  EXPECT_TRUE(limiter.Admit(1200));
+  EXPECT_EQ(10, CountAdmitted(&limiter, 1300, 2300, 10));
+}
+
+TEST(RateLimiter, MaxPerMinute) {
+  RateLimiter limiter(0, 6);
+  // A full bucket admits a burst of 6 events.
+  EXPECT_EQ(6, CountAdmitted(&limiter, 1000, 1100, 1));
+  EXPECT_FALSE(limiter.Admit(1100));
+  // A token is regained every 10 seconds.
+  EXPECT_FALSE(limiter.Admit(10999));
+  EXPECT_TRUE(limiter.Admit(11000));
+  EXPECT_FALSE(limiter.Admit(11001));
+  // In steady state, 6 events are admitted per minute.
+  EXPECT_EQ(6, CountAdmitted(&limiter, 11001, 71101, 100));
+  // A long quiet period refills the bucket, but not beyond a minute worth of
+  // tokens.
+  EXPECT_EQ(6, CountAdmitted(&limiter, 1000000, 1000100, 1));
+}
+
+TEST(RateLimiter, BothLimits) {
+  RateLimiter limiter(1000, 3);
+  // The burst is spread by the minimum interval.
+  EXPECT_EQ(3, CountAdmitted(&limiter, 0, 10000, 100));
+  EXPECT_EQ(1, CountAdmitted(&limiter, 10000, 30000, 100));
+}
+
+}  // namespace
+}  // namespace common
+}  // namespace threadstacks
@@ -4,7 +4,12 @@
 #include "common/sysutil.h"
 
 #include <dirent.h>
+#include <time.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
+#include <map>
 #include <set>
 #include <string>
 #include "common/defer.h"
@@ -74,5 +79,217 @@ std::vector<pid_t> Sysutil::ListThreads() {
   return pids;
 }
 
+// static
+std::vector<pid_t> Sysutil::ListThreads(pid_t pid) {
+  std::set<std::string> children;
+  std::vector<pid_t> tids;
+  std::string error;
+  if (not GetDirectoryContents("/proc/" + std::to_string(pid) + "/task",
+                               &children, &error)) {
+    std::cerr << "Unable to list threads in process " << pid
+              << ". Error: " << error << std::endl;
+    return tids;
+  }
+  for (const auto& child : children) {
+    char* end = nullptr;
+    const pid_t tid = strtol(child.c_str(), &end, 10);
+    if (end != child.c_str() && *end == '\0') {
+      tids.push_back(tid);
+    }
+  }
+  return tids;
+}
+
+// static
+bool Sysutil::VisitThreads(const std::function<void(pid_t)>& visitor) {
+  DIR* dir = opendir(kSelfTaskDir);
+  if (dir == nullptr) {
+    std::cerr << "Unable to list threads in current process. Error: "
+              << "Failed to open directory: " << kSelfTaskDir << std::endl;
+    return false;
+  }
+  DEFER(closedir(dir));
+  struct dirent entry;
+  struct dirent* result = nullptr;
+  int posix_error = 0;
+  while (true) {
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wdeprecated-declarations"
+    posix_error = readdir_r(dir, &entry, &result);
+#pragma GCC diagnostic pop
+    if (posix_error != 0 || result == nullptr) {
+      break;
+    }
+    char* end = nullptr;
+    const auto tid = strtol(entry.d_name, &end, 10);
+    // Skips "." and "..".
+    if (end == entry.d_name || *end != '\0') {
+      continue;
+    }
+    visitor(tid);
+  }
+  if (posix_error != 0) {
+    std::cerr << "Unable to list threads in current process. Error: "
+              << "Error reading directory: " << posix_error << std::endl;
+    return false;
+  }
+  return true;
+}
+
+// static
+std::vector<pid_t> Sysutil::ListProcessTree(pid_t root) {
+  std::set<std::string> children;
+  std::vector<pid_t> pids;
+  std::string error;
+  if (not GetDirectoryContents("/proc", &children, &error)) {
+    std::cerr << "Unable to list processes. Error: " << error << std::endl;
+    return pids;
+  }
+  // Maps every process to its children.
+  std::multimap<pid_t, pid_t> tree;
+  bool root_found = false;
+  for (const auto& child : children) {
+    char* end = nullptr;
+    const pid_t pid = strtol(child.c_str(), &end, 10);
+    if (end == child.c_str() || *end != '\0') {
+      continue;
+    }
+    // The parent pid is the 4th field of /proc/<pid>/stat, after the command
+    // name in parentheses, which may itself contain spaces and parentheses.
+    FILE* f = fopen(("/proc/" + child + "/stat").c_str(), "r");
+    if (f == nullptr) {
+      // The process exited in the meantime.
+      continue;
+    }
+    DEFER(fclose(f));
+    char buf[512];
+    const auto size = fread(buf, 1, sizeof(buf) - 1, f);
+    buf[size] = '\0';
+    const char* comm_end = strrchr(buf, ')');
+    char state;
+    pid_t ppid;
+    if (comm_end == nullptr || 2 != sscanf(comm_end + 1, " %c %d", &state,
+                                           &ppid)) {
+      continue;
+    }
+    tree.emplace(ppid, pid);
+    root_found |= pid == root;
+  }
+  if (not root_found) {
+    return pids;
+  }
+  pids.push_back(root);
+  for (size_t i = 0; i < pids.size(); ++i) {
+    const auto range = tree.equal_range(pids[i]);
+    for (auto it = range.first; it != range.second; ++it) {
+      pids.push_back(it->second);
+    }
+  }
+  return pids;
+}
+
+// static
+bool Sysutil::CatchesSignal(pid_t pid, int signum) {
+  FILE* f = fopen(("/proc/" + std::to_string(pid) + "/status").c_str(), "r");
+  if (f == nullptr) {
+    return false;
+  }
+  DEFER(fclose(f));
+  char line[256];
+  while (fgets(line, sizeof(line), f) != nullptr) {
+    unsigned long long caught;
+    if (1 == sscanf(line, "SigCgt: %llx", &caught)) {
+      return signum > 0 && signum <= 64 && (caught >> (signum - 1)) & 1;
+    }
+  }
+  return false;
+}
+
+// static
+char Sysutil::GetThreadState(pid_t tid) {
+  char path[64];
+  snprintf(path, sizeof(path), "/proc/self/task/%d/stat", tid);
+  FILE* f = fopen(path, "r");
+  if (f == nullptr) {
+    return '?';
+  }
+  DEFER(fclose(f));
+  char buf[512];
+  const auto size = fread(buf, 1, sizeof(buf) - 1, f);
+  buf[size] = '\0';
+  // The state is the 3rd field, after the command name in parentheses.
+  const char* comm_end = strrchr(buf, ')');
+  char state;
+  if (comm_end == nullptr || 1 != sscanf(comm_end + 1, " %c", &state)) {
+    return '?';
+  }
+  return state;
+}
+
+// static
+int64_t Sysutil::GetProcessCpuTimeNs() {
+  FILE* f = fopen("/proc/self/stat", "r");
+  if (f == nullptr) {
+    return -1;
+  }
+  DEFER(fclose(f));
+  char buf[1024];
+  const auto size = fread(buf, 1, sizeof(buf) - 1, f);
+  buf[size] = '\0';
+  // utime and stime are the 14th and 15th fields, in clock ticks.
+  const char* comm_end = strrchr(buf, ')');
+  unsigned long long utime, stime;
+  if (comm_end == nullptr ||
+      2 != sscanf(comm_end + 1, " %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u "
+                                "%llu %llu", &utime, &stime)) {
+    return -1;
+  }
+  static const int64_t ticks_per_second = sysconf(_SC_CLK_TCK);
+  return static_cast<int64_t>(utime + stime) * 1000000000 / ticks_per_second;
+}
+
+// static
+int64_t Sysutil::WallTimeNs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+// static
+bool Sysutil::GetThreadSchedStats(pid_t tid, SchedStats* stats) {
+  char path[64];
+  snprintf(path, sizeof(path), "/proc/self/task/%d/schedstat", tid);
+  FILE* f = fopen(path, "r");
+  if (f == nullptr) {
+    return false;
+  }
+  long long run_ns, wait_ns;
+  const bool parsed = 2 == fscanf(f, "%lld %lld", &run_ns, &wait_ns);
+  fclose(f);
+  if (not parsed) {
+    return false;
+  }
+  snprintf(path, sizeof(path), "/proc/self/task/%d/status", tid);
+  f = fopen(path, "r");
+  if (f == nullptr) {
+    return false;
+  }
+  DEFER(fclose(f));
+  long long voluntary = -1, involuntary = -1;
+  char line[256];
+  while (fgets(line, sizeof(line), f) != nullptr) {
+    sscanf(line, "voluntary_ctxt_switches: %lld", &voluntary);
+    sscanf(line, "nonvoluntary_ctxt_switches: %lld", &involuntary);
+  }
+  if (voluntary < 0 || involuntary < 0) {
+    return false;
+  }
+  stats->run_ns = run_ns;
+  stats->wait_ns = wait_ns;
+  stats->voluntary_switches = voluntary;
+  stats->involuntary_switches = involuntary;
+  return true;
+}
+
 }  // namespace common
 }  // namespace threadstacks
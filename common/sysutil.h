@@ -6,6 +6,9 @@
 
 #include <sys/types.h>
 #include <unistd.h>
+
+#include <cstdint>
+#include <functional>
 #include <vector>
 
 namespace threadstacks {
@@ -16,6 +19,46 @@ class Sysutil {
   // Returns a list of thread pids that are running in the calling process. On
   // error, returns an empty list.
   static std::vector<pid_t> ListThreads();
+  // Same as above, but lists the threads of process @pid.
+  static std::vector<pid_t> ListThreads(pid_t pid);
+  // Invokes @visitor with the pid of every thread running in the calling
+  // process. Unlike ListThreads(), this doesn't build a list of the pids, so
+  // the only memory it allocates is the directory stream opened by
+  // opendir(3). Returns false on error, in which case @visitor may have been
+  // invoked for some of the threads only.
+  static bool VisitThreads(const std::function<void(pid_t)>& visitor);
+  // Returns @root followed by the pids of all its descendant processes, in
+  // breadth-first order. On error, returns an empty list.
+  static std::vector<pid_t> ListProcessTree(pid_t root);
+  // Returns true iff process @pid has a handler installed for @signum, i.e.
+  // it catches the signal rather than ignoring it or taking the default
+  // action.
+  static bool CatchesSignal(pid_t pid, int signum);
+  // Returns the scheduler state of thread @tid of the calling process, as
+  // the one letter code of /proc/<pid>/stat, e.g. 'R' for running, 'S' for
+  // sleeping or 'D' for uninterruptible sleep. Returns '?' on error.
+  static char GetThreadState(pid_t tid);
+  // Returns the CPU time consumed by the calling process so far, user and
+  // system, in nanoseconds. Returns -1 on error.
+  static int64_t GetProcessCpuTimeNs();
+  // Returns the wall time in nanoseconds since the epoch. Async-signal-safe.
+  static int64_t WallTimeNs();
+
+  // Scheduler statistics of a thread, accumulated since it started.
+  struct SchedStats {
+    // Time spent running on a CPU, and waiting on a runqueue for one, in
+    // nanoseconds.
+    int64_t run_ns = 0;
+    int64_t wait_ns = 0;
+    // Number of context switches because the thread blocked, and because it
+    // was preempted.
+    int64_t voluntary_switches = 0;
+    int64_t involuntary_switches = 0;
+  };
+  // Fills @stats with the scheduler statistics of thread @tid of the calling
+  // process, from /proc/self/task/<tid>/schedstat and status. Returns false on
+  // error, e.g. if the kernel doesn't keep scheduler statistics.
+  static bool GetThreadSchedStats(pid_t tid, SchedStats* stats);
 };
 
 }  // namespace common
@@ -0,0 +1,41 @@
+// Copyright: ThoughtSpot Inc 2017
+
+#ifndef COMMON_VARINT_H_
+#define COMMON_VARINT_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace threadstacks {
+namespace common {
+
+// Appends @value to @out as a varint: 7 bits per byte, least significant
+// first, with the top bit set on all bytes but the last one. This is the
+// encoding of protocol buffers, see
+// https://developers.google.com/protocol-buffers/docs/encoding.
+inline void AppendVarint(uint64_t value, std::string* out) {
+  while (value >= 0x80) {
+    out->push_back(static_cast<char>(value | 0x80));
+    value >>= 7;
+  }
+  out->push_back(static_cast<char>(value));
+}
+
+// Reads the varint at @*pos of @data, and advances @*pos past it.
+inline uint64_t ReadVarint(const std::string& data, size_t* pos) {
+  uint64_t value = 0;
+  for (int shift = 0; *pos < data.size(); shift += 7) {
+    const uint8_t byte = data[(*pos)++];
+    value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+    if (not (byte & 0x80)) {
+      break;
+    }
+  }
+  return value;
+}
+
+}  // namespace common
+}  // namespace threadstacks
+
+#endif  // COMMON_VARINT_H_
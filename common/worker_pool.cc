@@ -0,0 +1,71 @@
+// Copyright: ThoughtSpot Inc 2017
+
+#include "common/worker_pool.h"
+
+namespace threadstacks {
+namespace common {
+
+WorkerPool::WorkerPool(int num_threads) {
+  for (int i = 0; i < num_threads; ++i) {
+    threads_.emplace_back(&WorkerPool::Run, this);
+  }
+}
+
+WorkerPool::~WorkerPool() {
+  {
+    std::lock_guard<std::mutex> l(m_);
+    shutdown_ = true;
+  }
+  start_.notify_all();
+  for (auto& t : threads_) {
+    t.join();
+  }
+}
+
+void WorkerPool::ParallelFor(int n, const std::function<void(int)>& fn) {
+  if (n <= 0) {
+    return;
+  }
+  std::lock_guard<std::mutex> loop_l(loop_m_);
+  std::unique_lock<std::mutex> l(m_);
+  fn_ = &fn;
+  n_ = n;
+  next_ = 0;
+  pending_ = n;
+  ++generation_;
+  start_.notify_all();
+  Work(&l);
+  done_.wait(l, [this]() { return pending_ == 0; });
+  fn_ = nullptr;
+}
+
+void WorkerPool::Run() {
+  int64_t seen_generation = 0;
+  std::unique_lock<std::mutex> l(m_);
+  while (true) {
+    start_.wait(l, [&]() {
+      return shutdown_ || generation_ != seen_generation;
+    });
+    if (shutdown_) {
+      return;
+    }
+    seen_generation = generation_;
+    Work(&l);
+  }
+}
+
+void WorkerPool::Work(std::unique_lock<std::mutex>* l) {
+  while (fn_ != nullptr && next_ < n_) {
+    const int i = next_++;
+    const auto* fn = fn_;
+    l->unlock();
+    (*fn)(i);
+    l->lock();
+    if (--pending_ == 0) {
+      done_.notify_all();
+    }
+  }
+}
+
+}  // namespace common
+}  // namespace threadstacks
@@ -0,0 +1,70 @@
+// Copyright: ThoughtSpot Inc 2017
+
+#ifndef COMMON_WORKER_POOL_H_
+#define COMMON_WORKER_POOL_H_
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace threadstacks {
+namespace common {
+
+// A WorkerPool is a fixed set of threads that execute data parallel loops.
+// The threads are started in the c'tor and joined in the d'tor, and stay idle
+// in between loops.
+//
+// Note: ParallelFor(...) may be called concurrently from multiple threads, in
+// which case the loops are executed one after the other.
+class WorkerPool {
+ public:
+  // Starts a pool with @num_threads threads. Note that the thread calling
+  // ParallelFor(...) also participates in the loop, so a pool of N threads
+  // executes loops with a parallelism of N + 1.
+  explicit WorkerPool(int num_threads);
+  ~WorkerPool();
+
+  // Returns the number of threads executing a loop, including the caller.
+  int parallelism() const { return threads_.size() + 1; }
+
+  // Invokes @fn for every index in [0, @n), in parallel, and returns after all
+  // the invocations have returned. Invocations are not ordered in any way.
+  void ParallelFor(int n, const std::function<void(int)>& fn);
+
+ private:
+  // The function run by each thread of the pool.
+  void Run();
+  // Runs invocations of the current loop until there are none left.
+  void Work(std::unique_lock<std::mutex>* l);
+
+  std::vector<std::thread> threads_;
+  // Serializes concurrent ParallelFor(...) calls.
+  std::mutex loop_m_;
+
+  std::mutex m_;
+  // Signalled when a new loop is started, or the pool is shut down.
+  std::condition_variable start_;
+  // Signalled when the last invocation of a loop returns.
+  std::condition_variable done_;
+  bool shutdown_ = false;
+  // Incremented for every loop, so that threads can tell loops apart.
+  int64_t generation_ = 0;
+  // The current loop: @fn_ invoked on indices [0, @n_). @next_ is the next
+  // index to hand out and @pending_ the number of invocations that haven't
+  // returned yet.
+  const std::function<void(int)>* fn_ = nullptr;
+  int n_ = 0;
+  int next_ = 0;
+  int pending_ = 0;
+
+  // Disable copy c'tor and assignment operator.
+  WorkerPool(const WorkerPool&) = delete;
+  WorkerPool& operator=(const WorkerPool&) = delete;
+};
+
+}  // namespace common
+}  // namespace threadstacks
+
+#endif  // COMMON_WORKER_POOL_H_
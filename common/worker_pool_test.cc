@@ -0,0 +1,54 @@
+// Copyright: ThoughtSpot Inc 2017
+
+#include "common/worker_pool.h"
+
+#include <atomic>
+#include <set>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace threadstacks {
+namespace common {
+namespace {
+
+TEST(WorkerPool, ParallelFor) {
+  WorkerPool pool(4);
+  EXPECT_EQ(5, pool.parallelism());
+  for (int n : {0, 1, 3, 1000}) {
+    std::vector<std::atomic<int>> counts(n);
+    pool.ParallelFor(n, [&](int i) { counts[i]++; });
+    for (int i = 0; i < n; ++i) {
+      EXPECT_EQ(1, counts[i].load()) << "n: " << n << ", i: " << i;
+    }
+  }
+}
+
+TEST(WorkerPool, NoThreads) {
+  WorkerPool pool(0);
+  int sum = 0;
+  pool.ParallelFor(10, [&](int i) { sum += i; });
+  EXPECT_EQ(45, sum);
+}
+
+TEST(WorkerPool, ConcurrentLoops) {
+  WorkerPool pool(3);
+  std::atomic<int> sum{0};
+  std::vector<std::thread> callers;
+  for (int c = 0; c < 4; ++c) {
+    callers.emplace_back([&]() {
+      for (int round = 0; round < 50; ++round) {
+        pool.ParallelFor(10, [&](int i) { sum += i; });
+      }
+    });
+  }
+  for (auto& t : callers) {
+    t.join();
+  }
+  EXPECT_EQ(4 * 50 * 45, sum.load());
+}
+
+}  // namespace
+}  // namespace common
+}  // namespace threadstacks
@@ -0,0 +1,181 @@
+// Copyright: ThoughtSpot Inc 2017
+
+#include "threadstacks/c_api.h"
+
+#include <algorithm>
+#include <cstring>
+#include <exception>
+#include <new>
+#include <string>
+
+#include "threadstacks/signal_handler.h"
+#include "threadstacks/symbol_table.h"
+
+struct threadstacks_collection {
+  threadstacks::StackTraceCollector collector;
+  threadstacks::StackTraceCollection collection;
+  threadstacks::SymbolTable symbols;
+  bool symbolized = false;
+  std::string error;
+};
+
+// Note: No exception may cross the C ABI. Every entry point that can throw,
+// e.g. when it runs out of memory, catches all exceptions and returns its
+// error value instead. The others only read fields of the collection.
+
+namespace {
+
+// Sets the error message of @c to @error, or clears it if there isn't enough
+// memory for it.
+void SetError(threadstacks_collection* c, const char* error) {
+  try {
+    c->error.assign(error);
+  } catch (...) {
+    c->error.clear();
+  }
+}
+
+// Returns the group @group of @c, or null if @group is invalid.
+const threadstacks::StackTraceCollection::Group* GetGroup(
+    const threadstacks_collection* c, int group) {
+  if (group < 0 || group >= c->collection.size()) {
+    return nullptr;
+  }
+  return &c->collection[group];
+}
+
+}  // namespace
+
+int threadstacks_abi_version(void) { return THREADSTACKS_ABI_VERSION; }
+
+int threadstacks_install_handler(void) {
+  try {
+    return threadstacks::StackTraceSignal::InstallInternalHandler() ? 0 : -1;
+  } catch (...) {
+    return -1;
+  }
+}
+
+int threadstacks_install_external_handler(void) {
+  try {
+    return threadstacks::StackTraceSignal::InstallExternalHandler() ? 0 : -1;
+  } catch (...) {
+    return -1;
+  }
+}
+
+threadstacks_collection* threadstacks_collection_new(void) {
+  try {
+    return new (std::nothrow) threadstacks_collection();
+  } catch (...) {
+    // The constructors of the members may still throw.
+    return nullptr;
+  }
+}
+
+void threadstacks_collection_free(threadstacks_collection* c) { delete c; }
+
+int threadstacks_collect(threadstacks_collection* c,
+                         int flags,
+                         int64_t timeout_ms) {
+  c->error.clear();
+  c->symbols.Clear();
+  c->symbolized = false;
+  try {
+    c->collector.set_timeout_ms(
+        timeout_ms > 0 ? timeout_ms
+                       : threadstacks::StackTraceCollector::kDefaultTimeoutMs);
+    if (not c->collector.Collect(nullptr, &c->collection, &c->error)) {
+      c->collection.Clear();
+      return -1;
+    }
+    if (flags & THREADSTACKS_SYMBOLIZE) {
+      c->collection.Symbolize(&c->symbols, nullptr);
+      c->symbolized = true;
+    }
+    return 0;
+  } catch (const std::exception& e) {
+    SetError(c, e.what());
+  } catch (...) {
+    SetError(c, "Unknown exception");
+  }
+  c->collection.Clear();
+  c->symbols.Clear();
+  return -1;
+}
+
+const char* threadstacks_error(const threadstacks_collection* c) {
+  return c->error.c_str();
+}
+
+int threadstacks_num_groups(const threadstacks_collection* c) {
+  return c->collection.size();
+}
+
+int threadstacks_num_threads(const threadstacks_collection* c) {
+  return c->collection.num_threads();
+}
+
+int threadstacks_group_tids(const threadstacks_collection* c,
+                            int group,
+                            int32_t* tids,
+                            int max_tids) {
+  const auto* g = GetGroup(c, group);
+  if (g == nullptr) {
+    return -1;
+  }
+  std::copy(g->tids, g->tids + std::min(g->num_tids, std::max(max_tids, 0)),
+            tids);
+  return g->num_tids;
+}
+
+int threadstacks_group_frames(const threadstacks_collection* c,
+                              int group,
+                              uint64_t* frames,
+                              int max_frames) {
+  const auto* g = GetGroup(c, group);
+  if (g == nullptr) {
+    return -1;
+  }
+  const int depth = g->trace->depth;
+  std::copy(g->trace->address,
+            g->trace->address + std::min(depth, std::max(max_frames, 0)),
+            frames);
+  return depth;
+}
+
+const char* threadstacks_symbol(const threadstacks_collection* c,
+                                uint64_t addr) {
+  return c->symbolized ? c->symbols.Lookup(addr) : nullptr;
+}
+
+int64_t threadstacks_format(const threadstacks_collection* c,
+                            int format,
+                            char* buf,
+                            size_t size) {
+  std::string out;
+  try {
+    switch (format) {
+      case THREADSTACKS_FORMAT_TEXT:
+        out = c->collection.ToPrettyString(c->symbols);
+        break;
+      case THREADSTACKS_FORMAT_FOLDED:
+        out = c->collection.ToFoldedString(c->symbolized ? &c->symbols
+                                                         : nullptr);
+        break;
+      case THREADSTACKS_FORMAT_RAW:
+        out = c->collection.ToRawString();
+        break;
+      default:
+        return -1;
+    }
+  } catch (...) {
+    return -1;
+  }
+  if (size > 0) {
+    const size_t n = std::min(out.size(), size - 1);
+    memcpy(buf, out.data(), n);
+    buf[n] = '\0';
+  }
+  return out.size();
+}
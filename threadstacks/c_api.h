@@ -0,0 +1,125 @@
+/* Copyright: ThoughtSpot Inc 2017 */
+
+/*
+ * A C interface to stack trace collection, e.g. for native components hosted
+ * by other runtimes. It only exchanges plain C types: collections are opaque
+ * handles owned by the library, and all data is either copied into buffers
+ * provided by the caller, or returned as pointers into the collection which
+ * stay valid until the next collection into the same handle, or until it is
+ * freed. Memory is never allocated on one side of the interface and freed on
+ * the other.
+ *
+ * Typical use:
+ *
+ *   threadstacks_install_handler();
+ *   threadstacks_collection* c = threadstacks_collection_new();
+ *   if (threadstacks_collect(c, THREADSTACKS_SYMBOLIZE, 0) == 0) {
+ *     for (int g = 0; g < threadstacks_num_groups(c); ++g) {
+ *       uint64_t frames[64];
+ *       int depth = threadstacks_group_frames(c, g, frames, 64);
+ *       ...
+ *     }
+ *   }
+ *   threadstacks_collection_free(c);
+ *
+ * Note: A handle must not be used by multiple threads at the same time.
+ */
+
+#ifndef THREADSTACKS_C_API_H_
+#define THREADSTACKS_C_API_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define THREADSTACKS_EXPORT __attribute__((visibility("default")))
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Version of this interface, which changes only on incompatible changes. */
+#define THREADSTACKS_ABI_VERSION 1
+
+/* Flags of threadstacks_collect(...). */
+enum {
+  /* Symbolize the frames, see threadstacks_symbol(...). */
+  THREADSTACKS_SYMBOLIZE = 1,
+};
+
+/* Formats of threadstacks_format(...), see StackTraceCollection. */
+enum {
+  THREADSTACKS_FORMAT_TEXT = 0,
+  THREADSTACKS_FORMAT_FOLDED = 1,
+  THREADSTACKS_FORMAT_RAW = 2,
+};
+
+typedef struct threadstacks_collection threadstacks_collection;
+
+/* Returns THREADSTACKS_ABI_VERSION of the library. */
+THREADSTACKS_EXPORT int threadstacks_abi_version(void);
+
+/* Installs the internal stack trace collection signal handler, which
+ * threadstacks_collect(...) depends on. Returns 0 on success, -1 on failure. */
+THREADSTACKS_EXPORT int threadstacks_install_handler(void);
+/* Installs the external stack trace collection signal handler. Returns 0 on
+ * success, -1 on failure. */
+THREADSTACKS_EXPORT int threadstacks_install_external_handler(void);
+
+/* Returns a new, empty collection, or NULL on failure. Handles are meant to
+ * be reused across collections, which reuse their memory. */
+THREADSTACKS_EXPORT threadstacks_collection* threadstacks_collection_new(void);
+/* Frees @c, which may be NULL. */
+THREADSTACKS_EXPORT void threadstacks_collection_free(
+    threadstacks_collection* c);
+
+/* Collects the stack traces of all the threads of the calling process into
+ * @c, replacing its previous contents. @flags is a combination of the flags
+ * above. @timeout_ms is the time to wait for threads to respond, 0 for the
+ * default. Returns 0 on success, -1 on failure, see threadstacks_error(...). */
+THREADSTACKS_EXPORT int threadstacks_collect(threadstacks_collection* c,
+                                             int flags,
+                                             int64_t timeout_ms);
+/* Returns the error message of the last failed collection into @c, or an
+ * empty string. */
+THREADSTACKS_EXPORT const char* threadstacks_error(
+    const threadstacks_collection* c);
+
+/* Returns the number of groups of threads that share a stack trace. Groups
+ * are indexed from 0. */
+THREADSTACKS_EXPORT int threadstacks_num_groups(
+    const threadstacks_collection* c);
+/* Returns the total number of threads across all the groups. */
+THREADSTACKS_EXPORT int threadstacks_num_threads(
+    const threadstacks_collection* c);
+/* Copies the tids of group @group into @tids, of size @max_tids. Returns the
+ * number of tids of the group, which may exceed @max_tids, or -1 if @group is
+ * invalid. */
+THREADSTACKS_EXPORT int threadstacks_group_tids(
+    const threadstacks_collection* c, int group, int32_t* tids, int max_tids);
+/* Copies the frame addresses of the stack trace of group @group, from the
+ * innermost to the outermost, into @frames, of size @max_frames. Returns the
+ * depth of the stack trace, which may exceed @max_frames, or -1 if @group is
+ * invalid. */
+THREADSTACKS_EXPORT int threadstacks_group_frames(
+    const threadstacks_collection* c,
+    int group,
+    uint64_t* frames,
+    int max_frames);
+/* Returns the symbol of frame address @addr of a stack trace in @c, or NULL if
+ * the collection wasn't symbolized. */
+THREADSTACKS_EXPORT const char* threadstacks_symbol(
+    const threadstacks_collection* c, uint64_t addr);
+
+/* Formats the stack traces in @c in @format into @buf, of size @size,
+ * truncating and NUL terminating them like snprintf(...). Text and folded
+ * stack traces are symbolized only if the collection was. Returns the length
+ * of the whole formatted stack traces, excluding the terminating NUL, or -1
+ * if @format is invalid or there isn't enough memory to format them. */
+THREADSTACKS_EXPORT int64_t threadstacks_format(
+    const threadstacks_collection* c, int format, char* buf, size_t size);
+
+#ifdef __cplusplus
+}  /* extern "C" */
+#endif
+
+#endif  /* THREADSTACKS_C_API_H_ */
@@ -0,0 +1,126 @@
+// Copyright: ThoughtSpot Inc 2017
+
+#include "threadstacks/c_api.h"
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace threadstacks {
+namespace {
+
+// Number of threads that share a stack trace.
+const int kNumWorkers = 4;
+
+std::atomic<bool> stop{false};
+// Number of workers that have entered CApiWorker().
+std::atomic<int> num_ready{0};
+
+__attribute__((noinline)) void CApiWorker() {
+  ++num_ready;
+  while (not stop) {
+    usleep(1000);
+  }
+}
+
+class CApiTest : public ::testing::Test {
+ public:
+  static void SetUpTestCase() {
+    ASSERT_EQ(0, threadstacks_install_handler());
+    for (int i = 0; i < kNumWorkers; ++i) {
+      workers_.emplace_back(CApiWorker);
+    }
+    // Collections must find every worker in CApiWorker().
+    while (num_ready < kNumWorkers) {
+      usleep(1000);
+    }
+  }
+
+  static void TearDownTestCase() {
+    stop = true;
+    for (auto& worker : workers_) {
+      worker.join();
+    }
+  }
+
+ protected:
+  static std::vector<std::thread> workers_;
+};
+
+// static
+std::vector<std::thread> CApiTest::workers_;
+
+TEST_F(CApiTest, Collect) {
+  EXPECT_EQ(THREADSTACKS_ABI_VERSION, threadstacks_abi_version());
+  threadstacks_collection* c = threadstacks_collection_new();
+  ASSERT_NE(nullptr, c);
+  // Handles are reusable.
+  for (int round = 0; round < 2; ++round) {
+    ASSERT_EQ(0, threadstacks_collect(c, THREADSTACKS_SYMBOLIZE, 0))
+        << threadstacks_error(c);
+    EXPECT_STREQ("", threadstacks_error(c));
+    EXPECT_EQ(kNumWorkers + 1, threadstacks_num_threads(c));
+    int num_workers = 0;
+    int num_threads = 0;
+    for (int g = 0; g < threadstacks_num_groups(c); ++g) {
+      int32_t tids[kNumWorkers + 1];
+      const int num_tids =
+          threadstacks_group_tids(c, g, tids, kNumWorkers + 1);
+      ASSERT_LT(0, num_tids);
+      num_threads += num_tids;
+      uint64_t frames[8];
+      const int depth = threadstacks_group_frames(c, g, frames, 8);
+      ASSERT_LT(0, depth);
+      for (int i = 0; i < std::min(depth, 8); ++i) {
+        const char* symbol = threadstacks_symbol(c, frames[i]);
+        ASSERT_NE(nullptr, symbol);
+        if (strstr(symbol, "CApiWorker") != nullptr) {
+          num_workers += num_tids;
+          break;
+        }
+      }
+    }
+    EXPECT_EQ(kNumWorkers + 1, num_threads);
+    EXPECT_EQ(kNumWorkers, num_workers);
+  }
+  EXPECT_EQ(-1, threadstacks_group_tids(c, -1, nullptr, 0));
+  EXPECT_EQ(-1, threadstacks_group_frames(c, threadstacks_num_groups(c),
+                                          nullptr, 0));
+  threadstacks_collection_free(c);
+}
+
+TEST_F(CApiTest, Format) {
+  threadstacks_collection* c = threadstacks_collection_new();
+  ASSERT_EQ(0, threadstacks_collect(c, 0, 0)) << threadstacks_error(c);
+  uint64_t frame;
+  ASSERT_LT(0, threadstacks_group_frames(c, 0, &frame, 1));
+  EXPECT_EQ(nullptr, threadstacks_symbol(c, frame));
+  for (int format : {THREADSTACKS_FORMAT_TEXT, THREADSTACKS_FORMAT_FOLDED,
+                     THREADSTACKS_FORMAT_RAW}) {
+    // The length is returned, whether the buffer is large enough or not.
+    const int64_t length = threadstacks_format(c, format, nullptr, 0);
+    ASSERT_LT(0, length);
+    std::vector<char> buf(length + 1, 'x');
+    EXPECT_EQ(length, threadstacks_format(c, format, buf.data(), buf.size()));
+    EXPECT_EQ(length, strlen(buf.data()));
+    EXPECT_EQ(length, threadstacks_format(c, format, buf.data(), 4));
+    EXPECT_EQ(3, strlen(buf.data()));
+  }
+  EXPECT_EQ(-1, threadstacks_format(c, 3, nullptr, 0));
+  threadstacks_collection_free(c);
+}
+
+}  // namespace
+}  // namespace threadstacks
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,252 @@
+// Copyright: ThoughtSpot Inc 2017
+
+#include "threadstacks/chrome_trace.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "threadstacks/symbol_table.h"
+
+namespace threadstacks {
+namespace {
+
+// Category of the slices of each thread state.
+const char* StateName(SampleStore::ThreadState state) {
+  switch (state) {
+    case SampleStore::kRunning:
+      return "running";
+    case SampleStore::kSleeping:
+      return "sleeping";
+    case SampleStore::kDiskSleep:
+      return "disk_sleep";
+    default:
+      return "other";
+  }
+}
+
+// Streams the trace to a Writer, in chunks of about Options::buffer_bytes.
+class TraceWriter {
+ public:
+  TraceWriter(const ChromeTrace::Options& options,
+              const ChromeTrace::Writer& writer)
+      : options_(options), writer_(writer) {
+    out_.append("{\"traceEvents\":[");
+  }
+
+  // Records sample @row, and writes the slice it ends, if any.
+  void Add(const SampleStore::Row& row) {
+    auto inserted = slices_.emplace(row.tid, Slice());
+    Slice& slice = inserted.first->second;
+    if (not inserted.second) {
+      if (row.stack == slice.stack && row.state == slice.state) {
+        slice.interval_ns = row.time_ns - slice.last_ns;
+        slice.last_ns = row.time_ns;
+        return;
+      }
+      WriteSlice(row.tid, slice, row.time_ns);
+      slice.interval_ns = row.time_ns - slice.last_ns;
+    }
+    slice.start_ns = row.time_ns;
+    slice.last_ns = row.time_ns;
+    slice.stack = row.stack;
+    slice.state = row.state;
+  }
+
+  // Writes the open slices, the stack frames and the end of the trace.
+  // Returns false if any write failed.
+  bool Finish() {
+    for (const auto& e : slices_) {
+      // The last slice of a thread lasts one sampling interval past its last
+      // sample.
+      WriteSlice(e.first, e.second, e.second.last_ns + e.second.interval_ns);
+    }
+    out_.append("\n],\n\"stackFrames\":{");
+    char buf[64];
+    for (size_t id = 0; id < frames_.size(); ++id) {
+      snprintf(buf, sizeof(buf), "%s\n\"%zu\":{\"name\":\"", id > 0 ? "," : "",
+               id);
+      out_.append(buf);
+      AppendFrameName(frames_[id].addr);
+      out_.append("\"");
+      if (frames_[id].parent >= 0) {
+        snprintf(buf, sizeof(buf), ",\"parent\":\"%d\"", frames_[id].parent);
+        out_.append(buf);
+      }
+      out_.append("}");
+      Flush(false);
+    }
+    out_.append("\n},\n\"displayTimeUnit\":\"ms\"}\n");
+    Flush(true);
+    return ok_;
+  }
+
+ private:
+  // Run of samples of a thread in the same stack trace and state.
+  struct Slice {
+    int64_t start_ns = 0;
+    // Time of the last sample of the run.
+    int64_t last_ns = 0;
+    // Interval between the last two samples of the thread.
+    int64_t interval_ns = 0;
+    StackId stack = 0;
+    SampleStore::ThreadState state = SampleStore::kOther;
+  };
+  // Node of the stackFrames dictionary.
+  struct Frame {
+    int64_t addr;
+    int parent;
+  };
+
+  // Returns whether @stack is in the stack table of the options.
+  bool HasStack(StackId stack) const {
+    return options_.stacks != nullptr &&
+           stack < static_cast<StackId>(options_.stacks->size());
+  }
+
+  // Appends the JSON-escaped symbol of @addr.
+  void AppendFrameName(int64_t addr) {
+    if (options_.symbols == nullptr) {
+      char buf[32];
+      snprintf(buf, sizeof(buf), "%#lx", addr);
+      out_.append(buf);
+      return;
+    }
+    for (const char* p = options_.symbols->Lookup(addr); *p != '\0'; ++p) {
+      const unsigned char c = *p;
+      if (c == '"' || c == '\\') {
+        out_.push_back('\\');
+        out_.push_back(c);
+      } else if (c < 0x20) {
+        char buf[8];
+        snprintf(buf, sizeof(buf), "\\u%04x", c);
+        out_.append(buf);
+      } else {
+        out_.push_back(c);
+      }
+    }
+  }
+
+  // Returns the id of the innermost frame of @stack in @frames_, adding the
+  // frames of @stack that aren't there yet.
+  int FrameId(StackId stack) {
+    auto it = stack_frames_.find(stack);
+    if (it != stack_frames_.end()) {
+      return it->second;
+    }
+    const auto* addrs = options_.stacks->addresses(stack);
+    int parent = -1;
+    for (int i = options_.stacks->depth(stack) - 1; i >= 0; --i) {
+      auto inserted =
+          frame_ids_.emplace(std::make_pair(parent, addrs[i]), frames_.size());
+      if (inserted.second) {
+        frames_.push_back({addrs[i], parent});
+      }
+      parent = inserted.first->second;
+    }
+    stack_frames_.emplace(stack, parent);
+    return parent;
+  }
+
+  // Writes @slice of thread @tid, which ends at @end_ns.
+  void WriteSlice(pid_t tid, const Slice& slice, int64_t end_ns) {
+    const bool has_stack =
+        HasStack(slice.stack) && options_.stacks->depth(slice.stack) > 0;
+    out_.append(num_slices_++ > 0 ? ",\n{\"name\":\"" : "\n{\"name\":\"");
+    char buf[256];
+    if (has_stack) {
+      AppendFrameName(options_.stacks->addresses(slice.stack)[0]);
+    } else {
+      snprintf(buf, sizeof(buf), "stack %u", slice.stack);
+      out_.append(buf);
+    }
+    snprintf(buf, sizeof(buf),
+             "\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,"
+             "\"ts\":%.3f,\"dur\":%.3f",
+             StateName(slice.state), options_.pid, tid,
+             slice.start_ns / 1000.0, (end_ns - slice.start_ns) / 1000.0);
+    out_.append(buf);
+    if (has_stack) {
+      snprintf(buf, sizeof(buf), ",\"sf\":\"%d\"", FrameId(slice.stack));
+      out_.append(buf);
+    }
+    snprintf(buf, sizeof(buf), ",\"args\":{\"stack\":%u}}", slice.stack);
+    out_.append(buf);
+    Flush(false);
+  }
+
+  // Passes the buffered output to the writer if it's full, or if @force.
+  void Flush(bool force) {
+    if (out_.empty() || (not force && out_.size() < options_.buffer_bytes)) {
+      return;
+    }
+    if (ok_) {
+      ok_ = writer_(out_.data(), out_.size());
+    }
+    out_.clear();
+  }
+
+  const ChromeTrace::Options& options_;
+  const ChromeTrace::Writer& writer_;
+  std::string out_;
+  bool ok_ = true;
+  int64_t num_slices_ = 0;
+  // Open slice of every thread.
+  std::unordered_map<pid_t, Slice> slices_;
+  // Frames written so far, indexed by their parent and address, and the
+  // innermost frame of every stack trace.
+  std::vector<Frame> frames_;
+  std::map<std::pair<int, int64_t>, int> frame_ids_;
+  std::unordered_map<StackId, int> stack_frames_;
+};
+
+}  // namespace
+
+// static
+bool ChromeTrace::Write(const SampleStore& store,
+                        const Options& options,
+                        const Writer& writer,
+                        std::string* error) {
+  TraceWriter trace(options, writer);
+  store.Visit(options.start_ns, options.end_ns, options.filter,
+              [&trace](const SampleStore::Row& row) { trace.Add(row); });
+  if (not trace.Finish()) {
+    error->assign("Failed to write the trace");
+    return false;
+  }
+  return true;
+}
+
+// static
+bool ChromeTrace::WriteFile(const SampleStore& store,
+                            const Options& options,
+                            const std::string& path,
+                            std::string* error) {
+  FILE* f = fopen(path.c_str(), "we");
+  if (f == nullptr) {
+    error->assign("Failed to open " + path + ": " + strerror(errno));
+    return false;
+  }
+  bool ok = Write(store, options,
+                  [f](const char* data, size_t size) {
+                    return fwrite(data, 1, size, f) == size;
+                  },
+                  error);
+  if (fclose(f) != 0 && ok) {
+    error->assign("Failed to write " + path + ": " + strerror(errno));
+    ok = false;
+  }
+  return ok;
+}
+
+// static
+void ChromeTrace::Symbolize(const StackTable& stacks, SymbolTable* symbols) {
+  symbols->Add(stacks);
+  symbols->Symbolize(nullptr);
+}
+
+}  // namespace threadstacks
@@ -0,0 +1,71 @@
+// Copyright: ThoughtSpot Inc 2017
+
+#ifndef THREADSTACKS_CHROME_TRACE_H_
+#define THREADSTACKS_CHROME_TRACE_H_
+
+#include <sys/types.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+
+#include "threadstacks/sample_store.h"
+#include "threadstacks/stack_table.h"
+
+namespace threadstacks {
+
+class SymbolTable;
+
+// ChromeTrace exports the per-thread history kept by a SampleStore as a
+// timeline in the Chrome trace event format, which chrome://tracing and
+// Perfetto load. Every thread gets a track, with a slice per run of
+// consecutive samples in the same stack trace and state. A slice is named
+// after the innermost frame of its stack trace, and refers to the whole stack
+// trace through the "stackFrames" dictionary of the trace.
+//
+// The trace is streamed: samples are decoded one chunk of the store at a time,
+// and only the open slice of every thread, and the frames seen so far, are
+// kept in memory. A long capture of thousands of threads can thus be written
+// straight to a file.
+class ChromeTrace {
+ public:
+  struct Options {
+    // Time range and threads to export, see SampleStore::Query(...).
+    int64_t start_ns = 0;
+    int64_t end_ns = INT64_MAX;
+    std::function<bool(pid_t /*tid*/)> filter;
+    // Stack traces of the stack ids in the store, e.g. the table of the last
+    // profile of the sampler. If null, or if it doesn't have a stack id,
+    // slices are named after the stack id, without stack frames.
+    const StackTable* stacks = nullptr;
+    // Symbols of the frames. If null, frames are printed as hex addresses.
+    const SymbolTable* symbols = nullptr;
+    // Process id the tracks are grouped under.
+    pid_t pid = 1;
+    // Size of the output buffered before it is passed to the writer.
+    size_t buffer_bytes = 64 << 10;
+  };
+
+  // Function that writes @size bytes at @data, and returns false on error.
+  using Writer = std::function<bool(const char* data, size_t size)>;
+
+  // Writes the trace of the samples of @store selected by @options to
+  // @writer. Returns false, and sets @error, if @writer fails.
+  static bool Write(const SampleStore& store,
+                    const Options& options,
+                    const Writer& writer,
+                    std::string* error);
+  // Same as above, but writes the trace to file @path.
+  static bool WriteFile(const SampleStore& store,
+                        const Options& options,
+                        const std::string& path,
+                        std::string* error);
+
+  // Adds all the addresses of @stacks to @symbols, and symbolizes them.
+  static void Symbolize(const StackTable& stacks, SymbolTable* symbols);
+};
+
+}  // namespace threadstacks
+
+#endif  // THREADSTACKS_CHROME_TRACE_H_
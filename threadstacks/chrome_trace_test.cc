@@ -0,0 +1,137 @@
+// Copyright: ThoughtSpot Inc 2017
+
+#include "threadstacks/chrome_trace.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "threadstacks/symbol_table.h"
+
+namespace threadstacks {
+namespace {
+
+const int64_t kPeriodNs = 10 * 1000 * 1000;
+
+// Returns the number of occurrences of @needle in @haystack.
+int Count(const std::string& haystack, const std::string& needle) {
+  int count = 0;
+  for (size_t pos = haystack.find(needle); pos != std::string::npos;
+       pos = haystack.find(needle, pos + 1)) {
+    ++count;
+  }
+  return count;
+}
+
+class ChromeTraceTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    const int64_t a[] = {0x10, 0x20};
+    const int64_t b[] = {0x30, 0x20};
+    ASSERT_EQ(0, stacks_.Intern(a, 2));
+    ASSERT_EQ(1, stacks_.Intern(b, 2));
+    symbols_.Add(0x10);
+    symbols_.Add(0x20);
+    symbols_.Add(0x30);
+    symbols_.Symbolize([](int64_t addr) {
+      return addr == 0x20 ? std::string("main") : "f\"" + std::to_string(addr);
+    });
+    SampleStore::Options options;
+    options.rounds_per_chunk = 4;
+    store_.reset(new SampleStore(options));
+    // Thread 1 is in stack trace 0 for 6 rounds, then in stack trace 1 for 4
+    // rounds, sleeping in the last 2. Thread 2 stays in stack trace 0.
+    for (int round = 0; round < 10; ++round) {
+      const Sampler::Sample samples[] = {{1, round < 6 ? 0u : 1u}, {2, 0}};
+      const SampleStore::ThreadState states[] = {
+          round < 8 ? SampleStore::kRunning : SampleStore::kSleeping,
+          SampleStore::kSleeping};
+      store_->Append(round * kPeriodNs, samples, states, 2);
+    }
+  }
+
+  // Returns the trace of @options, and counts the writes in @num_writes_.
+  std::string Write(const ChromeTrace::Options& options) {
+    std::string trace;
+    std::string error;
+    EXPECT_TRUE(ChromeTrace::Write(*store_, options,
+                                   [&](const char* data, size_t size) {
+                                     trace.append(data, size);
+                                     ++num_writes_;
+                                     return true;
+                                   },
+                                   &error)) << error;
+    return trace;
+  }
+
+  StackTable stacks_;
+  SymbolTable symbols_;
+  std::unique_ptr<SampleStore> store_;
+  int num_writes_ = 0;
+};
+
+TEST_F(ChromeTraceTest, Slices) {
+  ChromeTrace::Options options;
+  options.stacks = &stacks_;
+  options.symbols = &symbols_;
+  options.pid = 42;
+  const auto trace = Write(options);
+  EXPECT_EQ(0, trace.find("{\"traceEvents\":["));
+  EXPECT_EQ(1, num_writes_);
+  EXPECT_EQ(4, Count(trace, "\"ph\":\"X\""));
+  EXPECT_EQ(4, Count(trace, "\"pid\":42,"));
+  // Thread 1 changes stack trace, then state.
+  EXPECT_NE(std::string::npos,
+            trace.find("{\"name\":\"f\\\"16\",\"cat\":\"running\",\"ph\":\"X\","
+                       "\"pid\":42,\"tid\":1,\"ts\":0.000,\"dur\":60000.000,"
+                       "\"sf\":\"1\",\"args\":{\"stack\":0}}"));
+  EXPECT_NE(std::string::npos,
+            trace.find("{\"name\":\"f\\\"48\",\"cat\":\"running\",\"ph\":\"X\","
+                       "\"pid\":42,\"tid\":1,\"ts\":60000.000,"
+                       "\"dur\":20000.000,\"sf\":\"2\""));
+  // The last slices last one more sampling interval.
+  EXPECT_NE(std::string::npos,
+            trace.find("{\"name\":\"f\\\"48\",\"cat\":\"sleeping\",\"ph\":\"X\","
+                       "\"pid\":42,\"tid\":1,\"ts\":80000.000,"
+                       "\"dur\":20000.000,\"sf\":\"2\""));
+  EXPECT_NE(std::string::npos,
+            trace.find("\"tid\":2,\"ts\":0.000,\"dur\":100000.000,"));
+  // Both stack traces share their outermost frame.
+  EXPECT_NE(std::string::npos,
+            trace.find("\"stackFrames\":{\n"
+                       "\"0\":{\"name\":\"main\"},\n"
+                       "\"1\":{\"name\":\"f\\\"16\",\"parent\":\"0\"},\n"
+                       "\"2\":{\"name\":\"f\\\"48\",\"parent\":\"0\"}\n},"));
+}
+
+TEST_F(ChromeTraceTest, Streaming) {
+  ChromeTrace::Options options;
+  options.start_ns = 2 * kPeriodNs;
+  options.filter = [](pid_t tid) { return tid == 1; };
+  options.buffer_bytes = 1;
+  const auto trace = Write(options);
+  // Without stack traces, slices are named after their stack ids.
+  EXPECT_EQ(3, Count(trace, "\"ph\":\"X\""));
+  EXPECT_EQ(0, Count(trace, "\"tid\":2,"));
+  EXPECT_NE(std::string::npos,
+            trace.find("{\"name\":\"stack 0\",\"cat\":\"running\",\"ph\":\"X\","
+                       "\"pid\":1,\"tid\":1,\"ts\":20000.000,"
+                       "\"dur\":40000.000,\"args\":{\"stack\":0}}"));
+  EXPECT_NE(std::string::npos, trace.find("\"stackFrames\":{\n},"));
+  // A write per slice, and one for the end.
+  EXPECT_EQ(4, num_writes_);
+
+  std::string error;
+  EXPECT_FALSE(ChromeTrace::Write(
+      *store_, options, [](const char*, size_t) { return false; }, &error));
+  EXPECT_FALSE(error.empty());
+}
+
+}  // namespace
+}  // namespace threadstacks
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
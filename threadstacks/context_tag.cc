@@ -0,0 +1,14 @@
+// Copyright: ThoughtSpot Inc 2017
+
+#include "threadstacks/context_tag.h"
+
+namespace threadstacks {
+
+constexpr int ContextTag::kMaxSize;
+
+namespace internal {
+__thread const ContextTag* context_tag
+    __attribute__((tls_model("initial-exec"))) = nullptr;
+}  // namespace internal
+
+}  // namespace threadstacks
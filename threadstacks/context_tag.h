@@ -0,0 +1,82 @@
+// Copyright: ThoughtSpot Inc 2017
+
+#ifndef THREADSTACKS_CONTEXT_TAG_H_
+#define THREADSTACKS_CONTEXT_TAG_H_
+
+#include <atomic>
+#include <cstring>
+
+namespace threadstacks {
+
+// A ContextTag labels the work a thread is doing, e.g. the tenant, query or
+// request it serves, so that stack traces can be grouped or filtered by it.
+// A thread points its context slot at a tag with SetContextTag(...), which is
+// a single store, and the stack trace collection signal handler copies the
+// tag it points to along with the stack trace, see
+// StackTraceCollection::Group::tags and Sampler::Sample::tag.
+//
+// Since the tag is copied from a signal handler, which can interrupt the
+// thread at any point, the thread must not modify a tag while it's set: to
+// change the tag, fill in another one and set that one instead.
+//
+//   ContextTag tag("tenant=acme");
+//   ScopedContextTag scoped(&tag);
+//   HandleRequest(request);
+struct ContextTag {
+  // Maximum size of a tag, including the terminating NUL.
+  static constexpr int kMaxSize = 64;
+
+  ContextTag() { value[0] = '\0'; }
+  explicit ContextTag(const char* tag) { Set(tag); }
+
+  // Sets the tag to @tag, truncated to kMaxSize - 1 characters.
+  void Set(const char* tag) {
+    strncpy(value, tag, kMaxSize - 1);
+    value[kMaxSize - 1] = '\0';
+  }
+
+  // NUL terminated.
+  char value[kMaxSize];
+};
+
+namespace internal {
+// Context slot of the calling thread. Initial-exec, so that the signal handler
+// never triggers the lazy allocation of the TLS block of a dynamically loaded
+// library.
+extern __thread const ContextTag* context_tag
+    __attribute__((tls_model("initial-exec")));
+}  // namespace internal
+
+// Sets the tag of the calling thread to @tag, or clears it if @tag is null.
+// @tag must outlive its use as the tag of the thread.
+inline void SetContextTag(const ContextTag* tag) {
+  // Makes sure the handler sees the contents of @tag, if it interrupts the
+  // thread right after the store.
+  std::atomic_signal_fence(std::memory_order_release);
+  internal::context_tag = tag;
+}
+
+// Returns the tag of the calling thread, or null if it has none.
+inline const ContextTag* GetContextTag() { return internal::context_tag; }
+
+// Sets the tag of the calling thread for the lifetime of the object, and
+// restores the previous one on destruction.
+class ScopedContextTag {
+ public:
+  explicit ScopedContextTag(const ContextTag* tag)
+      : previous_(GetContextTag()) {
+    SetContextTag(tag);
+  }
+  ~ScopedContextTag() { SetContextTag(previous_); }
+
+ private:
+  const ContextTag* const previous_;
+
+  // Disable copy c'tor and assignment operator.
+  ScopedContextTag(const ScopedContextTag&) = delete;
+  ScopedContextTag& operator=(const ScopedContextTag&) = delete;
+};
+
+}  // namespace threadstacks
+
+#endif  // THREADSTACKS_CONTEXT_TAG_H_
@@ -0,0 +1,132 @@
+// Copyright: ThoughtSpot Inc 2017
+
+#include "threadstacks/crash_file.h"
+
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+#include "threadstacks/stack_unwinder.h"
+
+namespace threadstacks {
+
+constexpr char CrashFile::kMagic[8];
+constexpr uint32_t CrashFile::kVersion;
+
+// static
+bool CrashFile::Read(const std::string& path, CrashFile* crash,
+                     std::string* error) {
+  std::ifstream in(path, std::ios::binary);
+  if (not in) {
+    error->assign("Failed to open " + path);
+    return false;
+  }
+  std::stringstream data;
+  data << in.rdbuf();
+  return Parse(data.str(), crash, error);
+}
+
+// static
+bool CrashFile::Parse(const std::string& data, CrashFile* crash,
+                      std::string* error) {
+  *crash = CrashFile();
+  bool has_header = false;
+  size_t pos = 0;
+  while (not crash->complete && data.size() - pos >= sizeof(RecordHeader)) {
+    RecordHeader record;
+    memcpy(&record, data.data() + pos, sizeof(record));
+    pos += sizeof(record);
+    if (data.size() - pos < record.size) {
+      // Truncated by the death of the process.
+      break;
+    }
+    const char* payload = data.data() + pos;
+    pos += record.size;
+    if (not has_header && record.type != kHeader) {
+      break;
+    }
+    switch (record.type) {
+      case kHeader:
+        if (record.size < sizeof(Header)) {
+          error->assign("Truncated crash file header");
+          return false;
+        }
+        memcpy(&crash->header, payload, sizeof(Header));
+        if (0 != memcmp(crash->header.magic, kMagic, sizeof(kMagic))) {
+          error->assign("Not a crash file");
+          return false;
+        }
+        if (crash->header.version != kVersion) {
+          error->assign("Unsupported crash file version " +
+                        std::to_string(crash->header.version));
+          return false;
+        }
+        has_header = true;
+        break;
+      case kThread: {
+        ThreadHeader thread;
+        if (record.size < sizeof(thread)) {
+          break;
+        }
+        memcpy(&thread, payload, sizeof(thread));
+        const size_t regs_size = thread.num_regs * sizeof(uint64_t);
+        if (record.size - sizeof(thread) < regs_size + thread.stack_size) {
+          break;
+        }
+        Thread t;
+        t.tid = thread.tid;
+        t.crashed = thread.flags & kCrashed;
+        t.pc = thread.pc;
+        t.sp = thread.sp;
+        t.fp = thread.fp;
+        t.regs.resize(thread.num_regs);
+        memcpy(t.regs.data(), payload + sizeof(thread), regs_size);
+        t.stack.assign(payload + sizeof(thread) + regs_size,
+                       thread.stack_size);
+        crash->threads.push_back(std::move(t));
+        break;
+      }
+      case kMaps:
+        ParseMappings(std::string(payload, record.size), &crash->mappings);
+        break;
+      case kModules: {
+        std::istringstream lines(std::string(payload, record.size));
+        std::string line;
+        while (std::getline(lines, line)) {
+          const auto space = line.find(' ');
+          if (space != std::string::npos) {
+            crash->modules.push_back(
+                {line.substr(0, space), line.substr(space + 1)});
+          }
+        }
+        break;
+      }
+      case kEnd:
+        crash->complete = true;
+        break;
+      default:
+        // Skips records of newer writers.
+        break;
+    }
+  }
+  if (not has_header) {
+    error->assign("Not a crash file");
+    return false;
+  }
+  return true;
+}
+
+std::vector<StackTraceCollector::Result> CrashFile::Unwind() const {
+  return UnwindStackCopies(threads, mappings);
+}
+
+const CrashFile::Thread* CrashFile::crashed_thread() const {
+  for (const auto& thread : threads) {
+    if (thread.crashed) {
+      return &thread;
+    }
+  }
+  return nullptr;
+}
+
+}  // namespace threadstacks
@@ -0,0 +1,130 @@
+// Copyright: ThoughtSpot Inc 2017
+
+#ifndef THREADSTACKS_CRASH_FILE_H_
+#define THREADSTACKS_CRASH_FILE_H_
+
+#include <sys/types.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "threadstacks/elf_symbols.h"
+#include "threadstacks/signal_handler.h"
+
+namespace threadstacks {
+
+// A CrashFile is the contents of a crash file, as written by CrashHandler
+// when the process crashes. Unlike a core dump, a crash file only holds what's
+// needed to unwind the stacks of all the threads offline: their registers,
+// the top of their stacks, and the binaries mapped by the process, so it's
+// typically a few hundred KB.
+//
+// A crash file is a sequence of records, each starting with a RecordHeader,
+// followed by RecordHeader::size bytes of payload. The file starts with a
+// kHeader record, and ends with a kEnd record, unless the process died while
+// writing it. Integers are in the byte order of the crashed process.
+struct CrashFile {
+  static constexpr char kMagic[8] = "TSCRASH";
+  static constexpr uint32_t kVersion = 1;
+
+  enum RecordType : uint32_t {
+    // Payload: a Header.
+    kHeader = 1,
+    // Payload: a ThreadHeader, followed by ThreadHeader::num_regs raw
+    // registers (the general purpose registers of the ucontext, as 64 bit
+    // integers) and ThreadHeader::stack_size bytes of stack, starting at the
+    // stack pointer.
+    kThread = 2,
+    // Payload: the contents of /proc/self/maps.
+    kMaps = 3,
+    // Payload: a "<build ID> <path>\n" line per binary mapped by the process,
+    // as of the time the handler was installed.
+    kModules = 4,
+    // No payload.
+    kEnd = 5,
+  };
+
+  struct RecordHeader {
+    uint32_t type;
+    uint32_t size;
+  };
+
+  struct Header {
+    char magic[8];
+    uint32_t version;
+    // ELF machine of the process, e.g. EM_X86_64.
+    uint32_t machine;
+    int32_t pid;
+    // Thread that crashed.
+    int32_t tid;
+    // Signal that crashed the thread, with its code and faulting address.
+    int32_t signo;
+    int32_t code;
+    uint64_t fault_addr;
+    // Wall time of the crash, in nanoseconds since the epoch.
+    int64_t time_ns;
+  };
+
+  struct ThreadHeader {
+    int32_t tid;
+    // A combination of ThreadFlags.
+    uint32_t flags;
+    uint64_t pc;
+    uint64_t sp;
+    uint64_t fp;
+    uint32_t num_regs;
+    uint32_t stack_size;
+  };
+
+  enum ThreadFlags : uint32_t {
+    // The thread that crashed, whose registers are the faulting context.
+    kCrashed = 1,
+  };
+
+  // A thread, as read from a kThread record.
+  struct Thread {
+    pid_t tid = 0;
+    bool crashed = false;
+    uint64_t pc = 0;
+    uint64_t sp = 0;
+    uint64_t fp = 0;
+    std::vector<uint64_t> regs;
+    // Copy of the top of the stack, starting at @sp.
+    std::string stack;
+  };
+
+  // A binary mapped by the process, as read from the kModules record.
+  struct Module {
+    std::string build_id;
+    std::string path;
+  };
+
+  // Reads the crash file at @path into @crash. Returns false on failure, in
+  // which case @error is filled with a descriptive error message. A crash
+  // file truncated after its header is read as far as it goes, see
+  // @complete.
+  static bool Read(const std::string& path, CrashFile* crash,
+                   std::string* error);
+  // Same as above, but parses the contents @data of a crash file.
+  static bool Parse(const std::string& data, CrashFile* crash,
+                    std::string* error);
+
+  // Returns the stack traces of @threads, unwound with UnwindStackCopy(...)
+  // and grouped like the ones of StackTraceCollector::Collect(...).
+  std::vector<StackTraceCollector::Result> Unwind() const;
+  // Returns the crashed thread, or null if it wasn't written.
+  const Thread* crashed_thread() const;
+
+  Header header;
+  std::vector<Thread> threads;
+  // Executable file mappings of the process, parsed from the kMaps record.
+  std::vector<Mapping> mappings;
+  std::vector<Module> modules;
+  // Whether the file ends with a kEnd record.
+  bool complete = false;
+};
+
+}  // namespace threadstacks
+
+#endif  // THREADSTACKS_CRASH_FILE_H_
@@ -0,0 +1,457 @@
+// Copyright: ThoughtSpot Inc 2017
+
+#include "threadstacks/crash_handler.h"
+
+#include <dirent.h>
+#include <elf.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <ucontext.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <set>
+
+#include "common/sysutil.h"
+#include "threadstacks/crash_file.h"
+#include "threadstacks/elf_symbols.h"
+#include "threadstacks/signal_handler.h"
+
+namespace threadstacks {
+namespace {
+
+const int kFatalSignals[] = {SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT};
+constexpr int kNumFatalSignals = sizeof(kFatalSignals) / sizeof(int);
+// Size of the alternate signal stacks.
+constexpr size_t kAltStackSize = 64 * 1024;
+
+// Everything below is set up by Install(...), so that the handlers don't
+// allocate.
+CrashHandler::Options options;
+// Prefix of the crash file path, i.e. "<directory>/threadstacks-crash-".
+char path_prefix[PATH_MAX];
+struct sigaction old_actions[kNumFatalSignals];
+// Lines of the kModules record, as built by RefreshModules().
+std::atomic<const std::string*> modules{nullptr};
+
+// Thread handling a crash, if any.
+std::atomic<pid_t> crashing_tid{0};
+// Crash file being written.
+int crash_fd = -1;
+// Contents of /proc/self/maps, as of the crash. Processes with larger maps
+// files only get the first kMaxMapsSize bytes recorded.
+constexpr size_t kMaxMapsSize = 1024 * 1024;
+char maps[kMaxMapsSize];
+size_t maps_size = 0;
+// Thread that is asked to record its stack: it claims the request by
+// resetting @target_tid to 0, and sets @target_done when it's done.
+std::atomic<pid_t> target_tid{0};
+std::atomic<bool> target_done{false};
+
+pid_t GetTid() { return syscall(SYS_gettid); }
+
+int64_t MonotonicTimeNs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+// Writes @size bytes at @data to @fd. Returns false on failure.
+bool WriteAll(int fd, const void* data, size_t size) {
+  const char* p = static_cast<const char*>(data);
+  while (size > 0) {
+    const ssize_t n = write(fd, p, size);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    p += n;
+    size -= n;
+  }
+  return true;
+}
+
+// Same as WriteAll(...), but for @size bytes of memory at @data that may not
+// be readable, e.g. if it was unmapped after the maps were read. What can't be
+// read is written as zeros, so that the record keeps the size its header
+// declares.
+bool WriteMemory(int fd, const void* data, size_t size) {
+  const char* p = static_cast<const char*>(data);
+  while (size > 0) {
+    const ssize_t n = write(fd, p, size);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n < 0 && errno == EFAULT) {
+      break;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    p += n;
+    size -= n;
+  }
+  static const char kZeros[4096] = {};
+  while (size > 0) {
+    const size_t n = std::min(size, sizeof(kZeros));
+    if (not WriteAll(fd, kZeros, n)) {
+      return false;
+    }
+    size -= n;
+  }
+  return true;
+}
+
+bool WriteRecord(int fd, uint32_t type, const void* data, size_t size) {
+  const CrashFile::RecordHeader record = {type, static_cast<uint32_t>(size)};
+  return WriteAll(fd, &record, sizeof(record)) && WriteAll(fd, data, size);
+}
+
+// Formats @value in decimal at @buf, which must have room for 20 characters.
+// Returns the number of characters written.
+int FormatDecimal(uint64_t value, char* buf) {
+  char digits[20];
+  int n = 0;
+  do {
+    digits[n++] = '0' + value % 10;
+    value /= 10;
+  } while (value != 0);
+  for (int i = 0; i < n; ++i) {
+    buf[i] = digits[n - 1 - i];
+  }
+  return n;
+}
+
+// Parses the hex number at @p, up to the first non hex digit before @end,
+// which is returned in @next.
+uint64_t ParseHex(const char* p, const char* end, const char** next) {
+  uint64_t value = 0;
+  for (; p < end; ++p) {
+    const char c = *p;
+    if (c >= '0' && c <= '9') {
+      value = value * 16 + (c - '0');
+    } else if (c >= 'a' && c <= 'f') {
+      value = value * 16 + (c - 'a' + 10);
+    } else {
+      break;
+    }
+  }
+  *next = p;
+  return value;
+}
+
+// Returns the end of the mapping that contains @addr in @maps, or 0 if there
+// is none or it isn't readable, e.g. if @addr is in the guard page below a
+// thread stack that overflowed.
+uint64_t FindReadableEnd(uint64_t addr) {
+  const char* p = maps;
+  const char* const end = maps + maps_size;
+  while (p < end) {
+    const char* next;
+    const uint64_t start = ParseHex(p, end, &next);
+    if (next < end && *next == '-') {
+      const uint64_t stop = ParseHex(next + 1, end, &next);
+      if (addr >= start && addr < stop) {
+        // Permissions follow the range, e.g. "7ffd1000-7ffd3000 rw-p".
+        return next + 1 < end && *next == ' ' && next[1] == 'r' ? stop : 0;
+      }
+    }
+    p = static_cast<const char*>(memchr(next, '\n', end - next));
+    if (p == nullptr) {
+      break;
+    }
+    ++p;
+  }
+  return 0;
+}
+
+// Reads /proc/self/maps into @maps.
+void ReadMaps() {
+  maps_size = 0;
+  const int fd = open("/proc/self/maps", O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return;
+  }
+  ssize_t n;
+  while (maps_size < kMaxMapsSize &&
+         ((n = read(fd, maps + maps_size, kMaxMapsSize - maps_size)) > 0 ||
+          (n < 0 && errno == EINTR))) {
+    maps_size += n > 0 ? n : 0;
+  }
+  close(fd);
+}
+
+// Writes a kThread record for the calling thread, interrupted in @ucontext,
+// to the crash file. Returns false on failure.
+bool WriteThread(void* ucontext, uint32_t flags) {
+  const mcontext_t& mcontext = static_cast<ucontext_t*>(ucontext)->uc_mcontext;
+  CrashFile::ThreadHeader thread;
+  memset(&thread, 0, sizeof(thread));
+  thread.tid = GetTid();
+  thread.flags = flags;
+#if defined(__x86_64__)
+  thread.pc = mcontext.gregs[REG_RIP];
+  thread.sp = mcontext.gregs[REG_RSP];
+  thread.fp = mcontext.gregs[REG_RBP];
+  uint64_t regs[NGREG];
+  for (int i = 0; i < NGREG; ++i) {
+    regs[i] = mcontext.gregs[i];
+  }
+#elif defined(__aarch64__)
+  thread.pc = mcontext.pc;
+  thread.sp = mcontext.sp;
+  thread.fp = mcontext.regs[29];
+  uint64_t regs[34];
+  for (int i = 0; i < 31; ++i) {
+    regs[i] = mcontext.regs[i];
+  }
+  regs[31] = mcontext.sp;
+  regs[32] = mcontext.pc;
+  regs[33] = mcontext.pstate;
+#else
+#error "CrashHandler doesn't support this architecture"
+#endif
+  thread.num_regs = sizeof(regs) / sizeof(regs[0]);
+  // Only the stack up to the end of its mapping can be read, and none of it if
+  // the stack pointer isn't in a readable mapping.
+  const uint64_t stack_end = FindReadableEnd(thread.sp);
+  if (stack_end != 0) {
+    thread.stack_size = std::min<uint64_t>(stack_end - thread.sp,
+                                           options.max_stack_bytes);
+  }
+  const CrashFile::RecordHeader record = {
+      CrashFile::kThread,
+      static_cast<uint32_t>(sizeof(thread) + sizeof(regs) +
+                            thread.stack_size)};
+  return WriteAll(crash_fd, &record, sizeof(record)) &&
+         WriteAll(crash_fd, &thread, sizeof(thread)) &&
+         WriteAll(crash_fd, regs, sizeof(regs)) &&
+         WriteMemory(crash_fd, reinterpret_cast<const void*>(thread.sp),
+                     thread.stack_size);
+}
+
+// Has every other thread write its kThread record, one at a time.
+void WriteOtherThreads(pid_t pid, pid_t self) {
+  const int dir = open("/proc/self/task", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (dir < 0) {
+    return;
+  }
+  const int64_t timeout_ns = options.thread_timeout_ms * 1000 * 1000;
+  alignas(struct dirent64) char buf[4096];
+  long size;
+  while ((size = syscall(SYS_getdents64, dir, buf, sizeof(buf))) > 0) {
+    for (long pos = 0; pos < size;) {
+      const auto* entry = reinterpret_cast<struct dirent64*>(buf + pos);
+      pos += entry->d_reclen;
+      pid_t tid = 0;
+      for (const char* c = entry->d_name; *c >= '0' && *c <= '9'; ++c) {
+        tid = tid * 10 + (*c - '0');
+      }
+      if (tid == 0 || tid == self) {
+        continue;
+      }
+      target_done.store(false);
+      target_tid.store(tid);
+      if (0 != syscall(SYS_tgkill, pid, tid, options.thread_signum)) {
+        target_tid.store(0);
+        continue;
+      }
+      const int64_t deadline_ns = MonotonicTimeNs() + timeout_ns;
+      while (not target_done.load() && MonotonicTimeNs() < deadline_ns) {
+        sched_yield();
+      }
+      pid_t expected = tid;
+      if (not target_done.load() &&
+          not target_tid.compare_exchange_strong(expected, 0)) {
+        // The thread is writing its record, which must not be interleaved
+        // with the next one.
+        while (not target_done.load()) {
+          sched_yield();
+        }
+      }
+    }
+  }
+  close(dir);
+}
+
+// Opens the crash file of process @pid. Returns -1 on failure.
+int OpenCrashFile(pid_t pid) {
+  char path[PATH_MAX];
+  const size_t prefix = strlen(path_prefix);
+  memcpy(path, path_prefix, prefix);
+  size_t n = prefix + FormatDecimal(pid, path + prefix);
+  memcpy(path + n, ".tsc", sizeof(".tsc"));
+  return open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+}
+
+void CrashHandlerImpl(int signum, siginfo_t* siginfo, void* ucontext) {
+  const pid_t pid = getpid();
+  const pid_t self = GetTid();
+  pid_t expected = 0;
+  if (not crashing_tid.compare_exchange_strong(expected, self)) {
+    if (expected == self) {
+      // Crashed while handling the crash: gives up on the crash file. The
+      // fault happens again after returning, and kills the process.
+      signal(signum, SIG_DFL);
+      return;
+    }
+    // Another thread is handling its own crash, and is going to kill the
+    // process when it's done.
+    while (true) {
+      pause();
+    }
+  }
+  const int saved_errno = errno;
+  crash_fd = OpenCrashFile(pid);
+  if (crash_fd >= 0) {
+    CrashFile::Header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CrashFile::kMagic, sizeof(header.magic));
+    header.version = CrashFile::kVersion;
+#if defined(__x86_64__)
+    header.machine = EM_X86_64;
+#elif defined(__aarch64__)
+    header.machine = EM_AARCH64;
+#endif
+    header.pid = pid;
+    header.tid = self;
+    header.signo = signum;
+    header.code = siginfo->si_code;
+    header.fault_addr = reinterpret_cast<uint64_t>(siginfo->si_addr);
+    header.time_ns = common::Sysutil::WallTimeNs();
+    WriteRecord(crash_fd, CrashFile::kHeader, &header, sizeof(header));
+    ReadMaps();
+    WriteThread(ucontext, CrashFile::kCrashed);
+    WriteRecord(crash_fd, CrashFile::kMaps, maps, maps_size);
+    const std::string* lines = modules.load();
+    if (lines != nullptr) {
+      WriteRecord(crash_fd, CrashFile::kModules, lines->data(),
+                  lines->size());
+    }
+    WriteOtherThreads(pid, self);
+    WriteRecord(crash_fd, CrashFile::kEnd, nullptr, 0);
+    close(crash_fd);
+  }
+  // Handles the signal again, as if there was no crash handler.
+  for (int i = 0; i < kNumFatalSignals; ++i) {
+    if (kFatalSignals[i] == signum) {
+      sigaction(signum, &old_actions[i], nullptr);
+    }
+  }
+  errno = saved_errno;
+  syscall(SYS_tgkill, pid, self, signum);
+}
+
+void ThreadHandlerImpl(int signum, siginfo_t* siginfo, void* ucontext) {
+  pid_t expected = GetTid();
+  if (siginfo->si_pid != getpid() ||
+      not target_tid.compare_exchange_strong(expected, 0)) {
+    // Not asked to record its stack, or too late.
+    return;
+  }
+  const int saved_errno = errno;
+  WriteThread(ucontext, 0);
+  target_done.store(true);
+  errno = saved_errno;
+}
+
+}  // namespace
+
+// static
+bool CrashHandler::Install(const Options& opts, std::string* error) {
+  options = opts;
+  const int internal = StackTraceSignal::InternalSignum();
+  const int external = StackTraceSignal::ExternalSignum();
+  if (options.thread_signum == 0) {
+    options.thread_signum = SIGRTMIN + 2;
+    while (options.thread_signum == internal ||
+           options.thread_signum == external) {
+      ++options.thread_signum;
+    }
+  } else if (options.thread_signum == internal ||
+             options.thread_signum == external) {
+    error->assign("Signal " + std::to_string(options.thread_signum) +
+                  " is already used by StackTraceSignal");
+    return false;
+  }
+  const std::string prefix = options.directory + "/threadstacks-crash-";
+  if (prefix.size() + 32 > sizeof(path_prefix)) {
+    error->assign("Crash file directory is too long: " + options.directory);
+    return false;
+  }
+  memcpy(path_prefix, prefix.c_str(), prefix.size() + 1);
+  RefreshModules();
+  if (not InstallAltStack()) {
+    error->assign("Failed to set up an alternate signal stack");
+    return false;
+  }
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  sigemptyset(&action.sa_mask);
+  action.sa_flags = SA_RESTART | SA_SIGINFO;
+  action.sa_sigaction = ThreadHandlerImpl;
+  if (0 != sigaction(options.thread_signum, &action, nullptr)) {
+    error->assign("Failed to install handler for signal " +
+                  std::to_string(options.thread_signum));
+    return false;
+  }
+  action.sa_flags = SA_SIGINFO | SA_ONSTACK;
+  action.sa_sigaction = CrashHandlerImpl;
+  for (int i = 0; i < kNumFatalSignals; ++i) {
+    if (0 != sigaction(kFatalSignals[i], &action, &old_actions[i])) {
+      error->assign("Failed to install handler for signal " +
+                    std::to_string(kFatalSignals[i]));
+      return false;
+    }
+  }
+  return true;
+}
+
+// static
+void CrashHandler::RefreshModules() {
+  std::vector<Mapping> mappings;
+  std::string error;
+  if (not ReadMappings(getpid(), &mappings, &error)) {
+    return;
+  }
+  auto* lines = new std::string();
+  std::set<std::string> paths;
+  for (const auto& mapping : mappings) {
+    if (paths.insert(mapping.path).second) {
+      const auto build_id = ElfSymbols::ReadBuildId(mapping.path);
+      lines->append((build_id.empty() ? "-" : build_id) + " " + mapping.path +
+                    "\n");
+    }
+  }
+  // The previous list is leaked, as a crashing thread may be writing it.
+  modules.store(lines);
+}
+
+// static
+bool CrashHandler::InstallAltStack() {
+  stack_t current;
+  if (0 != sigaltstack(nullptr, &current)) {
+    return false;
+  }
+  if (not (current.ss_flags & SS_DISABLE)) {
+    return true;
+  }
+  stack_t stack;
+  memset(&stack, 0, sizeof(stack));
+  // Never freed, as the thread may use it until it exits.
+  stack.ss_sp = malloc(kAltStackSize);
+  stack.ss_size = kAltStackSize;
+  return stack.ss_sp != nullptr && 0 == sigaltstack(&stack, nullptr);
+}
+
+}  // namespace threadstacks
@@ -0,0 +1,67 @@
+// Copyright: ThoughtSpot Inc 2017
+
+#ifndef THREADSTACKS_CRASH_HANDLER_H_
+#define THREADSTACKS_CRASH_HANDLER_H_
+
+#include <cstdint>
+#include <string>
+
+namespace threadstacks {
+
+// A CrashHandler writes a crash file (see CrashFile) when the process is
+// killed by a fatal signal, i.e. SIGSEGV, SIGBUS, SIGFPE, SIGILL or SIGABRT,
+// after which the signal is handled as it would have been without it. The
+// stacks in the file are unwound and symbolized offline, e.g. with the
+// crash_stacks tool, so that crashes can be analyzed without core dumps.
+//
+// The crash file is written from the signal handler of the crashed thread, so
+// it only uses async-signal-safe functions: it records the faulting context
+// and the top of the stack of the crashed thread, then signals every other
+// thread in turn (with Options::thread_signum) to record its own registers
+// and stack. Threads that don't respond within Options::thread_timeout_ms,
+// e.g. because they block the signal, are left out. The build IDs of the
+// mapped binaries are read when the handler is installed (see
+// RefreshModules()), since that's not safe to do after a crash.
+//
+// Crashes caused by stack overflows are only recorded for threads with an
+// alternate signal stack, see InstallAltStack().
+class CrashHandler {
+ public:
+  struct Options {
+    // Directory the crash file is written to, as
+    // <directory>/threadstacks-crash-<pid>.tsc.
+    std::string directory = "/tmp";
+    // Number of bytes recorded from the top of the stack of every thread.
+    // Frames beyond that are lost.
+    int64_t max_stack_bytes = 32 * 1024;
+    // Signal used to have the other threads record their stacks. Must not be
+    // one of the signals of StackTraceSignal, so any call to
+    // StackTraceSignal::SetSignums(...) must come first. Defaults to the
+    // first realtime signal from SIGRTMIN + 2 on that StackTraceSignal
+    // doesn't use.
+    int thread_signum = 0;
+    // Time to wait for every other thread to record its stack, in
+    // milliseconds.
+    int64_t thread_timeout_ms = 100;
+  };
+
+  // Installs the handler, replacing the handlers of the fatal signals, which
+  // are restored before the signal is raised again. Returns false on failure,
+  // in which case @error is filled with a descriptive error message. Must be
+  // called once.
+  static bool Install(const Options& options, std::string* error);
+  // Re-reads the build IDs of the binaries mapped by the process, e.g. after
+  // loading shared libraries with dlopen(...).
+  static void RefreshModules();
+  // Sets up an alternate signal stack for the calling thread, if it has none,
+  // so that its crashes are recorded even if it overflows its stack. Called
+  // by Install(...) for the calling thread. Returns false on failure.
+  static bool InstallAltStack();
+
+ private:
+  CrashHandler() = delete;
+};
+
+}  // namespace threadstacks
+
+#endif  // THREADSTACKS_CRASH_HANDLER_H_
@@ -0,0 +1,265 @@
+// Copyright: ThoughtSpot Inc 2017
+
+#include "threadstacks/crash_handler.h"
+
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "common/sysutil.h"
+#include "gtest/gtest.h"
+#include "threadstacks/crash_file.h"
+#include "threadstacks/signal_handler.h"
+#include "threadstacks/symbol_table.h"
+
+namespace threadstacks {
+namespace {
+
+// Number of worker threads of the crashing process, which share a stack
+// trace.
+const int kNumWorkers = 3;
+
+// Blocks until @fd is closed.
+__attribute__((noinline)) void CrashWorkerInner(int fd) {
+  char c;
+  while (read(fd, &c, 1) > 0 || errno == EINTR) {
+  }
+}
+
+__attribute__((noinline)) void CrashWorkerOuter(int fd) {
+  CrashWorkerInner(fd);
+  // Prevents a tail call, which would drop this frame.
+  asm volatile("");
+}
+
+__attribute__((noinline)) void CrashInner(volatile int* p) {
+  *p = 1;
+}
+
+__attribute__((noinline)) void CrashOuter(volatile int* p) {
+  CrashInner(p);
+  asm volatile("");
+}
+
+// Set to stop Overflow(...) from recursing, which it never is: it keeps the
+// compiler from flagging or optimizing away the recursion.
+volatile bool stop_overflow = false;
+
+// Recurses until the stack overflows.
+__attribute__((noinline)) int Overflow(int depth) {
+  volatile char frame[1024];
+  frame[0] = depth;
+  if (stop_overflow) {
+    return 0;
+  }
+  return Overflow(depth + 1) + frame[0];
+}
+
+// Forks a child which installs the crash handler, and crashes with a null
+// pointer dereference while its workers are blocked. Returns the exit status
+// of the child.
+int CrashChild(const CrashHandler::Options& options, pid_t* pid) {
+  int fds[2];
+  if (0 != pipe(fds)) {
+    return -1;
+  }
+  *pid = fork();
+  if (*pid == 0) {
+    close(fds[1]);
+    std::string error;
+    if (not CrashHandler::Install(options, &error)) {
+      _exit(1);
+    }
+    std::vector<std::thread> workers;
+    for (int i = 0; i < kNumWorkers; ++i) {
+      workers.emplace_back(CrashWorkerOuter, fds[0]);
+    }
+    while (common::Sysutil::ListThreads(getpid()).size() !=
+           kNumWorkers + 1) {
+      usleep(1000);
+    }
+    // Give the workers a moment to block in read().
+    usleep(100000);
+    CrashOuter(nullptr);
+    _exit(0);
+  }
+  close(fds[0]);
+  int status = -1;
+  waitpid(*pid, &status, 0);
+  close(fds[1]);
+  return status;
+}
+
+TEST(CrashHandlerTest, Crash) {
+  CrashHandler::Options options;
+  options.directory = ::testing::TempDir();
+  pid_t pid;
+  const int status = CrashChild(options, &pid);
+  // The signal is handled as it would be without the crash handler.
+  ASSERT_TRUE(WIFSIGNALED(status)) << status;
+  EXPECT_EQ(SIGSEGV, WTERMSIG(status));
+
+  const auto path = options.directory + "/threadstacks-crash-" +
+                    std::to_string(pid) + ".tsc";
+  CrashFile crash;
+  std::string error;
+  ASSERT_TRUE(CrashFile::Read(path, &crash, &error)) << error;
+  unlink(path.c_str());
+  EXPECT_TRUE(crash.complete);
+  EXPECT_EQ(pid, crash.header.pid);
+  EXPECT_EQ(pid, crash.header.tid);
+  EXPECT_EQ(SIGSEGV, crash.header.signo);
+  EXPECT_EQ(0, crash.header.fault_addr);
+  ASSERT_EQ(kNumWorkers + 1, crash.threads.size());
+  const auto* crashed = crash.crashed_thread();
+  ASSERT_NE(nullptr, crashed);
+  EXPECT_EQ(pid, crashed->tid);
+  for (const auto& thread : crash.threads) {
+    EXPECT_FALSE(thread.regs.empty());
+    EXPECT_FALSE(thread.stack.empty());
+    EXPECT_GE(options.max_stack_bytes, thread.stack.size());
+  }
+  ASSERT_FALSE(crash.mappings.empty());
+  // The binary that crashed is one of the modules.
+  const auto* mapping = FindMapping(crash.mappings, crashed->pc);
+  ASSERT_NE(nullptr, mapping);
+  bool has_module = false;
+  for (const auto& module : crash.modules) {
+    has_module |= module.path == mapping->path &&
+                  module.build_id == ElfSymbols::ReadBuildId(mapping->path);
+  }
+  EXPECT_TRUE(has_module);
+
+  // Unwinds and symbolizes the stacks, as the crash_stacks tool does.
+  const auto results = crash.Unwind();
+  ElfSymbolCache cache;
+  SymbolTable symbols;
+  for (const auto& result : results) {
+    symbols.Add(result.trace);
+  }
+  symbols.Symbolize([&](int64_t addr) {
+    return cache.Symbolize(crash.mappings, addr);
+  });
+  const auto pretty = StackTraceCollector::ToPrettyString(results, symbols);
+  int num_crashed = 0;
+  int num_workers = 0;
+  for (const auto& result : results) {
+    const auto folded = StackTraceCollector::ToFoldedString({result}, &symbols);
+    if (folded.find("CrashOuter") != std::string::npos &&
+        folded.find("CrashInner") != std::string::npos) {
+      num_crashed += result.tids.size();
+    }
+    if (folded.find("CrashWorkerOuter") != std::string::npos &&
+        folded.find("CrashWorkerInner") != std::string::npos) {
+      num_workers += result.tids.size();
+    }
+  }
+  EXPECT_EQ(1, num_crashed) << pretty;
+  EXPECT_EQ(kNumWorkers, num_workers) << pretty;
+}
+
+// A thread that overflows its stack crashes with its stack pointer in the
+// guard page below the stack, which can't be copied: the crash file must
+// still be complete.
+TEST(CrashHandlerTest, StackOverflow) {
+  CrashHandler::Options options;
+  options.directory = ::testing::TempDir();
+  const pid_t pid = fork();
+  if (pid == 0) {
+    std::string error;
+    if (not CrashHandler::Install(options, &error)) {
+      _exit(1);
+    }
+    std::thread thread([] {
+      // The handler needs a stack of its own to run on.
+      if (not CrashHandler::InstallAltStack()) {
+        _exit(1);
+      }
+      Overflow(0);
+    });
+    thread.join();
+    _exit(0);
+  }
+  int status = -1;
+  waitpid(pid, &status, 0);
+  ASSERT_TRUE(WIFSIGNALED(status)) << status;
+  EXPECT_EQ(SIGSEGV, WTERMSIG(status));
+
+  const auto path = options.directory + "/threadstacks-crash-" +
+                    std::to_string(pid) + ".tsc";
+  CrashFile crash;
+  std::string error;
+  ASSERT_TRUE(CrashFile::Read(path, &crash, &error)) << error;
+  unlink(path.c_str());
+  EXPECT_TRUE(crash.complete);
+  EXPECT_NE(pid, crash.header.tid);
+  // The crashed thread and the main thread, blocked in join().
+  ASSERT_EQ(2, crash.threads.size());
+  const auto* crashed = crash.crashed_thread();
+  ASSERT_NE(nullptr, crashed);
+  EXPECT_EQ(crash.header.tid, crashed->tid);
+  EXPECT_FALSE(crashed->regs.empty());
+  for (const auto& thread : crash.threads) {
+    if (not thread.crashed) {
+      EXPECT_FALSE(thread.stack.empty());
+    }
+  }
+  EXPECT_FALSE(crash.mappings.empty());
+  EXPECT_FALSE(crash.modules.empty());
+}
+
+// The crash handler must not take over the signals of StackTraceSignal, which
+// may have been moved to the crash handler's default signal.
+TEST(CrashHandlerTest, StackTraceSignals) {
+  const pid_t pid = fork();
+  if (pid == 0) {
+    if (not StackTraceSignal::SetSignums(SIGRTMIN + 2, SIGRTMIN + 3) ||
+        not StackTraceSignal::InstallInternalHandler()) {
+      _exit(1);
+    }
+    struct sigaction before;
+    sigaction(SIGRTMIN + 2, nullptr, &before);
+    CrashHandler::Options options;
+    options.directory = ::testing::TempDir();
+    options.thread_signum = SIGRTMIN + 3;
+    std::string error;
+    if (CrashHandler::Install(options, &error)) {
+      _exit(2);
+    }
+    options.thread_signum = 0;
+    if (not CrashHandler::Install(options, &error)) {
+      _exit(3);
+    }
+    struct sigaction after;
+    sigaction(SIGRTMIN + 2, nullptr, &after);
+    _exit(after.sa_sigaction == before.sa_sigaction ? 0 : 4);
+  }
+  int status = -1;
+  waitpid(pid, &status, 0);
+  ASSERT_TRUE(WIFEXITED(status)) << status;
+  EXPECT_EQ(0, WEXITSTATUS(status));
+}
+
+TEST(CrashHandlerTest, Errors) {
+  CrashFile crash;
+  std::string error;
+  EXPECT_FALSE(CrashFile::Read("/nonexistent", &crash, &error));
+  EXPECT_FALSE(error.empty());
+  error.clear();
+  EXPECT_FALSE(CrashFile::Parse("not a crash file", &crash, &error));
+  EXPECT_FALSE(error.empty());
+}
+
+}  // namespace
+}  // namespace threadstacks
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
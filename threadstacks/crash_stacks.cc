@@ -0,0 +1,82 @@
+// Copyright: ThoughtSpot Inc 2017
+
+// Prints the stack traces of all the threads of a crashed process, unwound
+// from a crash file written by CrashHandler, and symbolized from the binaries
+// the process mapped. The binaries must not have changed since the crash,
+// which is checked against the build IDs in the crash file. The output
+// formats are the ones of ptrace_stacks: text (the default), folded or raw.
+//
+// Usage: crash_stacks <crash file> [text|folded|raw]
+
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+#include "threadstacks/crash_file.h"
+#include "threadstacks/elf_symbols.h"
+#include "threadstacks/symbol_table.h"
+
+int main(int argc, char** argv) {
+  const char* format = argc > 2 ? argv[2] : "text";
+  if (argc < 2 || argc > 3 ||
+      (0 != strcmp(format, "text") && 0 != strcmp(format, "folded") &&
+       0 != strcmp(format, "raw"))) {
+    fprintf(stderr, "Usage: %s <crash file> [text|folded|raw]\n", argv[0]);
+    return 1;
+  }
+  threadstacks::CrashFile crash;
+  std::string error;
+  if (not threadstacks::CrashFile::Read(argv[1], &crash, &error)) {
+    fprintf(stderr, "%s\n", error.c_str());
+    return 1;
+  }
+  const auto& header = crash.header;
+  fprintf(stderr, "Process %d crashed in thread %d with signal %d (%s)",
+          header.pid, header.tid, header.signo, strsignal(header.signo));
+  // The faulting address is only meaningful for signals sent by the kernel.
+  if (header.code > 0) {
+    fprintf(stderr, ", code %d, address 0x%" PRIx64, header.code,
+            header.fault_addr);
+  }
+  fprintf(stderr, "\n");
+  if (not crash.complete) {
+    fprintf(stderr, "Warning: crash file is truncated\n");
+  }
+  for (const auto& module : crash.modules) {
+    const auto build_id =
+        threadstacks::ElfSymbols::ReadBuildId(module.path);
+    if (module.build_id != "-" && build_id != module.build_id) {
+      fprintf(stderr, "Warning: %s changed since the crash, symbols may be "
+              "wrong\n", module.path.c_str());
+    }
+  }
+  const auto* crashed = crash.crashed_thread();
+  if (crashed != nullptr) {
+    fprintf(stderr, "Faulting pc 0x%" PRIx64 ", sp 0x%" PRIx64
+            ", fp 0x%" PRIx64 "\n", crashed->pc, crashed->sp, crashed->fp);
+  }
+
+  const auto results = crash.Unwind();
+  if (0 == strcmp(format, "raw")) {
+    printf("%s",
+           threadstacks::StackTraceCollector::ToRawString(results).c_str());
+    return 0;
+  }
+  threadstacks::ElfSymbolCache cache;
+  threadstacks::SymbolTable symbols;
+  for (const auto& result : results) {
+    symbols.Add(result.trace);
+  }
+  symbols.Symbolize([&](int64_t addr) {
+    return cache.Symbolize(crash.mappings, addr);
+  });
+  if (0 == strcmp(format, "folded")) {
+    printf("%s", threadstacks::StackTraceCollector::ToFoldedString(
+                     results, &symbols).c_str());
+  } else {
+    printf("%s", threadstacks::StackTraceCollector::ToPrettyString(
+                     results, symbols).c_str());
+  }
+  return 0;
+}
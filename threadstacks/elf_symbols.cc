@@ -0,0 +1,351 @@
+// Copyright: ThoughtSpot Inc 2017
+
+#include "threadstacks/elf_symbols.h"
+
+#include <cxxabi.h>
+#include <elf.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+#include "common/defer.h"
+
+namespace threadstacks {
+namespace {
+
+// A read-only mapping of a whole file.
+class MappedFile {
+ public:
+  MappedFile() = default;
+  ~MappedFile() {
+    if (data_ != nullptr) {
+      munmap(data_, size_);
+    }
+  }
+
+  // Maps the file at @path. Returns false on failure, in which case @error is
+  // filled with a descriptive error message.
+  bool Open(const std::string& path, std::string* error) {
+    const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+      error->assign("Failed to open " + path);  // errno
+      return false;
+    }
+    DEFER(close(fd));
+    struct stat st;
+    if (0 != fstat(fd, &st) || st.st_size == 0) {
+      error->assign("Failed to stat " + path);
+      return false;
+    }
+    void* data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+      error->assign("Failed to mmap " + path);  // errno
+      return false;
+    }
+    data_ = static_cast<char*>(data);
+    size_ = st.st_size;
+    return true;
+  }
+
+  // Returns a pointer to a @T at @offset, or null if it doesn't fit in the
+  // file.
+  template <typename T>
+  const T* At(uint64_t offset, uint64_t count = 1) const {
+    if (offset > size_ || count > (size_ - offset) / sizeof(T)) {
+      return nullptr;
+    }
+    return reinterpret_cast<const T*>(data_ + offset);
+  }
+
+ private:
+  char* data_ = nullptr;
+  size_t size_ = 0;
+
+  // Disable copy c'tor and assignment operator.
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+};
+
+// Returns the ELF header of @file, or null if it isn't a 64-bit ELF file.
+const Elf64_Ehdr* GetElfHeader(const MappedFile& file) {
+  const auto* ehdr = file.At<Elf64_Ehdr>(0);
+  if (ehdr == nullptr || 0 != memcmp(ehdr->e_ident, ELFMAG, SELFMAG) ||
+      ehdr->e_ident[EI_CLASS] != ELFCLASS64) {
+    return nullptr;
+  }
+  return ehdr;
+}
+
+// Returns the build ID in the notes of @file, as a hex string.
+std::string GetBuildId(const MappedFile& file, const Elf64_Ehdr& ehdr) {
+  const auto* shdrs = file.At<Elf64_Shdr>(ehdr.e_shoff, ehdr.e_shnum);
+  if (shdrs == nullptr) {
+    return "";
+  }
+  for (int i = 0; i < ehdr.e_shnum; ++i) {
+    if (shdrs[i].sh_type != SHT_NOTE) {
+      continue;
+    }
+    uint64_t offset = shdrs[i].sh_offset;
+    const uint64_t end = offset + shdrs[i].sh_size;
+    while (offset + sizeof(Elf64_Nhdr) <= end) {
+      const auto* nhdr = file.At<Elf64_Nhdr>(offset);
+      if (nhdr == nullptr) {
+        break;
+      }
+      const uint64_t name_offset = offset + sizeof(Elf64_Nhdr);
+      const uint64_t desc_offset = name_offset + ((nhdr->n_namesz + 3) & ~3);
+      const auto* name = file.At<char>(name_offset, nhdr->n_namesz);
+      const auto* desc = file.At<unsigned char>(desc_offset, nhdr->n_descsz);
+      if (name != nullptr && desc != nullptr &&
+          nhdr->n_type == NT_GNU_BUILD_ID && nhdr->n_namesz == 4 &&
+          0 == memcmp(name, "GNU", 4)) {
+        std::string build_id;
+        char buf[3];
+        for (uint32_t j = 0; j < nhdr->n_descsz; ++j) {
+          snprintf(buf, sizeof(buf), "%02x", desc[j]);
+          build_id.append(buf);
+        }
+        return build_id;
+      }
+      offset = desc_offset + ((nhdr->n_descsz + 3) & ~3);
+    }
+  }
+  return "";
+}
+
+}  // namespace
+
+bool ReadMappings(pid_t pid, std::vector<Mapping>* mappings,
+                  std::string* error) {
+  mappings->clear();
+  const auto path = "/proc/" + std::to_string(pid) + "/maps";
+  FILE* f = fopen(path.c_str(), "r");
+  if (f == nullptr) {
+    error->assign("Failed to open " + path);
+    return false;
+  }
+  DEFER(fclose(f));
+  std::string maps;
+  char buf[4096];
+  size_t size;
+  while ((size = fread(buf, 1, sizeof(buf), f)) > 0) {
+    maps.append(buf, size);
+  }
+  ParseMappings(maps, mappings);
+  return true;
+}
+
+void ParseMappings(const std::string& maps, std::vector<Mapping>* mappings) {
+  mappings->clear();
+  size_t pos = 0;
+  while (pos < maps.size()) {
+    size_t eol = maps.find('\n', pos);
+    if (eol == std::string::npos) {
+      eol = maps.size();
+    }
+    const std::string line = maps.substr(pos, eol - pos);
+    pos = eol + 1;
+    unsigned long start, end, offset;
+    char perms[8];
+    int path_start = 0;
+    if (4 != sscanf(line.c_str(), "%lx-%lx %7s %lx %*s %*s %n", &start, &end,
+                    perms, &offset, &path_start) ||
+        path_start == 0 || perms[2] != 'x' || line[path_start] != '/') {
+      continue;
+    }
+    mappings->push_back({static_cast<int64_t>(start),
+                         static_cast<int64_t>(end),
+                         static_cast<int64_t>(offset),
+                         line.substr(path_start)});
+  }
+}
+
+const Mapping* FindMapping(const std::vector<Mapping>& mappings,
+                           int64_t addr) {
+  auto it = std::upper_bound(
+      mappings.begin(), mappings.end(), addr,
+      [](int64_t a, const Mapping& m) { return a < m.start; });
+  if (it == mappings.begin()) {
+    return nullptr;
+  }
+  --it;
+  return addr < it->end ? &*it : nullptr;
+}
+
+// static
+std::string ElfSymbols::ReadBuildId(const std::string& path) {
+  MappedFile file;
+  std::string error;
+  if (not file.Open(path, &error)) {
+    return "";
+  }
+  const auto* ehdr = GetElfHeader(file);
+  return ehdr != nullptr ? GetBuildId(file, *ehdr) : "";
+}
+
+// static
+std::unique_ptr<ElfSymbols> ElfSymbols::Load(const std::string& path,
+                                             std::string* error) {
+  MappedFile file;
+  if (not file.Open(path, error)) {
+    return nullptr;
+  }
+  const auto* ehdr = GetElfHeader(file);
+  if (ehdr == nullptr) {
+    error->assign("Not a 64-bit ELF file: " + path);
+    return nullptr;
+  }
+  const auto* phdrs = file.At<Elf64_Phdr>(ehdr->e_phoff, ehdr->e_phnum);
+  const auto* shdrs = file.At<Elf64_Shdr>(ehdr->e_shoff, ehdr->e_shnum);
+  if (phdrs == nullptr || shdrs == nullptr) {
+    error->assign("Truncated ELF file: " + path);
+    return nullptr;
+  }
+  std::unique_ptr<ElfSymbols> symbols(new ElfSymbols());
+  symbols->build_id_ = GetBuildId(file, *ehdr);
+  for (int i = 0; i < ehdr->e_phnum; ++i) {
+    if (phdrs[i].p_type == PT_LOAD) {
+      symbols->segments_.push_back(
+          {static_cast<int64_t>(phdrs[i].p_offset),
+           static_cast<int64_t>(phdrs[i].p_filesz),
+           static_cast<int64_t>(phdrs[i].p_vaddr)});
+    }
+  }
+  // Both the full and the dynamic symbol tables are read, as stripped files
+  // only have the latter. Duplicates are removed below.
+  for (int i = 0; i < ehdr->e_shnum; ++i) {
+    if ((shdrs[i].sh_type != SHT_SYMTAB && shdrs[i].sh_type != SHT_DYNSYM) ||
+        shdrs[i].sh_link >= ehdr->e_shnum) {
+      continue;
+    }
+    const auto& strtab = shdrs[shdrs[i].sh_link];
+    const auto* strings = file.At<char>(strtab.sh_offset, strtab.sh_size);
+    const auto num_syms = shdrs[i].sh_size / sizeof(Elf64_Sym);
+    const auto* syms = file.At<Elf64_Sym>(shdrs[i].sh_offset, num_syms);
+    if (strings == nullptr || syms == nullptr) {
+      continue;
+    }
+    for (uint64_t j = 0; j < num_syms; ++j) {
+      if (ELF64_ST_TYPE(syms[j].st_info) != STT_FUNC ||
+          syms[j].st_value == 0 || syms[j].st_name >= strtab.sh_size) {
+        continue;
+      }
+      const char* name = strings + syms[j].st_name;
+      if (strnlen(name, strtab.sh_size - syms[j].st_name) ==
+          strtab.sh_size - syms[j].st_name) {
+        continue;
+      }
+      symbols->symbols_.push_back(
+          {static_cast<int64_t>(syms[j].st_value),
+           static_cast<int64_t>(syms[j].st_size),
+           static_cast<int64_t>(symbols->names_.size())});
+      int status = 0;
+      char* demangled = abi::__cxa_demangle(name, nullptr, nullptr, &status);
+      symbols->names_.append(status == 0 ? demangled : name);
+      symbols->names_.push_back('\0');
+      free(demangled);
+    }
+  }
+  auto& syms = symbols->symbols_;
+  std::sort(syms.begin(), syms.end(), [](const Symbol& a, const Symbol& b) {
+    return a.vaddr < b.vaddr || (a.vaddr == b.vaddr && a.size > b.size);
+  });
+  syms.erase(std::unique(syms.begin(), syms.end(),
+                         [](const Symbol& a, const Symbol& b) {
+                           return a.vaddr == b.vaddr;
+                         }),
+             syms.end());
+  return symbols;
+}
+
+const char* ElfSymbols::Lookup(int64_t offset) const {
+  int64_t vaddr = -1;
+  for (const auto& segment : segments_) {
+    if (offset >= segment.offset && offset < segment.offset + segment.size) {
+      vaddr = offset - segment.offset + segment.vaddr;
+      break;
+    }
+  }
+  if (vaddr < 0) {
+    return nullptr;
+  }
+  auto it = std::upper_bound(
+      symbols_.begin(), symbols_.end(), vaddr,
+      [](int64_t a, const Symbol& s) { return a < s.vaddr; });
+  if (it == symbols_.begin()) {
+    return nullptr;
+  }
+  --it;
+  // Symbols without a size, e.g. hand-written assembly, are assumed to extend
+  // to the next symbol.
+  if (it->size != 0 && vaddr >= it->vaddr + it->size) {
+    return nullptr;
+  }
+  return names_.data() + it->name;
+}
+
+const ElfSymbols* ElfSymbolCache::Get(const std::string& path) {
+  struct stat st;
+  if (0 != stat(path.c_str(), &st)) {
+    return nullptr;
+  }
+  const auto file_key = std::make_tuple(
+      st.st_dev, st.st_ino, static_cast<int64_t>(st.st_mtime));
+  auto it = by_file_.find(file_key);
+  if (it != by_file_.end()) {
+    return it->second;
+  }
+  auto key = ElfSymbols::ReadBuildId(path);
+  if (key.empty()) {
+    key = path;
+  }
+  const ElfSymbols* result = nullptr;
+  auto& symbols = by_build_id_[key];
+  std::string error;
+  if (symbols == nullptr) {
+    symbols = ElfSymbols::Load(path, &error);
+  }
+  if (symbols != nullptr) {
+    result = symbols.get();
+  } else {
+    std::cerr << "Failed to load symbols: " << error << std::endl;
+    by_build_id_.erase(key);
+  }
+  by_file_[file_key] = result;
+  return result;
+}
+
+std::string ElfSymbolCache::Symbolize(const std::vector<Mapping>& mappings,
+                                       int64_t addr) {
+  char buf[64];
+  const auto* mapping = FindMapping(mappings, addr);
+  if (mapping == nullptr) {
+    snprintf(buf, sizeof(buf), "(unknown) %#lx", addr);
+    return buf;
+  }
+  const int64_t offset = addr - mapping->start + mapping->offset;
+  const auto* symbols = Get(mapping->path);
+  if (symbols != nullptr) {
+    // As with ThreadStack::Symbolize(...), fall back to @addr - 1 in case
+    // @addr is the return address of a call at the end of a function.
+    const char* name = symbols->Lookup(offset);
+    if (name == nullptr) {
+      name = symbols->Lookup(offset - 1);
+    }
+    if (name != nullptr) {
+      return name;
+    }
+  }
+  snprintf(buf, sizeof(buf), "+%#lx", offset);
+  return "(unknown) " + mapping->path + buf;
+}
+
+}  // namespace threadstacks
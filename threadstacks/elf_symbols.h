@@ -0,0 +1,129 @@
+// Copyright: ThoughtSpot Inc 2017
+
+#ifndef THREADSTACKS_ELF_SYMBOLS_H_
+#define THREADSTACKS_ELF_SYMBOLS_H_
+
+#include <sys/types.h>
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <tuple>
+#include <vector>
+
+namespace threadstacks {
+
+// A file mapped into the address space of a process, as listed in
+// /proc/<pid>/maps.
+struct Mapping {
+  // Address range of the mapping, i.e. [start, end).
+  int64_t start;
+  int64_t end;
+  // Offset in the file of the start of the mapping.
+  int64_t offset;
+  std::string path;
+};
+
+// Fills @mappings with the executable file mappings of process @pid, sorted by
+// address. Returns false on failure, in which case @error is filled with a
+// descriptive error message.
+bool ReadMappings(pid_t pid, std::vector<Mapping>* mappings,
+                  std::string* error);
+// Same as above, but parses @maps, the contents of a /proc/<pid>/maps file,
+// e.g. as saved in a crash file.
+void ParseMappings(const std::string& maps, std::vector<Mapping>* mappings);
+
+// Returns the mapping in @mappings (as filled by ReadMappings(...)) that
+// contains @addr, or null if there is none.
+const Mapping* FindMapping(const std::vector<Mapping>& mappings, int64_t addr);
+
+// ElfSymbols holds the function symbols of an ELF file, so that addresses in
+// any process that maps the file can be symbolized without access to that
+// process. Unlike SymbolTable, which symbolizes addresses of the calling
+// process.
+class ElfSymbols {
+ public:
+  // Loads the function symbols of the ELF file at @path. Returns null on
+  // failure, in which case @error is filled with a descriptive error message.
+  static std::unique_ptr<ElfSymbols> Load(const std::string& path,
+                                          std::string* error);
+  // Returns the GNU build ID of the ELF file at @path as a hex string, or an
+  // empty string if it has none or can't be read.
+  static std::string ReadBuildId(const std::string& path);
+
+  ~ElfSymbols() = default;
+
+  // Returns the demangled name of the function at @offset in the file, or
+  // null if there is none.
+  const char* Lookup(int64_t offset) const;
+  // Returns the build ID of the file, as returned by ReadBuildId(...).
+  const std::string& build_id() const { return build_id_; }
+  // Returns the number of function symbols.
+  int size() const { return symbols_.size(); }
+
+ private:
+  // A loadable segment, which maps file offsets to virtual addresses.
+  struct Segment {
+    int64_t offset;
+    int64_t size;
+    int64_t vaddr;
+  };
+  struct Symbol {
+    int64_t vaddr;
+    int64_t size;
+    // Offset of the NUL terminated name in @names_.
+    int64_t name;
+  };
+
+  ElfSymbols() = default;
+
+  std::string build_id_;
+  std::vector<Segment> segments_;
+  // Sorted by virtual address.
+  std::vector<Symbol> symbols_;
+  std::string names_;
+
+  // Disable copy c'tor and assignment operator.
+  ElfSymbols(const ElfSymbols&) = delete;
+  ElfSymbols& operator=(const ElfSymbols&) = delete;
+};
+
+// An ElfSymbolCache loads the symbols of binaries on demand. Binaries are
+// identified by build ID, so that identical binaries (e.g. run by different
+// processes, or from different paths) are loaded once.
+//
+// Note: This class is not thread-safe.
+class ElfSymbolCache {
+ public:
+  ElfSymbolCache() = default;
+  ~ElfSymbolCache() = default;
+
+  // Returns the symbols of the binary at @path, loading them if no binary
+  // with the same build ID was loaded before. Returns null on failure.
+  const ElfSymbols* Get(const std::string& path);
+  // Returns the symbol of @addr in a process with @mappings (as filled by
+  // ReadMappings(...)). If @addr can't be symbolized, returns "(unknown)"
+  // followed by the binary and offset of @addr, if known.
+  std::string Symbolize(const std::vector<Mapping>& mappings, int64_t addr);
+
+  // Returns the number of binaries loaded so far.
+  int num_binaries() const { return by_build_id_.size(); }
+
+ private:
+  // Symbols of loaded binaries, keyed by build ID (or path, for binaries
+  // without one).
+  std::map<std::string, std::unique_ptr<ElfSymbols>> by_build_id_;
+  // Symbols of every file looked up so far, keyed by device, inode and
+  // modification time, so that build IDs are only read once per file. Null if
+  // the symbols couldn't be loaded.
+  std::map<std::tuple<dev_t, ino_t, int64_t>, const ElfSymbols*> by_file_;
+
+  // Disable copy c'tor and assignment operator.
+  ElfSymbolCache(const ElfSymbolCache&) = delete;
+  ElfSymbolCache& operator=(const ElfSymbolCache&) = delete;
+};
+
+}  // namespace threadstacks
+
+#endif  // THREADSTACKS_ELF_SYMBOLS_H_
@@ -0,0 +1,350 @@
+// Copyright: ThoughtSpot Inc 2017
+
+#include "threadstacks/host_aggregator.h"
+
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <sstream>
+
+#include "common/defer.h"
+#include "common/sysutil.h"
+
+namespace threadstacks {
+namespace {
+
+// Prefix of the line of a dump for which collection failed.
+const char kCollectionFailed[] = "StackTrace collection failed: ";
+
+// Fills @addr with the address of the unix domain socket at @path. Returns
+// false if @path is too long.
+bool MakeAddress(const std::string& path, sockaddr_un* addr) {
+  memset(addr, 0, sizeof(*addr));
+  addr->sun_family = AF_UNIX;
+  if (path.empty() || path.size() >= sizeof(addr->sun_path)) {
+    return false;
+  }
+  memcpy(addr->sun_path, path.data(), path.size());
+  return true;
+}
+
+// Parses a line of a raw dump, i.e. comma separated thread ids followed by
+// space separated hex addresses (see StackTraceCollection::ToRawString()).
+// Returns false if @line isn't one.
+bool ParseRawLine(const std::string& line,
+                  std::vector<pid_t>* tids,
+                  std::vector<int64_t>* addrs) {
+  tids->clear();
+  addrs->clear();
+  std::istringstream in(line);
+  std::string token;
+  if (not (in >> token)) {
+    return false;
+  }
+  std::istringstream tid_in(token);
+  std::string tid;
+  while (std::getline(tid_in, tid, ',')) {
+    char* end = nullptr;
+    const auto value = strtol(tid.c_str(), &end, 10);
+    if (end == tid.c_str() || *end != '\0') {
+      return false;
+    }
+    tids->push_back(value);
+  }
+  while (in >> token) {
+    char* end = nullptr;
+    const auto value = strtoull(token.c_str(), &end, 16);
+    if (token.compare(0, 2, "0x") != 0 || *end != '\0') {
+      return false;
+    }
+    addrs->push_back(value);
+  }
+  return not tids->empty();
+}
+
+// Symbolizes the raw dump @dump of process @pid from @mappings using
+// @symbols, and merges its stack traces into @traces. @group_index maps the
+// symbolized frames of every group of @traces to its index.
+void AddDump(pid_t pid,
+             const std::string& dump,
+             const std::vector<Mapping>& mappings,
+             ElfSymbolCache* symbols,
+             std::map<std::vector<std::string>, int>* group_index,
+             HostStackTraces* traces) {
+  std::vector<pid_t> tids;
+  std::vector<int64_t> addrs;
+  std::istringstream in(dump);
+  std::string line;
+  while (std::getline(in, line)) {
+    if (line.compare(0, strlen(kCollectionFailed), kCollectionFailed) == 0) {
+      traces->failed.emplace_back(pid, line.substr(strlen(kCollectionFailed)));
+      return;
+    }
+    if (not ParseRawLine(line, &tids, &addrs)) {
+      continue;
+    }
+    std::vector<std::string> frames;
+    for (const auto addr : addrs) {
+      frames.push_back(symbols->Symbolize(mappings, addr));
+    }
+    auto inserted = group_index->emplace(frames, traces->groups.size());
+    if (inserted.second) {
+      traces->groups.push_back({std::move(frames), {}});
+    }
+    auto& threads = traces->groups[inserted.first->second].threads;
+    for (const auto tid : tids) {
+      threads.push_back({pid, tid});
+    }
+  }
+  traces->collected.push_back(pid);
+}
+
+}  // namespace
+
+std::string HostStackTraces::ToPrettyString() const {
+  std::ostringstream out;
+  out << "Processes: " << collected.size() << " collected, " << failed.size()
+      << " failed" << std::endl;
+  for (const auto& group : groups) {
+    out << std::endl << "Threads: ";
+    for (size_t i = 0; i < group.threads.size(); ++i) {
+      out << (i == 0 ? "" : ", ") << group.threads[i].pid << "/"
+          << group.threads[i].tid;
+    }
+    out << std::endl << "Stack trace:" << std::endl;
+    for (size_t i = 0; i < group.frames.size(); ++i) {
+      out << (i == 0 ? "PC: @ " : "    @ ") << group.frames[i] << std::endl;
+    }
+  }
+  for (const auto& e : failed) {
+    out << std::endl << "Failed: " << e.first << ": " << e.second << std::endl;
+  }
+  return out.str();
+}
+
+// static
+bool HostAggregator::RegisterParticipant(const std::string& socket_path,
+                                         int sink_slot) {
+  sockaddr_un addr;
+  if (not MakeAddress(socket_path, &addr)) {
+    std::cerr << "Invalid stack trace aggregator socket path: " << socket_path
+              << std::endl;
+    return false;
+  }
+  return StackTraceSignal::RegisterExternalSink(
+      sink_slot, [addr](const std::string& dump) {
+        const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0) {
+          std::cerr << "Failed to create socket for stack trace aggregator"
+                    << std::endl;  // errno
+          return;
+        }
+        DEFER(close(fd));
+        if (0 != connect(fd, reinterpret_cast<const sockaddr*>(&addr),
+                         sizeof(addr))) {
+          std::cerr << "Failed to connect to stack trace aggregator at "
+                    << addr.sun_path << std::endl;  // errno
+          return;
+        }
+        size_t written = 0;
+        while (written < dump.size()) {
+          const auto n = send(fd, dump.data() + written, dump.size() - written,
+                              MSG_NOSIGNAL);
+          if (n < 0 && errno == EINTR) {
+            continue;
+          }
+          if (n < 0) {
+            std::cerr << "Failed to send stack traces to aggregator"
+                      << std::endl;  // errno
+            return;
+          }
+          written += n;
+        }
+      });
+}
+
+HostAggregator::HostAggregator(const Options& options) : options_(options) {}
+
+HostAggregator::~HostAggregator() {
+  if (listen_fd_ != -1) {
+    close(listen_fd_);
+    unlink(options_.socket_path.c_str());
+  }
+}
+
+bool HostAggregator::Init(std::string* error) {
+  sockaddr_un addr;
+  if (not MakeAddress(options_.socket_path, &addr)) {
+    error->assign("Invalid socket path: " + options_.socket_path);
+    return false;
+  }
+  const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    error->assign("Failed to create socket");  // errno
+    return false;
+  }
+  NAMED_DEFER(close_fd, close(fd));
+  // Remove the socket of an aggregator that didn't exit cleanly.
+  unlink(options_.socket_path.c_str());
+  if (0 != bind(fd, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) ||
+      0 != listen(fd, SOMAXCONN)) {
+    error->assign("Failed to listen on " + options_.socket_path);  // errno
+    return false;
+  }
+  close_fd.deactivate();
+  listen_fd_ = fd;
+  return true;
+}
+
+bool HostAggregator::Collect(const std::vector<pid_t>& pids,
+                             HostStackTraces* traces,
+                             std::string* error) {
+  *traces = HostStackTraces();
+  if (listen_fd_ == -1) {
+    error->assign("Aggregator not initialized");
+    return false;
+  }
+  const auto deadline = std::chrono::steady_clock::now() +
+                        std::chrono::milliseconds(options_.timeout_ms);
+  const int signum = StackTraceSignal::ExternalSignum();
+  StackTraceSignal::ExternalRequestOptions request;
+  request.format = StackTraceSignal::ExternalRequestOptions::kRaw;
+  request.symbolize = false;
+  request.sink = options_.sink_slot;
+  sigval value;
+  value.sival_int = StackTraceSignal::EncodeExternalRequest(request);
+
+  // Step 1: Signal all the participating processes at once, so that they
+  // collect their stack traces in parallel. Their mappings are read upfront,
+  // as a process may exit before its dump is symbolized.
+  std::map<pid_t, std::vector<Mapping>> pending;
+  for (const auto pid : pids) {
+    std::string mapping_error;
+    if (not common::Sysutil::CatchesSignal(pid, signum)) {
+      traces->failed.emplace_back(
+          pid, "Doesn't catch signal " + std::to_string(signum));
+    } else if (not ReadMappings(pid, &pending[pid], &mapping_error)) {
+      traces->failed.emplace_back(pid, mapping_error);
+      pending.erase(pid);
+    } else if (0 != sigqueue(pid, signum, value)) {
+      traces->failed.emplace_back(pid, "Failed to send signal");  // errno
+      pending.erase(pid);
+    }
+  }
+
+  // Step 2: Receive the dumps, symbolize them, and merge them by stack trace.
+  // The dumps are read from all the connections at once, so that a process
+  // that is slow to send its dump doesn't hold up the others.
+  struct Connection {
+    int fd;
+    pid_t pid;
+    std::string dump;
+  };
+  std::vector<Connection> connections;
+  DEFER(for (const auto& c : connections) close(c.fd); );
+  std::map<std::vector<std::string>, int> group_index;
+  std::vector<struct pollfd> pfds;
+  char buf[4096];
+  while (not pending.empty()) {
+    const auto remaining =
+        std::chrono::duration_cast<std::chrono::milliseconds>(
+            deadline - std::chrono::steady_clock::now()).count();
+    pfds.clear();
+    pfds.push_back({listen_fd_, POLLIN, 0});
+    for (const auto& c : connections) {
+      pfds.push_back({c.fd, POLLIN, 0});
+    }
+    const int ready =
+        poll(pfds.data(), pfds.size(), std::max<int64_t>(remaining, 0));
+    if (ready < 0 && errno == EINTR) {
+      continue;
+    }
+    if (ready <= 0) {
+      break;
+    }
+    // Read from the connections before accepting new ones, which shifts
+    // them in @pfds. In reverse, so that finished ones can be erased.
+    for (size_t i = connections.size(); i-- > 0;) {
+      if (pfds[i + 1].revents == 0) {
+        continue;
+      }
+      auto& c = connections[i];
+      const auto n = read(c.fd, buf, sizeof(buf));
+      if (n < 0 && (errno == EINTR || errno == EAGAIN)) {
+        continue;
+      }
+      if (n > 0) {
+        c.dump.append(buf, n);
+        continue;
+      }
+      // The dump is complete, or the connection failed.
+      auto it = pending.find(c.pid);
+      if (n == 0) {
+        AddDump(c.pid, c.dump, it->second, &symbols_, &group_index, traces);
+      } else {
+        traces->failed.emplace_back(c.pid, "Failed to read dump");  // errno
+      }
+      pending.erase(it);
+      close(c.fd);
+      connections.erase(connections.begin() + i);
+    }
+    if (not (pfds[0].revents & POLLIN)) {
+      continue;
+    }
+    const int fd =
+        accept4(listen_fd_, nullptr, nullptr, SOCK_CLOEXEC | SOCK_NONBLOCK);
+    if (fd < 0) {
+      continue;
+    }
+    NAMED_DEFER(close_fd, close(fd));
+    struct ucred cred;
+    socklen_t len = sizeof(cred);
+    if (0 != getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len)) {
+      continue;
+    }
+    // Ignore dumps that weren't asked for, e.g. late ones from a previous
+    // collection, and more than one connection per process.
+    if (pending.count(cred.pid) == 0 ||
+        std::any_of(connections.begin(), connections.end(),
+                    [&](const Connection& c) { return c.pid == cred.pid; })) {
+      continue;
+    }
+    close_fd.deactivate();
+    connections.push_back({fd, cred.pid, std::string()});
+  }
+  for (const auto& e : pending) {
+    traces->failed.emplace_back(e.first, "Timed out");
+  }
+  // Dumps arrive in no particular order, so sort for a stable output.
+  for (auto& group : traces->groups) {
+    std::sort(group.threads.begin(), group.threads.end(),
+              [](const HostStackTraces::Thread& a,
+                 const HostStackTraces::Thread& b) {
+                return a.pid < b.pid || (a.pid == b.pid && a.tid < b.tid);
+              });
+  }
+  std::sort(traces->collected.begin(), traces->collected.end());
+  std::stable_sort(traces->groups.begin(), traces->groups.end(),
+                   [](const HostStackTraces::Group& a,
+                      const HostStackTraces::Group& b) {
+                     return a.threads.size() > b.threads.size();
+                   });
+  if (traces->collected.empty()) {
+    error->assign("No process responded");
+    return false;
+  }
+  return true;
+}
+
+}  // namespace threadstacks
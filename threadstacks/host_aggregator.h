@@ -0,0 +1,107 @@
+// Copyright: ThoughtSpot Inc 2017
+
+#ifndef THREADSTACKS_HOST_AGGREGATOR_H_
+#define THREADSTACKS_HOST_AGGREGATOR_H_
+
+#include <sys/types.h>
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "threadstacks/elf_symbols.h"
+#include "threadstacks/signal_handler.h"
+
+namespace threadstacks {
+
+// Stack traces of the threads of a number of processes, merged across the
+// processes: threads with the same symbolized stack trace are grouped
+// together, no matter which process they belong to.
+struct HostStackTraces {
+  struct Thread {
+    pid_t pid;
+    pid_t tid;
+  };
+  struct Group {
+    // Symbolized frames, from the innermost to the outermost.
+    std::vector<std::string> frames;
+    // Sorted by pid, and then tid.
+    std::vector<Thread> threads;
+  };
+
+  // Sorted by decreasing number of threads.
+  std::vector<Group> groups;
+  // Processes whose stack traces were collected, sorted.
+  std::vector<pid_t> collected;
+  // Processes whose stack traces couldn't be collected, with the reason.
+  std::vector<std::pair<pid_t, std::string>> failed;
+
+  // Returns a human readable version of the stack traces.
+  std::string ToPrettyString() const;
+};
+
+// A HostAggregator collects the stack traces of cooperating processes on the
+// same host in one go, e.g. to diagnose a hang of a tree of processes.
+//
+// Participating processes install the external stacktrace collection signal
+// handler and call RegisterParticipant(...). The aggregator then sends each of
+// them the external signal in parallel, asking for a raw, unsymbolized dump
+// sent to a unix domain socket it listens on. Frames are symbolized by the
+// aggregator from the binaries mapped by each process. Binaries are
+// identified by build ID, so that their symbols are loaded once and shared by
+// all the processes that run identical binaries, across collections.
+//
+// Note: This class is not thread-safe.
+class HostAggregator {
+ public:
+  struct Options {
+    // Path of the unix domain socket participants send their dumps to.
+    std::string socket_path;
+    // External request sink slot that participants register the socket in.
+    int sink_slot = StackTraceSignal::kNumExternalRequestSlots - 2;
+    // Time to wait for all processes to respond, in milliseconds.
+    int64_t timeout_ms = 5000;
+  };
+
+  // Registers a sink in @sink_slot of the calling process, which sends dumps
+  // to the aggregator listening on @socket_path. Returns false on failure.
+  static bool RegisterParticipant(
+      const std::string& socket_path,
+      int sink_slot = StackTraceSignal::kNumExternalRequestSlots - 2);
+
+  explicit HostAggregator(const Options& options);
+  // Stops listening on the socket, if listening.
+  ~HostAggregator();
+
+  // Starts listening on the socket. Must be called before Collect(...).
+  // Returns false on failure, in which case @error is filled with a
+  // descriptive error message.
+  bool Init(std::string* error);
+
+  // Collects the stack traces of all the threads of processes @pids into
+  // @traces. Processes which don't catch the external signal are never sent
+  // it, and are reported as failed along with processes that didn't respond
+  // in time. Returns false if none of the processes responded, in which case
+  // @error is filled with a descriptive error message.
+  bool Collect(const std::vector<pid_t>& pids,
+               HostStackTraces* traces,
+               std::string* error);
+
+  // Returns the number of binaries whose symbols were loaded so far.
+  int num_binaries() const { return symbols_.num_binaries(); }
+
+ private:
+  const Options options_;
+  int listen_fd_ = -1;
+  // Shared by all the processes, across collections.
+  ElfSymbolCache symbols_;
+
+  // Disable copy c'tor and assignment operator.
+  HostAggregator(const HostAggregator&) = delete;
+  HostAggregator& operator=(const HostAggregator&) = delete;
+};
+
+}  // namespace threadstacks
+
+#endif  // THREADSTACKS_HOST_AGGREGATOR_H_
@@ -0,0 +1,312 @@
+// Copyright: ThoughtSpot Inc 2017
+
+#include "threadstacks/host_aggregator.h"
+
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "common/defer.h"
+#include "common/sysutil.h"
+#include "gtest/gtest.h"
+#include "threadstacks/elf_symbols.h"
+#include "threadstacks/signal_handler.h"
+
+namespace threadstacks {
+namespace {
+
+// Flags that make the test binary run as a participant process, as one that
+// never finishes sending its dump, or as one whose dump is much larger than
+// the socket buffer.
+const char kParticipantFlag[] = "--participant";
+const char kStalledParticipantFlag[] = "--stalled-participant";
+const char kLargeParticipantFlag[] = "--large-participant";
+
+// Blocks until @fd is closed. Participants wait here, so that the aggregator
+// finds this function in all their stack traces.
+__attribute__((noinline)) void ParticipantIdle(int fd) {
+  char c;
+  while (read(fd, &c, 1) > 0 || errno == EINTR) {
+  }
+}
+
+// Runs a participant that sends its dumps to @socket_path, until stdin is
+// closed.
+int RunParticipant(const std::string& socket_path) {
+  if (not StackTraceSignal::InstallInternalHandler() ||
+      not StackTraceSignal::InstallExternalHandler() ||
+      not HostAggregator::RegisterParticipant(socket_path)) {
+    return 1;
+  }
+  ParticipantIdle(STDIN_FILENO);
+  return 0;
+}
+
+// Returns a socket connected to the aggregator listening on @socket_path, or
+// -1 on failure.
+int Connect(const std::string& socket_path) {
+  sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, socket_path.c_str(), sizeof(addr.sun_path) - 1);
+  const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd >= 0 &&
+      0 != connect(fd, reinterpret_cast<const sockaddr*>(&addr),
+                   sizeof(addr))) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+// Runs a participant that connects to the aggregator listening on
+// @socket_path right away, and holds the connection open without sending
+// anything until stdin is closed, like a participant that stalls while
+// sending its dump. Its connection is the first one the aggregator accepts.
+int RunStalledParticipant(const std::string& socket_path) {
+  const int fd = Connect(socket_path);
+  if (fd < 0 || not StackTraceSignal::InstallInternalHandler() ||
+      not StackTraceSignal::InstallExternalHandler() ||
+      not StackTraceSignal::RegisterExternalSink(
+          StackTraceSignal::kNumExternalRequestSlots - 2,
+          [](const std::string&) {})) {
+    return 1;
+  }
+  ParticipantIdle(STDIN_FILENO);
+  close(fd);
+  return 0;
+}
+
+// Runs a participant like RunParticipant(...), but which pads its dumps with
+// empty lines to several MB, so that sending them takes the aggregator
+// reading along.
+int RunLargeParticipant(const std::string& socket_path) {
+  if (not StackTraceSignal::InstallInternalHandler() ||
+      not StackTraceSignal::InstallExternalHandler() ||
+      not StackTraceSignal::RegisterExternalSink(
+          StackTraceSignal::kNumExternalRequestSlots - 2,
+          [socket_path](const std::string& dump) {
+            const int fd = Connect(socket_path);
+            const auto data = dump + std::string(8 << 20, '\n');
+            for (size_t sent = 0; fd >= 0 && sent < data.size();) {
+              const auto n = send(fd, data.data() + sent, data.size() - sent,
+                                  MSG_NOSIGNAL);
+              if (n < 0 && errno != EINTR) {
+                break;
+              }
+              sent += std::max<ssize_t>(n, 0);
+            }
+            close(fd);
+          })) {
+    return 1;
+  }
+  ParticipantIdle(STDIN_FILENO);
+  return 0;
+}
+
+class HostAggregatorTest : public ::testing::Test {
+ public:
+  void SetUp() override {
+    socket_path_ =
+        "/tmp/host_aggregator_test." + std::to_string(getpid()) + ".sock";
+  }
+
+  void TearDown() override {
+    for (const auto& p : participants_) {
+      close(p.second);
+      waitpid(p.first, nullptr, 0);
+    }
+  }
+
+  // Starts a participant process, run with @flag, and waits for it to
+  // install the external signal handler.
+  pid_t StartParticipant(const char* flag = kParticipantFlag) {
+    int stdin_pipe[2];
+    // Close-on-exec, so that other participants don't inherit the pipe.
+    EXPECT_EQ(0, pipe2(stdin_pipe, O_CLOEXEC));
+    const pid_t pid = fork();
+    if (pid == 0) {
+      if (stdin_pipe[0] != STDIN_FILENO) {
+        dup2(stdin_pipe[0], STDIN_FILENO);
+        close(stdin_pipe[0]);
+      }
+      execl("/proc/self/exe", "host_aggregator_test", flag,
+            socket_path_.c_str(), nullptr);
+      _exit(1);
+    }
+    close(stdin_pipe[0]);
+    participants_.emplace_back(pid, stdin_pipe[1]);
+    while (not common::Sysutil::CatchesSignal(
+        pid, StackTraceSignal::ExternalSignum())) {
+      usleep(1000);
+    }
+    // Give the participant a moment to register its sink.
+    usleep(100000);
+    return pid;
+  }
+
+ protected:
+  std::string socket_path_;
+  // Pids of the participants, and the write ends of their stdin.
+  std::vector<std::pair<pid_t, int>> participants_;
+};
+
+TEST(ElfSymbolsTest, LookupSelf) {
+  std::vector<Mapping> mappings;
+  std::string error;
+  ASSERT_TRUE(ReadMappings(getpid(), &mappings, &error)) << error;
+  const auto addr = reinterpret_cast<int64_t>(&ParticipantIdle);
+  const auto* mapping = FindMapping(mappings, addr);
+  ASSERT_NE(nullptr, mapping);
+  auto symbols = ElfSymbols::Load(mapping->path, &error);
+  ASSERT_NE(nullptr, symbols) << error;
+  EXPECT_LT(0, symbols->size());
+  EXPECT_EQ(ElfSymbols::ReadBuildId(mapping->path), symbols->build_id());
+  const char* name = symbols->Lookup(addr - mapping->start + mapping->offset);
+  ASSERT_NE(nullptr, name);
+  EXPECT_NE(nullptr, strstr(name, "ParticipantIdle")) << name;
+  EXPECT_EQ(nullptr, FindMapping(mappings, 0));
+}
+
+TEST(SysutilTest, ListProcessTree) {
+  const pid_t child = fork();
+  if (child == 0) {
+    pause();
+    _exit(0);
+  }
+  DEFER(kill(child, SIGKILL); waitpid(child, nullptr, 0););
+  const auto tree = common::Sysutil::ListProcessTree(getpid());
+  ASSERT_LE(2, tree.size());
+  EXPECT_EQ(getpid(), tree[0]);
+  EXPECT_NE(tree.end(), std::find(tree.begin(), tree.end(), child));
+  EXPECT_FALSE(common::Sysutil::CatchesSignal(
+      child, StackTraceSignal::ExternalSignum()));
+}
+
+TEST_F(HostAggregatorTest, Collect) {
+  HostAggregator::Options options;
+  options.socket_path = socket_path_;
+  HostAggregator aggregator(options);
+  std::string error;
+  ASSERT_TRUE(aggregator.Init(&error)) << error;
+
+  const int kNumParticipants = 3;
+  std::vector<pid_t> pids;
+  for (int i = 0; i < kNumParticipants; ++i) {
+    pids.push_back(StartParticipant());
+  }
+
+  // Collect from one participant first, so that all the binaries are loaded.
+  HostStackTraces traces;
+  ASSERT_TRUE(aggregator.Collect({pids[0]}, &traces, &error)) << error;
+  EXPECT_EQ(1, traces.collected.size());
+  const int num_binaries = aggregator.num_binaries();
+  EXPECT_LT(0, num_binaries);
+
+  // The test process itself doesn't catch the signal, so it's never sent it.
+  auto all = pids;
+  all.push_back(getpid());
+  // Returns the groups of the stack traces of @traces with ParticipantIdle.
+  auto idle_groups = [](const HostStackTraces& traces) {
+    std::vector<const HostStackTraces::Group*> groups;
+    for (const auto& group : traces.groups) {
+      for (const auto& frame : group.frames) {
+        if (frame.find("ParticipantIdle") != std::string::npos) {
+          groups.push_back(&group);
+          break;
+        }
+      }
+    }
+    return groups;
+  };
+  // The main thread of a participant may still be returning from the
+  // handler of the signal that asked for its dump when its stack trace is
+  // taken, in which case the handler frames are on top of ParticipantIdle.
+  // Collect until none of them is caught there.
+  for (int attempt = 0; attempt < 10; ++attempt) {
+    ASSERT_TRUE(aggregator.Collect(all, &traces, &error)) << error;
+    if (idle_groups(traces).size() == 1) {
+      break;
+    }
+  }
+  EXPECT_EQ(kNumParticipants, traces.collected.size());
+  ASSERT_EQ(1, traces.failed.size());
+  EXPECT_EQ(getpid(), traces.failed[0].first);
+  // Identical binaries are only loaded once.
+  EXPECT_EQ(num_binaries, aggregator.num_binaries());
+
+  // The main threads of all the participants share a stack trace.
+  const auto idle = idle_groups(traces);
+  ASSERT_EQ(1, idle.size()) << traces.ToPrettyString();
+  ASSERT_EQ(kNumParticipants, idle[0]->threads.size())
+      << traces.ToPrettyString();
+  std::sort(pids.begin(), pids.end());
+  for (int i = 0; i < kNumParticipants; ++i) {
+    EXPECT_EQ(pids[i], idle[0]->threads[i].pid);
+    EXPECT_EQ(pids[i], idle[0]->threads[i].tid);
+  }
+}
+
+// A participant that never finishes sending its dump must not keep the
+// aggregator from receiving the dumps of the others.
+TEST_F(HostAggregatorTest, StalledParticipant) {
+  HostAggregator::Options options;
+  options.socket_path = socket_path_;
+  options.timeout_ms = 2000;
+  HostAggregator aggregator(options);
+  std::string error;
+  ASSERT_TRUE(aggregator.Init(&error)) << error;
+
+  const pid_t stalled = StartParticipant(kStalledParticipantFlag);
+  std::vector<pid_t> pids = {StartParticipant(),
+                             StartParticipant(kLargeParticipantFlag)};
+  std::sort(pids.begin(), pids.end());
+  HostStackTraces traces;
+  ASSERT_TRUE(aggregator.Collect({stalled, pids[0], pids[1]}, &traces,
+                                 &error))
+      << error;
+  EXPECT_EQ(pids, traces.collected) << traces.ToPrettyString();
+  ASSERT_EQ(1, traces.failed.size()) << traces.ToPrettyString();
+  EXPECT_EQ(stalled, traces.failed[0].first);
+  EXPECT_EQ("Timed out", traces.failed[0].second);
+}
+
+TEST_F(HostAggregatorTest, NoParticipants) {
+  HostAggregator::Options options;
+  options.socket_path = socket_path_;
+  options.timeout_ms = 100;
+  HostAggregator aggregator(options);
+  std::string error;
+  HostStackTraces traces;
+  EXPECT_FALSE(aggregator.Collect({getpid()}, &traces, &error));
+  ASSERT_TRUE(aggregator.Init(&error)) << error;
+  EXPECT_FALSE(aggregator.Collect({getpid()}, &traces, &error));
+  EXPECT_EQ(1, traces.failed.size());
+}
+
+}  // namespace
+}  // namespace threadstacks
+
+int main(int argc, char** argv) {
+  if (argc == 3 && 0 == strcmp(argv[1], threadstacks::kParticipantFlag)) {
+    return threadstacks::RunParticipant(argv[2]);
+  }
+  if (argc == 3 &&
+      0 == strcmp(argv[1], threadstacks::kStalledParticipantFlag)) {
+    return threadstacks::RunStalledParticipant(argv[2]);
+  }
+  if (argc == 3 && 0 == strcmp(argv[1], threadstacks::kLargeParticipantFlag)) {
+    return threadstacks::RunLargeParticipant(argv[2]);
+  }
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,44 @@
+// Copyright: ThoughtSpot Inc 2017
+
+// Prints the merged stack traces of a tree of cooperating processes, e.g. all
+// the processes of a service on this host. The processes must participate,
+// see HostAggregator::RegisterParticipant(...), with the same socket path.
+// Processes in the tree that don't catch the external signal are skipped.
+//
+// Usage: host_stacks <socket_path> <root_pid> [timeout_ms]
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+#include "common/sysutil.h"
+#include "threadstacks/host_aggregator.h"
+
+int main(int argc, char** argv) {
+  if (argc < 3) {
+    fprintf(stderr, "Usage: %s <socket_path> <root_pid> [timeout_ms]\n",
+            argv[0]);
+    return 1;
+  }
+  threadstacks::HostAggregator::Options options;
+  options.socket_path = argv[1];
+  if (argc > 3) {
+    options.timeout_ms = atol(argv[3]);
+  }
+  const auto pids =
+      threadstacks::common::Sysutil::ListProcessTree(atoi(argv[2]));
+  if (pids.empty()) {
+    fprintf(stderr, "No such process: %s\n", argv[2]);
+    return 1;
+  }
+  threadstacks::HostAggregator aggregator(options);
+  threadstacks::HostStackTraces traces;
+  std::string error;
+  if (not aggregator.Init(&error) ||
+      not aggregator.Collect(pids, &traces, &error)) {
+    fprintf(stderr, "%s\n", error.c_str());
+    return 1;
+  }
+  printf("%s", traces.ToPrettyString().c_str());
+  return 0;
+}
@@ -0,0 +1,123 @@
+// Copyright: ThoughtSpot Inc 2017
+
+#include "threadstacks/off_cpu.h"
+
+#include <algorithm>
+
+namespace threadstacks {
+
+void OffCpuProfile::Add(pid_t tid, int64_t time_ns, StackId stack,
+                        const common::Sysutil::SchedStats& stats) {
+  std::lock_guard<std::mutex> l(m_);
+  AddLocked(tid, time_ns, stack, stats);
+}
+
+void OffCpuProfile::AddLocked(pid_t tid, int64_t time_ns, StackId stack,
+                              const common::Sysutil::SchedStats& stats) {
+  auto inserted = threads_.emplace(tid, ThreadSample{time_ns, stats,
+                                                     num_rounds_});
+  if (inserted.second) {
+    return;
+  }
+  auto& previous = inserted.first->second;
+  const int64_t wall_ns = time_ns - previous.time_ns;
+  const int64_t run_ns = stats.run_ns - previous.stats.run_ns;
+  const int64_t wait_ns = stats.wait_ns - previous.stats.wait_ns;
+  const int64_t switches =
+      stats.voluntary_switches - previous.stats.voluntary_switches;
+  previous = ThreadSample{time_ns, stats, num_rounds_};
+  if (wall_ns <= 0 || run_ns < 0 || wait_ns < 0 || switches < 0) {
+    // A tid reused by a new thread.
+    return;
+  }
+  if (stack >= totals_.size()) {
+    totals_.resize(stack + 1);
+  }
+  auto& totals = totals_[stack];
+  totals.wait_ns += std::min(wait_ns, wall_ns);
+  if (switches > 0) {
+    totals.off_cpu_ns += std::max<int64_t>(wall_ns - run_ns - wait_ns, 0);
+    totals.num_switches += switches;
+  }
+  ++totals.num_intervals;
+  ++num_intervals_;
+}
+
+void OffCpuProfile::OnSamples(int64_t time_ns,
+                              const StackTable& stacks,
+                              const Sampler::Sample* samples,
+                              int num_samples) {
+  std::lock_guard<std::mutex> l(m_);
+  if (num_rounds_ == 0) {
+    start_ns_ = time_ns;
+  }
+  end_ns_ = time_ns;
+  ++num_rounds_;
+  common::Sysutil::SchedStats stats;
+  for (int i = 0; i < num_samples; ++i) {
+    if (common::Sysutil::GetThreadSchedStats(samples[i].tid, &stats)) {
+      AddLocked(samples[i].tid, time_ns, samples[i].stack, stats);
+    }
+  }
+  for (auto it = threads_.begin(); it != threads_.end();) {
+    if (it->second.round != num_rounds_) {
+      it = threads_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+auto OffCpuProfile::Top(int n) const -> std::vector<Entry> {
+  std::vector<Entry> entries;
+  {
+    std::lock_guard<std::mutex> l(m_);
+    for (StackId id = 0; id < totals_.size(); ++id) {
+      const auto& totals = totals_[id];
+      if (totals.off_cpu_ns > 0) {
+        entries.push_back(
+            {id, totals.off_cpu_ns, totals.wait_ns, totals.num_switches});
+      }
+    }
+  }
+  n = std::min<int>(std::max(n, 0), entries.size());
+  std::partial_sort(entries.begin(), entries.begin() + n, entries.end(),
+                    [](const Entry& a, const Entry& b) {
+                      return a.off_cpu_ns > b.off_cpu_ns ||
+                             (a.off_cpu_ns == b.off_cpu_ns &&
+                              a.stack < b.stack);
+                    });
+  entries.resize(n);
+  return entries;
+}
+
+Sampler::Profile OffCpuProfile::GetProfile(
+    std::shared_ptr<const StackTable> stacks) const {
+  Sampler::Profile profile;
+  profile.stacks = std::move(stacks);
+  std::lock_guard<std::mutex> l(m_);
+  profile.num_rounds = num_rounds_;
+  profile.start_ns = start_ns_;
+  profile.end_ns = end_ns_;
+  profile.num_samples = num_intervals_;
+  profile.counts.resize(totals_.size());
+  std::vector<int64_t> intervals(totals_.size());
+  for (size_t id = 0; id < totals_.size(); ++id) {
+    profile.counts[id] = totals_[id].off_cpu_ns;
+    intervals[id] = totals_[id].num_intervals;
+  }
+  profile.DropUnknownStacks(&intervals);
+  return profile;
+}
+
+void OffCpuProfile::Reset() {
+  std::lock_guard<std::mutex> l(m_);
+  totals_.clear();
+  threads_.clear();
+  num_rounds_ = 0;
+  start_ns_ = 0;
+  end_ns_ = 0;
+  num_intervals_ = 0;
+}
+
+}  // namespace threadstacks
@@ -0,0 +1,119 @@
+// Copyright: ThoughtSpot Inc 2017
+
+#ifndef THREADSTACKS_OFF_CPU_H_
+#define THREADSTACKS_OFF_CPU_H_
+
+#include <sys/types.h>
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "common/sysutil.h"
+#include "threadstacks/sampler.h"
+#include "threadstacks/stack_table.h"
+
+namespace threadstacks {
+
+// An OffCpuProfile charges the time threads spend blocked, e.g. on locks or
+// IO, to the stack traces they block in. The profile of a Sampler counts
+// samples, so it shows the most common waits; this one shows the waits that
+// cost the most latency.
+//
+// Successive samples of every thread are combined with the scheduler
+// statistics of the thread (see common::Sysutil::GetThreadSchedStats(...)):
+// of the wall time between two samples, the time the thread neither ran nor
+// waited for a CPU is off-CPU time, and is charged to the stack trace of the
+// later sample, i.e. where the thread sat when it was sampled. The time it
+// waited for a CPU (scheduling latency) is charged separately. A thread that
+// didn't block in between, i.e. had no voluntary context switch, is taken to
+// have been on the CPU all along, so that measurement noise isn't charged.
+//
+// Note that the sampling signal wakes up blocked threads, so a thread that
+// stays blocked shows a voluntary context switch per sample, and the time its
+// signal handler runs isn't off-CPU time.
+//
+// Note: This class is thread-safe.
+class OffCpuProfile : public Sampler::Listener {
+ public:
+  // Totals of a stack trace.
+  struct Entry {
+    StackId stack;
+    // Time threads spent blocked, and waiting for a CPU, in nanoseconds.
+    int64_t off_cpu_ns;
+    int64_t wait_ns;
+    // Number of times threads blocked.
+    int64_t num_switches;
+  };
+
+  OffCpuProfile() = default;
+  ~OffCpuProfile() override = default;
+
+  // Adds a sample of stack trace @stack of thread @tid, taken at @time_ns
+  // (wall time in nanoseconds since the epoch) with the scheduler statistics
+  // @stats of the thread. The time since the previous sample of the thread,
+  // if any, is charged to @stack. Samples of a thread must be added in time
+  // order.
+  void Add(pid_t tid, int64_t time_ns, StackId stack,
+           const common::Sysutil::SchedStats& stats);
+
+  // Sampler::Listener implementation. Reads the scheduler statistics of every
+  // sampled thread.
+  void OnSamples(int64_t time_ns,
+                 const StackTable& stacks,
+                 const Sampler::Sample* samples,
+                 int num_samples) override;
+
+  // Returns the @n stack traces with the most off-CPU time, in decreasing
+  // order of off-CPU time.
+  std::vector<Entry> Top(int n) const;
+  // Returns the off-CPU time of every stack trace as a profile, i.e. where
+  // counts are nanoseconds rather than samples, e.g. to render an off-CPU
+  // flame graph with Sampler::Profile::ToFoldedString(...). @stacks must hold
+  // the stack traces of the samples, e.g. as the profile of the sampler does.
+  Sampler::Profile GetProfile(std::shared_ptr<const StackTable> stacks) const;
+  // Drops all the totals, and the previous samples of the threads.
+  void Reset();
+
+ private:
+  struct Totals {
+    int64_t off_cpu_ns = 0;
+    int64_t wait_ns = 0;
+    int64_t num_switches = 0;
+    // Number of intervals charged to the stack trace.
+    int64_t num_intervals = 0;
+  };
+  // The previous sample of a thread.
+  struct ThreadSample {
+    int64_t time_ns;
+    common::Sysutil::SchedStats stats;
+    // Round of the sample, to forget the threads that exited.
+    int64_t round;
+  };
+
+  // Same as Add(...), but must be called with @m_ held.
+  void AddLocked(pid_t tid, int64_t time_ns, StackId stack,
+                 const common::Sysutil::SchedStats& stats);
+
+  mutable std::mutex m_;
+  // Indexed by StackId.
+  std::vector<Totals> totals_;
+  std::unordered_map<pid_t, ThreadSample> threads_;
+  // Number of rounds seen by OnSamples(...), and the wall time of the first
+  // and the last one.
+  int64_t num_rounds_ = 0;
+  int64_t start_ns_ = 0;
+  int64_t end_ns_ = 0;
+  // Number of intervals charged.
+  int64_t num_intervals_ = 0;
+
+  // Disable copy c'tor and assignment operator.
+  OffCpuProfile(const OffCpuProfile&) = delete;
+  OffCpuProfile& operator=(const OffCpuProfile&) = delete;
+};
+
+}  // namespace threadstacks
+
+#endif  // THREADSTACKS_OFF_CPU_H_
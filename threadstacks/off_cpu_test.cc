@@ -0,0 +1,152 @@
+// Copyright: ThoughtSpot Inc 2017
+
+#include "threadstacks/off_cpu.h"
+
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <thread>
+
+#include "gtest/gtest.h"
+#include "threadstacks/signal_handler.h"
+
+namespace threadstacks {
+namespace {
+
+const int64_t kMsNs = 1000 * 1000;
+
+common::Sysutil::SchedStats Stats(int64_t run_ms, int64_t wait_ms,
+                                  int64_t voluntary_switches) {
+  common::Sysutil::SchedStats stats;
+  stats.run_ns = run_ms * kMsNs;
+  stats.wait_ns = wait_ms * kMsNs;
+  stats.voluntary_switches = voluntary_switches;
+  return stats;
+}
+
+TEST(OffCpuProfileTest, Add) {
+  OffCpuProfile profile;
+  // Thread 1 blocks in stack trace 0, thread 2 keeps running in stack trace
+  // 1, but gets preempted.
+  profile.Add(1, 0, 0, Stats(0, 0, 0));
+  profile.Add(2, 0, 1, Stats(0, 0, 0));
+  profile.Add(1, 100 * kMsNs, 0, Stats(10, 5, 3));
+  profile.Add(2, 100 * kMsNs, 1, Stats(90, 10, 0));
+  profile.Add(1, 200 * kMsNs, 0, Stats(10, 5, 4));
+  // A new thread with the tid of thread 2.
+  profile.Add(2, 200 * kMsNs, 1, Stats(1, 0, 0));
+
+  const auto top = profile.Top(10);
+  ASSERT_EQ(1, top.size());
+  EXPECT_EQ(0, top[0].stack);
+  EXPECT_EQ(185 * kMsNs, top[0].off_cpu_ns);
+  EXPECT_EQ(5 * kMsNs, top[0].wait_ns);
+  EXPECT_EQ(4, top[0].num_switches);
+  EXPECT_TRUE(profile.Top(0).empty());
+
+  StackTable table;
+  const int64_t a[] = {1, 2};
+  const int64_t b[] = {3};
+  table.Intern(a, 2);
+  table.Intern(b, 1);
+  const auto off_cpu =
+      profile.GetProfile(std::make_shared<const StackTable>(table));
+  ASSERT_EQ(2, off_cpu.counts.size());
+  EXPECT_EQ(185 * kMsNs, off_cpu.counts[0]);
+  EXPECT_EQ(0, off_cpu.counts[1]);
+  EXPECT_EQ(3, off_cpu.num_samples);
+  EXPECT_EQ("0x2;0x1 185000000\n", off_cpu.ToFoldedString(nullptr));
+
+  // A table taken before stack trace 1 was interned.
+  StackTable old_table;
+  old_table.Intern(a, 2);
+  const auto old_off_cpu =
+      profile.GetProfile(std::make_shared<const StackTable>(old_table));
+  ASSERT_EQ(1, old_off_cpu.counts.size());
+  EXPECT_EQ(185 * kMsNs, old_off_cpu.counts[0]);
+  EXPECT_EQ(2, old_off_cpu.num_samples);
+
+  profile.Reset();
+  EXPECT_TRUE(profile.Top(10).empty());
+}
+
+// Records the stack trace of a thread in the last round.
+class StackOf : public Sampler::Listener {
+ public:
+  explicit StackOf(pid_t tid) : tid_(tid) {}
+  void OnSamples(int64_t time_ns,
+                 const StackTable& stacks,
+                 const Sampler::Sample* samples,
+                 int num_samples) override {
+    for (int i = 0; i < num_samples; ++i) {
+      if (samples[i].tid == tid_) {
+        stack = samples[i].stack;
+      }
+    }
+  }
+
+  StackId stack = 0;
+
+ private:
+  const pid_t tid_;
+};
+
+TEST(OffCpuProfileTest, Sampler) {
+  int fds[2];
+  ASSERT_EQ(0, pipe(fds));
+  std::atomic<pid_t> blocked_tid{0};
+  std::thread blocked([&]() {
+    blocked_tid = syscall(SYS_gettid);
+    char c;
+    while (read(fds[0], &c, 1) < 0 && errno == EINTR) {
+    }
+  });
+  while (blocked_tid == 0) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  // Give the thread a moment to block in read().
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+  Sampler sampler{Sampler::Options()};
+  OffCpuProfile profile;
+  StackOf stack_of(blocked_tid);
+  sampler.AddListener(&profile);
+  sampler.AddListener(&stack_of);
+  std::string error;
+  const int kNumRounds = 5;
+  for (int i = 0; i < kNumRounds; ++i) {
+    if (i > 0) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+    ASSERT_TRUE(sampler.SampleOnce(&error)) << error;
+  }
+  close(fds[1]);
+  blocked.join();
+  close(fds[0]);
+
+  const auto off_cpu = profile.GetProfile(sampler.GetProfile().stacks);
+  EXPECT_EQ(kNumRounds, off_cpu.num_rounds);
+  ASSERT_LT(stack_of.stack, off_cpu.counts.size());
+  // The thread was blocked for about 4 intervals of 50ms.
+  EXPECT_LE(100 * kMsNs, off_cpu.counts[stack_of.stack]);
+  EXPECT_GE((kNumRounds - 1) * 100 * kMsNs, off_cpu.counts[stack_of.stack]);
+  bool found = false;
+  for (const auto& entry : profile.Top(10)) {
+    found |= entry.stack == stack_of.stack;
+  }
+  EXPECT_TRUE(found);
+}
+
+}  // namespace
+}  // namespace threadstacks
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  if (not threadstacks::StackTraceSignal::InstallInternalHandler()) {
+    return 1;
+  }
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,199 @@
+// Copyright: ThoughtSpot Inc 2017
+//
+// A shared library that installs the stacktrace collection signal handlers in
+// any process it is preloaded into, e.g.
+//
+//   LD_PRELOAD=libthreadstacks_preload.so <program>
+//   kill -s RTMIN+1 <pid>
+//
+// It is configured through the following environment variables, all of which
+// are optional:
+//
+//   THREADSTACKS_DISABLE=1          Don't install anything.
+//   THREADSTACKS_INTERNAL_SIGNAL=n  Signal numbers to use instead of SIGRTMIN
+//   THREADSTACKS_EXTERNAL_SIGNAL=n  and SIGRTMIN + 1. Both must be set.
+//   THREADSTACKS_DUMP_FILE=path     Append external dumps to @path instead of
+//                                   writing them to stderr.
+//   THREADSTACKS_HOST_SOCKET=path   Participate in host-wide collections by
+//                                   the aggregator listening on @path, see
+//                                   HostAggregator.
+//   THREADSTACKS_SAMPLE_HZ=rate     Continuously sample all the threads.
+//   THREADSTACKS_PROFILE_FILE=path  Write the sampled profile, in the folded
+//                                   format, to @path when the process exits,
+//                                   and ...
+//   THREADSTACKS_PROFILE_INTERVAL_SEC=n  ... every @n seconds, if set.
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "common/defer.h"
+#include "threadstacks/host_aggregator.h"
+#include "threadstacks/sampler.h"
+#include "threadstacks/signal_handler.h"
+#include "threadstacks/symbol_table.h"
+
+namespace threadstacks {
+namespace {
+
+// External request slot of the THREADSTACKS_DUMP_FILE sink.
+constexpr int kDumpFileSinkSlot =
+    StackTraceSignal::kNumExternalRequestSlots - 1;
+
+// Returns the value of environment variable @name, or an empty string if it's
+// unset.
+std::string GetEnv(const char* name) {
+  const char* value = getenv(name);
+  return value != nullptr ? value : "";
+}
+
+// Appends @data to the file at @path, creating the file if needed. If
+// @truncate is true, the file is truncated first.
+void WriteFile(const std::string& path,
+               const std::string& data,
+               bool truncate) {
+  const int flags = O_WRONLY | O_CREAT | O_CLOEXEC |
+                    (truncate ? O_TRUNC : O_APPEND);
+  const int fd = open(path.c_str(), flags, 0644);
+  if (fd < 0) {
+    std::cerr << "threadstacks: Failed to open " << path
+              << ", errno: " << errno << std::endl;
+    return;
+  }
+  DEFER(close(fd));
+  size_t written = 0;
+  while (written < data.size()) {
+    const auto ret = write(fd, data.data() + written, data.size() - written);
+    if (ret < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      std::cerr << "threadstacks: Failed to write " << path
+                << ", errno: " << errno << std::endl;
+      return;
+    }
+    written += ret;
+  }
+}
+
+// Continuous profiling state, which is intentionally leaked: the sampling
+// thread keeps running until the process exits.
+struct ProfilingState {
+  Sampler* sampler = nullptr;
+  std::string profile_file;
+  std::mutex m;
+  // Signalled on exit, to stop the profile writer thread.
+  std::condition_variable exit_cv;
+  bool exiting = false;
+  // Writes the profile periodically, if an interval is set.
+  std::thread writer;
+};
+
+ProfilingState* profiling = nullptr;
+
+// Writes the profile sampled so far to the profile file.
+void WriteProfile() {
+  auto profile = profiling->sampler->GetProfile();
+  SymbolTable symbols;
+  profile.Symbolize(&symbols);
+  WriteFile(profiling->profile_file, profile.ToFoldedString(&symbols),
+            /*truncate=*/true);
+}
+
+void StartProfiling(double rate_hz,
+                    const std::string& profile_file,
+                    int interval_sec) {
+  Sampler::Options options;
+  options.rate_hz = rate_hz;
+  profiling = new ProfilingState();
+  profiling->sampler = new Sampler(options);
+  profiling->profile_file = profile_file;
+  profiling->sampler->Start();
+  if (profile_file.empty() || interval_sec <= 0) {
+    return;
+  }
+  profiling->writer = std::thread([interval_sec]() {
+    std::unique_lock<std::mutex> l(profiling->m);
+    while (not profiling->exit_cv.wait_for(
+        l, std::chrono::seconds(interval_sec),
+        []() { return profiling->exiting; })) {
+      l.unlock();
+      WriteProfile();
+      l.lock();
+    }
+  });
+}
+
+__attribute__((constructor)) void Install() {
+  if (not GetEnv("THREADSTACKS_DISABLE").empty()) {
+    return;
+  }
+  const auto internal = GetEnv("THREADSTACKS_INTERNAL_SIGNAL");
+  const auto external = GetEnv("THREADSTACKS_EXTERNAL_SIGNAL");
+  if (not internal.empty() || not external.empty()) {
+    if (not StackTraceSignal::SetSignums(atoi(internal.c_str()),
+                                         atoi(external.c_str()))) {
+      std::cerr << "threadstacks: Invalid signal numbers: '" << internal
+                << "', '" << external << "'" << std::endl;
+      return;
+    }
+  }
+  const auto dump_file = GetEnv("THREADSTACKS_DUMP_FILE");
+  if (not dump_file.empty()) {
+    StackTraceSignal::RegisterExternalSink(
+        kDumpFileSinkSlot, [dump_file](const std::string& dump) {
+          WriteFile(dump_file, dump, /*truncate=*/false);
+        });
+    StackTraceSignal::ExternalRequestOptions options;
+    options.sink = kDumpFileSinkSlot;
+    StackTraceSignal::SetDefaultExternalRequestOptions(options);
+  }
+  const auto host_socket = GetEnv("THREADSTACKS_HOST_SOCKET");
+  if (not host_socket.empty() &&
+      not HostAggregator::RegisterParticipant(host_socket)) {
+    // Still install the handlers below, so that dumps to stderr and
+    // THREADSTACKS_DUMP_FILE keep working.
+    std::cerr << "threadstacks: Failed to register with the host aggregator "
+              << "at '" << host_socket << "'" << std::endl;
+  }
+  if (not StackTraceSignal::InstallInternalHandler() ||
+      not StackTraceSignal::InstallExternalHandler()) {
+    std::cerr << "threadstacks: Failed to install signal handlers"
+              << std::endl;
+    return;
+  }
+  const double rate_hz = atof(GetEnv("THREADSTACKS_SAMPLE_HZ").c_str());
+  if (rate_hz > 0) {
+    StartProfiling(rate_hz, GetEnv("THREADSTACKS_PROFILE_FILE"),
+                   atoi(GetEnv("THREADSTACKS_PROFILE_INTERVAL_SEC").c_str()));
+  }
+}
+
+__attribute__((destructor)) void Uninstall() {
+  if (profiling == nullptr) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> l(profiling->m);
+    profiling->exiting = true;
+  }
+  profiling->exit_cv.notify_all();
+  // The writer thread truncates the same file, so it must be done before the
+  // final profile is written.
+  if (profiling->writer.joinable()) {
+    profiling->writer.join();
+  }
+  if (not profiling->profile_file.empty()) {
+    WriteProfile();
+  }
+}
+
+}  // namespace
+}  // namespace threadstacks
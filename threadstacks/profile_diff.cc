@@ -0,0 +1,225 @@
+// Copyright: ThoughtSpot Inc 2017
+
+#include "threadstacks/profile_diff.h"
+
+#include <cmath>
+#include <cstdio>
+#include <map>
+#include <unordered_map>
+
+#include "common/varint.h"
+#include "threadstacks/symbol_table.h"
+
+namespace threadstacks {
+namespace {
+
+// Appends the fields of a protocol buffer message to a string, see
+// https://developers.google.com/protocol-buffers/docs/encoding.
+class ProtoWriter {
+ public:
+  // Appends varint field @field.
+  void Varint(int field, uint64_t value) {
+    common::AppendVarint(field << 3, &out_);
+    common::AppendVarint(value, &out_);
+  }
+  // Appends length delimited field @field, e.g. a string or a message.
+  void Bytes(int field, const std::string& value) {
+    common::AppendVarint(field << 3 | 2, &out_);
+    common::AppendVarint(value.size(), &out_);
+    out_.append(value);
+  }
+  // Appends packed repeated varint field @field.
+  void Packed(int field, const std::vector<uint64_t>& values) {
+    std::string packed;
+    for (const auto value : values) {
+      common::AppendVarint(value, &packed);
+    }
+    Bytes(field, packed);
+  }
+
+  const std::string& str() const { return out_; }
+
+ private:
+  std::string out_;
+};
+
+// Returns the wall time covered by @profile, in nanoseconds.
+int64_t Duration(const Sampler::Profile& profile) {
+  return profile.end_ns - profile.start_ns;
+}
+
+}  // namespace
+
+// static
+bool ProfileDiff::Compute(const Sampler::Profile& before,
+                          const Sampler::Profile& after,
+                          Normalization normalization,
+                          ProfileDiff* diff,
+                          std::string* error) {
+  double scale = 1;
+  switch (normalization) {
+    case kNone:
+      break;
+    case kBySamples:
+      if (before.num_samples > 0) {
+        scale = static_cast<double>(after.num_samples) / before.num_samples;
+      }
+      break;
+    case kByTime:
+      if (before.num_rounds < 2 || after.num_rounds < 2 ||
+          Duration(before) <= 0 || Duration(after) <= 0) {
+        error->assign("Both profiles need at least two sampling rounds to "
+                      "be normalized by time");
+        return false;
+      }
+      scale = static_cast<double>(Duration(after)) / Duration(before);
+      break;
+  }
+  auto stacks = after.stacks != nullptr ? after.stacks
+                                        : std::make_shared<StackTable>();
+  // Ids of the stack traces of @before in @stacks. Identical if the profiles
+  // share the table.
+  std::vector<StackId> ids(before.counts.size());
+  std::shared_ptr<StackTable> copy;
+  for (StackId id = 0; id < ids.size(); ++id) {
+    ids[id] = id;
+    if (before.counts[id] == 0 || before.stacks == stacks) {
+      continue;
+    }
+    const auto* addrs = before.stacks->addresses(id);
+    const int depth = before.stacks->depth(id);
+    const auto found = stacks->Find(addrs, depth);
+    if (found >= 0) {
+      ids[id] = found;
+      continue;
+    }
+    if (copy == nullptr) {
+      copy = std::make_shared<StackTable>(*stacks);
+      stacks = copy;
+    }
+    ids[id] = copy->Intern(addrs, depth);
+  }
+  diff->stacks = stacks;
+  diff->before.assign(stacks->size(), 0);
+  diff->after.assign(stacks->size(), 0);
+  for (StackId id = 0; id < ids.size(); ++id) {
+    diff->before[ids[id]] += before.counts[id] * scale;
+  }
+  for (StackId id = 0; id < after.counts.size(); ++id) {
+    diff->after[id] = after.counts[id];
+  }
+  return true;
+}
+
+std::string ProfileDiff::ToFoldedString(const SymbolTable* symbols) const {
+  std::string out;
+  char buf[64];
+  for (StackId id = 0; id < before.size(); ++id) {
+    if (before[id] == 0 && after[id] == 0) {
+      continue;
+    }
+    const auto* addrs = stacks->addresses(id);
+    for (int i = stacks->depth(id) - 1; i >= 0; --i) {
+      if (symbols != nullptr) {
+        out.append(symbols->Lookup(addrs[i]));
+      } else {
+        snprintf(buf, sizeof(buf), "%#lx", addrs[i]);
+        out.append(buf);
+      }
+      if (i > 0) {
+        out.append(";");
+      }
+    }
+    snprintf(buf, sizeof(buf), " %.0f %.0f\n", before[id], after[id]);
+    out.append(buf);
+  }
+  return out;
+}
+
+std::string ProfileDiff::ToPprof(const SymbolTable* symbols) const {
+  // Field numbers of profile.proto.
+  enum {
+    kProfileSampleType = 1,
+    kProfileSample = 2,
+    kProfileLocation = 4,
+    kProfileFunction = 5,
+    kProfileStringTable = 6,
+    kValueTypeType = 1,
+    kValueTypeUnit = 2,
+    kSampleLocationId = 1,
+    kSampleValue = 2,
+    kLocationId = 1,
+    kLocationAddress = 3,
+    kLocationLine = 4,
+    kLineFunctionId = 1,
+    kFunctionId = 1,
+    kFunctionName = 2,
+  };
+  ProtoWriter profile;
+  // Index of every string in the string table, which starts with "".
+  std::vector<std::string> strings = {""};
+  std::unordered_map<std::string, uint64_t> string_ids = {{"", 0}};
+  auto string_id = [&](const std::string& str) {
+    auto inserted = string_ids.emplace(str, strings.size());
+    if (inserted.second) {
+      strings.push_back(str);
+    }
+    return inserted.first->second;
+  };
+  ProtoWriter sample_type;
+  sample_type.Varint(kValueTypeType, string_id("samples"));
+  sample_type.Varint(kValueTypeUnit, string_id("count"));
+  profile.Bytes(kProfileSampleType, sample_type.str());
+
+  // Ids of locations by address, and of functions by name, from 1.
+  std::map<int64_t, uint64_t> location_ids;
+  std::unordered_map<std::string, uint64_t> function_ids;
+  for (StackId id = 0; id < before.size(); ++id) {
+    const auto value = std::llround(delta(id));
+    if (value == 0) {
+      continue;
+    }
+    std::vector<uint64_t> locations;
+    const auto* addrs = stacks->addresses(id);
+    for (int i = 0; i < stacks->depth(id); ++i) {
+      auto inserted = location_ids.emplace(addrs[i], location_ids.size() + 1);
+      locations.push_back(inserted.first->second);
+    }
+    ProtoWriter sample;
+    sample.Packed(kSampleLocationId, locations);
+    sample.Packed(kSampleValue, {static_cast<uint64_t>(value)});
+    profile.Bytes(kProfileSample, sample.str());
+  }
+  for (const auto& e : location_ids) {
+    ProtoWriter location;
+    location.Varint(kLocationId, e.second);
+    location.Varint(kLocationAddress, e.first);
+    if (symbols != nullptr) {
+      const std::string name = symbols->Lookup(e.first);
+      auto inserted = function_ids.emplace(name, function_ids.size() + 1);
+      if (inserted.second) {
+        ProtoWriter function;
+        function.Varint(kFunctionId, inserted.first->second);
+        function.Varint(kFunctionName, string_id(name));
+        profile.Bytes(kProfileFunction, function.str());
+      }
+      ProtoWriter line;
+      line.Varint(kLineFunctionId, inserted.first->second);
+      location.Bytes(kLocationLine, line.str());
+    }
+    profile.Bytes(kProfileLocation, location.str());
+  }
+  for (const auto& str : strings) {
+    profile.Bytes(kProfileStringTable, str);
+  }
+  return profile.str();
+}
+
+void ProfileDiff::Symbolize(SymbolTable* symbols) const {
+  symbols->Add(*stacks, [this](StackId id) {
+    return id < before.size() && (before[id] != 0 || after[id] != 0);
+  });
+  symbols->Symbolize(nullptr);
+}
+
+}  // namespace threadstacks
@@ -0,0 +1,77 @@
+// Copyright: ThoughtSpot Inc 2017
+
+#ifndef THREADSTACKS_PROFILE_DIFF_H_
+#define THREADSTACKS_PROFILE_DIFF_H_
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "threadstacks/sampler.h"
+#include "threadstacks/stack_table.h"
+
+namespace threadstacks {
+
+class SymbolTable;
+
+// A ProfileDiff is the difference between two sampling profiles, e.g. of the
+// windows before and after a deploy, to find out what got hotter. The counts
+// of the earlier profile are scaled to the later one, so that profiles of
+// different lengths can be compared.
+//
+// The diff is computed on stack ids: profiles of the same sampler share their
+// stack ids, and stack traces of other profiles are matched by address. No
+// side is symbolized, until the diff is formatted.
+struct ProfileDiff {
+  // How the counts of the profiles are normalized.
+  enum Normalization {
+    // Raw counts.
+    kNone,
+    // By the total number of samples of each profile, i.e. compares the share
+    // of every stack trace.
+    kBySamples,
+    // By the wall time covered by each profile, i.e. compares the rate at
+    // which every stack trace is seen. Requires at least two rounds per
+    // profile.
+    kByTime,
+  };
+
+  // Stack traces that the vectors below refer to: those of the later profile,
+  // plus any that are only in the earlier one.
+  std::shared_ptr<const StackTable> stacks;
+  // before[id] and after[id] are the counts of stack trace @id in the earlier
+  // profile, scaled to the later one, and in the later profile.
+  std::vector<double> before;
+  std::vector<double> after;
+
+  // Computes the diff from @before to @after into @diff. Returns false on
+  // failure, in which case @error is filled with a descriptive error message.
+  static bool Compute(const Sampler::Profile& before,
+                      const Sampler::Profile& after,
+                      Normalization normalization,
+                      ProfileDiff* diff,
+                      std::string* error);
+
+  // Returns the change of the count of stack trace @id.
+  double delta(StackId id) const { return after[id] - before[id]; }
+
+  // Returns the diff in the format of differential flame graph tools (e.g.
+  // difffolded.pl): a line per stack trace seen in either profile, with the
+  // frames from the outermost to the innermost separated by ';', followed by
+  // the two counts, rounded. Frames are looked up in @symbols, or printed as
+  // hex addresses if @symbols is null.
+  std::string ToFoldedString(const SymbolTable* symbols) const;
+  // Returns the diff as a serialized pprof profile (profile.proto, not
+  // compressed) with a sample per stack trace, whose value is the rounded
+  // delta, i.e. negative for stack traces that got colder. Frames are looked
+  // up in @symbols, or left as addresses if @symbols is null.
+  std::string ToPprof(const SymbolTable* symbols) const;
+  // Adds all the addresses of stack traces seen in either profile to
+  // @symbols, and symbolizes them.
+  void Symbolize(SymbolTable* symbols) const;
+};
+
+}  // namespace threadstacks
+
+#endif  // THREADSTACKS_PROFILE_DIFF_H_
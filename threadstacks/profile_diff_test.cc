@@ -0,0 +1,151 @@
+// Copyright: ThoughtSpot Inc 2017
+
+#include "threadstacks/profile_diff.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "common/varint.h"
+#include "gtest/gtest.h"
+
+namespace threadstacks {
+namespace {
+
+// Returns a profile of @num_rounds rounds over @duration_ns, with @counts of
+// the stack traces in @stacks.
+Sampler::Profile MakeProfile(std::shared_ptr<const StackTable> stacks,
+                             const std::vector<int64_t>& counts,
+                             int64_t num_rounds,
+                             int64_t duration_ns) {
+  Sampler::Profile profile;
+  profile.stacks = std::move(stacks);
+  profile.counts = counts;
+  for (const auto count : counts) {
+    profile.num_samples += count;
+  }
+  profile.num_rounds = num_rounds;
+  profile.start_ns = 1000;
+  profile.end_ns = 1000 + duration_ns;
+  return profile;
+}
+
+// Returns the length delimited fields @field of message @data.
+std::vector<std::string> ReadFields(const std::string& data, int field) {
+  std::vector<std::string> result;
+  size_t pos = 0;
+  while (pos < data.size()) {
+    const auto tag = common::ReadVarint(data, &pos);
+    if ((tag & 7) == 0) {
+      common::ReadVarint(data, &pos);
+      continue;
+    }
+    const auto size = common::ReadVarint(data, &pos);
+    if (static_cast<int>(tag >> 3) == field) {
+      result.push_back(data.substr(pos, size));
+    }
+    pos += size;
+  }
+  return result;
+}
+
+TEST(ProfileDiffTest, SharedStackTable) {
+  auto stacks = std::make_shared<StackTable>();
+  const int64_t a[] = {0x10, 0x20};
+  const int64_t b[] = {0x30, 0x20};
+  const int64_t c[] = {0x40};
+  ASSERT_EQ(0, stacks->Intern(a, 2));
+  ASSERT_EQ(1, stacks->Intern(b, 2));
+  ASSERT_EQ(2, stacks->Intern(c, 1));
+  // Half as long as @after, with stack trace b getting hotter.
+  const auto before = MakeProfile(stacks, {6, 2}, 5, 1000);
+  const auto after = MakeProfile(stacks, {8, 12, 4}, 11, 2000);
+
+  ProfileDiff diff;
+  std::string error;
+  ASSERT_TRUE(ProfileDiff::Compute(before, after, ProfileDiff::kNone, &diff,
+                                   &error)) << error;
+  EXPECT_EQ(stacks, diff.stacks);
+  EXPECT_EQ(std::vector<double>({6, 2, 0}), diff.before);
+  EXPECT_EQ(std::vector<double>({8, 12, 4}), diff.after);
+
+  ASSERT_TRUE(ProfileDiff::Compute(before, after, ProfileDiff::kBySamples,
+                                   &diff, &error)) << error;
+  EXPECT_EQ(std::vector<double>({18, 6, 0}), diff.before);
+  EXPECT_EQ(-10, diff.delta(0));
+  EXPECT_EQ(6, diff.delta(1));
+  EXPECT_EQ(4, diff.delta(2));
+
+  ASSERT_TRUE(ProfileDiff::Compute(before, after, ProfileDiff::kByTime,
+                                   &diff, &error)) << error;
+  EXPECT_EQ(std::vector<double>({12, 4, 0}), diff.before);
+  EXPECT_EQ("0x20;0x10 12 8\n0x20;0x30 4 12\n0x40 0 4\n",
+            diff.ToFoldedString(nullptr));
+
+  // A single round doesn't cover any time.
+  EXPECT_FALSE(ProfileDiff::Compute(MakeProfile(stacks, {1}, 1, 0), after,
+                                    ProfileDiff::kByTime, &diff, &error));
+  EXPECT_FALSE(error.empty());
+}
+
+TEST(ProfileDiffTest, SeparateStackTables) {
+  auto stacks_before = std::make_shared<StackTable>();
+  auto stacks_after = std::make_shared<StackTable>();
+  const int64_t a[] = {0x10, 0x20};
+  const int64_t b[] = {0x30, 0x20};
+  const int64_t c[] = {0x40};
+  stacks_before->Intern(c, 1);
+  stacks_before->Intern(a, 2);
+  stacks_after->Intern(a, 2);
+  stacks_after->Intern(b, 2);
+  const auto before = MakeProfile(stacks_before, {3, 5}, 2, 1000);
+  const auto after = MakeProfile(stacks_after, {4, 7}, 2, 1000);
+
+  ProfileDiff diff;
+  std::string error;
+  ASSERT_TRUE(ProfileDiff::Compute(before, after, ProfileDiff::kNone, &diff,
+                                   &error)) << error;
+  // Stack trace c is only in @before, so it's added to a copy of the table.
+  ASSERT_EQ(3, diff.stacks->size());
+  EXPECT_EQ(2, stacks_after->size());
+  EXPECT_EQ(2, diff.stacks->Find(c, 1));
+  EXPECT_EQ(std::vector<double>({5, 0, 3}), diff.before);
+  EXPECT_EQ(std::vector<double>({4, 7, 0}), diff.after);
+}
+
+TEST(ProfileDiffTest, Pprof) {
+  auto stacks = std::make_shared<StackTable>();
+  const int64_t a[] = {0x10, 0x20};
+  const int64_t b[] = {0x30, 0x20};
+  stacks->Intern(a, 2);
+  stacks->Intern(b, 2);
+  ProfileDiff diff;
+  std::string error;
+  ASSERT_TRUE(ProfileDiff::Compute(MakeProfile(stacks, {5, 1}, 2, 1000),
+                                   MakeProfile(stacks, {2, 4}, 2, 1000),
+                                   ProfileDiff::kNone, &diff, &error));
+  const auto pprof = diff.ToPprof(nullptr);
+  std::vector<int64_t> values;
+  for (const auto& sample : ReadFields(pprof, 2)) {
+    const auto packed = ReadFields(sample, 2);
+    ASSERT_EQ(1, packed.size());
+    size_t pos = 0;
+    values.push_back(common::ReadVarint(packed[0], &pos));
+    EXPECT_EQ(2, ReadFields(sample, 1)[0].size());
+  }
+  EXPECT_EQ(std::vector<int64_t>({-3, 3}), values);
+  // 3 distinct addresses.
+  EXPECT_EQ(3, ReadFields(pprof, 4).size());
+  const auto strings = ReadFields(pprof, 6);
+  ASSERT_EQ(3, strings.size());
+  EXPECT_EQ("", strings[0]);
+  EXPECT_EQ("samples", strings[1]);
+}
+
+}  // namespace
+}  // namespace threadstacks
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
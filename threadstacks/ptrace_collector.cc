@@ -0,0 +1,193 @@
+// Copyright: ThoughtSpot Inc 2017
+
+#include "threadstacks/ptrace_collector.h"
+
+#include <elf.h>
+#include <sys/ptrace.h>
+#include <sys/uio.h>
+#include <sys/user.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <set>
+
+#include "common/defer.h"
+#include "common/sysutil.h"
+#include "threadstacks/stack_unwinder.h"
+#include "threadstacks/symbol_table.h"
+
+namespace threadstacks {
+namespace {
+
+// State of a seized thread.
+struct Tracee {
+  pid_t tid;
+  // Whether the thread is seized and interrupted, but its stop hasn't been
+  // waited for yet.
+  bool stopping = false;
+  // Whether the thread is stopped, and has to be detached.
+  bool stopped = false;
+  // Signal that stopped the thread before the interrupt did, if any, which is
+  // delivered on detach.
+  int signum = 0;
+  // Registers of the thread.
+  uint64_t pc = 0;
+  uint64_t sp = 0;
+  uint64_t fp = 0;
+  // Copy of the top of the stack, starting at @sp.
+  std::string stack;
+};
+
+// Waits for @tracee, which is stopping, to stop. Returns false if the thread
+// exited instead.
+bool WaitForStop(Tracee* tracee) {
+  tracee->stopping = false;
+  int status;
+  if (tracee->tid != waitpid(tracee->tid, &status, __WALL) ||
+      not WIFSTOPPED(status)) {
+    return false;
+  }
+  tracee->stopped = true;
+  if (status >> 16 != PTRACE_EVENT_STOP) {
+    // Stopped for delivery of a signal, which must not get lost.
+    tracee->signum = WSTOPSIG(status);
+  }
+  return true;
+}
+
+// Fills the pc, sp and fp of @tracee from its registers. Returns false on
+// failure.
+bool ReadRegisters(Tracee* tracee) {
+  struct user_regs_struct regs;
+  struct iovec iov = {&regs, sizeof(regs)};
+  if (0 != ptrace(PTRACE_GETREGSET, tracee->tid, NT_PRSTATUS, &iov)) {
+    return false;
+  }
+#if defined(__x86_64__)
+  tracee->pc = regs.rip;
+  tracee->sp = regs.rsp;
+  tracee->fp = regs.rbp;
+#elif defined(__aarch64__)
+  tracee->pc = regs.pc;
+  tracee->sp = regs.sp;
+  tracee->fp = regs.regs[29];
+#else
+#error "PtraceCollector doesn't support this architecture"
+#endif
+  return true;
+}
+
+}  // namespace
+
+auto PtraceCollector::Collect(pid_t pid, std::string* error)
+    -> std::vector<StackTraceCollector::Result> {
+  std::vector<StackTraceCollector::Result> results;
+  last_stop_us_ = 0;
+  if (pid == getpid()) {
+    error->assign("Can't trace the calling process");
+    return results;
+  }
+  // Read before stopping the process, to keep the stop window short.
+  if (not ReadMappings(pid, &mappings_, error)) {
+    return results;
+  }
+
+  std::vector<Tracee> tracees;
+  // Threads seized before a failure have to stop before they can be
+  // detached, or they stay traced, and stopped, until the caller exits.
+  DEFER(
+    for (auto& tracee : tracees) {
+      if (tracee.stopping) {
+        WaitForStop(&tracee);
+      }
+      if (tracee.stopped) {
+        ptrace(PTRACE_DETACH, tracee.tid, nullptr, tracee.signum);
+      }
+    }
+  );
+  const auto start = std::chrono::steady_clock::now();
+  // Threads may be created until all the threads are stopped, so list them
+  // until no new ones show up.
+  std::set<pid_t> seen;
+  while (true) {
+    const size_t first = tracees.size();
+    for (const auto tid : common::Sysutil::ListThreads(pid)) {
+      if (not seen.insert(tid).second) {
+        continue;
+      }
+      if (0 != ptrace(PTRACE_SEIZE, tid, nullptr, nullptr)) {
+        if (errno == ESRCH) {
+          // The thread exited in the meantime.
+          continue;
+        }
+        error->assign("Failed to seize thread " + std::to_string(tid) +
+                      ", errno: " + std::to_string(errno));
+        return results;
+      }
+      tracees.emplace_back();
+      tracees.back().tid = tid;
+      if (0 != ptrace(PTRACE_INTERRUPT, tid, nullptr, nullptr)) {
+        if (errno == ESRCH) {
+          // The thread exited in the meantime.
+          continue;
+        }
+        error->assign("Failed to interrupt thread " + std::to_string(tid) +
+                      ", errno: " + std::to_string(errno));
+        return results;
+      }
+      tracees.back().stopping = true;
+    }
+    if (first == tracees.size()) {
+      break;
+    }
+    for (size_t i = first; i < tracees.size(); ++i) {
+      if (tracees[i].stopping) {
+        // Fails if the thread exited in the meantime, which is fine.
+        WaitForStop(&tracees[i]);
+      }
+    }
+  }
+  if (tracees.empty()) {
+    error->assign("No such process: " + std::to_string(pid));
+    return results;
+  }
+
+  for (auto& tracee : tracees) {
+    if (not tracee.stopped || not ReadRegisters(&tracee)) {
+      continue;
+    }
+    tracee.stack.resize(options_.max_stack_bytes);
+    struct iovec local = {&tracee.stack[0], tracee.stack.size()};
+    struct iovec remote = {reinterpret_cast<void*>(tracee.sp),
+                           tracee.stack.size()};
+    // Reads stop at the end of the stack mapping.
+    const auto size = process_vm_readv(pid, &local, 1, &remote, 1, 0);
+    tracee.stack.resize(std::max<ssize_t>(size, 0));
+  }
+  for (auto& tracee : tracees) {
+    if (tracee.stopped) {
+      ptrace(PTRACE_DETACH, tracee.tid, nullptr, tracee.signum);
+      tracee.stopped = false;
+    }
+  }
+  last_stop_us_ = std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now() - start).count();
+
+  return UnwindStackCopies(tracees, mappings_);
+}
+
+void PtraceCollector::Symbolize(
+    const std::vector<StackTraceCollector::Result>& result,
+    SymbolTable* symbols) {
+  for (const auto& e : result) {
+    symbols->Add(e.trace);
+  }
+  symbols->Symbolize([this](int64_t addr) {
+    return symbols_.Symbolize(mappings_, addr);
+  });
+}
+
+}  // namespace threadstacks
@@ -0,0 +1,79 @@
+// Copyright: ThoughtSpot Inc 2017
+
+#ifndef THREADSTACKS_PTRACE_COLLECTOR_H_
+#define THREADSTACKS_PTRACE_COLLECTOR_H_
+
+#include <sys/types.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "threadstacks/elf_symbols.h"
+#include "threadstacks/signal_handler.h"
+
+namespace threadstacks {
+
+class SymbolTable;
+
+// A PtraceCollector collects the stack traces of all the threads of another
+// process, without any cooperation from it, i.e. the process needs neither
+// the signal handlers nor the library linked in.
+//
+// The threads are seized with PTRACE_SEIZE and stopped with PTRACE_INTERRUPT.
+// While they are stopped, only their registers and the top of their stacks
+// are copied out (with process_vm_readv), after which they are detached right
+// away, so that the process is stopped for as short as possible. The stacks
+// are unwound from the copies afterwards, see UnwindStackCopy(...), so frames
+// are only found reliably in code built with frame pointers.
+//
+// The results are grouped like the ones of StackTraceCollector::Collect(...),
+// and can be formatted with the same StackTraceCollector::To*String(...)
+// functions, after symbolizing them with Symbolize(...).
+//
+// Note: This class is not thread-safe.
+class PtraceCollector {
+ public:
+  struct Options {
+    // Number of bytes copied from the top of the stack of every thread. Frames
+    // beyond that are lost.
+    int64_t max_stack_bytes = 64 * 1024;
+  };
+
+  PtraceCollector() = default;
+  explicit PtraceCollector(const Options& options) : options_(options) {}
+  ~PtraceCollector() = default;
+
+  // Returns stack traces of all the threads of process @pid. Returns an empty
+  // vector on encountering an error, e.g. if the calling process isn't allowed
+  // to trace @pid, in which case @error is filled with a descriptive error
+  // message. @pid can't be the calling process.
+  std::vector<StackTraceCollector::Result> Collect(pid_t pid,
+                                                   std::string* error);
+
+  // Adds all the addresses in @result, as returned by the last call to
+  // Collect(...), to @symbols and symbolizes them from the binaries mapped by
+  // the process at the time.
+  void Symbolize(const std::vector<StackTraceCollector::Result>& result,
+                 SymbolTable* symbols);
+
+  // Returns the time the threads of the process were stopped for by the last
+  // call to Collect(...), in microseconds.
+  int64_t last_stop_us() const { return last_stop_us_; }
+
+ private:
+  const Options options_;
+  // Executable mappings of the process of the last collection.
+  std::vector<Mapping> mappings_;
+  // Shared across collections.
+  ElfSymbolCache symbols_;
+  int64_t last_stop_us_ = 0;
+
+  // Disable copy c'tor and assignment operator.
+  PtraceCollector(const PtraceCollector&) = delete;
+  PtraceCollector& operator=(const PtraceCollector&) = delete;
+};
+
+}  // namespace threadstacks
+
+#endif  // THREADSTACKS_PTRACE_COLLECTOR_H_
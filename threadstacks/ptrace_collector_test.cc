@@ -0,0 +1,128 @@
+// Copyright: ThoughtSpot Inc 2017
+
+#include "threadstacks/ptrace_collector.h"
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "common/sysutil.h"
+#include "gtest/gtest.h"
+#include "threadstacks/symbol_table.h"
+
+namespace threadstacks {
+namespace {
+
+// Number of worker threads of the traced process, which share a stack trace.
+const int kNumWorkers = 3;
+
+// Blocks until @fd is closed.
+__attribute__((noinline)) void PtraceInner(int fd) {
+  char c;
+  while (read(fd, &c, 1) > 0 || errno == EINTR) {
+  }
+}
+
+__attribute__((noinline)) void PtraceOuter(int fd) {
+  PtraceInner(fd);
+  // Prevents a tail call, which would drop this frame.
+  asm volatile("");
+}
+
+class PtraceCollectorTest : public ::testing::Test {
+ public:
+  void SetUp() override {
+    int fds[2];
+    ASSERT_EQ(0, pipe(fds));
+    child_ = fork();
+    if (child_ == 0) {
+      close(fds[1]);
+      std::vector<std::thread> workers;
+      for (int i = 0; i < kNumWorkers; ++i) {
+        workers.emplace_back(PtraceOuter, fds[0]);
+      }
+      for (auto& worker : workers) {
+        worker.join();
+      }
+      _exit(0);
+    }
+    close(fds[0]);
+    pipe_ = fds[1];
+    while (common::Sysutil::ListThreads(child_).size() != kNumWorkers + 1) {
+      usleep(1000);
+    }
+    // Give the workers a moment to block in read().
+    usleep(100000);
+  }
+
+  // Makes the child exit, and returns its exit status.
+  int StopChild() {
+    close(pipe_);
+    int status = -1;
+    waitpid(child_, &status, 0);
+    return status;
+  }
+
+ protected:
+  pid_t child_ = -1;
+  int pipe_ = -1;
+};
+
+TEST_F(PtraceCollectorTest, Collect) {
+  PtraceCollector collector;
+  std::string error;
+  for (int round = 0; round < 2; ++round) {
+    const auto results = collector.Collect(child_, &error);
+    ASSERT_FALSE(results.empty()) << error;
+    SymbolTable symbols;
+    collector.Symbolize(results, &symbols);
+    const auto pretty = StackTraceCollector::ToPrettyString(results, symbols);
+    int num_threads = 0;
+    int num_workers = 0;
+    for (const auto& result : results) {
+      num_threads += result.tids.size();
+      const auto folded =
+          StackTraceCollector::ToFoldedString({result}, &symbols);
+      if (folded.find("PtraceOuter") != std::string::npos &&
+          folded.find("PtraceInner") != std::string::npos) {
+        num_workers += result.tids.size();
+      }
+    }
+    EXPECT_EQ(kNumWorkers + 1, num_threads) << pretty;
+    EXPECT_EQ(kNumWorkers, num_workers) << pretty;
+    EXPECT_LT(0, collector.last_stop_us());
+    EXPECT_NE(std::string::npos,
+              StackTraceCollector::ToFoldedString(results, &symbols)
+                  .find("PtraceInner"));
+    const auto raw = StackTraceCollector::ToRawString(results);
+    EXPECT_EQ(results.size(), std::count(raw.begin(), raw.end(), '\n'));
+  }
+  // The threads resume once detached.
+  const int status = StopChild();
+  ASSERT_TRUE(WIFEXITED(status)) << status;
+  EXPECT_EQ(0, WEXITSTATUS(status));
+}
+
+TEST_F(PtraceCollectorTest, Errors) {
+  PtraceCollector collector;
+  std::string error;
+  EXPECT_TRUE(collector.Collect(getpid(), &error).empty());
+  EXPECT_FALSE(error.empty());
+  StopChild();
+  error.clear();
+  EXPECT_TRUE(collector.Collect(child_, &error).empty());
+  EXPECT_FALSE(error.empty());
+}
+
+}  // namespace
+}  // namespace threadstacks
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
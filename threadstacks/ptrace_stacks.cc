@@ -0,0 +1,48 @@
+// Copyright: ThoughtSpot Inc 2017
+
+// Prints the stack traces of all the threads of a process, which doesn't need
+// to cooperate, see PtraceCollector. The output formats are the ones of
+// external stack trace dumps: text (the default), folded or raw.
+//
+// Usage: ptrace_stacks <pid> [text|folded|raw]
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include "threadstacks/ptrace_collector.h"
+#include "threadstacks/symbol_table.h"
+
+int main(int argc, char** argv) {
+  const char* format = argc > 2 ? argv[2] : "text";
+  if (argc < 2 || argc > 3 ||
+      (0 != strcmp(format, "text") && 0 != strcmp(format, "folded") &&
+       0 != strcmp(format, "raw"))) {
+    fprintf(stderr, "Usage: %s <pid> [text|folded|raw]\n", argv[0]);
+    return 1;
+  }
+  threadstacks::PtraceCollector collector;
+  std::string error;
+  const auto results = collector.Collect(atoi(argv[1]), &error);
+  if (results.empty()) {
+    fprintf(stderr, "%s\n", error.c_str());
+    return 1;
+  }
+  fprintf(stderr, "Stopped for %ld us\n", collector.last_stop_us());
+  if (0 == strcmp(format, "raw")) {
+    printf("%s",
+           threadstacks::StackTraceCollector::ToRawString(results).c_str());
+    return 0;
+  }
+  threadstacks::SymbolTable symbols;
+  collector.Symbolize(results, &symbols);
+  if (0 == strcmp(format, "folded")) {
+    printf("%s", threadstacks::StackTraceCollector::ToFoldedString(
+                     results, &symbols).c_str());
+  } else {
+    printf("%s", threadstacks::StackTraceCollector::ToPrettyString(
+                     results, symbols).c_str());
+  }
+  return 0;
+}
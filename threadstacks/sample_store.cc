@@ -0,0 +1,301 @@
+// Copyright: ThoughtSpot Inc 2017
+
+#include "threadstacks/sample_store.h"
+
+#include <algorithm>
+#include <map>
+#include <unordered_map>
+
+#include "common/sysutil.h"
+#include "common/varint.h"
+
+namespace threadstacks {
+namespace {
+
+// Number of bits per bit-packed thread state.
+constexpr int kStateBits = 2;
+constexpr int kStatesPerByte = 8 / kStateBits;
+
+SampleStore::ThreadState ToThreadState(char state) {
+  switch (state) {
+    case 'R':
+      return SampleStore::kRunning;
+    case 'S':
+      return SampleStore::kSleeping;
+    case 'D':
+      return SampleStore::kDiskSleep;
+    default:
+      return SampleStore::kOther;
+  }
+}
+
+}  // namespace
+
+int64_t SampleStore::Chunk::size_bytes() const {
+  return sizeof(*this) + times.size() + runs.size() + states.size() +
+         tids.size() * sizeof(tids[0]) + stacks.size() * sizeof(stacks[0]) +
+         (thread_offsets.size() + state_offsets.size()) * sizeof(uint32_t);
+}
+
+SampleStore::SampleStore(const Options& options) : options_(options) {}
+
+void SampleStore::OnSamples(int64_t time_ns,
+                            const StackTable& stacks,
+                            const Sampler::Sample* samples,
+                            int num_samples) {
+  states_.assign(num_samples, kOther);
+  if (options_.record_states) {
+    for (int i = 0; i < num_samples; ++i) {
+      states_[i] =
+          ToThreadState(common::Sysutil::GetThreadState(samples[i].tid));
+    }
+  }
+  Append(time_ns, samples, states_.data(), num_samples);
+}
+
+void SampleStore::Append(int64_t time_ns,
+                         const Sampler::Sample* samples,
+                         const ThreadState* states,
+                         int num_samples) {
+  std::lock_guard<std::mutex> l(m_);
+  open_times_.push_back(time_ns);
+  open_offsets_.push_back(open_samples_.size());
+  for (int i = 0; i < num_samples; ++i) {
+    open_samples_.push_back({samples[i].tid, samples[i].stack, states[i]});
+  }
+  if (static_cast<int>(open_times_.size()) >=
+      std::max(options_.rounds_per_chunk, 1)) {
+    Seal();
+  }
+}
+
+void SampleStore::Seal() {
+  auto sealed = std::make_shared<Chunk>();
+  Chunk& chunk = *sealed;
+  chunk.start_ns = open_times_.front();
+  chunk.end_ns = open_times_.back();
+  chunk.num_rounds = open_times_.size();
+  chunk.num_samples = open_samples_.size();
+  int64_t last_ns = chunk.start_ns;
+  for (const auto time_ns : open_times_) {
+    common::AppendVarint(time_ns - last_ns, &chunk.times);
+    last_ns = time_ns;
+  }
+  // Rounds, stack ids and states of every thread, in time order.
+  struct ThreadSamples {
+    std::vector<int> rounds;
+    std::vector<StackId> stacks;
+    std::vector<ThreadState> states;
+  };
+  std::map<pid_t, ThreadSamples> threads;
+  for (int round = 0; round < chunk.num_rounds; ++round) {
+    const size_t end = round + 1 < chunk.num_rounds ? open_offsets_[round + 1]
+                                                    : open_samples_.size();
+    for (size_t i = open_offsets_[round]; i < end; ++i) {
+      auto& thread = threads[open_samples_[i].tid];
+      thread.rounds.push_back(round);
+      thread.stacks.push_back(open_samples_[i].stack);
+      thread.states.push_back(open_samples_[i].state);
+    }
+  }
+  std::unordered_map<StackId, uint32_t> stack_index;
+  chunk.states.assign(
+      (chunk.num_samples + kStatesPerByte - 1) / kStatesPerByte, 0);
+  uint32_t state_offset = 0;
+  for (const auto& e : threads) {
+    const auto& thread = e.second;
+    chunk.tids.push_back(e.first);
+    chunk.thread_offsets.push_back(chunk.runs.size());
+    chunk.state_offsets.push_back(state_offset);
+    // Runs of consecutive rounds: the number of rounds skipped since the end
+    // of the previous run, and the length of the run.
+    std::vector<std::pair<int, int>> round_runs;
+    int next_round = 0;
+    for (const auto round : thread.rounds) {
+      if (round_runs.empty() || round != next_round) {
+        round_runs.emplace_back(round - next_round, 0);
+      }
+      ++round_runs.back().second;
+      next_round = round + 1;
+    }
+    common::AppendVarint(round_runs.size(), &chunk.runs);
+    for (const auto& run : round_runs) {
+      common::AppendVarint(run.first, &chunk.runs);
+      common::AppendVarint(run.second, &chunk.runs);
+    }
+    // Runs of the same stack id: its index in the dictionary, and the length
+    // of the run.
+    std::vector<std::pair<uint32_t, int>> stack_runs;
+    for (const auto stack : thread.stacks) {
+      const auto index =
+          stack_index.emplace(stack, chunk.stacks.size()).first->second;
+      if (index == chunk.stacks.size()) {
+        chunk.stacks.push_back(stack);
+      }
+      if (stack_runs.empty() || stack_runs.back().first != index) {
+        stack_runs.emplace_back(index, 0);
+      }
+      ++stack_runs.back().second;
+    }
+    common::AppendVarint(stack_runs.size(), &chunk.runs);
+    for (const auto& run : stack_runs) {
+      common::AppendVarint(run.first, &chunk.runs);
+      common::AppendVarint(run.second, &chunk.runs);
+    }
+    for (const auto state : thread.states) {
+      chunk.states[state_offset / kStatesPerByte] |=
+          state << (state_offset % kStatesPerByte * kStateBits);
+      ++state_offset;
+    }
+  }
+  open_times_.clear();
+  open_offsets_.clear();
+  open_samples_.clear();
+
+  sealed_bytes_ += chunk.size_bytes();
+  sealed_samples_ += chunk.num_samples;
+  chunks_.push_back(std::move(sealed));
+  while (options_.max_bytes > 0 && sealed_bytes_ > options_.max_bytes &&
+         chunks_.size() > 1) {
+    sealed_bytes_ -= chunks_.front()->size_bytes();
+    sealed_samples_ -= chunks_.front()->num_samples;
+    chunks_.pop_front();
+  }
+}
+
+// static
+void SampleStore::Decode(const Chunk& chunk,
+                         int64_t start_ns,
+                         int64_t end_ns,
+                         const std::function<bool(pid_t)>& filter,
+                         const std::function<void(const Row&)>& visitor) {
+  std::vector<int64_t> times(chunk.num_rounds);
+  size_t pos = 0;
+  int64_t time_ns = chunk.start_ns;
+  for (auto& t : times) {
+    time_ns += common::ReadVarint(chunk.times, &pos);
+    t = time_ns;
+  }
+  for (size_t i = 0; i < chunk.tids.size(); ++i) {
+    const pid_t tid = chunk.tids[i];
+    if (filter && not filter(tid)) {
+      continue;
+    }
+    pos = chunk.thread_offsets[i];
+    std::vector<int> rounds;
+    const auto num_round_runs = common::ReadVarint(chunk.runs, &pos);
+    int next_round = 0;
+    for (uint64_t run = 0; run < num_round_runs; ++run) {
+      next_round += common::ReadVarint(chunk.runs, &pos);
+      const auto length = common::ReadVarint(chunk.runs, &pos);
+      for (uint64_t j = 0; j < length; ++j) {
+        rounds.push_back(next_round++);
+      }
+    }
+    const auto num_stack_runs = common::ReadVarint(chunk.runs, &pos);
+    uint32_t sample = 0;
+    for (uint64_t run = 0; run < num_stack_runs; ++run) {
+      const StackId stack = chunk.stacks[common::ReadVarint(chunk.runs, &pos)];
+      const auto length = common::ReadVarint(chunk.runs, &pos);
+      for (uint64_t j = 0; j < length; ++j, ++sample) {
+        const auto t = times[rounds[sample]];
+        if (t < start_ns || t > end_ns) {
+          continue;
+        }
+        const uint32_t index = chunk.state_offsets[i] + sample;
+        const auto state = static_cast<ThreadState>(
+            (chunk.states[index / kStatesPerByte] >>
+             (index % kStatesPerByte * kStateBits)) &
+            ((1 << kStateBits) - 1));
+        visitor({t, tid, stack, state});
+      }
+    }
+  }
+}
+
+void SampleStore::Snapshot(int64_t start_ns,
+                           int64_t end_ns,
+                           const std::function<bool(pid_t)>& filter,
+                           std::vector<std::shared_ptr<const Chunk>>* chunks,
+                           std::vector<Row>* open) const {
+  std::lock_guard<std::mutex> l(m_);
+  // Chunks are sorted by time, and don't overlap.
+  auto it = std::lower_bound(chunks_.begin(), chunks_.end(), start_ns,
+                             [](const std::shared_ptr<const Chunk>& chunk,
+                                int64_t t) { return chunk->end_ns < t; });
+  for (; it != chunks_.end() && (*it)->start_ns <= end_ns; ++it) {
+    chunks->push_back(*it);
+  }
+  for (size_t round = 0; round < open_times_.size(); ++round) {
+    const auto t = open_times_[round];
+    if (t < start_ns || t > end_ns) {
+      continue;
+    }
+    const size_t end = round + 1 < open_times_.size()
+                           ? open_offsets_[round + 1]
+                           : open_samples_.size();
+    for (size_t i = open_offsets_[round]; i < end; ++i) {
+      const auto& sample = open_samples_[i];
+      if (not filter || filter(sample.tid)) {
+        open->push_back({t, sample.tid, sample.stack, sample.state});
+      }
+    }
+  }
+}
+
+int SampleStore::Query(int64_t start_ns,
+                       int64_t end_ns,
+                       const std::function<bool(pid_t)>& filter,
+                       std::vector<Row>* rows) const {
+  rows->clear();
+  std::vector<std::shared_ptr<const Chunk>> chunks;
+  std::vector<Row> open;
+  Snapshot(start_ns, end_ns, filter, &chunks, &open);
+  for (const auto& chunk : chunks) {
+    Decode(*chunk, start_ns, end_ns, filter,
+           [rows](const Row& row) { rows->push_back(row); });
+  }
+  rows->insert(rows->end(), open.begin(), open.end());
+  std::sort(rows->begin(), rows->end(), [](const Row& a, const Row& b) {
+    return a.time_ns != b.time_ns ? a.time_ns < b.time_ns : a.tid < b.tid;
+  });
+  return chunks.size();
+}
+
+void SampleStore::Visit(int64_t start_ns,
+                        int64_t end_ns,
+                        const std::function<bool(pid_t)>& filter,
+                        const std::function<void(const Row&)>& visitor) const {
+  std::vector<std::shared_ptr<const Chunk>> chunks;
+  std::vector<Row> open;
+  Snapshot(start_ns, end_ns, filter, &chunks, &open);
+  // Sealed chunks are immutable, so they are decoded without holding @m_,
+  // and released as soon as they are visited, in case they get evicted
+  // meanwhile.
+  for (auto& chunk : chunks) {
+    Decode(*chunk, start_ns, end_ns, filter, visitor);
+    chunk.reset();
+  }
+  for (const auto& row : open) {
+    visitor(row);
+  }
+}
+
+int64_t SampleStore::num_samples() const {
+  std::lock_guard<std::mutex> l(m_);
+  return sealed_samples_ + open_samples_.size();
+}
+
+int64_t SampleStore::size_bytes() const {
+  std::lock_guard<std::mutex> l(m_);
+  return sealed_bytes_ + open_times_.size() * sizeof(int64_t) +
+         open_offsets_.size() * sizeof(uint32_t) +
+         open_samples_.size() * sizeof(OpenSample);
+}
+
+int SampleStore::num_chunks() const {
+  std::lock_guard<std::mutex> l(m_);
+  return chunks_.size();
+}
+
+}  // namespace threadstacks
@@ -0,0 +1,182 @@
+// Copyright: ThoughtSpot Inc 2017
+
+#ifndef THREADSTACKS_SAMPLE_STORE_H_
+#define THREADSTACKS_SAMPLE_STORE_H_
+
+#include <sys/types.h>
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "threadstacks/sampler.h"
+#include "threadstacks/stack_table.h"
+
+namespace threadstacks {
+
+// A SampleStore keeps the individual samples of a Sampler over time, unlike
+// its aggregated Profile, so that questions such as "where was thread 1234
+// blocked between 10:01:03 and 10:01:09" can be answered.
+//
+// Samples are stored column-wise in chunks of consecutive sampling rounds.
+// Within a sealed chunk, samples are ordered by thread, and then by time:
+//  - the timestamps of the rounds are delta-encoded,
+//  - tids and stack ids are replaced by indexes into per-chunk dictionaries,
+//  - the rounds a thread was sampled in, and its stack ids, are run-length
+//    encoded, since threads mostly live through a chunk and often stay in
+//    the same stack trace,
+//  - thread states are bit-packed, at 2 bits per sample.
+// This takes well under a byte per sample for long-lived threads. Chunks are
+// indexed by time, so that range queries only decode the chunks, and the
+// threads of a chunk, that they select.
+//
+// The oldest chunks are dropped once the store exceeds its size limit.
+//
+// Note: This class is thread-safe.
+class SampleStore : public Sampler::Listener {
+ public:
+  // Scheduler state of a sampled thread.
+  enum ThreadState : uint8_t {
+    kRunning = 0,
+    kSleeping = 1,
+    // Uninterruptible sleep, usually waiting for I/O.
+    kDiskSleep = 2,
+    // Any other state, or unknown.
+    kOther = 3,
+  };
+
+  struct Options {
+    // Number of sampling rounds per chunk.
+    int rounds_per_chunk = 256;
+    // Size above which the oldest chunks are dropped, in bytes. 0 for no
+    // limit.
+    int64_t max_bytes = 64 << 20;
+    // Whether OnSamples(...) reads the state of every sampled thread from
+    // /proc, right after the round. Otherwise states are all kOther.
+    bool record_states = true;
+  };
+
+  // A sample, as returned by queries.
+  struct Row {
+    int64_t time_ns;
+    pid_t tid;
+    StackId stack;
+    ThreadState state;
+  };
+
+  explicit SampleStore(const Options& options);
+  ~SampleStore() override = default;
+
+  // Appends the sampling round taken at @time_ns, of @num_samples samples
+  // with states @states. Rounds must be appended in time order.
+  void Append(int64_t time_ns,
+              const Sampler::Sample* samples,
+              const ThreadState* states,
+              int num_samples);
+
+  // Sampler::Listener implementation.
+  void OnSamples(int64_t time_ns,
+                 const StackTable& stacks,
+                 const Sampler::Sample* samples,
+                 int num_samples) override;
+
+  // Fills @rows with the samples taken in [@start_ns, @end_ns] of the threads
+  // for which @filter returns true, or of all the threads if @filter is
+  // empty, ordered by time and then tid. Returns the number of sealed chunks
+  // that were decoded.
+  int Query(int64_t start_ns,
+            int64_t end_ns,
+            const std::function<bool(pid_t /*tid*/)>& filter,
+            std::vector<Row>* rows) const;
+  // Same as above, but streams the samples to @visitor instead of returning
+  // them, decoding one chunk at a time. The samples of every thread are
+  // visited in time order, but samples of different threads are not ordered.
+  // The store can be appended to while @visitor runs.
+  void Visit(int64_t start_ns,
+             int64_t end_ns,
+             const std::function<bool(pid_t /*tid*/)>& filter,
+             const std::function<void(const Row&)>& visitor) const;
+
+  // Returns the number of samples held, and their size in bytes.
+  int64_t num_samples() const;
+  int64_t size_bytes() const;
+  // Returns the number of sealed chunks.
+  int num_chunks() const;
+
+ private:
+  // Sealed chunk of consecutive rounds.
+  struct Chunk {
+    // Time of the first and last rounds.
+    int64_t start_ns;
+    int64_t end_ns;
+    int num_rounds;
+    int64_t num_samples;
+    // Delta-encoded times of the rounds, from @start_ns, as varints.
+    std::string times;
+    // Dictionaries: the sorted tids of the chunk, and its stack ids.
+    std::vector<pid_t> tids;
+    std::vector<StackId> stacks;
+    // Varint encoded runs of the threads, in the order of @tids, starting
+    // at @thread_offsets[i] for thread i. See Seal().
+    std::string runs;
+    std::vector<uint32_t> thread_offsets;
+    // Bit-packed states of all the samples, in the order of @tids and time.
+    // The samples of thread i start at index @state_offsets[i].
+    std::string states;
+    std::vector<uint32_t> state_offsets;
+
+    int64_t size_bytes() const;
+  };
+  // Sample of the open chunk.
+  struct OpenSample {
+    pid_t tid;
+    StackId stack;
+    ThreadState state;
+  };
+
+  // Encodes the open chunk into a sealed one. Expects @m_ to be held.
+  void Seal();
+  // Invokes @visitor with the rows of @chunk in the range and selected by
+  // @filter, thread by thread.
+  static void Decode(const Chunk& chunk,
+                     int64_t start_ns,
+                     int64_t end_ns,
+                     const std::function<bool(pid_t)>& filter,
+                     const std::function<void(const Row&)>& visitor);
+  // Fills @chunks with the sealed chunks that overlap [@start_ns, @end_ns],
+  // and @open with the rows of the open chunk in that range and selected by
+  // @filter.
+  void Snapshot(int64_t start_ns,
+                int64_t end_ns,
+                const std::function<bool(pid_t)>& filter,
+                std::vector<std::shared_ptr<const Chunk>>* chunks,
+                std::vector<Row>* open) const;
+
+  const Options options_;
+  // Reused across rounds by OnSamples(...).
+  std::vector<ThreadState> states_;
+
+  // Protects the members below.
+  mutable std::mutex m_;
+  // Sealed chunks, in time order. Shared with the visitors that decode them.
+  std::deque<std::shared_ptr<const Chunk>> chunks_;
+  int64_t sealed_bytes_ = 0;
+  int64_t sealed_samples_ = 0;
+  // Rounds of the open chunk: their times, and the offsets of their first
+  // samples in @open_samples_.
+  std::vector<int64_t> open_times_;
+  std::vector<uint32_t> open_offsets_;
+  std::vector<OpenSample> open_samples_;
+
+  // Disable copy c'tor and assignment operator.
+  SampleStore(const SampleStore&) = delete;
+  SampleStore& operator=(const SampleStore&) = delete;
+};
+
+}  // namespace threadstacks
+
+#endif  // THREADSTACKS_SAMPLE_STORE_H_
@@ -0,0 +1,146 @@
+// Copyright: ThoughtSpot Inc 2017
+
+#include "threadstacks/sample_store.h"
+
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "threadstacks/signal_handler.h"
+
+namespace threadstacks {
+namespace {
+
+const int kNumThreads = 20;
+const int64_t kPeriodNs = 10 * 1000 * 1000;
+const int64_t kStartNs = 1000 * 1000 * 1000;
+
+int64_t RoundTime(int round) { return kStartNs + round * kPeriodNs; }
+
+// Appends rounds [@first_round, @end_round) to @store: thread 100 + i has
+// stack trace i % 3, except that thread 105 moves to stack trace 7 from round
+// 500, and thread 119 only lives through rounds [300, 700). Thread 100 is in
+// uninterruptible sleep in rounds [100, 200).
+void AppendRounds(int first_round, int end_round, SampleStore* store) {
+  std::vector<Sampler::Sample> samples;
+  std::vector<SampleStore::ThreadState> states;
+  for (int round = first_round; round < end_round; ++round) {
+    samples.clear();
+    states.clear();
+    for (int i = 0; i < kNumThreads; ++i) {
+      if (i == 19 && (round < 300 || round >= 700)) {
+        continue;
+      }
+      const StackId stack = i == 5 && round >= 500 ? 7 : i % 3;
+      samples.push_back({100 + i, stack});
+      states.push_back(i == 0 && round >= 100 && round < 200
+                           ? SampleStore::kDiskSleep
+                           : SampleStore::kSleeping);
+    }
+    store->Append(RoundTime(round), samples.data(), states.data(),
+                  samples.size());
+  }
+}
+
+TEST(SampleStoreTest, Query) {
+  SampleStore::Options options;
+  options.rounds_per_chunk = 100;
+  SampleStore store(options);
+  AppendRounds(0, 1000, &store);
+  EXPECT_EQ(10, store.num_chunks());
+  const int64_t num_samples = 1000 * (kNumThreads - 1) + 400;
+  EXPECT_EQ(num_samples, store.num_samples());
+  EXPECT_GT(num_samples, store.size_bytes());
+  // Samples of the open chunk aren't encoded yet.
+  AppendRounds(1000, 1050, &store);
+
+  std::vector<SampleStore::Row> rows;
+  // All of thread 105, from all the chunks, and the open one.
+  EXPECT_EQ(10, store.Query(0, RoundTime(2000),
+                            [](pid_t tid) { return tid == 105; }, &rows));
+  ASSERT_EQ(1050, rows.size());
+  for (int round = 0; round < 1050; ++round) {
+    EXPECT_EQ(RoundTime(round), rows[round].time_ns);
+    EXPECT_EQ(105, rows[round].tid);
+    EXPECT_EQ(round >= 500 ? 7 : 2, rows[round].stack);
+    EXPECT_EQ(SampleStore::kSleeping, rows[round].state);
+  }
+
+  // Only the chunk of the range is decoded.
+  EXPECT_EQ(1, store.Query(RoundTime(150), RoundTime(160),
+                           [](pid_t tid) { return tid == 100; }, &rows));
+  ASSERT_EQ(11, rows.size());
+  for (const auto& row : rows) {
+    EXPECT_EQ(SampleStore::kDiskSleep, row.state);
+  }
+  EXPECT_EQ(2, store.Query(RoundTime(199), RoundTime(200),
+                           [](pid_t tid) { return tid == 100; }, &rows));
+  ASSERT_EQ(2, rows.size());
+  EXPECT_EQ(SampleStore::kDiskSleep, rows[0].state);
+  EXPECT_EQ(SampleStore::kSleeping, rows[1].state);
+
+  // Threads that don't live through whole chunks.
+  store.Query(0, RoundTime(2000), [](pid_t tid) { return tid == 119; },
+              &rows);
+  ASSERT_EQ(400, rows.size());
+  EXPECT_EQ(RoundTime(300), rows.front().time_ns);
+  EXPECT_EQ(RoundTime(699), rows.back().time_ns);
+
+  // All the threads of a round, in the open chunk, ordered by tid.
+  EXPECT_EQ(0, store.Query(RoundTime(1020), RoundTime(1020), nullptr, &rows));
+  ASSERT_EQ(kNumThreads - 1, rows.size());
+  for (int i = 0; i < kNumThreads - 1; ++i) {
+    EXPECT_EQ(100 + i, rows[i].tid);
+  }
+}
+
+TEST(SampleStoreTest, MaxBytes) {
+  SampleStore::Options options;
+  options.rounds_per_chunk = 100;
+  options.max_bytes = 1;
+  SampleStore store(options);
+  AppendRounds(0, 1000, &store);
+  // The latest chunk is always kept.
+  EXPECT_EQ(1, store.num_chunks());
+  EXPECT_EQ(100 * (kNumThreads - 1), store.num_samples());
+  std::vector<SampleStore::Row> rows;
+  EXPECT_EQ(0, store.Query(0, RoundTime(899), nullptr, &rows));
+  EXPECT_TRUE(rows.empty());
+  EXPECT_EQ(1, store.Query(0, RoundTime(900), nullptr, &rows));
+  EXPECT_EQ(kNumThreads - 1, rows.size());
+}
+
+TEST(SampleStoreTest, Sampler) {
+  SampleStore::Options options;
+  options.rounds_per_chunk = 2;
+  SampleStore store(options);
+  Sampler sampler(Sampler::Options{});
+  sampler.AddListener(&store);
+  std::string error;
+  for (int i = 0; i < 3; ++i) {
+    ASSERT_TRUE(sampler.SampleOnce(&error)) << error;
+  }
+  EXPECT_EQ(1, store.num_chunks());
+  std::vector<SampleStore::Row> rows;
+  store.Query(0, INT64_MAX, nullptr, &rows);
+  EXPECT_EQ(store.num_samples(), rows.size());
+  ASSERT_LE(3, rows.size());
+  int num_main = 0;
+  for (const auto& row : rows) {
+    num_main += row.tid == getpid();
+  }
+  EXPECT_EQ(3, num_main);
+}
+
+}  // namespace
+}  // namespace threadstacks
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  if (not threadstacks::StackTraceSignal::InstallInternalHandler()) {
+    return 1;
+  }
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,240 @@
+// Copyright: ThoughtSpot Inc 2017
+
+#include "threadstacks/sampler.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+#include "common/sysutil.h"
+#include "threadstacks/symbol_table.h"
+
+namespace threadstacks {
+
+std::string Sampler::Profile::ToFoldedString(
+    const SymbolTable* symbols) const {
+  std::string out;
+  char buf[32];
+  for (StackId id = 0; id < counts.size(); ++id) {
+    if (counts[id] == 0) {
+      continue;
+    }
+    const auto* addrs = stacks->addresses(id);
+    for (int i = stacks->depth(id) - 1; i >= 0; --i) {
+      if (symbols != nullptr) {
+        out.append(symbols->Lookup(addrs[i]));
+      } else {
+        snprintf(buf, sizeof(buf), "%#lx", addrs[i]);
+        out.append(buf);
+      }
+      if (i > 0) {
+        out.append(";");
+      }
+    }
+    snprintf(buf, sizeof(buf), " %ld\n", counts[id]);
+    out.append(buf);
+  }
+  return out;
+}
+
+void Sampler::Profile::Symbolize(SymbolTable* symbols) const {
+  symbols->Add(*stacks, [this](StackId id) {
+    return id < counts.size() && counts[id] != 0;
+  });
+  symbols->Symbolize(nullptr);
+}
+
+auto Sampler::Profile::GetExemplars(StackId id) const
+    -> std::vector<Exemplar> {
+  if (id >= counts.size() || exemplars_per_stack == 0) {
+    return {};
+  }
+  const auto begin = exemplars.begin() + id * exemplars_per_stack;
+  return std::vector<Exemplar>(
+      begin, begin + std::min<int64_t>(counts[id], exemplars_per_stack));
+}
+
+void Sampler::Profile::DropUnknownStacks(const std::vector<int64_t>* samples) {
+  if (stacks == nullptr ||
+      counts.size() <= static_cast<size_t>(stacks->size())) {
+    return;
+  }
+  const auto& dropped = samples != nullptr ? *samples : counts;
+  for (size_t id = stacks->size(); id < dropped.size(); ++id) {
+    num_samples -= dropped[id];
+  }
+  counts.resize(stacks->size());
+  if (exemplars.size() >
+      static_cast<size_t>(stacks->size()) * exemplars_per_stack) {
+    exemplars.resize(stacks->size() * exemplars_per_stack);
+  }
+}
+
+Sampler::Sampler(const Options& options)
+    : options_(options), stacks_(std::make_shared<StackTable>()) {
+  collector_.set_timeout_ms(options_.timeout_ms);
+  profile_.exemplars_per_stack = std::max(options_.exemplars_per_stack, 0);
+}
+
+Sampler::~Sampler() { Stop(); }
+
+void Sampler::AddListener(Listener* listener) {
+  listeners_.push_back(listener);
+}
+
+bool Sampler::Start() {
+  std::lock_guard<std::mutex> l(m_);
+  if (thread_.joinable()) {
+    return false;
+  }
+  stop_ = false;
+  thread_ = std::thread(&Sampler::Run, this);
+  return true;
+}
+
+void Sampler::Stop() {
+  {
+    std::lock_guard<std::mutex> l(m_);
+    stop_ = true;
+  }
+  stop_cv_.notify_all();
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+}
+
+bool Sampler::SampleOnce(std::string* error) { return TakeRound(error); }
+
+auto Sampler::GetProfile() const -> Profile {
+  std::lock_guard<std::mutex> l(m_);
+  Profile profile = profile_;
+  profile.stacks = stacks_;
+  return profile;
+}
+
+auto Sampler::ResetProfile() -> Profile {
+  std::lock_guard<std::mutex> l(m_);
+  Profile profile = std::move(profile_);
+  profile.stacks = stacks_;
+  profile_ = Profile();
+  profile_.exemplars_per_stack = profile.exemplars_per_stack;
+  return profile;
+}
+
+void Sampler::Run() {
+  const auto period = std::chrono::nanoseconds(
+      static_cast<int64_t>(1e9 / std::max(options_.rate_hz, 1e-3)));
+  auto next = std::chrono::steady_clock::now();
+  bool failing = false;
+  while (true) {
+    {
+      std::unique_lock<std::mutex> l(m_);
+      if (stop_cv_.wait_until(l, next, [this]() { return stop_; })) {
+        return;
+      }
+    }
+    std::string error;
+    if (not TakeRound(&error)) {
+      // Report only the first of consecutive failures.
+      if (not failing) {
+        std::cerr << "Failed to sample stack traces: " << error << std::endl;
+      }
+      failing = true;
+    } else {
+      failing = false;
+    }
+    // Skip the rounds that were missed, e.g. because collections took longer
+    // than the sampling period.
+    next += period;
+    const auto now = std::chrono::steady_clock::now();
+    if (next < now) {
+      next = now + period;
+    }
+  }
+}
+
+bool Sampler::TakeRound(std::string* error) {
+  if (not collector_.Collect(nullptr, &collection_, error)) {
+    return false;
+  }
+  const auto time_ns = common::Sysutil::WallTimeNs();
+  samples_.clear();
+  cpu_ns_.clear();
+  for (const auto& group : collection_) {
+    for (int i = 0; i < group.num_tids; ++i) {
+      cpu_ns_.emplace_back(group.tids[i], group.cpu_ns[i]);
+    }
+  }
+  std::sort(cpu_ns_.begin(), cpu_ns_.end());
+  {
+    std::lock_guard<std::mutex> l(m_);
+    // Never modify a table that is shared with a profile.
+    if (stacks_.use_count() > 1) {
+      stacks_ = std::make_shared<StackTable>(*stacks_);
+    }
+    for (const auto& group : collection_) {
+      const auto id = stacks_->Intern(*group.trace);
+      if (id >= profile_.counts.size()) {
+        profile_.counts.resize(id + 1, 0);
+        profile_.exemplars.resize(
+            profile_.counts.size() * profile_.exemplars_per_stack);
+      }
+      for (int i = 0; i < group.num_tids; ++i) {
+        samples_.push_back({group.tids[i], id, group.tags[i],
+                            CpuDelta(group.tids[i], group.cpu_ns[i])});
+        CountSample(time_ns, samples_.back());
+      }
+    }
+    if (profile_.num_rounds == 0) {
+      profile_.start_ns = time_ns;
+    }
+    profile_.end_ns = time_ns;
+    ++profile_.num_rounds;
+    profile_.num_samples += samples_.size();
+  }
+  // Note that only this thread modifies @stacks_, so it can be read without
+  // holding the lock.
+  for (auto* listener : listeners_) {
+    listener->OnSamples(time_ns, *stacks_, samples_.data(), samples_.size());
+  }
+  collection_.Clear();
+  last_cpu_ns_.swap(cpu_ns_);
+  return true;
+}
+
+void Sampler::CountSample(int64_t time_ns, const Sample& sample) {
+  const int64_t count = ++profile_.counts[sample.stack];
+  const int k = profile_.exemplars_per_stack;
+  if (k == 0) {
+    return;
+  }
+  // The count-th sample replaces a random exemplar with probability
+  // k / count.
+  const int64_t slot =
+      count <= k ? count - 1
+                 : std::uniform_int_distribution<int64_t>(0, count - 1)(rng_);
+  if (slot >= k) {
+    return;
+  }
+  auto& exemplar = profile_.exemplars[sample.stack * k + slot];
+  exemplar.tid = sample.tid;
+  exemplar.time_ns = time_ns;
+  exemplar.cpu_ns = sample.cpu_ns;
+  strncpy(exemplar.tag, sample.tag, sizeof(exemplar.tag) - 1);
+  exemplar.tag[sizeof(exemplar.tag) - 1] = '\0';
+}
+
+int64_t Sampler::CpuDelta(pid_t tid, int64_t cpu_ns) {
+  auto it = std::lower_bound(last_cpu_ns_.begin(), last_cpu_ns_.end(),
+                             std::make_pair(tid, int64_t{-1}));
+  if (cpu_ns < 0 || it == last_cpu_ns_.end() || it->first != tid ||
+      it->second < 0) {
+    return -1;
+  }
+  // A tid reused by a new thread may have consumed less CPU time.
+  return std::max<int64_t>(cpu_ns - it->second, 0);
+}
+
+}  // namespace threadstacks
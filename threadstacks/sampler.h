@@ -0,0 +1,195 @@
+// Copyright: ThoughtSpot Inc 2017
+
+#ifndef THREADSTACKS_SAMPLER_H_
+#define THREADSTACKS_SAMPLER_H_
+
+#include <sys/types.h>
+
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "threadstacks/context_tag.h"
+#include "threadstacks/signal_handler.h"
+#include "threadstacks/stack_table.h"
+
+namespace threadstacks {
+
+class SymbolTable;
+
+// A Sampler periodically collects the stack traces of all the threads of the
+// process, interns them in a StackTable, and aggregates them into a Profile,
+// i.e. the number of times every stack trace was seen. Listeners can also
+// observe every round of samples as it is taken, e.g. to keep a history.
+//
+// Note: The internal stacktrace collection signal handler must be installed
+// for sampling to work.
+class Sampler {
+ public:
+  struct Options {
+    // Number of sampling rounds per second.
+    double rate_hz = 10;
+    // Time to wait for threads to respond in every round, in milliseconds.
+    int64_t timeout_ms = 1000;
+    // Number of exemplars kept per stack trace in the profile, see
+    // Profile::exemplars. 0 to keep none.
+    int exemplars_per_stack = 4;
+  };
+
+  // The stack trace of a thread in a sampling round.
+  struct Sample {
+    pid_t tid;
+    StackId stack;
+    // Context tag of the thread, see ContextTag, or "" if it had none. Only
+    // valid during Listener::OnSamples(...).
+    const char* tag = "";
+    // CPU time consumed by the thread since its sample in the previous round,
+    // in nanoseconds, or -1 if it had none.
+    int64_t cpu_ns = -1;
+  };
+
+  // A sample kept in a profile as an example of the samples of its stack
+  // trace.
+  struct Exemplar {
+    pid_t tid;
+    // Wall time of the round, in nanoseconds since the epoch.
+    int64_t time_ns;
+    // See Sample::cpu_ns.
+    int64_t cpu_ns;
+    // Context tag of the thread, NUL terminated.
+    char tag[ContextTag::kMaxSize];
+  };
+
+  // Profile aggregated over a number of sampling rounds.
+  struct Profile {
+    // Stack traces that @counts refer to. Note that the table is shared
+    // with, and never modified by, the sampler.
+    std::shared_ptr<const StackTable> stacks;
+    // counts[id] is the number of samples with stack trace @id. Stack traces
+    // interned after the profile was taken don't have a count.
+    std::vector<int64_t> counts;
+    // Number of sampling rounds, and the total number of samples over them.
+    int64_t num_rounds = 0;
+    int64_t num_samples = 0;
+    // Wall time of the first and the last round, in nanoseconds since the
+    // epoch.
+    int64_t start_ns = 0;
+    int64_t end_ns = 0;
+    // Uniform random sample of the samples of every stack trace, which
+    // survives aggregation, e.g. to tell which threads, tags and how much CPU
+    // time make up a count. Stack trace @id has min(counts[id],
+    // exemplars_per_stack) exemplars, starting at
+    // exemplars[id * exemplars_per_stack]. Every sample is kept with the same
+    // probability (reservoir sampling), in O(1) time and memory per stack
+    // trace.
+    int exemplars_per_stack = 0;
+    std::vector<Exemplar> exemplars;
+
+    // Returns the profile in the folded format used by flame graph tools: a
+    // line per stack trace with a non-zero count, with the frames from the
+    // outermost to the innermost separated by ';', followed by a space and
+    // the count. Frames are looked up in @symbols, or printed as hex
+    // addresses if @symbols is null.
+    std::string ToFoldedString(const SymbolTable* symbols) const;
+    // Adds all the addresses of stack traces with a non-zero count to
+    // @symbols, and symbolizes them.
+    void Symbolize(SymbolTable* symbols) const;
+    // Returns the exemplars of stack trace @id.
+    std::vector<Exemplar> GetExemplars(StackId id) const;
+    // Drops the counts of the stack traces that aren't in @stacks, i.e. were
+    // interned after the table was taken, and their samples from
+    // @num_samples. @samples[id] is the number of samples that make up
+    // counts[id]; if @samples is null, the counts are numbers of samples.
+    void DropUnknownStacks(const std::vector<int64_t>* samples = nullptr);
+  };
+
+  // Observes sampling rounds.
+  class Listener {
+   public:
+    virtual ~Listener() = default;
+    // Called on the sampling thread after every round taken at @time_ns (wall
+    // time in nanoseconds since the epoch), with the @num_samples samples of
+    // the round. @stacks holds the stack traces of the samples, and must not
+    // be used after the call returns.
+    virtual void OnSamples(int64_t time_ns,
+                           const StackTable& stacks,
+                           const Sample* samples,
+                           int num_samples) = 0;
+  };
+
+  explicit Sampler(const Options& options);
+  // Stops sampling, if started.
+  ~Sampler();
+
+  // Adds @listener, which must outlive the sampler. Must be called before
+  // Start(), or in between Stop() and Start().
+  void AddListener(Listener* listener);
+
+  // Starts sampling on a thread of its own. Returns false if already
+  // started.
+  bool Start();
+  // Stops sampling, and waits for the sampling thread to exit.
+  void Stop();
+
+  // Takes a single sampling round on the calling thread. Must not be called
+  // while sampling is started. Returns false on failure, in which case
+  // @error is filled with a descriptive error message.
+  bool SampleOnce(std::string* error);
+
+  // Returns the profile aggregated since the sampler was created, or last
+  // reset.
+  Profile GetProfile() const;
+  // Returns the profile aggregated so far, and starts aggregating a new one.
+  // Note that stack ids stay valid across resets.
+  Profile ResetProfile();
+
+ private:
+  // The function run by the sampling thread.
+  void Run();
+  // Takes a sampling round.
+  bool TakeRound(std::string* error);
+  // Counts @sample, taken at @time_ns, in @profile_. Must be called with @m_
+  // held.
+  void CountSample(int64_t time_ns, const Sample& sample);
+  // Returns the CPU time consumed by thread @tid since the previous round,
+  // given the CPU time @cpu_ns it consumed so far, or -1 if unknown.
+  int64_t CpuDelta(pid_t tid, int64_t cpu_ns);
+
+  const Options options_;
+  std::vector<Listener*> listeners_;
+  // Reused across rounds, so that steady-state rounds don't allocate.
+  StackTraceCollector collector_;
+  StackTraceCollection collection_;
+  std::vector<Sample> samples_;
+  // CPU time of every thread in the previous and the current round, sorted
+  // by tid.
+  std::vector<std::pair<pid_t, int64_t>> last_cpu_ns_;
+  std::vector<std::pair<pid_t, int64_t>> cpu_ns_;
+
+  // Protects the members below.
+  mutable std::mutex m_;
+  // Signalled when @stop_ is set.
+  std::condition_variable stop_cv_;
+  bool stop_ = false;
+  std::thread thread_;
+  // Copied on write, if it's shared with a Profile when a new stack trace is
+  // interned.
+  std::shared_ptr<StackTable> stacks_;
+  Profile profile_;
+  // Picks the exemplars to replace.
+  std::minstd_rand rng_;
+
+  // Disable copy c'tor and assignment operator.
+  Sampler(const Sampler&) = delete;
+  Sampler& operator=(const Sampler&) = delete;
+};
+
+}  // namespace threadstacks
+
+#endif  // THREADSTACKS_SAMPLER_H_
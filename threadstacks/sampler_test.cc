@@ -0,0 +1,216 @@
+// Copyright: ThoughtSpot Inc 2017
+
+#include "threadstacks/sampler.h"
+
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "threadstacks/context_tag.h"
+#include "threadstacks/signal_handler.h"
+
+namespace threadstacks {
+
+TEST(StackTableTest, Intern) {
+  StackTable table;
+  const int64_t a[] = {1, 2, 3};
+  const int64_t b[] = {1, 2};
+  EXPECT_EQ(-1, table.Find(a, 3));
+  EXPECT_EQ(0, table.Intern(a, 3));
+  EXPECT_EQ(1, table.Intern(b, 2));
+  EXPECT_EQ(0, table.Intern(a, 3));
+  EXPECT_EQ(1, table.Find(b, 2));
+  EXPECT_EQ(2, table.size());
+  EXPECT_EQ(3, table.depth(0));
+  EXPECT_EQ(2, table.depth(1));
+  EXPECT_EQ(3, table.addresses(0)[2]);
+
+  table.Clear();
+  EXPECT_EQ(0, table.size());
+  EXPECT_EQ(-1, table.Find(a, 3));
+}
+
+class CountingListener : public Sampler::Listener {
+ public:
+  void OnSamples(int64_t time_ns,
+                 const StackTable& stacks,
+                 const Sampler::Sample* samples,
+                 int num_samples) override {
+    ++rounds;
+    for (int i = 0; i < num_samples; ++i) {
+      EXPECT_LT(samples[i].stack, stacks.size());
+    }
+    last_num_samples = num_samples;
+  }
+
+  int rounds = 0;
+  int last_num_samples = 0;
+};
+
+// Records the time of every round.
+class RoundTimes : public Sampler::Listener {
+ public:
+  void OnSamples(int64_t time_ns,
+                 const StackTable& stacks,
+                 const Sampler::Sample* samples,
+                 int num_samples) override {
+    times.push_back(time_ns);
+  }
+
+  std::vector<int64_t> times;
+};
+
+TEST(SamplerTest, SampleOnce) {
+  Sampler sampler{Sampler::Options()};
+  CountingListener listener;
+  sampler.AddListener(&listener);
+  std::string error;
+  ASSERT_TRUE(sampler.SampleOnce(&error)) << error;
+  ASSERT_TRUE(sampler.SampleOnce(&error)) << error;
+
+  EXPECT_EQ(2, listener.rounds);
+  EXPECT_LE(1, listener.last_num_samples);
+  const auto profile = sampler.GetProfile();
+  EXPECT_EQ(2, profile.num_rounds);
+  EXPECT_EQ(2 * listener.last_num_samples, profile.num_samples);
+  EXPECT_LE(profile.start_ns, profile.end_ns);
+  int64_t total = 0;
+  for (auto count : profile.counts) {
+    total += count;
+  }
+  EXPECT_EQ(profile.num_samples, total);
+  EXPECT_FALSE(profile.ToFoldedString(nullptr).empty());
+}
+
+TEST(SamplerTest, ResetProfileKeepsStackIds) {
+  Sampler sampler{Sampler::Options()};
+  std::string error;
+  ASSERT_TRUE(sampler.SampleOnce(&error)) << error;
+  const auto first = sampler.ResetProfile();
+  const int first_size = first.stacks->size();
+  EXPECT_EQ(1, first.num_rounds);
+  EXPECT_EQ(0, sampler.GetProfile().num_rounds);
+
+  // Interning new stack traces must not modify the table of @first.
+  std::thread other([&sampler, &error]() {
+    ASSERT_TRUE(sampler.SampleOnce(&error)) << error;
+  });
+  other.join();
+  EXPECT_EQ(first_size, first.stacks->size());
+  const auto second = sampler.GetProfile();
+  EXPECT_EQ(1, second.num_rounds);
+  EXPECT_LE(first_size, second.stacks->size());
+  for (int id = 0; id < first_size; ++id) {
+    EXPECT_EQ(id, second.stacks->Find(first.stacks->addresses(id),
+                                      first.stacks->depth(id)));
+  }
+}
+
+TEST(SamplerTest, Exemplars) {
+  // A tagged thread that burns CPU, and one that blocks.
+  std::atomic<bool> stop{false};
+  std::atomic<int> num_ready{0};
+  std::atomic<pid_t> busy_tid{0};
+  std::thread busy([&]() {
+    ContextTag tag("busy");
+    ScopedContextTag scoped(&tag);
+    busy_tid = syscall(SYS_gettid);
+    ++num_ready;
+    while (not stop) {
+    }
+  });
+  int fds[2];
+  ASSERT_EQ(0, pipe(fds));
+  std::thread blocked([&]() {
+    ++num_ready;
+    char c;
+    read(fds[0], &c, 1);
+  });
+  while (num_ready != 2) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  Sampler::Options options;
+  options.exemplars_per_stack = 2;
+  Sampler sampler(options);
+  RoundTimes rounds;
+  sampler.AddListener(&rounds);
+  const int kNumRounds = 50;
+  std::string error;
+  for (int i = 0; i < kNumRounds; ++i) {
+    ASSERT_TRUE(sampler.SampleOnce(&error)) << error;
+  }
+  stop = true;
+  busy.join();
+  close(fds[1]);
+  blocked.join();
+  close(fds[0]);
+
+  const auto profile = sampler.GetProfile();
+  EXPECT_EQ(2, profile.exemplars_per_stack);
+  bool busy_cpu = false;
+  bool spread = false;
+  for (StackId id = 0; id < profile.counts.size(); ++id) {
+    const auto exemplars = profile.GetExemplars(id);
+    ASSERT_EQ(std::min<int64_t>(profile.counts[id], 2), exemplars.size());
+    for (const auto& exemplar : exemplars) {
+      EXPECT_LE(profile.start_ns, exemplar.time_ns);
+      EXPECT_GE(profile.end_ns, exemplar.time_ns);
+      if (exemplar.tid == busy_tid) {
+        EXPECT_STREQ("busy", exemplar.tag);
+        busy_cpu |= exemplar.cpu_ns > 0;
+      } else {
+        EXPECT_STREQ("", exemplar.tag);
+      }
+      // The exemplars of a stack trace seen once per round aren't just the
+      // first ones, except with probability 1 / C(50, 2).
+      spread |= profile.counts[id] == kNumRounds &&
+                exemplar.time_ns > rounds.times[1];
+    }
+  }
+  EXPECT_TRUE(busy_cpu);
+  EXPECT_TRUE(spread);
+  EXPECT_TRUE(profile.GetExemplars(profile.counts.size()).empty());
+
+  // No exemplars are kept if disabled.
+  options.exemplars_per_stack = 0;
+  Sampler disabled(options);
+  ASSERT_TRUE(disabled.SampleOnce(&error)) << error;
+  EXPECT_TRUE(disabled.GetProfile().exemplars.empty());
+  EXPECT_TRUE(disabled.GetProfile().GetExemplars(0).empty());
+}
+
+TEST(SamplerTest, StartStop) {
+  Sampler::Options options;
+  options.rate_hz = 100;
+  Sampler sampler(options);
+  CountingListener listener;
+  sampler.AddListener(&listener);
+  ASSERT_TRUE(sampler.Start());
+  EXPECT_FALSE(sampler.Start());
+  while (sampler.GetProfile().num_rounds < 3) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  sampler.Stop();
+  const auto rounds = sampler.GetProfile().num_rounds;
+  EXPECT_EQ(rounds, listener.rounds);
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  EXPECT_EQ(rounds, sampler.GetProfile().num_rounds);
+}
+
+}  // namespace threadstacks
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  if (threadstacks::StackTraceSignal::InstallInternalHandler()) {
+    return RUN_ALL_TESTS();
+  }
+  std::cerr << "Failed to install signal handler" << std::endl;
+  return -1;
+}
@@ -5,43 +5,92 @@
 #include "threadstacks/signal_handler.h"
 #include "absl/debugging/symbolize.h"
 #include <fcntl.h>
+#include <sched.h>
 // The following #define makes libunwind use a faster unwinding mechanism.
 #define UNW_LOCAL_ONLY
 #include <libunwind.h>
+#include <sys/eventfd.h>
 #include <sys/select.h>
 #include <sys/syscall.h>
 #include <sys/timerfd.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
 
 #include <algorithm>
+#include <atomic>
+#include <cerrno>
 #include <cstring>
 #include <iomanip>
 #include <iostream>
-#include <future>
-#include <map>
 #include <memory>
-#include <set>
-#include <sstream>
+#include <mutex>
 #include <string>
 #include <vector>
 
+#include "common/buffered_channel.h"
+#include "common/cancellation.h"
 #include "common/defer.h"
+#include "common/rate_limiter.h"
 #include "common/sysutil.h"
+#include "common/worker_pool.h"
+#include "threadstacks/context_tag.h"
 #include "threadstacks/stack_tracer.h"
+#include "threadstacks/symbol_table.h"
 
 namespace threadstacks {
-namespace {
 
 // A form sent by StackTraceCollector to threads to fill in their stack trace
 // and submit the results. Note that methods of this class invoked by signal
 // handler of recipient threads should *NOT* call any async-signal-unsafe
 // methods.
+//
+// A form's lifecycle is driven by its state:
+//   kFree -> kPending:      Collector hands out the form to a thread.
+//   kPending -> kWriting:   Signal handler of the thread starts filling it in.
+//   kWriting -> kDone:      Signal handler has filled in and submitted it.
+//   kPending -> kAbandoned: Collector gave up waiting for the thread (timeout
+//                           or cancellation).
+//   * -> kFree:             Form is returned to StackTraceFormPool.
+// Only a handler that wins the kPending -> kWriting transition touches the
+// form, which neutralizes signals that are delivered after the collector has
+// moved on.
 class StackTraceForm {
  public:
-  StackTraceForm(pid_t tid, int ack_fd) : ack_fd_(ack_fd) { stack_.tid = tid; }
+  enum State { kFree, kPending, kWriting, kDone, kAbandoned };
+
+  StackTraceForm() = default;
   ~StackTraceForm() = default;
 
+  // Prepares the form for collecting the stack trace of thread @tid, to be
+  // acked on @ack_fd. Must only be called on a kFree form.
+  void Reset(pid_t tid, int ack_fd) {
+    stack_.tid = tid;
+    stack_.depth = 0;
+    tag_[0] = '\0';
+    cpu_ns_ = -1;
+    ack_fd_ = ack_fd;
+    state_.store(kPending, std::memory_order_release);
+  }
+
+  // Claims the form on behalf of the calling thread @tid. Returns false if the
+  // form is not meant to be filled in by the caller, e.g. because the
+  // collector already gave up on it.
+  bool Claim(pid_t tid) {
+    int expected = kPending;
+    if (not state_.compare_exchange_strong(expected, kWriting,
+                                           std::memory_order_acquire)) {
+      return false;
+    }
+    if (stack_.tid != tid) {
+      // A stale signal from an earlier collection, delivered after this form
+      // was recycled for a different thread.
+      state_.store(kPending, std::memory_order_release);
+      return false;
+    }
+    return true;
+  }
+
   // Adds an address to the stack trace.
   bool AddInfo(int64_t size, int64_t address) {
     if (stack_.depth >= ThreadStack::kMaxDepth) {
@@ -53,30 +102,310 @@ class StackTraceForm {
     return true;
   }
 
-  // Submits the strack trace form.
+  // Copies the context tag @tag, if any, into the form.
+  void SetTag(const ContextTag* tag) {
+    if (tag != nullptr) {
+      memcpy(tag_, tag->value, sizeof(tag_));
+      tag_[sizeof(tag_) - 1] = '\0';
+    }
+  }
+
+  // Records the CPU time consumed by the calling thread so far.
+  void SetCpuTime() {
+    struct timespec ts;
+    if (0 == clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts)) {
+      cpu_ns_ = static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+    }
+  }
+
+  // Submits the strack trace form. Must only be called after a successful
+  // Claim(...).
   bool Submit() {
     // Write a one-byte ack.
     const char ack_ch = 'y';  // Value doesn't matter.
     static_assert(1 == sizeof(ack_ch), "char size is not 1 byte");
     auto num_written = write(ack_fd_, &ack_ch, sizeof(ack_ch));
+    state_.store(kDone, std::memory_order_release);
     return sizeof(ack_ch) == num_written;
   }
 
+  // Settles the form after the collector stopped waiting for acks: a form that
+  // wasn't claimed yet is abandoned, and a form that is being filled in is
+  // waited upon. Returns true iff the form holds a submitted stack trace.
+  bool Settle() {
+    while (true) {
+      int expected = kPending;
+      if (state_.compare_exchange_strong(expected, kAbandoned)) {
+        return false;
+      }
+      if (kWriting != expected) {
+        return kDone == expected;
+      }
+      // A handler is at most a few hundred instructions away from submitting
+      // the form, so simply spin.
+      sched_yield();
+    }
+  }
+
+  void Release() { state_.store(kFree, std::memory_order_release); }
+
   // Returns a const reference to the stack trace submitted in the form.
   const ThreadStack& stack() const { return stack_; }
+  // Returns the context tag submitted in the form, or "" if there's none.
+  const char* tag() const { return tag_; }
+  // Returns the CPU time submitted in the form, or -1 if it's unknown.
+  int64_t cpu_ns() const { return cpu_ns_; }
 
  private:
+  // Current state of the form, one of State.
+  std::atomic<int> state_{kFree};
   // File descriptor where the ack should be written.
-  const int ack_fd_;
+  int ack_fd_ = -1;
   // Stack trace of the thread.
   ThreadStack stack_;
+  // Context tag of the thread, NUL terminated.
+  char tag_[ContextTag::kMaxSize];
+  // CPU time of the thread, in nanoseconds.
+  int64_t cpu_ns_ = -1;
+};
+
+namespace {
+
+void ErrLog(const char* msg) { write(STDERR_FILENO, msg, strlen(msg)); }
+
+// A process-wide pool of StackTraceForms. Pointers to forms are handed out to
+// signal handlers which may run arbitrarily late, e.g. if the target thread
+// has the signal blocked, so forms are never freed. Instead they are recycled
+// across collections, which also saves an allocation per thread per
+// collection.
+class StackTraceFormPool {
+ public:
+  static StackTraceFormPool* Get() {
+    // Intentionally leaked, see above.
+    static auto* pool = new StackTraceFormPool();
+    return pool;
+  }
+
+  // Returns a form ready to collect the stack trace of @tid.
+  StackTraceForm* Acquire(pid_t tid, int ack_fd) {
+    StackTraceForm* form = nullptr;
+    {
+      std::lock_guard<std::mutex> l(m_);
+      if (not free_.empty()) {
+        form = free_.back();
+        free_.pop_back();
+      }
+    }
+    if (form == nullptr) {
+      form = new StackTraceForm();
+    }
+    form->Reset(tid, ack_fd);
+    return form;
+  }
+
+  // Returns @form to the pool. The form must have been settled.
+  void Release(StackTraceForm* form) {
+    form->Release();
+    std::lock_guard<std::mutex> l(m_);
+    free_.push_back(form);
+  }
+
+ private:
+  StackTraceFormPool() = default;
+
+  std::mutex m_;
+  std::vector<StackTraceForm*> free_;
+};
+
+// Limits on, and counters of, external stack trace requests. Note that it is
+// constant-initialized, so it can be used from signal handlers, as well as
+// before the stack trace service is started.
+struct ExternalRequestControl {
+  // See StackTraceSignal::ExternalRequestLimits.
+  std::atomic<int64_t> min_interval_ms{0};
+  std::atomic<int> max_per_minute{0};
+  // See StackTraceSignal::ExternalRequestStats.
+  std::atomic<int64_t> received{0};
+  std::atomic<int64_t> served{0};
+  std::atomic<int64_t> coalesced{0};
+  std::atomic<int64_t> rejected{0};
+  std::atomic<int64_t> dropped{0};
+  std::atomic<int64_t> completed{0};
+};
+
+ExternalRequestControl external_request_control;
+
+// Thread filters and sinks that external stack trace requests can refer to,
+// see StackTraceSignal::RegisterExternalThreadFilter(...) and
+// StackTraceSignal::RegisterExternalSink(...).
+class ExternalRequestRegistry {
+ public:
+  static ExternalRequestRegistry* Get() {
+    // Intentionally leaked, so that the stack trace service thread can use it
+    // during exit.
+    static auto* registry = new ExternalRequestRegistry();
+    return registry;
+  }
+
+  void SetThreadFilter(int slot, std::function<bool(pid_t)> filter) {
+    std::lock_guard<std::mutex> l(m_);
+    filters_[slot] = std::move(filter);
+  }
+  void SetSink(int slot, std::function<void(const std::string&)> sink) {
+    std::lock_guard<std::mutex> l(m_);
+    sinks_[slot] = std::move(sink);
+  }
+  // Returns a copy of the filter in @slot, which may be empty.
+  std::function<bool(pid_t)> GetThreadFilter(int slot) {
+    std::lock_guard<std::mutex> l(m_);
+    return filters_[slot];
+  }
+  void SetDefaultOptions(
+      const StackTraceSignal::ExternalRequestOptions& options) {
+    std::lock_guard<std::mutex> l(m_);
+    default_options_ = options;
+  }
+  StackTraceSignal::ExternalRequestOptions GetDefaultOptions() {
+    std::lock_guard<std::mutex> l(m_);
+    return default_options_;
+  }
+  // Returns a copy of the sink in @slot, which may be empty.
+  std::function<void(const std::string&)> GetSink(int slot) {
+    std::lock_guard<std::mutex> l(m_);
+    return sinks_[slot];
+  }
+
+ private:
+  ExternalRequestRegistry() = default;
+
+  std::mutex m_;
+  std::function<bool(pid_t)>
+      filters_[StackTraceSignal::kNumExternalRequestSlots];
+  std::function<void(const std::string&)>
+      sinks_[StackTraceSignal::kNumExternalRequestSlots];
+  StackTraceSignal::ExternalRequestOptions default_options_;
+};
+
+// A fixed-size queue of external stack trace requests, filled in by the
+// external signal handler and drained by the stack trace service thread.
+// Push(...) is async-signal-safe: it neither allocates nor creates file
+// descriptors, and costs a single compare-and-swap per request, plus an
+// eventfd write (the doorbell) only if the service thread isn't already
+// awake. Requests that don't fit in the queue are dropped, and counted in
+// @external_request_control.
+//
+// The queue is a ring of kCapacity slots. Producers reserve a slot by
+// advancing @head_, and publish it by setting its sequence number. The single
+// consumer reads published slots in order and advances @tail_, which frees
+// the slots for reuse.
+class ExternalRequestQueue {
+ public:
+  // A request for a dump of stack traces.
+  struct Request {
+    // Pid of the process that sent the signal.
+    pid_t sender;
+    // How the signal was sent, e.g. SI_QUEUE for sigqueue().
+    int code;
+    // Payload of the signal. Only meaningful if it was sent with sigqueue().
+    sigval value;
+  };
+
+  ExternalRequestQueue() = default;
+  ~ExternalRequestQueue() = default;
+
+  // Creates the doorbell. Returns false on failure.
+  bool Init() {
+    doorbell_fd_ = eventfd(0, EFD_CLOEXEC);
+    if (doorbell_fd_ == -1) {
+      std::cerr << "Failed to create eventfd for stack trace requests"
+                << std::endl;  // errno
+      return false;
+    }
+    return true;
+  }
+
+  // Adds @request to the queue. Returns false if the queue is full.
+  bool Push(const Request& request) {
+    auto head = head_.load(std::memory_order_relaxed);
+    do {
+      if (head - tail_.load(std::memory_order_acquire) >= kCapacity) {
+        external_request_control.dropped.fetch_add(1,
+                                                   std::memory_order_relaxed);
+        return false;
+      }
+    } while (not head_.compare_exchange_weak(head, head + 1,
+                                             std::memory_order_relaxed));
+    auto& slot = slots_[head % kCapacity];
+    slot.request = request;
+    slot.seq.store(head + 1, std::memory_order_release);
+    // Ring the doorbell, unless it has been rung since the consumer last
+    // answered it.
+    if (not doorbell_rung_.exchange(true, std::memory_order_acq_rel)) {
+      const uint64_t one = 1;
+      if (sizeof(one) != write(doorbell_fd_, &one, sizeof(one))) {
+        ErrLog("Failed to ring stack trace service doorbell\n");
+      }
+    }
+    return true;
+  }
+
+  // Blocks until the doorbell is rung. Requests pushed before the doorbell
+  // was rung can then be popped. Must only be called by the consumer.
+  void Wait() {
+    uint64_t count;
+    while (-1 == read(doorbell_fd_, &count, sizeof(count))) {
+      if (errno != EINTR) {
+        std::cerr << "Failed to read stack trace service doorbell"
+                  << std::endl;  // errno
+        return;
+      }
+    }
+    doorbell_rung_.exchange(false, std::memory_order_acq_rel);
+  }
+
+  // Pops the oldest published request into @request. Returns false if there
+  // is none. Must only be called by the consumer.
+  bool Pop(Request* request) {
+    auto tail = tail_.load(std::memory_order_relaxed);
+    auto& slot = slots_[tail % kCapacity];
+    if (slot.seq.load(std::memory_order_acquire) != tail + 1) {
+      return false;
+    }
+    *request = slot.request;
+    tail_.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+ private:
+  // Maximum number of requests pending in the queue.
+  static constexpr uint64_t kCapacity = 1024;
+
+  struct Slot {
+    // Position of the request in the queue, plus one. Set once the request
+    // is published.
+    std::atomic<uint64_t> seq{0};
+    Request request;
+  };
+
+  Slot slots_[kCapacity];
+  // Position of the next slot to be reserved by a producer.
+  std::atomic<uint64_t> head_{0};
+  // Position of the next slot to be read by the consumer.
+  std::atomic<uint64_t> tail_{0};
+  // Whether the doorbell has been rung since the consumer last answered it.
+  std::atomic<bool> doorbell_rung_{false};
+  int doorbell_fd_ = -1;
 };
 
 // State associated with the external stacktrace signal handler.
 struct ExternalHandlerState {
   ExternalHandlerState();
   const pid_t server_tgid;
-  int server_fd;
+  // Whether the stack trace service thread is running.
+  bool running = false;
+  // Queue of requests to the stack trace service thread. Preallocated, so
+  // that the signal handler only has to fill in a slot.
+  ExternalRequestQueue requests;
 };
 
 // Note that this function uses a function local static to guarantee a single
@@ -84,25 +413,21 @@ struct ExternalHandlerState {
 // that any subsequent calls to this function don't update the external handler
 // state or result in any side-effects of construction of ExternalHandlerState
 // object (e.g. launch of RequestProcessor thread).
-const ExternalHandlerState& GetExternalHandlerState() {
+ExternalHandlerState& GetExternalHandlerState() {
   static ExternalHandlerState state;
   return state;
 };
 
 // Returns in @difference the set of elements that are present in the first
 // set, but not in the second one.
-template <typename T>
-void STLSetDifference(const std::set<T>& first,
-                      const std::set<T>& second,
-                      std::set<T>* difference) {
+template <typename Set>
+void STLSetDifference(const Set& first, const Set& second, Set* difference) {
   difference->clear();
   std::set_difference(first.begin(), first.end(),
                       second.begin(), second.end(),
                       std::inserter(*difference, difference->end()));
 }
 
-void ErrLog(const char* msg) { write(STDERR_FILENO, msg, strlen(msg)); }
-
 void InternalHandler(int signum, siginfo_t* siginfo, void* ucontext) {
   // Typically the stacktrace collection signal is sent by a StackTraceCollector
   // object. However, it can also be sent by an external entity, e.g. using
@@ -116,7 +441,13 @@ void InternalHandler(int signum, siginfo_t* siginfo, void* ucontext) {
     ErrLog("Couldn't retrieve StackTraceForm pointer, ignoring signal...\n");
     return;
   }
+  if (not form->Claim(syscall(SYS_gettid))) {
+    ErrLog("Ignoring stale stacktrace collection signal...\n");
+    return;
+  }
 
+  form->SetTag(GetContextTag());
+  form->SetCpuTime();
   BackwardsTrace trace;
   trace.Capture(ucontext);
   trace.stack().Visit([&](int, int size, int64_t addr) {
@@ -131,28 +462,14 @@ void InternalHandler(int signum, siginfo_t* siginfo, void* ucontext) {
 void ExternalHandler(int signum,
                      siginfo_t* siginfo,
                      void* ucontext,
-                     int stack_trace_fd) {
-  int pipe_fd[2];
-  if (-1 == pipe(pipe_fd)) {
-    ErrLog(
-        "Failed to create pipe for communicating with stack trace "
-        "service thread\n");
-    return;
-  }
-  // We don't wait for the stack trace service thread to finish servicing this
-  // request, so the read end can be closed right away.
-  close(pipe_fd[0]);
-  auto ret = write(stack_trace_fd, &pipe_fd[1], sizeof(pipe_fd[1]));
-  if (-1 == ret) {
-    // TODO(nipun): Print errno.
-    ErrLog("Failed to send a request to stack trace service thread\n");
-    close(pipe_fd[1]);
-    return;
-  }
-  if (sizeof(pipe_fd[1]) != ret) {
-    ErrLog("Failed to request stack trace service thread.\n");
-    close(pipe_fd[1]);
-    return;
+                     ExternalRequestQueue* requests) {
+  // Preserve errno for the interrupted code.
+  const int saved_errno = errno;
+  DEFER(errno = saved_errno);
+  external_request_control.received.fetch_add(1, std::memory_order_relaxed);
+  if (not requests->Push(
+          {siginfo->si_pid, siginfo->si_code, siginfo->si_value})) {
+    ErrLog("Too many pending requests to stack trace service thread\n");
   }
 }
 
@@ -175,7 +492,7 @@ void ExternalStackTraceSignalHandler(int signum,
         "group\n");
   } else {
     ExternalHandler(
-        signum, siginfo, ucontext, GetExternalHandlerState().server_fd);
+        signum, siginfo, ucontext, &GetExternalHandlerState().requests);
   }
 }
 
@@ -183,81 +500,278 @@ void ExternalStackTraceSignalHandler(int signum,
 // processes the collected stack traces. The default behavior is to write
 // stacktraces to stderr.
 
-// The function run by the stack trace service thread. Returns a file
-// descriptor, by populating @p, which can be written to request a dump of
-// stack trace on stderr. Each request should contain another file
-// descriptor, which is closed at the end of servicing the request - this can
-// be used by requesters to wait for their request to be serviced.
-void RequestProcessor(std::promise<int>* p) {
-  std::cout << "Started external stacktrace collection signal processor thread"
-            << std::endl;
-  int pipe_fd[2];
-  // Open the pipe with O_CLOEXEC so that it is not visible to an exec'ed
-  // child process.
-  if (0 != pipe2(pipe_fd, O_CLOEXEC)) {
-    std::cerr << "Failed to create pipe" << std::endl;  // errno, crash.
+// A request to dump stack traces to stderr, as it flows through the stages of
+// DumpPipeline.
+struct DumpRequest {
+  // Sequence number of the request, starting at 1.
+  int64_t id = 0;
+  StackTraceSignal::ExternalRequestOptions options;
+  // Populated by the collect stage.
+  StackTraceCollection collection;
+  std::string error;
+  bool collected = false;
+  // Populated by the symbolize stage.
+  SymbolTable symbols;
+  // Populated by the format stage.
+  std::string trace;
+  // The whole dump, populated by the write stage if it goes to a sink.
+  std::string dump;
+};
+
+// DumpPipeline services stack trace dump requests in four stages - collect,
+// symbolize, format and write - connected by bounded channels. The collect
+// stage runs on the thread submitting requests, and every other stage runs on
+// a thread of its own. The next request can be collected while the previous
+// one is still being symbolized, formatted or written, so that under repeated
+// triggers the throughput is limited by the slowest stage, rather than by the
+// sum of all the stages.
+//
+// A fixed number of DumpRequests circulate through the pipeline: Submit(...)
+// takes a free request, and the write stage returns it once done. This bounds
+// the number of requests in flight (Submit(...) blocks when all of them are
+// taken), and lets requests reuse their memory across dumps.
+class DumpPipeline {
+ public:
+  DumpPipeline()
+      : free_(kDepth), symbolize_(kDepth), format_(kDepth), write_(kDepth) {
+    for (int i = 0; i < kDepth; ++i) {
+      free_.Write(new DumpRequest());
+    }
+    // The pipeline runs for the entire lifetime of the process.
+    std::thread(&DumpPipeline::SymbolizeStage, this).detach();
+    std::thread(&DumpPipeline::FormatStage, this).detach();
+    std::thread(&DumpPipeline::WriteStage, this).detach();
   }
-  // Acknowledge the start of stack trace service thread.
-  p->set_value(pipe_fd[1]);
-  int64_t request_count = 0;
-  while (true) {
-    ++request_count;
-    int ack_fd;
-    auto ret = read(pipe_fd[0], &ack_fd, sizeof(ack_fd));
-    if (-1 == ret) {
-      std::cerr << "Failed to read stack trace service request"
-                << std::endl;  // errno
-      continue;
+
+  // Collects stack traces for request number @id with @options, and hands the
+  // request over to the rest of the pipeline. Blocks if there are already
+  // kDepth requests in the pipeline. Must always be called from the same
+  // thread.
+  void Submit(int64_t id,
+              const StackTraceSignal::ExternalRequestOptions& options) {
+    DumpRequest* request = nullptr;
+    free_.Read(&request);
+    request->id = id;
+    request->options = options;
+    request->error.clear();
+    collector_.set_thread_filter(
+        options.thread_filter == 0
+            ? nullptr
+            : ExternalRequestRegistry::Get()->GetThreadFilter(
+                  options.thread_filter));
+    collector_.set_timeout_ms(options.deadline_ms == 0
+                                  ? StackTraceCollector::kDefaultTimeoutMs
+                                  : options.deadline_ms);
+    request->collected =
+        collector_.Collect(nullptr, &request->collection, &request->error) &&
+        not request->collection.empty();
+    if (not request->collected && request->error.empty()) {
+      request->error.assign("No threads selected");
     }
-    if (0 == ret) {
-      std::cerr << "Received request to terminate stack trace service thread"
-                << std::endl;  // errno.
-      close(pipe_fd[1]);
-      break;
+    symbolize_.Write(request);
+  }
+
+ private:
+  // Maximum number of requests in the pipeline.
+  static constexpr int kDepth = 4;
+
+  void SymbolizeStage() {
+    DumpRequest* request = nullptr;
+    while (symbolize_.Read(&request)) {
+      request->symbols.Clear();
+      if (request->collected && Symbolized(request->options)) {
+        request->collection.Symbolize(&request->symbols, nullptr);
+      }
+      format_.Write(request);
+    }
+  }
+
+  void FormatStage() {
+    DumpRequest* request = nullptr;
+    while (format_.Read(&request)) {
+      request->trace.clear();
+      if (request->collected) {
+        const auto& options = request->options;
+        const auto& collection = request->collection;
+        switch (options.format) {
+          case StackTraceSignal::ExternalRequestOptions::kFolded:
+            request->trace = collection.ToFoldedString(
+                Symbolized(options) ? &request->symbols : nullptr);
+            break;
+          case StackTraceSignal::ExternalRequestOptions::kRaw:
+            request->trace = collection.ToRawString();
+            break;
+          default:
+            request->trace = collection.ToPrettyString(request->symbols);
+            break;
+        }
+      }
+      write_.Write(request);
+    }
+  }
+
+  void WriteStage() {
+    DumpRequest* request = nullptr;
+    while (write_.Read(&request)) {
+      auto sink = request->options.sink == 0
+                      ? nullptr
+                      : ExternalRequestRegistry::Get()->GetSink(
+                            request->options.sink);
+      if (sink) {
+        FormatDump(*request, &request->dump);
+        sink(request->dump);
+      } else {
+        WriteDump(*request);
+      }
+      // Drop the collection right away, so that the stack trace forms it
+      // holds are returned to the pool.
+      request->collection.Clear();
+      external_request_control.completed.fetch_add(1);
+      free_.Write(request);
     }
-    if (sizeof(ack_fd) != ret) {
-      std::cerr
-          << "Read partial data of stack trace collection request. Expected "
-          << sizeof(ack_fd) << " bytes, got " << ret << " bytes" << std::endl;
-      continue;
-    }
-    DEFER(if (0 != close(ack_fd)) {
-      std::cerr << "Failed to ack stack trace requester" << std::endl;  // errno
-    });
-    // Flush stderr before acking the requester. This is required because some
-    // requesters assert the presence of stack traces in stderr, after they
-    // receive the ack.
-    DEFER(fflush(stderr));
+  }
+
+  // Returns true iff frames should be symbolized for @options.
+  static bool Symbolized(
+      const StackTraceSignal::ExternalRequestOptions& options) {
+    return options.symbolize &&
+           options.format != StackTraceSignal::ExternalRequestOptions::kRaw;
+  }
+
+  // Writes the dump of @request to stderr.
+  static void WriteDump(const DumpRequest& request) {
     fprintf(stderr,
             "=============================================\n"
             "%ld) Stack traces - Start \n"
             "=============================================\n",
-            request_count);
-    StackTraceCollector collector;
-    std::string error;
-    auto results = collector.Collect(&error);
-    if (results.empty()) {
-      std::cerr << "StackTrace collection failed: " << error << std::endl;
+            request.id);
+    if (not request.collected) {
+      std::cerr << "StackTrace collection failed: " << request.error
+                << std::endl;
     } else {
-      const auto& trace = StackTraceCollector::ToPrettyString(results);
-      fprintf(stderr, "\n%s\n", trace.c_str());
+      fprintf(stderr, "\n%s\n", request.trace.c_str());
       fprintf(stderr,
               "============================================\n"
               "%ld) Stack traces - End \n"
               "============================================\n",
-              request_count);
+              request.id);
+    }
+    fflush(stderr);
+  }
+
+  // Formats the dump of @request, as written by WriteDump(...), into @out.
+  static void FormatDump(const DumpRequest& request, std::string* out) {
+    char buf[128];
+    snprintf(buf, sizeof(buf),
+             "=============================================\n"
+             "%ld) Stack traces - Start \n"
+             "=============================================\n",
+             request.id);
+    out->assign(buf);
+    if (not request.collected) {
+      out->append("StackTrace collection failed: ");
+      out->append(request.error);
+      out->append("\n");
+      return;
+    }
+    out->append("\n");
+    out->append(request.trace);
+    out->append("\n");
+    snprintf(buf, sizeof(buf),
+             "============================================\n"
+             "%ld) Stack traces - End \n"
+             "============================================\n",
+             request.id);
+    out->append(buf);
+  }
+
+  // Reused across requests, so that steady-state collections don't allocate.
+  StackTraceCollector collector_;
+  common::BufferedChannel<DumpRequest*> free_;
+  common::BufferedChannel<DumpRequest*> symbolize_;
+  common::BufferedChannel<DumpRequest*> format_;
+  common::BufferedChannel<DumpRequest*> write_;
+};
+
+// static
+constexpr int DumpPipeline::kDepth;
+
+// The function run by the stack trace service thread. Serves the requests in
+// @requests by handing them over to a DumpPipeline, which dumps stack traces
+// as per the options encoded in the requests. Requests are admitted subject
+// to the limits in @external_request_control, before any collection work
+// starts: a request that exceeds the limits is coalesced into the dump of
+// another request popped along with it, or rejected if there is none. The
+// DumpPipeline is only created on the first request.
+void RequestProcessor(ExternalRequestQueue* requests) {
+  // Created on the first request, as most processes never get one.
+  DumpPipeline* pipeline = nullptr;
+  auto& control = external_request_control;
+  std::unique_ptr<common::RateLimiter> limiter;
+  int64_t request_count = 0;
+  int64_t reported_dropped = 0;
+  while (true) {
+    requests->Wait();
+    if (pipeline == nullptr) {
+      // Intentionally leaked, as the pipeline threads run for the entire
+      // lifetime of the process.
+      pipeline = new DumpPipeline();
+    }
+    // Pick up any change to the limits. Note that this resets the limiter.
+    const auto min_interval_ms = control.min_interval_ms.load();
+    const auto max_per_minute = control.max_per_minute.load();
+    if (limiter == nullptr || limiter->min_interval_ms() != min_interval_ms ||
+        limiter->max_per_minute() != max_per_minute) {
+      limiter.reset(new common::RateLimiter(min_interval_ms, max_per_minute));
+    }
+    int64_t served = 0;
+    int64_t coalesced = 0;
+    int64_t rejected = 0;
+    ExternalRequestQueue::Request request;
+    while (requests->Pop(&request)) {
+      if (limiter->Admit(common::RateLimiter::NowMs())) {
+        ++served;
+        auto options = ExternalRequestRegistry::Get()->GetDefaultOptions();
+        if (request.code == SI_QUEUE) {
+          StackTraceSignal::DecodeExternalRequest(request.value.sival_int,
+                                                  &options);
+        }
+        pipeline->Submit(++request_count, options);
+      } else if (served > 0) {
+        ++coalesced;
+      } else {
+        ++rejected;
+      }
+    }
+    control.served += served;
+    control.coalesced += coalesced;
+    control.rejected += rejected;
+    if (rejected > 0) {
+      std::cerr << "Rejected " << rejected
+                << " stack trace requests, as they exceeded the rate limits"
+                << std::endl;
+    }
+    const auto dropped = control.dropped.load();
+    if (dropped != reported_dropped) {
+      std::cerr << "Dropped " << dropped - reported_dropped
+                << " stack trace requests, as too many were pending"
+                << std::endl;
+      reported_dropped = dropped;
     }
   }
 }
 
 ExternalHandlerState::ExternalHandlerState() : server_tgid(getpid()) {
-  std::promise<int> p;
-  auto f = p.get_future();
-  auto t = std::thread(RequestProcessor, &p);
+  if (not requests.Init()) {
+    return;
+  }
   // Stack trace service thread runs for the entire lifetime of the process.
-  t.detach();
-  // Wait for stack trace service thread to start.
-  server_fd = f.get();
+  // Note that it only waits for the first request until one arrives: the dump
+  // pipeline, its threads and buffers are all created lazily. A thread can't
+  // be started from the signal handler itself, as thread creation isn't
+  // async-signal-safe.
+  std::thread(RequestProcessor, &requests).detach();
+  running = true;
 }
 
 // Sends signal @signum to thread @tid of process group @pid with payload
@@ -281,81 +795,253 @@ int SignalThread(pid_t pid, pid_t tid, uid_t uid, int signum, sigval payload) {
   return syscall(SYS_rt_tgsigqueueinfo, pid, tid, signum, &info);
 }
 
+// Returns an upper bound on the number of bytes AppendPrettyString(...)
+// appends for @trace shared by @num_tids threads. Each frame is printed on a
+// line of at most 256 bytes (see ThreadStack::PrettyPrint()), but most lines
+// are much shorter.
+size_t EstimatePrettyStringSize(const ThreadStack& trace, int num_tids) {
+  return 32 + 12 * num_tids + 128 * trace.depth;
+}
+
+// Appends a pretty string for @trace, shared by the @num_tids threads in @tids,
+// to @out. Formatting straight into a string that is sized upfront, instead of
+// an ostringstream, makes pretty printing allocate (almost) once.
+void AppendPrettyString(const ThreadStack& trace,
+                        const pid_t* tids,
+                        int num_tids,
+                        const SymbolTable& symbols,
+                        std::string* out) {
+  if (num_tids == 0) {
+    out->append("No Threads\n");
+    return;
+  }
+  char buf[32];
+  out->append("Threads: ");
+  for (int i = 0; i < num_tids - 1; ++i) {
+    snprintf(buf, sizeof(buf), "%d, ", tids[i]);
+    out->append(buf);
+  }
+  snprintf(buf, sizeof(buf), "%d\n", tids[num_tids - 1]);
+  out->append(buf);
+  out->append("Stack trace:\n");
+  trace.PrettyPrint(
+      [&](const char *str) {
+        out->append(str);
+      },
+      [&](int64_t addr) {
+        return symbols.Lookup(addr);
+      });
+  out->append("\n");
+}
+
+// Appends a line for @trace, shared by @num_tids threads, in the folded
+// format to @out. See StackTraceCollection::ToFoldedString(...).
+void AppendFoldedString(const ThreadStack& trace,
+                        int num_tids,
+                        const SymbolTable* symbols,
+                        std::string* out) {
+  char buf[32];
+  for (int i = trace.depth - 1; i >= 0; --i) {
+    if (symbols != nullptr) {
+      out->append(symbols->Lookup(trace.address[i]));
+    } else {
+      snprintf(buf, sizeof(buf), "%#lx", trace.address[i]);
+      out->append(buf);
+    }
+    if (i > 0) {
+      out->append(";");
+    }
+  }
+  snprintf(buf, sizeof(buf), " %d\n", num_tids);
+  out->append(buf);
+}
+
+// Appends a line for @trace, shared by the @num_tids threads in @tids, in the
+// raw format to @out. See StackTraceCollection::ToRawString().
+void AppendRawString(const ThreadStack& trace,
+                     const pid_t* tids,
+                     int num_tids,
+                     std::string* out) {
+  char buf[32];
+  for (int i = 0; i < num_tids; ++i) {
+    snprintf(buf, sizeof(buf), i == 0 ? "%d" : ",%d", tids[i]);
+    out->append(buf);
+  }
+  for (int i = 0; i < trace.depth; ++i) {
+    snprintf(buf, sizeof(buf), " %#lx", trace.address[i]);
+    out->append(buf);
+  }
+  out->append("\n");
+}
+
+// Orders forms by the stack traces they hold.
+struct StackComparator {
+  bool operator()(const StackTraceForm* a, const StackTraceForm* b) const {
+    const auto& astack = a->stack();
+    const auto& bstack = b->stack();
+    if (astack.depth != bstack.depth) {
+      return astack.depth < bstack.depth;
+    }
+    for (int i = 0; i < astack.depth; ++i) {
+      if (astack.address[i] != bstack.address[i]) {
+        return astack.address[i] < bstack.address[i];
+      }
+    }
+    return false;
+  };
+};
+
+// Map from a stacktrace to the vector of forms that hold the exact same
+// stacktrace.
+using UniqueTraces = common::ArenaMap<StackTraceForm*,
+                                      common::ArenaVector<StackTraceForm*>,
+                                      StackComparator>;
+
+// Returns a hash of the stack trace in @form.
+uint64_t StackHash(const StackTraceForm* form) {
+  // FNV-1a over the addresses.
+  const auto& stack = form->stack();
+  uint64_t hash = 14695981039346656037ULL ^ stack.depth;
+  for (int i = 0; i < stack.depth; ++i) {
+    hash = (hash ^ static_cast<uint64_t>(stack.address[i])) * 1099511628211ULL;
+  }
+  return hash;
+}
+
+// Minimum number of forms for which grouping is done in parallel.
+constexpr int kMinFormsToGroupInParallel = 512;
+
 }  // namespace
 
 auto StackTraceCollector::Collect(std::string* error) -> std::vector<Result> {
-  auto tids_v = common::Sysutil::ListThreads();
-  std::set<pid_t> init_tids(tids_v.begin(), tids_v.end());
-  std::vector<std::unique_ptr<StackTraceForm>> slot;
+  return Collect(nullptr, error);
+}
+
+auto StackTraceCollector::Collect(const common::CancellationToken* token,
+                                  std::string* error) -> std::vector<Result> {
+  StackTraceCollection collection;
+  if (not Collect(token, &collection, error)) {
+    return {};
+  }
+  std::vector<Result> results(collection.size());
+  for (int i = 0; i < collection.size(); ++i) {
+    const auto& group = collection[i];
+    results[i].trace = *group.trace;
+    results[i].tids.assign(group.tids, group.tids + group.num_tids);
+  }
+  return results;
+}
+
+bool StackTraceCollector::Collect(const common::CancellationToken* token,
+                                  StackTraceCollection* collection,
+                                  std::string* error) {
+  collection->Clear();
+  if (token != nullptr && token->IsCancelled()) {
+    error->assign("Stacktrace collection cancelled");
+    return false;
+  }
+  // All the temporaries below are served by @arena_, so they must be destroyed
+  // before the arena is reset.
+  DEFER(arena_.Reset());
+  common::ArenaAllocator<pid_t> alloc(&arena_);
+  common::ArenaSet<pid_t> init_tids(alloc);
+  if (not common::Sysutil::VisitThreads([&](pid_t tid) {
+        if (not thread_filter_ || thread_filter_(tid)) {
+          init_tids.insert(tid);
+        }
+      })) {
+    error->assign("Failed to list threads");
+    return false;
+  }
+  common::ArenaVector<StackTraceForm*> slot(alloc);
+  slot.reserve(init_tids.size());
   // Step 1: Create a pipe on which threads can send acks after they finish
   // writing their stacktrace.
   int pipe_fd[2];
   if (-1 == pipe(pipe_fd)) {
     std::cerr << "Failed to create pipe" << std::endl;  // errno
     error->assign("Internal server error");
-    return {};
+    return false;
   }
   DEFER(close(pipe_fd[0]));
   DEFER(close(pipe_fd[1]));
+  // Forms are settled before the ack pipe is closed (note the reverse order of
+  // DEFERs), so that no signal handler can write to a closed, or worse, a
+  // reused file descriptor.
+  auto* pool = StackTraceFormPool::Get();
+  DEFER(for (auto* form : slot) {
+    form->Settle();
+    pool->Release(form);
+  });
   const auto pid = getpid();
   const auto uid = getuid();
   // Step 2: Signal all threads to write their stack trace in a pre-allocated
   // area. Note that some threads might have died by now, so signalling them
   // will fail. Such failures are noted in @failed_tids.
-  std::set<pid_t> failed_tids;
+  common::ArenaSet<pid_t> failed_tids(alloc);
   for (auto tid : init_tids) {
-    std::unique_ptr<StackTraceForm> stack(new StackTraceForm(tid, pipe_fd[1]));
+    auto* form = pool->Acquire(tid, pipe_fd[1]);
     union sigval payload;
-    payload.sival_ptr = stack.get();
+    payload.sival_ptr = form;
     // Signaling might fail if the thread is no longer alive.
     auto ret = SignalThread(
         pid, tid, uid, StackTraceSignal::InternalSignum(), payload);
     if (0 != ret) {
       std::cerr << "Unable to signal thread " << tid << std::endl;  // errno
       failed_tids.insert(tid);
+      form->Settle();
+      pool->Release(form);
     } else {
-      slot.push_back(std::move(stack));
+      slot.push_back(form);
     }
   }
-  std::set<pid_t> tids;
+  common::ArenaSet<pid_t> tids(alloc);
   STLSetDifference(init_tids, failed_tids, &tids);
 
-  // Step 3: Create a 5 second timer, to perform a bounded wait on acks from
-  // threads.
+  // Step 3: Create a timer, to perform a bounded wait on acks from threads.
   auto timer_fd = timerfd_create(CLOCK_REALTIME, TFD_CLOEXEC);
   if (timer_fd == -1) {
     std::cerr << "Failed to create timer" << std::endl;  // errno
     error->assign("Failed to create an internal timer");
-    return {};
+    return false;
   }
+  DEFER(close(timer_fd));
   struct itimerspec time_spec;
   bzero(&time_spec, sizeof(time_spec));
-  time_spec.it_value.tv_sec = 5;  // TODO(nipun): Make configurable.
-  time_spec.it_value.tv_nsec = 0;
+  // Note that a zero timer would never go off.
+  const auto timeout_ms = std::max<int64_t>(1, timeout_ms_);
+  time_spec.it_value.tv_sec = timeout_ms / 1000;
+  time_spec.it_value.tv_nsec = (timeout_ms % 1000) * 1000000;
   time_spec.it_interval.tv_sec = 0;
   time_spec.it_interval.tv_nsec = 0;
   if (-1 == timerfd_settime(timer_fd, 0, &time_spec, nullptr)) {
     std::cerr << "Failed to set timer" << std::endl;  // errno
     error->assign("Failed to set an internal timer");
-    return {};
+    return false;
   }
-  DEFER(close(timer_fd));
 
-  // Step 4: Wait for all the acks, timing out after 5 seconds.
+  // Step 4: Wait for all the acks, timing out after @timeout_ms_, or bailing
+  // out early if @token gets cancelled.
+  const int cancel_fd = token == nullptr ? -1 : token->fd();
+  // Set operations on pipe_fd[0] to be non-blocking. This is important if the
+  // select() on this fd returns, but the subsequent read block. This behaviour
+  // is possible in exceptional cases, and when occurs would cause the entire
+  // process to become non-responsive.
+  int flags = fcntl(pipe_fd[0], F_GETFL, 0);
+  fcntl(pipe_fd[0], F_SETFL, flags | O_NONBLOCK);
   int acks = 0;
+  bool cancelled = false;
   while (acks < static_cast<int>(tids.size())) {
-    // Set operations on pipe_fd[0] to be non-blocking. This is important if the
-    // select() on this fd returns, but the subsequent read block. This behaviour
-    // is possible in exceptional cases, and when occurs would cause the entire
-    // process to become non-responsive.
-    int flags = fcntl(pipe_fd[0], F_GETFL, 0);
-    fcntl(pipe_fd[0], F_SETFL, flags | O_NONBLOCK);
     fd_set read_fds;
     FD_ZERO(&read_fds);
     FD_SET(pipe_fd[0], &read_fds);
     FD_SET(timer_fd, &read_fds);
-    auto max_fd = std::max(pipe_fd[0], timer_fd) + 1;
-    auto ret = select(max_fd, &read_fds, nullptr, nullptr, nullptr);
+    auto max_fd = std::max(pipe_fd[0], timer_fd);
+    if (cancel_fd != -1) {
+      FD_SET(cancel_fd, &read_fds);
+      max_fd = std::max(max_fd, cancel_fd);
+    }
+    auto ret = select(max_fd + 1, &read_fds, nullptr, nullptr, nullptr);
     if (ret == -1) {
       std::cerr << "select(...) failed, will try again" << std::endl;  // errno
     } else if (ret == 0) {
@@ -363,6 +1049,9 @@ auto StackTraceCollector::Collect(std::string* error) -> std::vector<Result> {
       // the select syscall.
       std::cerr << "No file descriptors ready, will try again"
                 << std::endl;  // errno
+    } else if (cancel_fd != -1 && FD_ISSET(cancel_fd, &read_fds)) {
+      cancelled = true;
+      break;
     } else if (FD_ISSET(timer_fd, &read_fds)) {
       std::cerr << "Failed to get all (" << tids.size()
                 << ") the stacktrace acks within timeout. Got only " << acks
@@ -370,7 +1059,7 @@ auto StackTraceCollector::Collect(std::string* error) -> std::vector<Result> {
       error->assign("Failed to get all (" + std::to_string(tids.size()) +
                     ") stacktraces within timeout. Got only " +
                     std::to_string(acks));
-      return {};
+      return false;
     } else if (FD_ISSET(pipe_fd[0], &read_fds)) {
       char ch;
       auto num_read = read(pipe_fd[0], &ch, sizeof(ch));
@@ -383,76 +1072,307 @@ auto StackTraceCollector::Collect(std::string* error) -> std::vector<Result> {
         ++acks;
       }
     }
+    // Tokens without an eventfd are polled instead.
+    if (token != nullptr && cancel_fd == -1 && token->IsCancelled()) {
+      cancelled = true;
+      break;
+    }
+  }
+
+  // Step 5: Settle all the forms. Threads that haven't started filling in
+  // their forms are abandoned, so that their (late) signal handlers don't
+  // touch the forms. When the collection is cancelled, only the forms which
+  // were submitted so far make it to the result. The submitted forms are
+  // handed over to @collection.
+  auto& submitted = collection->forms_;
+  submitted.reserve(slot.size());
+  for (auto* form : slot) {
+    if (form->Settle()) {
+      submitted.push_back(form);
+    } else {
+      pool->Release(form);
+    }
+  }
+  slot.clear();
+  if (cancelled) {
+    error->assign("Stacktrace collection cancelled. Got only " +
+                  std::to_string(submitted.size()) + " of " +
+                  std::to_string(tids.size()) + " stacktraces");
   }
 
-  // Step 6: All acks have been received, post-process the data communicated by
-  // threads and produce the final result.
-  struct StackComparator {
-    bool operator()(StackTraceForm* a, StackTraceForm* b) const {
-      const auto& astack = a->stack();
-      const auto& bstack = b->stack();
-      if (astack.depth != bstack.depth) {
-        return astack.depth < bstack.depth;
+  // Step 6: Post-process the data communicated by threads and produce the
+  // final result. Note that @tids_ is sized upfront, so that pointers into it
+  // stay valid.
+  collection->tids_.reserve(submitted.size());
+  collection->tags_.reserve(submitted.size());
+  collection->cpu_ns_.reserve(submitted.size());
+  auto add_group = [&](StackTraceForm* form,
+                       const common::ArenaVector<StackTraceForm*>& forms) {
+    const auto begin = collection->tids_.size();
+    for (const auto* e : forms) {
+      collection->tids_.push_back(e->stack().tid);
+      collection->tags_.push_back(e->tag());
+      collection->cpu_ns_.push_back(e->cpu_ns());
+    }
+    collection->groups_.push_back({&form->stack(),
+                                   collection->tids_.data() + begin,
+                                   static_cast<int>(forms.size()),
+                                   collection->tags_.data() + begin,
+                                   collection->cpu_ns_.data() + begin});
+  };
+  if (pool_ == nullptr ||
+      static_cast<int>(submitted.size()) < kMinFormsToGroupInParallel) {
+    UniqueTraces unique_traces(alloc);
+    for (auto* e : submitted) {
+      auto it = unique_traces.find(e);
+      if (it == unique_traces.end()) {
+        it = unique_traces.emplace(
+            e, common::ArenaVector<StackTraceForm*>(alloc)).first;
       }
-      for (int i = 0; i < astack.depth; ++i) {
-        if (astack.address[i] != bstack.address[i]) {
-          return astack.address[i] < bstack.address[i];
-        }
+      it->second.push_back(e);
+    }
+    collection->groups_.reserve(unique_traces.size());
+    for (const auto& e : unique_traces) {
+      add_group(e.first, e.second);
+    }
+    return true;
+  }
+
+  // Parallel variant of the above: forms are sharded by the hash of their
+  // stack traces, so that each shard can be grouped independently (in its own
+  // arena). Merging the shards in StackComparator order produces the exact
+  // same result as the serial variant.
+  const int n = submitted.size();
+  const int num_shards = pool_->parallelism();
+  while (static_cast<int>(shard_arenas_.size()) < num_shards) {
+    shard_arenas_.emplace_back(new common::Arena());
+  }
+  common::ArenaVector<uint64_t> hashes(n, alloc);
+  pool_->ParallelFor(num_shards, [&](int shard) {
+    for (int i = static_cast<int64_t>(n) * shard / num_shards;
+         i < static_cast<int64_t>(n) * (shard + 1) / num_shards; ++i) {
+      hashes[i] = StackHash(submitted[i]);
+    }
+  });
+  std::vector<std::unique_ptr<UniqueTraces>> shards(num_shards);
+  pool_->ParallelFor(num_shards, [&](int shard) {
+    common::ArenaAllocator<pid_t> shard_alloc(shard_arenas_[shard].get());
+    shards[shard].reset(new UniqueTraces(shard_alloc));
+    auto& unique_traces = *shards[shard];
+    for (int i = 0; i < n; ++i) {
+      if (static_cast<int>(hashes[i] % num_shards) != shard) {
+        continue;
       }
-      return false;
-    };
-  };
+      auto* e = submitted[i];
+      auto it = unique_traces.find(e);
+      if (it == unique_traces.end()) {
+        it = unique_traces.emplace(
+            e, common::ArenaVector<StackTraceForm*>(shard_alloc)).first;
+      }
+      it->second.push_back(e);
+    }
+  });
+  common::ArenaVector<const UniqueTraces::value_type*> merged(alloc);
+  for (const auto& shard : shards) {
+    for (const auto& e : *shard) {
+      merged.push_back(&e);
+    }
+  }
+  std::sort(merged.begin(), merged.end(),
+            [](const UniqueTraces::value_type* a,
+               const UniqueTraces::value_type* b) {
+              return StackComparator()(a->first, b->first);
+            });
+  collection->groups_.reserve(merged.size());
+  for (const auto* e : merged) {
+    add_group(e->first, e->second);
+  }
+  shards.clear();
+  for (auto& arena : shard_arenas_) {
+    arena->Reset();
+  }
+  return true;
+}
 
-  // Map from a stacktrace to the vector of tids that have the exact same
-  // stacktrace.
-  std::map<StackTraceForm*, std::vector<pid_t>, StackComparator> unique_traces;
-  for (const auto& e : slot) {
-    auto it = unique_traces.find(e.get());
-    if (it == unique_traces.end()) {
-      unique_traces[e.get()].push_back(e->stack().tid);
-    } else {
-      it->second.push_back(e->stack().tid);
+StackTraceCollection::StackTraceCollection()
+    : groups_(common::ArenaAllocator<Group>(&arena_)),
+      tids_(common::ArenaAllocator<pid_t>(&arena_)),
+      tags_(common::ArenaAllocator<const char*>(&arena_)),
+      cpu_ns_(common::ArenaAllocator<int64_t>(&arena_)),
+      forms_(common::ArenaAllocator<StackTraceForm*>(&arena_)) {}
+
+StackTraceCollection::~StackTraceCollection() { Clear(); }
+
+void StackTraceCollection::Clear() {
+  auto* pool = StackTraceFormPool::Get();
+  for (auto* form : forms_) {
+    pool->Release(form);
+  }
+  // Drop the vectors' memory before resetting the arena which backs them.
+  common::ArenaVector<Group>(groups_.get_allocator()).swap(groups_);
+  common::ArenaVector<pid_t>(tids_.get_allocator()).swap(tids_);
+  common::ArenaVector<const char*>(tags_.get_allocator()).swap(tags_);
+  common::ArenaVector<int64_t>(cpu_ns_.get_allocator()).swap(cpu_ns_);
+  common::ArenaVector<StackTraceForm*>(forms_.get_allocator()).swap(forms_);
+  arena_.Reset();
+}
+
+void StackTraceCollection::Symbolize(SymbolTable* symbols,
+                                     common::WorkerPool* pool) const {
+  for (const auto& e : *this) {
+    symbols->Add(*e.trace);
+  }
+  symbols->Symbolize(pool);
+}
+
+std::string StackTraceCollection::ToPrettyString(
+    common::WorkerPool* pool) const {
+  SymbolTable symbols;
+  Symbolize(&symbols, pool);
+  return ToPrettyString(symbols, pool);
+}
+
+std::string StackTraceCollection::ToPrettyString(
+    const SymbolTable& symbols,
+    common::WorkerPool* pool) const {
+  std::string out;
+  if (pool == nullptr || size() < pool->parallelism()) {
+    size_t estimate = 0;
+    for (const auto& e : *this) {
+      estimate += EstimatePrettyStringSize(*e.trace, e.num_tids);
+    }
+    out.reserve(estimate);
+    for (const auto& e : *this) {
+      AppendPrettyString(*e.trace, e.tids, e.num_tids, symbols, &out);
+    }
+    return out;
+  }
+  // Format contiguous ranges of groups in parallel, and concatenate them in
+  // order.
+  const int num_ranges = pool->parallelism();
+  std::vector<std::string> ranges(num_ranges);
+  pool->ParallelFor(num_ranges, [&](int range) {
+    const int begin = static_cast<int64_t>(size()) * range / num_ranges;
+    const int end = static_cast<int64_t>(size()) * (range + 1) / num_ranges;
+    size_t range_estimate = 0;
+    for (int i = begin; i < end; ++i) {
+      range_estimate += EstimatePrettyStringSize(*groups_[i].trace,
+                                                 groups_[i].num_tids);
+    }
+    ranges[range].reserve(range_estimate);
+    for (int i = begin; i < end; ++i) {
+      const auto& e = groups_[i];
+      AppendPrettyString(*e.trace, e.tids, e.num_tids, symbols,
+                         &ranges[range]);
     }
+  });
+  size_t total = 0;
+  for (const auto& range : ranges) {
+    total += range.size();
   }
+  out.reserve(total);
+  for (const auto& range : ranges) {
+    out.append(range);
+  }
+  return out;
+}
 
-  std::vector<Result> results;
-  results.reserve(unique_traces.size());
-  for (const auto& e : unique_traces) {
-    const auto& stack = e.first->stack();
-    Result r;
-    r.tids = e.second;
-    r.trace = stack;
-    results.push_back(r);
+// static
+constexpr int64_t StackTraceCollector::kDefaultTimeoutMs;
+
+std::string StackTraceCollection::ToFoldedString(
+    const SymbolTable* symbols) const {
+  std::string out;
+  for (const auto& e : *this) {
+    AppendFoldedString(*e.trace, e.num_tids, symbols, &out);
   }
-  return results;
+  return out;
+}
+
+std::string StackTraceCollection::ToRawString() const {
+  std::string out;
+  for (const auto& e : *this) {
+    AppendRawString(*e.trace, e.tids, e.num_tids, &out);
+  }
+  return out;
 }
 
 // static
 std::string StackTraceCollector::ToPrettyString(const std::vector<Result>& r) {
-  std::ostringstream ss;
+  SymbolTable symbols;
   for (const auto& e : r) {
-    if (e.tids.empty()) {
-      ss << "No Threads" << std::endl;
-      continue;
-    }
-    ss << "Threads: ";
-    for (int i = 0; i < static_cast<int>(e.tids.size()) - 1; ++i) {
-      ss << e.tids[i] << ", ";
-    }
-    ss << *e.tids.rbegin() << std::endl;
-    ss << "Stack trace:" << std::endl;
-    e.trace.PrettyPrint(
-        [&](const char *str) {
-          ss << str;
-        });
-    ss << std::endl;
+    symbols.Add(e.trace);
+  }
+  symbols.Symbolize(nullptr);
+  return ToPrettyString(r, symbols);
+}
+
+// static
+std::string StackTraceCollector::ToPrettyString(const std::vector<Result>& r,
+                                                const SymbolTable& symbols) {
+  size_t estimate = 0;
+  for (const auto& e : r) {
+    estimate += EstimatePrettyStringSize(e.trace, e.tids.size());
   }
-  return ss.str();
+  std::string out;
+  out.reserve(estimate);
+  for (const auto& e : r) {
+    AppendPrettyString(e.trace, e.tids.data(), e.tids.size(), symbols, &out);
+  }
+  return out;
+}
+
+// static
+std::string StackTraceCollector::ToFoldedString(const std::vector<Result>& r,
+                                                const SymbolTable* symbols) {
+  std::string out;
+  for (const auto& e : r) {
+    AppendFoldedString(e.trace, e.tids.size(), symbols, &out);
+  }
+  return out;
+}
+
+// static
+std::string StackTraceCollector::ToRawString(const std::vector<Result>& r) {
+  std::string out;
+  for (const auto& e : r) {
+    AppendRawString(e.trace, e.tids.data(), e.tids.size(), &out);
+  }
+  return out;
+}
+
+namespace {
+
+// Signal numbers set by StackTraceSignal::SetSignums(...), or 0 for the
+// defaults.
+std::atomic<int> internal_signum{0};
+std::atomic<int> external_signum{0};
+
+}  // namespace
+
+int StackTraceSignal::InternalSignum() {
+  const int signum = internal_signum.load(std::memory_order_relaxed);
+  return signum != 0 ? signum : SIGRTMIN;
 }
 
-int StackTraceSignal::InternalSignum() { return SIGRTMIN; }
+int StackTraceSignal::ExternalSignum() {
+  const int signum = external_signum.load(std::memory_order_relaxed);
+  return signum != 0 ? signum : SIGRTMIN + 1;
+}
 
-int StackTraceSignal::ExternalSignum() { return SIGRTMIN + 1; }
+// static
+bool StackTraceSignal::SetSignums(int internal, int external) {
+  auto is_realtime = [](int signum) {
+    return signum >= SIGRTMIN && signum <= SIGRTMAX;
+  };
+  if (not is_realtime(internal) || not is_realtime(external) ||
+      internal == external) {
+    return false;
+  }
+  internal_signum = internal;
+  external_signum = external;
+  return true;
+}
 
 // static
 bool StackTraceSignal::InstallInternalHandler() {
@@ -466,8 +1386,8 @@ bool StackTraceSignal::InstallInternalHandler() {
 }
 
 bool StackTraceSignal::InstallExternalHandler() {
-  auto state = GetExternalHandlerState();
-  if (state.server_fd < 0) {
+  const auto& state = GetExternalHandlerState();
+  if (not state.running) {
     std::cerr << "Failed to setup external signal handler" << std::endl;
     return false;
   }
@@ -481,4 +1401,104 @@ bool StackTraceSignal::InstallExternalHandler() {
   return 0 == sigaction(StackTraceSignal::ExternalSignum(), &action, nullptr);
 }
 
+// static
+constexpr int StackTraceSignal::kNumExternalRequestSlots;
+
+// static
+int StackTraceSignal::EncodeExternalRequest(
+    const ExternalRequestOptions& options) {
+  int payload = kExternalRequestTag | (options.format & 0x3);
+  if (not options.symbolize) {
+    payload |= kExternalRequestFast;
+  }
+  payload |= (options.thread_filter & 0xf) << kExternalRequestThreadFilterShift;
+  if (options.deadline_ms > 0) {
+    // Round up to the nearest representable deadline.
+    int code = 1;
+    while (code < 0xf && (int64_t{10} << (code - 1)) < options.deadline_ms) {
+      ++code;
+    }
+    payload |= code << kExternalRequestDeadlineShift;
+  }
+  payload |= (options.sink & 0xf) << kExternalRequestSinkShift;
+  return payload;
+}
+
+// static
+bool StackTraceSignal::DecodeExternalRequest(int payload,
+                                             ExternalRequestOptions* options) {
+  // Tag in the top byte, and zeros in the reserved bits 3 and 16-23.
+  const uint32_t bits = static_cast<uint32_t>(payload);
+  if ((bits & 0xff000000) != static_cast<uint32_t>(kExternalRequestTag) ||
+      (bits & 0x00ff0008) != 0 || (bits & 0x3) == 0x3) {
+    return false;
+  }
+  ExternalRequestOptions decoded;
+  decoded.format = static_cast<ExternalRequestOptions::Format>(bits & 0x3);
+  decoded.symbolize = (bits & kExternalRequestFast) == 0;
+  decoded.thread_filter = (bits >> kExternalRequestThreadFilterShift) & 0xf;
+  const int deadline = (bits >> kExternalRequestDeadlineShift) & 0xf;
+  decoded.deadline_ms = deadline == 0 ? 0 : int64_t{10} << (deadline - 1);
+  decoded.sink = (bits >> kExternalRequestSinkShift) & 0xf;
+  *options = decoded;
+  return true;
+}
+
+// static
+void StackTraceSignal::SetDefaultExternalRequestOptions(
+    const ExternalRequestOptions& options) {
+  ExternalRequestRegistry::Get()->SetDefaultOptions(options);
+}
+
+// static
+bool StackTraceSignal::RegisterExternalThreadFilter(
+    int slot,
+    std::function<bool(pid_t)> filter) {
+  if (slot <= 0 || slot >= kNumExternalRequestSlots) {
+    return false;
+  }
+  ExternalRequestRegistry::Get()->SetThreadFilter(slot, std::move(filter));
+  return true;
+}
+
+// static
+bool StackTraceSignal::RegisterExternalSink(
+    int slot,
+    std::function<void(const std::string&)> sink) {
+  if (slot <= 0 || slot >= kNumExternalRequestSlots) {
+    return false;
+  }
+  ExternalRequestRegistry::Get()->SetSink(slot, std::move(sink));
+  return true;
+}
+
+// static
+void StackTraceSignal::SetExternalRequestLimits(
+    const ExternalRequestLimits& limits) {
+  external_request_control.min_interval_ms = limits.min_interval_ms;
+  external_request_control.max_per_minute = limits.max_per_minute;
+}
+
+// static
+auto StackTraceSignal::GetExternalRequestLimits() -> ExternalRequestLimits {
+  ExternalRequestLimits limits;
+  limits.min_interval_ms = external_request_control.min_interval_ms;
+  limits.max_per_minute = external_request_control.max_per_minute;
+  return limits;
+}
+
+// static
+auto StackTraceSignal::GetExternalRequestStats() -> ExternalRequestStats {
+  ExternalRequestStats stats;
+  // Read first, so that signals received while the other counters are read
+  // make the stats look busy rather than idle.
+  stats.received = external_request_control.received;
+  stats.served = external_request_control.served;
+  stats.coalesced = external_request_control.coalesced;
+  stats.rejected = external_request_control.rejected;
+  stats.dropped = external_request_control.dropped;
+  stats.completed = external_request_control.completed;
+  return stats;
+}
+
 }  // namespace threadstacks
@@ -7,13 +7,109 @@
 #include <signal.h>
 #include <sys/types.h>
 
+#include <functional>
+#include <memory>
 #include <string>
 #include <vector>
 
+#include "common/arena.h"
 #include "common/types.h"
 #include "threadstacks/stack_tracer.h"
 
 namespace threadstacks {
+namespace common {
+class CancellationToken;
+class WorkerPool;
+}  // namespace common
+
+class StackTraceForm;
+class SymbolTable;
+
+// A StackTraceCollection holds the stack traces gathered by a single
+// StackTraceCollector::Collect(...) call, grouped by unique stack trace.
+// Stack traces are not copied out of the memory that threads wrote them into;
+// instead, the collection keeps that memory checked out until it is destroyed
+// or reused for another collection. Pointers handed out by a collection are
+// valid only as long as the collection is neither destroyed nor reused.
+//
+// Note: This class is not thread-safe.
+class StackTraceCollection {
+ public:
+  // A group of threads that share the exact same stack trace.
+  struct Group {
+    // The shared stack trace.
+    const ThreadStack* trace;
+    // Array of @num_tids tids that share the above stack trace.
+    const pid_t* tids;
+    int num_tids;
+    // Array of the @num_tids context tags of the threads, in the order of
+    // @tids, see ContextTag. Threads without a tag have an empty one.
+    const char* const* tags;
+    // Array of the @num_tids CPU times consumed by the threads so far, in
+    // nanoseconds, in the order of @tids, or -1 where unknown.
+    const int64_t* cpu_ns;
+  };
+
+  StackTraceCollection();
+  ~StackTraceCollection();
+
+  // Iteration over the groups, in a deterministic order.
+  int size() const { return groups_.size(); }
+  bool empty() const { return groups_.empty(); }
+  const Group& operator[](int i) const { return groups_[i]; }
+  const Group* begin() const { return groups_.data(); }
+  const Group* end() const { return groups_.data() + groups_.size(); }
+
+  // Returns the total number of threads across all the groups.
+  int num_threads() const { return tids_.size(); }
+
+  // Returns a pretty string containing all the stack traces in the collection.
+  // If @pool is non-null, symbolization and formatting are done in parallel
+  // on @pool. The output is the same either way.
+  std::string ToPrettyString(common::WorkerPool* pool = nullptr) const;
+  // Same as above, but looks up symbols in @symbols, which should have been
+  // populated by Symbolize(...).
+  std::string ToPrettyString(const SymbolTable& symbols,
+                             common::WorkerPool* pool = nullptr) const;
+  // Adds all the addresses in the collection to @symbols and symbolizes them,
+  // in parallel on @pool if it's non-null.
+  void Symbolize(SymbolTable* symbols, common::WorkerPool* pool) const;
+  // Returns the stack traces in the folded format used by flame graph tools:
+  // a line per group, with the frames from the outermost to the innermost
+  // separated by ';', followed by a space and the number of threads in the
+  // group. Frames are looked up in @symbols, or printed as hex addresses if
+  // @symbols is null.
+  std::string ToFoldedString(const SymbolTable* symbols) const;
+  // Returns the stack traces without symbolizing them, for offline
+  // symbolization: a line per group, with the comma separated tids of the
+  // group, followed by the space separated hex addresses of the frames, from
+  // the innermost to the outermost.
+  std::string ToRawString() const;
+
+  // Drops all the groups and returns the underlying memory for reuse.
+  void Clear();
+
+ private:
+  friend class StackTraceCollector;
+
+  // Backs @groups_, @tids_, @tags_, @cpu_ns_ and @forms_. Note that it must be
+  // declared before them.
+  common::Arena arena_;
+  common::ArenaVector<Group> groups_;
+  // Tids of all the groups, stored contiguously per group.
+  common::ArenaVector<pid_t> tids_;
+  // Context tags of all the groups, parallel to @tids_. They point into the
+  // forms.
+  common::ArenaVector<const char*> tags_;
+  // CPU times of all the groups, parallel to @tids_.
+  common::ArenaVector<int64_t> cpu_ns_;
+  // Forms holding the stack traces that @groups_ point to.
+  common::ArenaVector<StackTraceForm*> forms_;
+
+  // Disable copy c'tor and assignment operator.
+  StackTraceCollection(const StackTraceCollection&) = delete;
+  StackTraceCollection& operator=(const StackTraceCollection&) = delete;
+};
 
 // A StackTraceCollector can be used for collecting stack traces of all threads
 // running in the current process.
@@ -31,14 +127,71 @@ class StackTraceCollector {
 
   // Returns a pretty string containing all the stack traces in @result.
   static std::string ToPrettyString(const std::vector<Result>& result);
+  // Same as above, but looks up symbols in @symbols, e.g. as populated for
+  // the stack traces of another process.
+  static std::string ToPrettyString(const std::vector<Result>& result,
+                                    const SymbolTable& symbols);
+  // Same as StackTraceCollection::ToFoldedString(...) and
+  // StackTraceCollection::ToRawString(), for @result.
+  static std::string ToFoldedString(const std::vector<Result>& result,
+                                    const SymbolTable* symbols);
+  static std::string ToRawString(const std::vector<Result>& result);
 
   StackTraceCollector() = default;
+  // Creates a collector that groups large collections in parallel on @pool.
+  // @pool must outlive the collector.
+  explicit StackTraceCollector(common::WorkerPool* pool) : pool_(pool) {}
   ~StackTraceCollector() = default;
 
+  // Returns the arena which backs the collector's internal data structures.
+  // The arena is reset at the end of every collection.
+  const common::Arena& arena() const { return arena_; }
+
+  // Restricts subsequent collections to the threads for which @filter
+  // returns true. An empty @filter selects all the threads, which is the
+  // default. Threads that are filtered out are not signalled at all.
+  void set_thread_filter(std::function<bool(pid_t /*tid*/)> filter) {
+    thread_filter_ = std::move(filter);
+  }
+  // Sets the time that subsequent collections wait for threads to respond,
+  // before giving up. Defaults to kDefaultTimeoutMs.
+  void set_timeout_ms(int64_t timeout_ms) { timeout_ms_ = timeout_ms; }
+
+  static constexpr int64_t kDefaultTimeoutMs = 5000;
+
   // Returns stack traces of all threads in the system. Returns an empty vector
   // on encountering an error, in which case @error is filled with a descriptive
   // error message.
   std::vector<Result> Collect(std::string* error);
+  // Same as above, but the collection can be aborted by cancelling @token
+  // (which may be null) from another thread. On cancellation, stack traces of
+  // the threads that responded so far are returned and @error is filled with a
+  // descriptive message. Signals that reach the remaining threads after the
+  // collection has been aborted are ignored.
+  std::vector<Result> Collect(const common::CancellationToken* token,
+                              std::string* error);
+  // Same as above, but populates @collection, instead of copying each unique
+  // stack trace into a Result. Any previous contents of @collection are
+  // dropped. Returns false on encountering an error, in which case @error is
+  // filled with a descriptive error message. On cancellation, returns true with
+  // the partial results in @collection and fills @error.
+  bool Collect(const common::CancellationToken* token,
+               StackTraceCollection* collection,
+               std::string* error);
+
+ private:
+  // Serves the temporaries of Collect(...), so that a collection doesn't
+  // contend with the application on the global allocator. Reused across
+  // collections made by this collector.
+  common::Arena arena_;
+  // Optional pool for post-processing collections in parallel.
+  common::WorkerPool* pool_ = nullptr;
+  // See set_thread_filter(...) and set_timeout_ms(...).
+  std::function<bool(pid_t)> thread_filter_;
+  int64_t timeout_ms_ = kDefaultTimeoutMs;
+  // Arenas for the shards of parallel post-processing, one per thread of
+  // @pool_.
+  std::vector<std::unique_ptr<common::Arena>> shard_arenas_;
 };
 
 // StackTraceSignal class provides some utility methods to install internal and
@@ -46,17 +199,147 @@ class StackTraceCollector {
 class StackTraceSignal {
  public:
   // Returns the signal number used for the internal stack trace collection
-  // mechanism.
+  // mechanism. Defaults to SIGRTMIN.
   static int InternalSignum();
   // Returns the signal number that can be used to trigger stacktrace
-  // collection in this process.
+  // collection in this process. Defaults to SIGRTMIN + 1.
   static int ExternalSignum();
+  // Changes the signal numbers returned by the above methods, e.g. because
+  // the defaults are in use by the application. Must be called before
+  // installing the handlers, and before any collection. Returns false, and
+  // changes nothing, unless the signal numbers are distinct realtime signals.
+  static bool SetSignums(int internal_signum, int external_signum);
 
   // Installs the internal stacktrace collection signal handler.
   static bool InstallInternalHandler();
-  // Installs the external stacktrace collection signal handler.
+  // Installs the external stacktrace collection signal handler. This is
+  // cheap: the stack trace service only starts a thread that waits for
+  // signals, and creates its threads and buffers on the first signal.
   static bool InstallExternalHandler();
 
+  // Limits on the rate at which external stacktrace collection signals result
+  // in dumps of stack traces. By default, there are no limits.
+  struct ExternalRequestLimits {
+    // Minimum time between two dumps, in milliseconds. 0 for no minimum.
+    int64_t min_interval_ms = 0;
+    // Maximum number of dumps per minute. 0 for no maximum.
+    int max_per_minute = 0;
+  };
+  // Counters of external stacktrace collection signals received so far.
+  struct ExternalRequestStats {
+    // Signals received, each of which ends up in exactly one of the counters
+    // below once the stack trace service has picked it up.
+    int64_t received = 0;
+    // Signals that resulted in a dump.
+    int64_t served = 0;
+    // Signals that exceeded the limits, but arrived together with a served
+    // signal, and were coalesced into its dump.
+    int64_t coalesced = 0;
+    // Signals that exceeded the limits, and were ignored.
+    int64_t rejected = 0;
+    // Signals that were ignored because too many were pending.
+    int64_t dropped = 0;
+    // Dumps written, i.e. served signals whose dump is done.
+    int64_t completed = 0;
+
+    // Returns true iff every signal received has been picked up, and the
+    // dumps of all the served ones are done.
+    bool idle() const {
+      return received == served + coalesced + rejected + dropped &&
+             completed == served;
+    }
+  };
+
+  // Options of the dump requested by an external stacktrace collection
+  // signal. The options can be encoded in the payload of a signal sent with
+  // sigqueue(), see EncodeExternalRequest(...). Signals without a valid
+  // payload, e.g. ones sent with kill(), get the default options.
+  struct ExternalRequestOptions {
+    enum Format {
+      // Same as StackTraceCollection::ToPrettyString(...).
+      kText = 0,
+      // Same as StackTraceCollection::ToFoldedString(...).
+      kFolded = 1,
+      // Same as StackTraceCollection::ToRawString().
+      kRaw = 2,
+    };
+    Format format = kText;
+    // Whether to symbolize frames. Raw dumps are never symbolized.
+    bool symbolize = true;
+    // Slot of the thread filter to apply, see
+    // RegisterExternalThreadFilter(...). 0, or a slot without a filter,
+    // selects all the threads.
+    int thread_filter = 0;
+    // Time to wait for threads to respond, in milliseconds. 0 for the default
+    // of StackTraceCollector. Other values are rounded up to 10ms times a
+    // power of 2, up to about 160 seconds.
+    int64_t deadline_ms = 0;
+    // Slot of the sink to write the dump to, see RegisterExternalSink(...).
+    // 0, or a slot without a sink, writes the dump to stderr.
+    int sink = 0;
+  };
+
+  // Layout of the payload (sival_int) of an external stacktrace collection
+  // signal. A payload is valid only if it carries kExternalRequestTag in its
+  // top byte, and the reserved bits are all zero. E.g. a raw dump without
+  // symbolization, i.e. kExternalRequestTag | kExternalRequestRaw |
+  // kExternalRequestFast = 0x5a000006, can be requested from a shell with
+  // util-linux kill:
+  //   kill -s RTMIN+1 -q 1509949446 <pid>
+  enum ExternalRequestBits : int {
+    kExternalRequestTag = 0x5a000000,
+    // Bits 0-1: The format.
+    kExternalRequestFolded = 1,
+    kExternalRequestRaw = 2,
+    // Bit 2: Skip symbolization.
+    kExternalRequestFast = 1 << 2,
+    // Bits 4-7: The thread filter slot.
+    kExternalRequestThreadFilterShift = 4,
+    // Bits 8-11: The deadline, n stands for 10ms << (n - 1).
+    kExternalRequestDeadlineShift = 8,
+    // Bits 12-15: The sink slot.
+    kExternalRequestSinkShift = 12,
+    // Bit 3 and bits 16-23 are reserved.
+  };
+  // Number of thread filter and sink slots. Slot 0 is reserved for the
+  // defaults.
+  static constexpr int kNumExternalRequestSlots = 16;
+
+  // Sets the options of dumps requested by signals without a valid payload.
+  // Defaults to ExternalRequestOptions().
+  static void SetDefaultExternalRequestOptions(
+      const ExternalRequestOptions& options);
+
+  // Returns the payload that requests a dump with @options.
+  static int EncodeExternalRequest(const ExternalRequestOptions& options);
+  // Decodes @payload into @options. Returns false, leaving @options
+  // untouched, if @payload is not a valid payload.
+  static bool DecodeExternalRequest(int payload,
+                                    ExternalRequestOptions* options);
+  // Registers @filter in thread filter slot @slot, in [1,
+  // kNumExternalRequestSlots). Replaces any filter registered in the slot
+  // earlier. An empty @filter clears the slot. Returns false if @slot is
+  // invalid.
+  static bool RegisterExternalThreadFilter(
+      int slot,
+      std::function<bool(pid_t /*tid*/)> filter);
+  // Registers @sink in sink slot @slot, in [1, kNumExternalRequestSlots).
+  // Replaces any sink registered in the slot earlier. An empty @sink clears
+  // the slot. Returns false if @slot is invalid. Sinks are invoked on the
+  // stack trace service thread, with the whole dump.
+  static bool RegisterExternalSink(
+      int slot,
+      std::function<void(const std::string& /*dump*/)> sink);
+
+  // Sets the limits on external stacktrace collection signals. The limits are
+  // enforced before any collection work starts, and can be changed at any
+  // time.
+  static void SetExternalRequestLimits(const ExternalRequestLimits& limits);
+  // Returns the current limits on external stacktrace collection signals.
+  static ExternalRequestLimits GetExternalRequestLimits();
+  // Returns the counters of external stacktrace collection signals.
+  static ExternalRequestStats GetExternalRequestStats();
+
   // TODO(nipun): Expose an async-signal-safe function to request dumping
   // of stack traces to stderr. Such a function can be called from signal
   // handlers of fatal signals such as SIGABRT, SIGSEGV, SIGTERM, etc. to get
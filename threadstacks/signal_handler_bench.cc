@@ -0,0 +1,161 @@
+// Copyright: ThoughtSpot Inc 2017
+
+// Reports the cost of installing the signal handlers at startup, the number
+// of heap allocations made by stack trace collection, symbolization and
+// pretty printing, and the latency of collection and pretty printing with and
+// without a worker pool.
+//
+// Usage: signal_handler_bench [num_threads] [num_iterations] [num_workers]
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <future>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "common/sysutil.h"
+#include "common/worker_pool.h"
+#include "threadstacks/signal_handler.h"
+#include "threadstacks/symbol_table.h"
+
+namespace {
+std::atomic<int64_t> num_allocations{0};
+
+// Counts every heap allocation made through operator new. The replacements
+// below all go through these two functions, which must not be inlined into
+// their callers: GCC would otherwise see free() called on memory returned by
+// operator new, and warn about mismatched allocation functions.
+__attribute__((noinline)) void* CountedAlloc(size_t size) {
+  num_allocations.fetch_add(1, std::memory_order_relaxed);
+  void* p = malloc(size);
+  if (p == nullptr) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+
+__attribute__((noinline)) void CountedFree(void* p) noexcept { free(p); }
+}  // namespace
+
+void* operator new(size_t size) { return CountedAlloc(size); }
+
+void* operator new[](size_t size) { return CountedAlloc(size); }
+
+void operator delete(void* p) noexcept { CountedFree(p); }
+
+void operator delete(void* p, size_t) noexcept { CountedFree(p); }
+
+void operator delete[](void* p) noexcept { CountedFree(p); }
+
+void operator delete[](void* p, size_t) noexcept { CountedFree(p); }
+
+int main(int argc, char** argv) {
+  const int num_threads = argc > 1 ? atoi(argv[1]) : 100;
+  const int num_iterations = argc > 2 ? atoi(argv[2]) : 10;
+  const int num_workers = argc > 3 ? atoi(argv[3]) : 0;
+  auto micros_since = [](std::chrono::steady_clock::time_point start) {
+    return static_cast<long>(
+        std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - start).count());
+  };
+
+  // Installation happens once per process, so it's measured first, before
+  // anything else has a chance to start threads or warm up the allocator.
+  const auto install_start = std::chrono::steady_clock::now();
+  const auto install_allocations = num_allocations.load();
+  if (not threadstacks::StackTraceSignal::InstallInternalHandler() ||
+      not threadstacks::StackTraceSignal::InstallExternalHandler()) {
+    fprintf(stderr, "Failed to install signal handlers\n");
+    return 1;
+  }
+  const auto install_us = micros_since(install_start);
+  printf("Install: %ld us, %ld allocations, %zu threads\n", install_us,
+         num_allocations.load() - install_allocations,
+         threadstacks::common::Sysutil::ListThreads().size());
+
+  std::promise<void> done;
+  std::shared_future<void> done_future = done.get_future().share();
+  std::vector<std::thread> threads;
+  for (int i = 0; i < num_threads; ++i) {
+    threads.emplace_back([done_future] { done_future.wait(); });
+  }
+
+  threadstacks::StackTraceCollector collector;
+  for (int i = 0; i < num_iterations; ++i) {
+    std::string error;
+    const auto before = num_allocations.load();
+    auto results = collector.Collect(&error);
+    const auto after_collect = num_allocations.load();
+    const auto pretty = threadstacks::StackTraceCollector::ToPrettyString(
+        results);
+    const auto after_format = num_allocations.load();
+    if (not error.empty()) {
+      fprintf(stderr, "Collection failed: %s\n", error.c_str());
+      return 1;
+    }
+    printf("Results, iteration %d: %d threads, %zu unique stacks, %ld "
+           "allocations in Collect(), %ld allocations in ToPrettyString(), "
+           "%ld arena blocks allocated so far\n",
+           i, num_threads + 1, results.size(), after_collect - before,
+           after_format - after_collect,
+           collector.arena().num_blocks_allocated());
+  }
+
+  threadstacks::StackTraceCollection collection;
+  for (int i = 0; i < num_iterations; ++i) {
+    std::string error;
+    const auto before = num_allocations.load();
+    if (not collector.Collect(nullptr, &collection, &error)) {
+      fprintf(stderr, "Collection failed: %s\n", error.c_str());
+      return 1;
+    }
+    const auto after_collect = num_allocations.load();
+    // Symbolization is measured apart from formatting, since callers that
+    // format a collection more than once can symbolize it once.
+    threadstacks::SymbolTable symbols;
+    collection.Symbolize(&symbols, nullptr);
+    const auto after_symbolize = num_allocations.load();
+    const auto pretty = collection.ToPrettyString(symbols);
+    const auto after_format = num_allocations.load();
+    printf("Collection, iteration %d: %d threads, %d unique stacks, %ld "
+           "allocations in Collect(), %ld allocations in Symbolize(), %ld "
+           "allocations in ToPrettyString()\n",
+           i, collection.num_threads(), collection.size(),
+           after_collect - before, after_symbolize - after_collect,
+           after_format - after_symbolize);
+  }
+
+  threadstacks::common::WorkerPool pool(num_workers);
+  for (auto* p : {static_cast<threadstacks::common::WorkerPool*>(nullptr),
+                  &pool}) {
+    if (p != nullptr && num_workers == 0) {
+      break;
+    }
+    threadstacks::StackTraceCollector timed_collector(p);
+    for (int i = 0; i < num_iterations; ++i) {
+      std::string error;
+      const auto start = std::chrono::steady_clock::now();
+      if (not timed_collector.Collect(nullptr, &collection, &error)) {
+        fprintf(stderr, "Collection failed: %s\n", error.c_str());
+        return 1;
+      }
+      const auto collect_us = micros_since(start);
+      const auto format_start = std::chrono::steady_clock::now();
+      const auto pretty = collection.ToPrettyString(p);
+      printf("%d workers, iteration %d: %ld us in Collect(), %ld us in "
+             "ToPrettyString()\n",
+             p == nullptr ? 0 : num_workers, i, collect_us,
+             micros_since(format_start));
+    }
+  }
+
+  done.set_value();
+  for (auto& t : threads) {
+    t.join();
+  }
+  return 0;
+}
@@ -5,24 +5,32 @@
 
 #include <fcntl.h>
 #include <signal.h>
+#include <sys/resource.h>
 #include <sys/select.h>
 #include <sys/syscall.h>
 #include <unistd.h>
 
 #include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <future>
+#include <map>
 #include <random>
 #include <thread>
 
+#include "common/cancellation.h"
 #include "common/defer.h"
 #include "common/sysutil.h"
 #include "common/unbuffered_channel.h"
+#include "common/worker_pool.h"
+#include "threadstacks/context_tag.h"
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
 #include "glog/logging.h"
 
 using testing::AllOf;
 using testing::Gt;
+using testing::HasSubstr;
 using testing::IsEmpty;
 using testing::Le;
 using threadstacks::common::UnbufferedChannel;
@@ -67,6 +75,32 @@ void G(int fd) {
   while (0 != read(fd, &ch, sizeof(ch))) {;}
 }
 
+// Blocks in read(2) on @fd until it's closed.
+__attribute__((noinline)) void BlockedInRead(int fd) {
+  char ch;
+  while (0 < read(fd, &ch, sizeof(ch))) {
+  }
+  // Keeps the call to read(2) from being a tail call.
+  asm volatile("");
+}
+
+// Returns the number of the system call thread @tid of the calling process is
+// blocked in, or -1 if it isn't blocked in one.
+long GetBlockingSyscall(pid_t tid) {
+  char path[64];
+  snprintf(path, sizeof(path), "/proc/self/task/%d/syscall", tid);
+  FILE* f = fopen(path, "r");
+  if (f == nullptr) {
+    return -1;
+  }
+  long nr = -1;
+  if (1 != fscanf(f, "%ld", &nr)) {
+    nr = -1;
+  }
+  fclose(f);
+  return nr;
+}
+
 // Returns the bytes read from @fd as a string.
 std::string ReadFromFD(int fd) {
   std::string output;
@@ -96,16 +130,38 @@ int NumMatches(const std::string& str, const std::string& token) {
   return count;
 }
 
+// Waits until the stack trace service has received at least @min_received
+// external signals in total, and is done with all the signals it received.
+// Returns the stats of external signals as of then, or as of a timeout of 30
+// seconds, in which case they aren't idle.
+StackTraceSignal::ExternalRequestStats WaitForExternalRequests(
+    int64_t min_received = 0) {
+  const auto deadline =
+      std::chrono::steady_clock::now() + std::chrono::seconds(30);
+  while (true) {
+    const auto stats = StackTraceSignal::GetExternalRequestStats();
+    if ((stats.received >= min_received && stats.idle()) ||
+        std::chrono::steady_clock::now() > deadline) {
+      return stats;
+    }
+    usleep(1000);
+  }
+}
+
+// Number of threads in the process when no test is running - the main thread,
+// the external stack trace signal processor thread, and the three other stage
+// threads of its pipeline, once it is started by the first external signal.
+const int kNumIdleThreads = 5;
+
 class StackTraceCollectorTest : public ::testing::Test {
  public:
   StackTraceCollectorTest() = default;
   ~StackTraceCollectorTest() override = default;
   void SetUp() override {
     // Wait for any threads from the previous test to stop appearing in the
-    // ListThread's output. Proceed only when there are precisely two threads
-    // detected - the main thread and the external stack trace signal processor
-    // thread.
-    while (2 != common::Sysutil::ListThreads().size()) {;}
+    // ListThread's output. Proceed only when there are precisely
+    // kNumIdleThreads threads detected.
+    while (kNumIdleThreads != common::Sysutil::ListThreads().size()) {;}
     // Note down the minimum available file descriptor before the test starts.
     min_fd_init_ = open("/dev/null", O_WRONLY);
     close(min_fd_init_);
@@ -135,11 +191,277 @@ TEST_F(StackTraceCollectorTest, Basic) {
       ::testing::UnorderedElementsAreArray(common::Sysutil::ListThreads()));
 }
 
+// Verifies that a StackTraceCollection partitions all the threads into groups
+// of unique stack traces, and that it can be reused across collections.
+TEST_F(StackTraceCollectorTest, Collection) {
+  StackTraceCollector collector;
+  StackTraceCollection collection;
+  for (int i = 0; i < 3; ++i) {
+    std::string error;
+    ASSERT_TRUE(collector.Collect(nullptr, &collection, &error)) << error;
+    EXPECT_THAT(error, IsEmpty());
+    std::vector<pid_t> tids;
+    for (const auto& group : collection) {
+      EXPECT_GT(group.trace->depth, 0);
+      EXPECT_GT(group.num_tids, 0);
+      tids.insert(tids.end(), group.tids, group.tids + group.num_tids);
+    }
+    EXPECT_EQ(collection.num_threads(), tids.size());
+    EXPECT_THAT(
+        tids,
+        ::testing::UnorderedElementsAreArray(common::Sysutil::ListThreads()));
+  }
+  collection.Clear();
+  EXPECT_TRUE(collection.empty());
+  EXPECT_EQ(0, collection.num_threads());
+}
+
+// Verifies thread filters, and the folded and raw formats of a collection.
+TEST_F(StackTraceCollectorTest, Collection_FilterAndFormats) {
+  const pid_t tid = syscall(SYS_gettid);
+  StackTraceCollector collector;
+  collector.set_thread_filter([tid](pid_t t) { return t == tid; });
+  StackTraceCollection collection;
+  std::string error;
+  ASSERT_TRUE(collector.Collect(nullptr, &collection, &error)) << error;
+  ASSERT_EQ(1, collection.size());
+  ASSERT_EQ(1, collection[0].num_tids);
+  EXPECT_EQ(tid, collection[0].tids[0]);
+  const auto& trace = *collection[0].trace;
+  ASSERT_GT(trace.depth, 1);
+
+  char buf[32];
+  snprintf(buf, sizeof(buf), "%d %#lx ", tid, trace.address[0]);
+  const auto raw = collection.ToRawString();
+  EXPECT_EQ(0, raw.find(buf)) << raw;
+  EXPECT_EQ(trace.depth, NumMatches(raw, " 0x")) << raw;
+  EXPECT_EQ(1, NumMatches(raw, "\n")) << raw;
+
+  // Frames are folded from the outermost to the innermost.
+  snprintf(buf, sizeof(buf), "%#lx;", trace.address[trace.depth - 1]);
+  const auto folded = collection.ToFoldedString(nullptr);
+  EXPECT_EQ(0, folded.find(buf)) << folded;
+  snprintf(buf, sizeof(buf), ";%#lx 1\n", trace.address[0]);
+  EXPECT_THAT(folded, HasSubstr(buf));
+  EXPECT_EQ(trace.depth - 1, NumMatches(folded, ";")) << folded;
+}
+
+// Verifies that the context tags and CPU times of threads are collected with
+// their stack traces.
+TEST_F(StackTraceCollectorTest, Collection_ContextTags) {
+  const int kNumTagged = 2;
+  std::atomic<int> num_ready{0};
+  std::atomic<bool> stop{false};
+  std::vector<std::thread> threads;
+  std::vector<pid_t> tids(kNumTagged);
+  for (int i = 0; i < kNumTagged; ++i) {
+    threads.emplace_back([&, i]() {
+      ContextTag tag(("tenant=" + std::to_string(i)).c_str());
+      ScopedContextTag scoped(&tag);
+      tids[i] = GetTid();
+      ++num_ready;
+      while (not stop) {
+        usleep(1000);
+      }
+    });
+  }
+  DEFER(
+    stop = true;
+    for (auto& thread : threads) {
+      thread.join();
+    }
+  );
+  while (num_ready != kNumTagged) {
+    usleep(1000);
+  }
+  // Tags longer than ContextTag::kMaxSize are truncated.
+  ContextTag tag(std::string(2 * ContextTag::kMaxSize, 'x').c_str());
+  {
+    ScopedContextTag scoped(&tag);
+    EXPECT_EQ(&tag, GetContextTag());
+  }
+  EXPECT_EQ(nullptr, GetContextTag());
+  SetContextTag(&tag);
+  DEFER(SetContextTag(nullptr));
+
+  StackTraceCollector collector;
+  StackTraceCollection collection;
+  std::string error;
+  ASSERT_TRUE(collector.Collect(nullptr, &collection, &error)) << error;
+  std::map<pid_t, std::string> tags;
+  for (const auto& group : collection) {
+    for (int i = 0; i < group.num_tids; ++i) {
+      tags[group.tids[i]] = group.tags[i];
+      EXPECT_LE(0, group.cpu_ns[i]);
+    }
+  }
+  EXPECT_EQ(collection.num_threads(), tags.size());
+  for (int i = 0; i < kNumTagged; ++i) {
+    EXPECT_EQ("tenant=" + std::to_string(i), tags[tids[i]]);
+  }
+  EXPECT_EQ(std::string(ContextTag::kMaxSize - 1, 'x'), tags[GetTid()]);
+  int num_untagged = 0;
+  for (const auto& e : tags) {
+    num_untagged += e.second.empty();
+  }
+  EXPECT_EQ(collection.num_threads() - kNumTagged - 1, num_untagged);
+}
+
+// Verifies encoding and decoding of external request options.
+// Verifies that stack traces start at the interrupted frame: a thread blocked
+// in a system call is captured in the system call wrapper, called from the
+// function that made the call.
+TEST_F(StackTraceCollectorTest, Collection_InnermostFrame) {
+  int fds[2];
+  ASSERT_EQ(0, pipe(fds));
+  NAMED_DEFER(close_write_end, close(fds[1]));
+  DEFER(close(fds[0]));
+  UnbufferedChannel<pid_t> tid_ch;
+  auto t = std::thread([&] {
+    tid_ch.Write(GetTid());
+    BlockedInRead(fds[0]);
+  });
+  // Unblocks the thread before joining it.
+  DEFER({
+    close_write_end.run_and_expire();
+    t.join();
+  });
+  pid_t tid;
+  ASSERT_TRUE(tid_ch.Read(&tid));
+  while (SYS_read != GetBlockingSyscall(tid)) {
+    usleep(1000);
+  }
+
+  StackTraceCollector collector;
+  collector.set_thread_filter([tid](pid_t t) { return t == tid; });
+  StackTraceCollection collection;
+  std::string error;
+  ASSERT_TRUE(collector.Collect(nullptr, &collection, &error)) << error;
+  ASSERT_EQ(1, collection.size());
+  const auto& trace = *collection.begin()->trace;
+  ASSERT_LE(2, trace.depth);
+  char symbol[1024];
+  ASSERT_TRUE(ThreadStack::Symbolize(trace.address[0], symbol,
+                                     sizeof(symbol)));
+  // E.g. "read", "__read" or "__libc_read", depending on the libc.
+  EXPECT_THAT(std::string(symbol), ::testing::MatchesRegex("(.*_)?read"));
+  ASSERT_TRUE(ThreadStack::Symbolize(trace.address[1], symbol,
+                                     sizeof(symbol)));
+  EXPECT_THAT(std::string(symbol), HasSubstr("BlockedInRead"));
+}
+
+TEST_F(StackTraceCollectorTest, ExternalRequestOptions_Encoding) {
+  using Options = StackTraceSignal::ExternalRequestOptions;
+  Options options;
+  options.format = Options::kRaw;
+  options.symbolize = false;
+  options.thread_filter = 3;
+  options.deadline_ms = 100;
+  options.sink = 15;
+  const int payload = StackTraceSignal::EncodeExternalRequest(options);
+  Options decoded;
+  ASSERT_TRUE(StackTraceSignal::DecodeExternalRequest(payload, &decoded));
+  EXPECT_EQ(Options::kRaw, decoded.format);
+  EXPECT_FALSE(decoded.symbolize);
+  EXPECT_EQ(3, decoded.thread_filter);
+  // Deadlines are rounded up to 10ms times a power of 2.
+  EXPECT_EQ(160, decoded.deadline_ms);
+  EXPECT_EQ(15, decoded.sink);
+
+  // The defaults encode to just the tag, and decode back to the defaults.
+  EXPECT_EQ(StackTraceSignal::kExternalRequestTag,
+            StackTraceSignal::EncodeExternalRequest(Options()));
+  ASSERT_TRUE(StackTraceSignal::DecodeExternalRequest(
+      StackTraceSignal::kExternalRequestTag, &decoded));
+  EXPECT_EQ(Options::kText, decoded.format);
+  EXPECT_TRUE(decoded.symbolize);
+  EXPECT_EQ(0, decoded.thread_filter);
+  EXPECT_EQ(0, decoded.deadline_ms);
+  EXPECT_EQ(0, decoded.sink);
+
+  // Payloads without the tag, or with reserved bits set, are invalid.
+  const int tag = StackTraceSignal::kExternalRequestTag;
+  for (int invalid : {0, 1, -1, int{StackTraceSignal::kExternalRequestRaw},
+                      tag | 0x3, tag | 0x8, tag | 0x10000}) {
+    EXPECT_FALSE(StackTraceSignal::DecodeExternalRequest(invalid, &decoded))
+        << std::hex << invalid;
+  }
+}
+
+// Verifies that a collection with an already cancelled token doesn't signal
+// any thread.
+TEST_F(StackTraceCollectorTest, Cancel_BeforeStart) {
+  common::CancellationToken token;
+  token.Cancel();
+  StackTraceCollector collector;
+  std::string error;
+  auto ret = collector.Collect(&token, &error);
+  EXPECT_THAT(ret, IsEmpty());
+  EXPECT_THAT(error, HasSubstr("cancelled"));
+}
+
+// Verifies that an in-flight collection, waiting on a thread which has the
+// internal signal blocked, can be cancelled. The stale signal delivered to that
+// thread afterwards must be ignored, and subsequent collections must work as
+// usual.
+TEST_F(StackTraceCollectorTest, Cancel_InFlight) {
+  UnbufferedChannel<pid_t> tid_ch;
+  UnbufferedChannel<bool> unblock_ch, unblocked_ch;
+  auto t = std::thread([&] {
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, StackTraceSignal::InternalSignum());
+    pthread_sigmask(SIG_BLOCK, &set, nullptr);
+    tid_ch.Write(GetTid());
+    bool unused;
+    unblock_ch.Read(&unused);
+    // Delivers the stale signal, if it's still pending.
+    pthread_sigmask(SIG_UNBLOCK, &set, nullptr);
+    unblocked_ch.Write(true);
+  });
+  pid_t blocked_tid;
+  ASSERT_TRUE(tid_ch.Read(&blocked_tid));
+
+  common::CancellationToken token;
+  auto canceller = std::async(std::launch::async, [&] {
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    token.Cancel();
+  });
+  StackTraceCollector collector;
+  std::string error;
+  const auto start = std::chrono::steady_clock::now();
+  auto ret = collector.Collect(&token, &error);
+  const auto elapsed = std::chrono::steady_clock::now() - start;
+  canceller.get();
+  // The collection timeout is 5 seconds.
+  EXPECT_LT(elapsed, std::chrono::seconds(2));
+  EXPECT_THAT(error, HasSubstr("cancelled"));
+  const auto tids = GetTids(ret);
+  EXPECT_THAT(tids, ::testing::Contains(GetTid()));
+  EXPECT_THAT(tids, ::testing::Not(::testing::Contains(blocked_tid)));
+
+  unblock_ch.Write(true);
+  bool unused;
+  ASSERT_TRUE(unblocked_ch.Read(&unused));
+  t.join();
+
+  error.clear();
+  ret = collector.Collect(&error);
+  EXPECT_THAT(error, IsEmpty());
+  EXPECT_THAT(
+      GetTids(ret),
+      ::testing::UnorderedElementsAreArray(common::Sysutil::ListThreads()));
+}
+
 // Verifies for system sanity when many threads bombard the process with
 // external stack collection signal using kill().
 TEST_F(StackTraceCollectorTest, Stress_ExternalSignum_Kill) {
   const int kNumSignallers = 10;
   const int kNumIterations = 5;
+  // Step 0: Wait for the dumps requested by earlier tests, so that only the
+  // dumps of this test are counted.
+  const auto orig_stats = WaitForExternalRequests();
+  ASSERT_TRUE(orig_stats.idle());
   // Step 1: Redirect stderr to a pipe. This helps in verifying the contents
   // of stderr.
   const int stderr_copy = dup(STDERR_FILENO);
@@ -151,14 +473,13 @@ TEST_F(StackTraceCollectorTest, Stress_ExternalSignum_Kill) {
   int stderr_pipe[2];
   ASSERT_NE(-1, pipe(stderr_pipe));
   DEFER(close(stderr_pipe[0]));
-  DEFER(close(stderr_pipe[1]));
   ASSERT_NE(-1, dup2(stderr_pipe[1], STDERR_FILENO));
   close(stderr_pipe[1]);  // stderr_pipe[1] is now an alias for STDERR_FILENO.
 
   // Step 2: Launch t1 and t2 threads.
   int t1_done[2];  // Used to signal t1 to exit.
   DEFER(close(t1_done[0]));
-  DEFER(close(t1_done[1]));
+  NAMED_DEFER(close_t1_done, close(t1_done[1]));
   ASSERT_NE(-1, pipe(t1_done)) << "Errno: " << errno;
   std::promise<void> t2_done;  // Used to signal t2 to exit.
   std::thread t1(F, t2_done.get_future());
@@ -172,7 +493,7 @@ TEST_F(StackTraceCollectorTest, Stress_ExternalSignum_Kill) {
   // Step 4: Wait for all threads to start and capture their tids. Then,
   // launch @kNumSignallers child processes, which send @kNumIterations
   // external signal using sigqueue().
-  while (5 != common::Sysutil::ListThreads().size()) {;}
+  while (kNumIdleThreads + 3 != common::Sysutil::ListThreads().size()) {;}
   const auto tids = common::Sysutil::ListThreads();
 
   std::set<pid_t> child;
@@ -182,33 +503,36 @@ TEST_F(StackTraceCollectorTest, Stress_ExternalSignum_Kill) {
     // Child process.
     if (pid == 0) {
       RandomGen rng;
+      int num_sent = 0;
       for (int i = 0; i < kNumIterations; ++i) {
         // Send external signal to a randomly selected thread.
         auto tid = tids[rng.NextInt(0, tids.size())];
-        kill(tid, StackTraceSignal::ExternalSignum());
+        if (0 == kill(tid, StackTraceSignal::ExternalSignum())) {
+          ++num_sent;
+        }
       }
-      exit(0);
+      // Report the number of signals sent in the exit status.
+      exit(num_sent);
     } else {
       child.insert(pid);
     }
   }
 
   // Wait for all child processes to finish.
+  int num_sent = 0;
   while (not child.empty()) {
     int status = 0;
     auto pid = waitpid(*child.begin(), &status, 0);
     if (pid > 0) {
       child.erase(pid);
+      num_sent += WIFEXITED(status) ? WEXITSTATUS(status) : 0;
     }
   }
 
-  // Give enough time for all signals to be delivered. Unfortunately there is
-  // no easy way to write this test without a sleep, given than signals are
-  // delivered out-of-band.
-  int sleep_time = 3;
-  while (sleep_time > 0) {
-    sleep_time = sleep(sleep_time);
-  }
+  // Wait for all the signals that were sent to be picked up, and for their
+  // dumps to be written.
+  const auto stats = WaitForExternalRequests(orig_stats.received + num_sent);
+  EXPECT_TRUE(stats.idle());
 
   // Step 5: Verify expectations.
   // Redirect stderr back to STDERR_FILNO. Note that this also closes the
@@ -216,7 +540,7 @@ TEST_F(StackTraceCollectorTest, Stress_ExternalSignum_Kill) {
   restore_stderr.run_and_expire();
 
   // Signal t1 and t2 to exit.
-  close(t1_done[1]);
+  close_t1_done.run_and_expire();
   t2_done.set_value();
   t1.join();
   t2.join();
@@ -238,6 +562,10 @@ TEST_F(StackTraceCollectorTest, Stress_ExternalSignum_Kill) {
 TEST_F(StackTraceCollectorTest, Stress_ExternalSignum_Sigqueue) {
   const int kNumSignallers = 10;
   const int kNumIterations = 5;
+  // Step 0: Wait for the dumps requested by earlier tests, so that only the
+  // dumps of this test are counted.
+  const auto orig_stats = WaitForExternalRequests();
+  ASSERT_TRUE(orig_stats.idle());
   // Step 1: Redirect stderr to a pipe. This helps in verifying the contents
   // of stderr.
   const int stderr_copy = dup(STDERR_FILENO);
@@ -249,14 +577,13 @@ TEST_F(StackTraceCollectorTest, Stress_ExternalSignum_Sigqueue) {
   int stderr_pipe[2];
   ASSERT_NE(-1, pipe(stderr_pipe));
   DEFER(close(stderr_pipe[0]));
-  DEFER(close(stderr_pipe[1]));
   ASSERT_NE(-1, dup2(stderr_pipe[1], STDERR_FILENO));
   close(stderr_pipe[1]);  // stderr_pipe[1] is now an alias for STDERR_FILENO.
 
   // Step 2: Launch t1 and t2 threads.
   int t1_done[2];  // Used to signal t1 to exit.
   DEFER(close(t1_done[0]));
-  DEFER(close(t1_done[1]));
+  NAMED_DEFER(close_t1_done, close(t1_done[1]));
   ASSERT_NE(-1, pipe(t1_done)) << "Errno: " << errno;
   std::promise<void> t2_done;  // Used to signal t2 to exit.
   std::thread t1(F, t2_done.get_future());
@@ -270,7 +597,7 @@ TEST_F(StackTraceCollectorTest, Stress_ExternalSignum_Sigqueue) {
   // Step 4: Wait for all threads to start and capture their tids. Then,
   // launch @kNumSignallers child processes, which send @kNumIterations
   // external signal using sigqueue().
-  while (5 != common::Sysutil::ListThreads().size()) {
+  while (kNumIdleThreads + 3 != common::Sysutil::ListThreads().size()) {
     ;
   }
   const auto tids = common::Sysutil::ListThreads();
@@ -298,7 +625,9 @@ TEST_F(StackTraceCollectorTest, Stress_ExternalSignum_Sigqueue) {
     }
   }
 
-  // Wait for all child processes to finish.
+  // Wait for all child processes to finish. They retry until each of their
+  // signals is sent.
+  const int num_sent = kNumSignallers * kNumIterations;
   while (not child.empty()) {
     int status = 0;
     auto pid = waitpid(*child.begin(), &status, 0);
@@ -306,13 +635,10 @@ TEST_F(StackTraceCollectorTest, Stress_ExternalSignum_Sigqueue) {
       child.erase(pid);
     }
   }
-  // Give enough time for all signals to be delivered. Unfortunately there is
-  // no easy way to write this test without a sleep, given than signals are
-  // delivered out-of-band.
-  int sleep_time = 3;
-  while (sleep_time > 0) {
-    sleep_time = sleep(sleep_time);
-  }
+  // Wait for all the signals that were sent to be picked up, and for their
+  // dumps to be written.
+  const auto stats = WaitForExternalRequests(orig_stats.received + num_sent);
+  EXPECT_TRUE(stats.idle());
 
   // Step 5: Verify expectations.
   // Redirect stderr back to STDERR_FILNO. Note that this also closes the
@@ -320,7 +646,7 @@ TEST_F(StackTraceCollectorTest, Stress_ExternalSignum_Sigqueue) {
   restore_stderr.run_and_expire();
 
   // Signal t1 and t2 to exit.
-  close(t1_done[1]);
+  close_t1_done.run_and_expire();
   t2_done.set_value();
   t1.join();
   t2.join();
@@ -336,6 +662,165 @@ TEST_F(StackTraceCollectorTest, Stress_ExternalSignum_Sigqueue) {
       << stderr_str;
 }
 
+// Verifies that external stack collection requests are accepted even when the
+// process can't open any more file descriptors, i.e. that no file descriptor
+// is created per request.
+TEST_F(StackTraceCollectorTest, ExternalSignum_NoFileDescriptorsPerRequest) {
+  const int kNumSignals = 20;
+  // Step 0: Wait for the dumps requested by earlier tests, so that only the
+  // dumps of this test are counted.
+  const auto orig_stats = WaitForExternalRequests();
+  ASSERT_TRUE(orig_stats.idle());
+  // Step 1: Redirect stderr to a pipe. This helps in verifying the contents
+  // of stderr.
+  const int stderr_copy = dup(STDERR_FILENO);
+  ASSERT_NE(-1, stderr_copy);
+  NAMED_DEFER(restore_stderr,
+              // Restored stderr at the end of test.
+              dup2(stderr_copy, STDERR_FILENO);
+              close(stderr_copy););
+  int stderr_pipe[2];
+  ASSERT_NE(-1, pipe(stderr_pipe));
+  DEFER(close(stderr_pipe[0]));
+  ASSERT_NE(-1, dup2(stderr_pipe[1], STDERR_FILENO));
+  close(stderr_pipe[1]);  // stderr_pipe[1] is now an alias for STDERR_FILENO.
+  std::future<std::string> stderr_output =
+      std::async(std::launch::async, ReadFromFD, stderr_pipe[0]);
+
+  // Step 2: Lower the limit on open file descriptors to the minimum available
+  // file descriptor, so that no new file descriptor can be opened. Then send
+  // external signals. Note that the collections themselves fail, as they
+  // need file descriptors, but every request should still be served.
+  struct rlimit orig_limit;
+  ASSERT_EQ(0, getrlimit(RLIMIT_NOFILE, &orig_limit));
+  const int min_fd = open("/dev/null", O_WRONLY);
+  ASSERT_NE(-1, min_fd);
+  close(min_fd);
+  struct rlimit limit = orig_limit;
+  limit.rlim_cur = min_fd;
+  ASSERT_EQ(0, setrlimit(RLIMIT_NOFILE, &limit));
+  NAMED_DEFER(restore_limit, setrlimit(RLIMIT_NOFILE, &orig_limit));
+  for (int i = 0; i < kNumSignals; ++i) {
+    union sigval sv;
+    sv.sival_int = 0;
+    ASSERT_EQ(0, sigqueue(getpid(), StackTraceSignal::ExternalSignum(), sv));
+  }
+  // Wait for all the requests to be served.
+  const auto stats =
+      WaitForExternalRequests(orig_stats.received + kNumSignals);
+  restore_limit.run_and_expire();
+
+  // Step 3: Verify expectations.
+  restore_stderr.run_and_expire();
+  auto stderr_str = stderr_output.get();
+  ASSERT_TRUE(stats.idle());
+  EXPECT_EQ(kNumSignals, stats.received - orig_stats.received);
+  EXPECT_EQ(kNumSignals, stats.served - orig_stats.served);
+  EXPECT_EQ(kNumSignals, NumMatches(stderr_str, "Stack traces - Start"))
+      << stderr_str;
+  EXPECT_EQ(0, NumMatches(stderr_str, "stack trace service thread"))
+      << stderr_str;
+}
+
+// Verifies that external stack collection signals in excess of the limits
+// don't result in dumps.
+TEST_F(StackTraceCollectorTest, ExternalSignum_Limits) {
+  const int kNumSignals = 10;
+  // Step 0: Wait for the dumps requested by earlier tests, which would
+  // otherwise use up the limits.
+  const auto orig_stats = WaitForExternalRequests();
+  ASSERT_TRUE(orig_stats.idle());
+  // Step 1: Redirect stderr to a pipe. This helps in verifying the contents
+  // of stderr.
+  const int stderr_copy = dup(STDERR_FILENO);
+  ASSERT_NE(-1, stderr_copy);
+  NAMED_DEFER(restore_stderr,
+              // Restored stderr at the end of test.
+              dup2(stderr_copy, STDERR_FILENO);
+              close(stderr_copy););
+  int stderr_pipe[2];
+  ASSERT_NE(-1, pipe(stderr_pipe));
+  DEFER(close(stderr_pipe[0]));
+  ASSERT_NE(-1, dup2(stderr_pipe[1], STDERR_FILENO));
+  close(stderr_pipe[1]);  // stderr_pipe[1] is now an alias for STDERR_FILENO.
+  std::future<std::string> stderr_output =
+      std::async(std::launch::async, ReadFromFD, stderr_pipe[0]);
+
+  // Step 2: Allow a single dump, and send a few external signals.
+  const auto orig_limits = StackTraceSignal::GetExternalRequestLimits();
+  StackTraceSignal::ExternalRequestLimits limits;
+  limits.min_interval_ms = 60 * 60 * 1000;
+  limits.max_per_minute = 1;
+  StackTraceSignal::SetExternalRequestLimits(limits);
+  DEFER(StackTraceSignal::SetExternalRequestLimits(orig_limits));
+  for (int i = 0; i < kNumSignals; ++i) {
+    union sigval sv;
+    sv.sival_int = 0;
+    ASSERT_EQ(0, sigqueue(getpid(), StackTraceSignal::ExternalSignum(), sv));
+  }
+  // Wait for all the signals to be picked up, and the dump to be written.
+  const auto stats =
+      WaitForExternalRequests(orig_stats.received + kNumSignals);
+
+  // Step 3: Verify expectations.
+  restore_stderr.run_and_expire();
+  auto stderr_str = stderr_output.get();
+  ASSERT_TRUE(stats.idle());
+  EXPECT_EQ(kNumSignals, stats.received - orig_stats.received);
+  EXPECT_EQ(1, NumMatches(stderr_str, "Stack traces - Start")) << stderr_str;
+  EXPECT_EQ(1, NumMatches(stderr_str, "Stack traces - End")) << stderr_str;
+  EXPECT_EQ(1, stats.served - orig_stats.served);
+  EXPECT_EQ(kNumSignals - 1,
+            (stats.coalesced - orig_stats.coalesced) +
+                (stats.rejected - orig_stats.rejected));
+  EXPECT_EQ(0, stats.dropped - orig_stats.dropped);
+}
+
+// Verifies that the options in the payload of an external stack collection
+// signal are honored.
+TEST_F(StackTraceCollectorTest, ExternalSignum_Options) {
+  // Wait for the dumps requested by earlier tests, which the request below
+  // would otherwise queue behind.
+  const auto orig_stats = WaitForExternalRequests();
+  ASSERT_TRUE(orig_stats.idle());
+  const pid_t tid = syscall(SYS_gettid);
+  ASSERT_TRUE(StackTraceSignal::RegisterExternalThreadFilter(
+      1, [tid](pid_t t) { return t == tid; }));
+  DEFER(StackTraceSignal::RegisterExternalThreadFilter(1, nullptr));
+  std::promise<std::string> dump;
+  ASSERT_TRUE(StackTraceSignal::RegisterExternalSink(
+      1, [&dump](const std::string& d) { dump.set_value(d); }));
+  DEFER(StackTraceSignal::RegisterExternalSink(1, nullptr));
+  EXPECT_FALSE(StackTraceSignal::RegisterExternalSink(0, nullptr));
+  EXPECT_FALSE(StackTraceSignal::RegisterExternalSink(
+      StackTraceSignal::kNumExternalRequestSlots, nullptr));
+
+  StackTraceSignal::ExternalRequestOptions options;
+  options.format = StackTraceSignal::ExternalRequestOptions::kRaw;
+  options.symbolize = false;
+  options.thread_filter = 1;
+  options.sink = 1;
+  union sigval sv;
+  sv.sival_int = StackTraceSignal::EncodeExternalRequest(options);
+  ASSERT_EQ(0, sigqueue(getpid(), StackTraceSignal::ExternalSignum(), sv));
+
+  auto f = dump.get_future();
+  ASSERT_EQ(std::future_status::ready, f.wait_for(std::chrono::seconds(10)));
+  const auto str = f.get();
+  // The request was served on its own, as the latest dump.
+  const auto stats = WaitForExternalRequests(orig_stats.received + 1);
+  ASSERT_TRUE(stats.idle());
+  EXPECT_EQ(1, stats.served - orig_stats.served);
+  EXPECT_THAT(str, HasSubstr("\n" + std::to_string(stats.served) +
+                             ") Stack traces - Start"))
+      << str;
+  EXPECT_EQ(1, NumMatches(str, "Stack traces - Start")) << str;
+  EXPECT_EQ(1, NumMatches(str, "Stack traces - End")) << str;
+  // A single raw line, for this thread.
+  EXPECT_THAT(str, HasSubstr("\n" + std::to_string(tid) + " 0x")) << str;
+  EXPECT_EQ(0, NumMatches(str, "Threads:")) << str;
+}
+
 // Verifies that external signal handler can safely be installed multiple times.
 TEST_F(StackTraceCollectorTest, ExternalHandlerInstalledMultipleTimes) {
   for (int i = 0; i < 10; ++i) {
@@ -352,14 +837,13 @@ TEST_F(StackTraceCollectorTest, ExternalHandlerInstalledMultipleTimes) {
   int stderr_pipe[2];
   ASSERT_NE(-1, pipe(stderr_pipe));
   DEFER(close(stderr_pipe[0]));
-  DEFER(close(stderr_pipe[1]));
   ASSERT_NE(-1, dup2(stderr_pipe[1], STDERR_FILENO));
   close(stderr_pipe[1]);  // stderr_pipe[1] is now an alias for STDERR_FILENO.
 
   // Step 2: Launch t1 and t2 threads.
   int t1_done[2];  // Used to signal t1 to exit.
   DEFER(close(t1_done[0]));
-  DEFER(close(t1_done[1]));
+  NAMED_DEFER(close_t1_done, close(t1_done[1]));
   ASSERT_NE(-1, pipe(t1_done)) << "Errno: " << errno;
   std::promise<void> t2_done;  // Used to signal t2 to exit.
   std::thread t1(F, t2_done.get_future());
@@ -373,7 +857,7 @@ TEST_F(StackTraceCollectorTest, ExternalHandlerInstalledMultipleTimes) {
   // Step 4: Wait for all threads to start and capture their tids. Then,
   // launch @kNumSignallers child processes, which send @kNumIterations
   // external signal using sigqueue().
-  while (5 != common::Sysutil::ListThreads().size()) {;}
+  while (kNumIdleThreads + 3 != common::Sysutil::ListThreads().size()) {;}
   const auto tids = common::Sysutil::ListThreads();
 
   auto pid = fork();
@@ -403,7 +887,7 @@ TEST_F(StackTraceCollectorTest, ExternalHandlerInstalledMultipleTimes) {
   restore_stderr.run_and_expire();
 
   // Signal t1 and t2 to exit.
-  close(t1_done[1]);
+  close_t1_done.run_and_expire();
   t2_done.set_value();
   t1.join();
   t2.join();
@@ -433,7 +917,6 @@ TEST_F(StackTraceCollectorTest, InternalSignum_FromExternalProcess) {
   int stderr_pipe[2];
   ASSERT_NE(-1, pipe(stderr_pipe));
   DEFER(close(stderr_pipe[0]));
-  DEFER(close(stderr_pipe[1]));
   ASSERT_NE(-1, dup2(stderr_pipe[1], STDERR_FILENO));
   close(stderr_pipe[1]);  // stderr_pipe[1] is now an alias for STDERR_FILENO.
 
@@ -492,7 +975,6 @@ TEST_F(StackTraceCollectorTest, ExternalSignum_FromExternalProcess) {
   int stderr_pipe[2];
   ASSERT_NE(-1, pipe(stderr_pipe));
   DEFER(close(stderr_pipe[0]));
-  DEFER(close(stderr_pipe[1]));
   ASSERT_NE(-1, dup2(stderr_pipe[1], STDERR_FILENO));
   close(stderr_pipe[1]);  // stderr_pipe[1] is now an alias for STDERR_FILENO.
 
@@ -551,7 +1033,6 @@ TEST_F(StackTraceCollectorTest, Fork_ChildReceivedStackTraceCollectionSignal) {
   int stderr_pipe[2];
   ASSERT_NE(-1, pipe(stderr_pipe));
   DEFER(close(stderr_pipe[0]));
-  DEFER(close(stderr_pipe[1]));
   ASSERT_NE(-1, dup2(stderr_pipe[1], STDERR_FILENO));
   close(stderr_pipe[1]);  // stderr_pipe[1] is now an alias for STDERR_FILENO.
 
@@ -598,6 +1079,53 @@ TEST_F(StackTraceCollectorTest, Fork_ChildReceivedStackTraceCollectionSignal) {
   }
 }
 
+// Verifies that post-processing a large collection on a worker pool produces
+// the exact same result as the serial post-processing.
+TEST_F(StackTraceCollectorTest, Collection_Parallel) {
+  std::promise<void> done;
+  std::shared_future<void> done_future = done.get_future().share();
+  std::vector<std::thread> threads;
+  for (int i = 0; i < 600; ++i) {
+    if (i % 2 == 0) {
+      threads.emplace_back([done_future] { done_future.wait(); });
+    } else {
+      threads.emplace_back(
+          [done_future] { done_future.wait_for(std::chrono::hours(1)); });
+    }
+  }
+  DEFER({
+    done.set_value();
+    for (auto& t : threads) {
+      t.join();
+    }
+  });
+
+  common::WorkerPool pool(3);
+  StackTraceCollector serial_collector;
+  StackTraceCollector parallel_collector(&pool);
+  StackTraceCollection serial, parallel;
+  std::string error;
+  ASSERT_TRUE(serial_collector.Collect(nullptr, &serial, &error)) << error;
+  ASSERT_TRUE(parallel_collector.Collect(nullptr, &parallel, &error)) << error;
+  // The main thread and the worker threads may have moved in between the two
+  // collections, so only compare the large groups of idle threads.
+  auto large_groups = [](const StackTraceCollection& collection) {
+    std::vector<std::pair<std::vector<int64_t>, std::vector<pid_t>>> groups;
+    for (const auto& group : collection) {
+      if (group.num_tids > 100) {
+        groups.emplace_back(
+            std::vector<int64_t>(group.trace->address,
+                                 group.trace->address + group.trace->depth),
+            std::vector<pid_t>(group.tids, group.tids + group.num_tids));
+      }
+    }
+    return groups;
+  };
+  EXPECT_EQ(2, large_groups(serial).size());
+  EXPECT_EQ(large_groups(serial), large_groups(parallel));
+  EXPECT_EQ(parallel.ToPrettyString(), parallel.ToPrettyString(&pool));
+}
+
 void Function1(UnbufferedChannel<bool>* in, UnbufferedChannel<bool>* out) {
   bool unused;
   out->Write(true);
@@ -642,10 +1170,14 @@ MATCHER_P3(HasSubStack, tid, function_name, count, "") {
     return true;
   }
 
+  std::vector<std::string> symbols;
+  it->trace.VisitWithSymbol(
+      [&](int, int64_t, int64_t, const char* symbol) {
+        symbols.push_back(symbol);
+      });
   bool match_started = false;
   int found = 0;
-  for (int i = 0; i < it->trace.size(); ++i) {
-    const auto& elem = it->trace[i].second;
+  for (const auto& elem : symbols) {
     if (elem.find(function_name) != std::string::npos) {
       match_started = true;
       if (count == ++found) {
@@ -787,6 +1319,24 @@ int main(int argc, char** argv) {
   ::testing::InitGoogleTest(&argc, argv);
   if (threadstacks::StackTraceSignal::InstallInternalHandler() &&
       threadstacks::StackTraceSignal::InstallExternalHandler()) {
+    // The stack trace service only creates its pipeline on the first
+    // external signal. Check that installation didn't, and then start it, so
+    // that all the tests see the same threads. Wait for the dump of that
+    // signal to be written, so that it doesn't show up in the first tests.
+    if (2 != threadstacks::common::Sysutil::ListThreads().size()) {
+      std::cerr << "Stack trace service started eagerly" << std::endl;
+      return -1;
+    }
+    kill(getpid(), threadstacks::StackTraceSignal::ExternalSignum());
+    if (not threadstacks::WaitForExternalRequests(1).idle()) {
+      std::cerr << "Stack trace service didn't serve the first signal"
+                << std::endl;
+      return -1;
+    }
+    while (threadstacks::kNumIdleThreads !=
+           threadstacks::common::Sysutil::ListThreads().size()) {
+      usleep(1000);
+    }
     return RUN_ALL_TESTS();
   }
   std::cerr << "Failed to install signal handlers" << std::endl;
@@ -0,0 +1,120 @@
+// Copyright: ThoughtSpot Inc 2017
+
+#include "threadstacks/slow_events.h"
+
+#include <algorithm>
+#include <iostream>
+
+#include "common/sysutil.h"
+
+namespace threadstacks {
+namespace {
+
+std::atomic<SlowEventRecorder*> global_recorder{nullptr};
+
+}  // namespace
+
+SlowEventRecorder::SlowEventRecorder(const Options& options, Callback callback)
+    : options_(options),
+      callback_(std::move(callback)),
+      pending_(std::max(options.max_pending, 1)),
+      limiter_(options.min_interval_ms, options.max_captures_per_minute) {
+  collector_.set_timeout_ms(options_.timeout_ms);
+  thread_ = std::thread(&SlowEventRecorder::Run, this);
+}
+
+SlowEventRecorder::~SlowEventRecorder() {
+  pending_.Close();
+  thread_.join();
+}
+
+bool SlowEventRecorder::OnSlowEvent(const std::string& tag,
+                                    int64_t duration_ns) {
+  if (not Admit(tag, common::RateLimiter::NowMs())) {
+    ++num_dropped_;
+    return false;
+  }
+  Pending event;
+  event.tag = tag;
+  event.duration_ns = duration_ns;
+  event.end_ns = common::Sysutil::WallTimeNs();
+  // Never blocks, as Admit(...) reserved room for the event.
+  pending_.Write(event);
+  ++num_captures_;
+  return true;
+}
+
+bool SlowEventRecorder::Admit(const std::string& tag, int64_t now_ms) {
+  std::lock_guard<std::mutex> l(m_);
+  // Checked first, so that an event dropped for lack of room neither counts
+  // as a capture of its tag nor takes a token.
+  if (num_pending_ >= std::max(options_.max_pending, 1)) {
+    return false;
+  }
+  auto it = last_capture_ms_.find(tag);
+  if (it != last_capture_ms_.end() &&
+      now_ms - it->second < options_.tag_interval_ms) {
+    return false;
+  }
+  if (it == last_capture_ms_.end() &&
+      static_cast<int>(last_capture_ms_.size()) >= options_.max_tags) {
+    // Forgets the tags that can be captured again anyway.
+    for (auto e = last_capture_ms_.begin(); e != last_capture_ms_.end();) {
+      if (now_ms - e->second >= options_.tag_interval_ms) {
+        e = last_capture_ms_.erase(e);
+      } else {
+        ++e;
+      }
+    }
+    if (static_cast<int>(last_capture_ms_.size()) >= options_.max_tags) {
+      return false;
+    }
+  }
+  if (not limiter_.Admit(now_ms)) {
+    return false;
+  }
+  last_capture_ms_[tag] = now_ms;
+  ++num_pending_;
+  return true;
+}
+
+void SlowEventRecorder::Run() {
+  Pending event;
+  while (pending_.Read(&event)) {
+    {
+      std::lock_guard<std::mutex> l(m_);
+      --num_pending_;
+    }
+    Capture capture;
+    capture.tag = std::move(event.tag);
+    capture.duration_ns = event.duration_ns;
+    capture.end_ns = event.end_ns;
+    if (options_.history != nullptr) {
+      options_.history->Query(event.end_ns - event.duration_ns, event.end_ns,
+                              nullptr, &capture.samples);
+    } else {
+      std::string error;
+      if (not collector_.Collect(nullptr, &collection_, &error)) {
+        std::cerr << "Failed to collect stack traces for slow event "
+                  << capture.tag << ": " << error << std::endl;
+        continue;
+      }
+      capture.snapshot = StackSnapshot::Of(collection_);
+      collection_.Clear();
+    }
+    if (callback_) {
+      callback_(capture);
+    }
+  }
+}
+
+void SetSlowEventRecorder(SlowEventRecorder* recorder) {
+  global_recorder.store(recorder);
+}
+
+bool OnSlowEvent(const std::string& tag, int64_t duration_ns) {
+  SlowEventRecorder* recorder = global_recorder.load();
+  return recorder != nullptr && recorder->OnSlowEvent(tag, duration_ns);
+}
+
+}  // namespace threadstacks
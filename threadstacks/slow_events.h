@@ -0,0 +1,150 @@
+// Copyright: ThoughtSpot Inc 2017
+
+#ifndef THREADSTACKS_SLOW_EVENTS_H_
+#define THREADSTACKS_SLOW_EVENTS_H_
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "common/buffered_channel.h"
+#include "common/rate_limiter.h"
+#include "threadstacks/sample_store.h"
+#include "threadstacks/signal_handler.h"
+#include "threadstacks/snapshot_diff.h"
+
+namespace threadstacks {
+
+// A SlowEventRecorder captures what the whole process was doing when the
+// application reports an outlier, e.g. a request that took 2 seconds:
+//
+//   const auto start = ...;
+//   HandleRequest(request);
+//   const auto duration_ns = ...;
+//   if (duration_ns > kSlowNs) {
+//     threadstacks::OnSlowEvent("HandleRequest", duration_ns);
+//   }
+//
+// If the recorder has a SampleStore fed by a Sampler, a capture holds the
+// samples of all the threads over the event itself. Otherwise, a capture is a
+// snapshot of all the threads taken right after the event, which only shows
+// the state they were left in.
+//
+// Reporting an event is cheap: it's admitted or dropped under a mutex, and
+// admitted events are handed over to a capture thread, so that the reporting
+// thread never waits for a capture. Events are deduplicated by tag, i.e.
+// events with the same tag are captured at most once per
+// Options::tag_interval_ms, and captures are rate limited across tags, which
+// bounds the overhead during outlier storms.
+//
+// Note: This class is thread-safe.
+class SlowEventRecorder {
+ public:
+  struct Options {
+    // Minimum time between captures of events with the same tag, in
+    // milliseconds.
+    int64_t tag_interval_ms = 60 * 1000;
+    // Minimum time between any captures, in milliseconds, and maximum number
+    // of captures per minute. See common::RateLimiter.
+    int64_t min_interval_ms = 1000;
+    int max_captures_per_minute = 10;
+    // Maximum number of tags remembered for deduplication. Events with new
+    // tags are dropped while the recorder remembers this many recent tags.
+    int max_tags = 1024;
+    // Maximum number of captures waiting for the capture thread.
+    int max_pending = 4;
+    // History to pull the samples of events from, or null to take snapshots.
+    // Must outlive the recorder.
+    const SampleStore* history = nullptr;
+    // Time that snapshots wait for threads to respond, in milliseconds.
+    int64_t timeout_ms = 1000;
+  };
+
+  // A captured event.
+  struct Capture {
+    // Tag and duration of the event, as reported.
+    std::string tag;
+    int64_t duration_ns = 0;
+    // Wall time at which the event was reported, i.e. ended, in nanoseconds
+    // since the epoch.
+    int64_t end_ns = 0;
+    // Samples of all the threads over the event, ordered by time and tid, if
+    // the recorder has a history.
+    std::vector<SampleStore::Row> samples;
+    // Stack traces of all the threads right after the event, otherwise.
+    StackSnapshot snapshot;
+  };
+
+  // Called on the capture thread with every capture.
+  using Callback = std::function<void(const Capture& capture)>;
+
+  SlowEventRecorder(const Options& options, Callback callback);
+  // Waits for the pending captures, and stops the capture thread.
+  ~SlowEventRecorder();
+
+  // Reports that an event tagged @tag just took @duration_ns. Returns true if
+  // the event is going to be captured, or false if it was dropped.
+  bool OnSlowEvent(const std::string& tag, int64_t duration_ns);
+
+  // Returns the number of events captured, or going to be, and dropped.
+  int64_t num_captures() const { return num_captures_; }
+  int64_t num_dropped() const { return num_dropped_; }
+
+ private:
+  // An admitted event.
+  struct Pending {
+    std::string tag;
+    int64_t duration_ns = 0;
+    int64_t end_ns = 0;
+  };
+
+  // Returns whether an event tagged @tag at monotonic time @now_ms is
+  // admitted, in which case it's given one of the Options::max_pending slots
+  // of @pending_.
+  bool Admit(const std::string& tag, int64_t now_ms);
+  // The function run by the capture thread.
+  void Run();
+
+  const Options options_;
+  const Callback callback_;
+  // Admitted events, from the reporting threads to the capture thread.
+  common::BufferedChannel<Pending> pending_;
+  std::thread thread_;
+  // Only used by the capture thread.
+  StackTraceCollector collector_;
+  StackTraceCollection collection_;
+
+  std::atomic<int64_t> num_captures_{0};
+  std::atomic<int64_t> num_dropped_{0};
+
+  // Protects the members below.
+  std::mutex m_;
+  common::RateLimiter limiter_;
+  // Events admitted but not read by the capture thread yet. Admitting events
+  // only while this is under Options::max_pending makes sure that admitted
+  // events never find @pending_ full.
+  int num_pending_ = 0;
+  // Monotonic time of the last capture of every tag, in milliseconds.
+  std::unordered_map<std::string, int64_t> last_capture_ms_;
+
+  // Disable copy c'tor and assignment operator.
+  SlowEventRecorder(const SlowEventRecorder&) = delete;
+  SlowEventRecorder& operator=(const SlowEventRecorder&) = delete;
+};
+
+// Sets the recorder that OnSlowEvent(...) reports to, or none if @recorder is
+// null. The recorder must outlive its use by OnSlowEvent(...).
+void SetSlowEventRecorder(SlowEventRecorder* recorder);
+
+// Reports a slow event to the recorder set by SetSlowEventRecorder(...), see
+// SlowEventRecorder::OnSlowEvent(...). Returns false if there's no recorder.
+bool OnSlowEvent(const std::string& tag, int64_t duration_ns);
+
+}  // namespace threadstacks
+
+#endif  // THREADSTACKS_SLOW_EVENTS_H_
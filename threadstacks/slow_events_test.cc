@@ -0,0 +1,164 @@
+// Copyright: ThoughtSpot Inc 2017
+
+#include "threadstacks/slow_events.h"
+
+#include <unistd.h>
+
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "common/sysutil.h"
+#include "gtest/gtest.h"
+
+namespace threadstacks {
+namespace {
+
+const int64_t kMsNs = 1000 * 1000;
+
+// Returns options without rate limits across tags.
+SlowEventRecorder::Options NoLimits() {
+  SlowEventRecorder::Options options;
+  options.min_interval_ms = 0;
+  options.max_captures_per_minute = 0;
+  return options;
+}
+
+TEST(SlowEventsTest, Snapshot) {
+  std::vector<SlowEventRecorder::Capture> captures;
+  {
+    SlowEventRecorder recorder(NoLimits(),
+                               [&](const SlowEventRecorder::Capture& capture) {
+                                 captures.push_back(capture);
+                               });
+    EXPECT_TRUE(recorder.OnSlowEvent("rpc", 2000 * kMsNs));
+    // Deduplicated by tag.
+    EXPECT_FALSE(recorder.OnSlowEvent("rpc", 3000 * kMsNs));
+    EXPECT_TRUE(recorder.OnSlowEvent("db", 1000 * kMsNs));
+    EXPECT_EQ(2, recorder.num_captures());
+    EXPECT_EQ(1, recorder.num_dropped());
+  }
+  ASSERT_EQ(2, captures.size());
+  EXPECT_EQ("rpc", captures[0].tag);
+  EXPECT_EQ(2000 * kMsNs, captures[0].duration_ns);
+  EXPECT_EQ("db", captures[1].tag);
+  for (const auto& capture : captures) {
+    EXPECT_TRUE(capture.samples.empty());
+    // The snapshot has all the threads, including this one.
+    EXPECT_EQ(1, capture.snapshot.threads.count(getpid()));
+  }
+}
+
+TEST(SlowEventsTest, RateLimits) {
+  auto options = NoLimits();
+  options.tag_interval_ms = 0;
+  options.max_tags = 2;
+  options.max_captures_per_minute = 3;
+  SlowEventRecorder recorder(options, nullptr);
+  EXPECT_TRUE(recorder.OnSlowEvent("a", 1));
+  EXPECT_TRUE(recorder.OnSlowEvent("a", 1));
+  EXPECT_TRUE(recorder.OnSlowEvent("b", 1));
+  // Over the rate limit.
+  EXPECT_FALSE(recorder.OnSlowEvent("b", 1));
+
+  options.tag_interval_ms = 60 * 1000;
+  options.max_captures_per_minute = 0;
+  SlowEventRecorder tags(options, nullptr);
+  EXPECT_TRUE(tags.OnSlowEvent("a", 1));
+  EXPECT_TRUE(tags.OnSlowEvent("b", 1));
+  // Too many tags.
+  EXPECT_FALSE(tags.OnSlowEvent("c", 1));
+  EXPECT_EQ(1, tags.num_dropped());
+}
+
+// An event dropped because the capture thread is backed up must not keep
+// later events with its tag from being captured.
+TEST(SlowEventsTest, Backlog) {
+  std::mutex m;
+  std::condition_variable cv;
+  int num_started = 0;
+  bool released = false;
+  std::vector<std::string> tags;
+  auto options = NoLimits();
+  options.max_pending = 1;
+  {
+    SlowEventRecorder recorder(options,
+                               [&](const SlowEventRecorder::Capture& capture) {
+                                 std::unique_lock<std::mutex> l(m);
+                                 tags.push_back(capture.tag);
+                                 ++num_started;
+                                 cv.notify_all();
+                                 cv.wait(l, [&] { return released; });
+                               });
+    EXPECT_TRUE(recorder.OnSlowEvent("a", 1));
+    {
+      // The capture thread is stuck in the callback of "a".
+      std::unique_lock<std::mutex> l(m);
+      cv.wait(l, [&] { return num_started == 1; });
+    }
+    EXPECT_TRUE(recorder.OnSlowEvent("b", 1));
+    // No room left.
+    EXPECT_FALSE(recorder.OnSlowEvent("c", 1));
+    {
+      std::unique_lock<std::mutex> l(m);
+      released = true;
+      cv.notify_all();
+      cv.wait(l, [&] { return num_started == 2; });
+    }
+    // There's room again, and "c" wasn't captured before.
+    EXPECT_TRUE(recorder.OnSlowEvent("c", 1));
+    EXPECT_EQ(3, recorder.num_captures());
+    EXPECT_EQ(1, recorder.num_dropped());
+  }
+  EXPECT_EQ(std::vector<std::string>({"a", "b", "c"}), tags);
+}
+
+TEST(SlowEventsTest, History) {
+  // 3 threads sampled every 100ms over the last 3 seconds.
+  SampleStore::Options store_options;
+  store_options.rounds_per_chunk = 8;
+  SampleStore store(store_options);
+  const int64_t now_ns = common::Sysutil::WallTimeNs();
+  for (int64_t t = now_ns - 3000 * kMsNs; t <= now_ns; t += 100 * kMsNs) {
+    const Sampler::Sample samples[] = {{1, 0}, {2, 1}, {3, 2}};
+    const SampleStore::ThreadState states[] = {
+        SampleStore::kRunning, SampleStore::kSleeping, SampleStore::kSleeping};
+    store.Append(t, samples, states, 3);
+  }
+  std::vector<SlowEventRecorder::Capture> captures;
+  auto options = NoLimits();
+  options.history = &store;
+  {
+    SlowEventRecorder recorder(options,
+                               [&](const SlowEventRecorder::Capture& capture) {
+                                 captures.push_back(capture);
+                               });
+    SetSlowEventRecorder(&recorder);
+    EXPECT_TRUE(OnSlowEvent("query", 1000 * kMsNs));
+    SetSlowEventRecorder(nullptr);
+  }
+  EXPECT_FALSE(OnSlowEvent("query", 1000 * kMsNs));
+  ASSERT_EQ(1, captures.size());
+  const auto& capture = captures[0];
+  EXPECT_EQ("query", capture.tag);
+  EXPECT_TRUE(capture.snapshot.threads.empty());
+  // About 10 rounds of the last second.
+  ASSERT_LE(9 * 3, capture.samples.size());
+  EXPECT_GE(11 * 3, capture.samples.size());
+  for (const auto& row : capture.samples) {
+    EXPECT_LE(capture.end_ns - capture.duration_ns, row.time_ns);
+    EXPECT_GE(capture.end_ns, row.time_ns);
+  }
+}
+
+}  // namespace
+}  // namespace threadstacks
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  if (not threadstacks::StackTraceSignal::InstallInternalHandler()) {
+    return 1;
+  }
+  return RUN_ALL_TESTS();
+}
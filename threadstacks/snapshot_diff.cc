@@ -0,0 +1,256 @@
+// Copyright: ThoughtSpot Inc 2017
+
+#include "threadstacks/snapshot_diff.h"
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <sstream>
+#include <unordered_map>
+
+namespace threadstacks {
+namespace {
+
+// Returns the number of threads with each stack trace of @snapshot, by hash.
+std::unordered_map<uint64_t, int> CountByHash(const StackSnapshot& snapshot) {
+  std::vector<int> counts(snapshot.stacks.size());
+  for (const auto& e : snapshot.threads) {
+    ++counts[e.second];
+  }
+  std::unordered_map<uint64_t, int> result;
+  for (StackId id = 0; id < counts.size(); ++id) {
+    result[snapshot.hash(id)] += counts[id];
+  }
+  return result;
+}
+
+// Parses the hex number at @*str into @value, and advances @*str past it.
+// Returns false if there is no number at @*str.
+bool ParseHex(const char** str, uint64_t* value) {
+  char* end = nullptr;
+  *value = strtoull(*str, &end, 16);
+  if (end == *str) {
+    return false;
+  }
+  *str = end;
+  return true;
+}
+
+}  // namespace
+
+// static
+StackSnapshot StackSnapshot::Of(const StackTraceCollection& collection) {
+  StackSnapshot snapshot;
+  for (const auto& group : collection) {
+    const auto id = snapshot.stacks.Intern(*group.trace);
+    for (int i = 0; i < group.num_tids; ++i) {
+      snapshot.threads[group.tids[i]] = id;
+    }
+  }
+  return snapshot;
+}
+
+// static
+StackSnapshot StackSnapshot::Of(
+    const std::vector<StackTraceCollector::Result>& result) {
+  StackSnapshot snapshot;
+  for (const auto& e : result) {
+    const auto id = snapshot.stacks.Intern(e.trace);
+    for (const auto tid : e.tids) {
+      snapshot.threads[tid] = id;
+    }
+  }
+  return snapshot;
+}
+
+// static
+SnapshotDiff SnapshotDiff::Compute(const StackSnapshot& before,
+                                   const StackSnapshot& after) {
+  SnapshotDiff diff;
+  const auto counts_before = CountByHash(before);
+  // Records the stack trace @id of @after, if it isn't in @before.
+  auto add_stack = [&](StackId id, uint64_t hash) {
+    if (counts_before.count(hash) == 0 && diff.stacks.count(hash) == 0) {
+      const auto* addrs = after.stacks.addresses(id);
+      diff.stacks[hash].assign(addrs, addrs + after.stacks.depth(id));
+    }
+  };
+  // Both maps are sorted by tid, so walk them in lockstep.
+  auto it_before = before.threads.begin();
+  auto it_after = after.threads.begin();
+  while (it_before != before.threads.end() ||
+         it_after != after.threads.end()) {
+    if (it_after == after.threads.end() ||
+        (it_before != before.threads.end() &&
+         it_before->first < it_after->first)) {
+      diff.disappeared.push_back(it_before->first);
+      ++it_before;
+      continue;
+    }
+    const auto hash = after.hash(it_after->second);
+    if (it_before == before.threads.end() ||
+        it_after->first < it_before->first) {
+      diff.appeared.emplace_back(it_after->first, hash);
+      add_stack(it_after->second, hash);
+      ++it_after;
+      continue;
+    }
+    if (before.hash(it_before->second) != hash) {
+      diff.changed.emplace_back(it_after->first, hash);
+      add_stack(it_after->second, hash);
+    }
+    ++it_before;
+    ++it_after;
+  }
+  const auto counts_after = CountByHash(after);
+  for (const auto& e : counts_after) {
+    const auto it = counts_before.find(e.first);
+    const int count_before = it == counts_before.end() ? 0 : it->second;
+    if (e.second > count_before) {
+      diff.grown.push_back({e.first, count_before, e.second});
+    }
+  }
+  std::sort(diff.grown.begin(), diff.grown.end(),
+            [](const Growth& a, const Growth& b) { return a.hash < b.hash; });
+  return diff;
+}
+
+bool SnapshotDiff::Apply(const StackSnapshot& before,
+                         StackSnapshot* after) const {
+  std::unordered_map<uint64_t, StackId> ids_before;
+  for (int id = 0; id < before.stacks.size(); ++id) {
+    ids_before.emplace(before.hash(id), id);
+  }
+  // Stack trace of every thread of the new snapshot, by hash.
+  std::map<pid_t, uint64_t> threads;
+  for (const auto& e : before.threads) {
+    threads[e.first] = before.hash(e.second);
+  }
+  for (const auto tid : disappeared) {
+    threads.erase(tid);
+  }
+  for (const auto* changes : {&appeared, &changed}) {
+    for (const auto& e : *changes) {
+      threads[e.first] = e.second;
+    }
+  }
+  StackSnapshot result;
+  for (const auto& e : threads) {
+    auto it = stacks.find(e.second);
+    if (it != stacks.end()) {
+      result.threads[e.first] =
+          result.stacks.Intern(it->second.data(), it->second.size());
+      continue;
+    }
+    auto it_before = ids_before.find(e.second);
+    if (it_before == ids_before.end()) {
+      return false;
+    }
+    result.threads[e.first] =
+        result.stacks.Intern(before.stacks.addresses(it_before->second),
+                             before.stacks.depth(it_before->second));
+  }
+  *after = std::move(result);
+  return true;
+}
+
+std::string SnapshotDiff::ToString() const {
+  std::string out;
+  char buf[64];
+  for (const auto& e : stacks) {
+    snprintf(buf, sizeof(buf), "#%" PRIx64, e.first);
+    out.append(buf);
+    for (const auto addr : e.second) {
+      snprintf(buf, sizeof(buf), " %#" PRIx64, addr);
+      out.append(buf);
+    }
+    out.append("\n");
+  }
+  for (const auto& e : appeared) {
+    snprintf(buf, sizeof(buf), "+%d %" PRIx64 "\n", e.first, e.second);
+    out.append(buf);
+  }
+  for (const auto& e : changed) {
+    snprintf(buf, sizeof(buf), "~%d %" PRIx64 "\n", e.first, e.second);
+    out.append(buf);
+  }
+  for (const auto tid : disappeared) {
+    snprintf(buf, sizeof(buf), "-%d\n", tid);
+    out.append(buf);
+  }
+  for (const auto& e : grown) {
+    snprintf(buf, sizeof(buf), "^%" PRIx64 " %d %d\n", e.hash, e.before,
+             e.after);
+    out.append(buf);
+  }
+  return out;
+}
+
+// static
+bool SnapshotDiff::Parse(const std::string& delta,
+                         SnapshotDiff* diff,
+                         std::string* error) {
+  *diff = SnapshotDiff();
+  std::istringstream in(delta);
+  std::string line;
+  for (int line_number = 1; std::getline(in, line); ++line_number) {
+    if (line.empty()) {
+      continue;
+    }
+    const char* str = line.c_str() + 1;
+    bool ok = true;
+    switch (line[0]) {
+      case '#': {
+        uint64_t hash = 0;
+        ok = ParseHex(&str, &hash);
+        auto& stack = diff->stacks[hash];
+        uint64_t addr = 0;
+        while (ok && *str != '\0') {
+          ok = ParseHex(&str, &addr);
+          stack.push_back(addr);
+        }
+        break;
+      }
+      case '+':
+      case '~': {
+        int tid = 0;
+        uint64_t hash = 0;
+        int consumed = 0;
+        ok = 2 == sscanf(str, "%d %" SCNx64 "%n", &tid, &hash, &consumed) &&
+             str[consumed] == '\0';
+        (line[0] == '+' ? diff->appeared : diff->changed)
+            .emplace_back(tid, hash);
+        break;
+      }
+      case '-': {
+        int tid = 0;
+        int consumed = 0;
+        ok = 1 == sscanf(str, "%d%n", &tid, &consumed) &&
+             str[consumed] == '\0';
+        diff->disappeared.push_back(tid);
+        break;
+      }
+      case '^': {
+        Growth growth = {0, 0, 0};
+        int consumed = 0;
+        ok = 3 == sscanf(str, "%" SCNx64 " %d %d%n", &growth.hash,
+                         &growth.before, &growth.after, &consumed) &&
+             str[consumed] == '\0';
+        diff->grown.push_back(growth);
+        break;
+      }
+      default:
+        ok = false;
+    }
+    if (not ok) {
+      error->assign("Invalid snapshot diff line " +
+                    std::to_string(line_number) + ": " + line);
+      *diff = SnapshotDiff();
+      return false;
+    }
+  }
+  return true;
+}
+
+}  // namespace threadstacks
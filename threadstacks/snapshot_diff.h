@@ -0,0 +1,106 @@
+// Copyright: ThoughtSpot Inc 2017
+
+#ifndef THREADSTACKS_SNAPSHOT_DIFF_H_
+#define THREADSTACKS_SNAPSHOT_DIFF_H_
+
+#include <sys/types.h>
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "threadstacks/signal_handler.h"
+#include "threadstacks/stack_table.h"
+
+namespace threadstacks {
+
+// A StackSnapshot is a compact copy of the stack traces of the threads of a
+// process at some point, which can be kept around to diff later collections
+// against, see SnapshotDiff.
+struct StackSnapshot {
+  // Distinct stack traces of the threads.
+  StackTable stacks;
+  // Stack trace of every thread, by tid.
+  std::map<pid_t, StackId> threads;
+
+  // Returns a snapshot of the stack traces in @collection.
+  static StackSnapshot Of(const StackTraceCollection& collection);
+  // Returns a snapshot of the stack traces in @result.
+  static StackSnapshot Of(const std::vector<StackTraceCollector::Result>& result);
+
+  // Returns the hash of stack trace @id, see StackTable::Hash(...). Stack
+  // traces are identified by hash across snapshots.
+  uint64_t hash(StackId id) const {
+    return StackTable::Hash(stacks.addresses(id), stacks.depth(id));
+  }
+};
+
+// A SnapshotDiff holds what changed between two snapshots of the same
+// process, e.g. two dumps taken a few seconds apart. Threads are keyed by tid,
+// and stack traces by hash. A diff carries the stack traces that were not in
+// the old snapshot, so that the new snapshot can be rebuilt from the old one
+// and the diff, see Apply(...). Repeated dumps then only need to transmit or
+// store the diff, which is usually a small fraction of a full dump.
+//
+// The compact text form of a diff, see ToString(), has a line per change:
+//
+//   #<hash> <addr> <addr> ...   A stack trace not in the old snapshot, from
+//                               the innermost frame to the outermost one.
+//   +<tid> <hash>               A thread that appeared.
+//   ~<tid> <hash>               A thread whose stack trace changed.
+//   -<tid>                      A thread that disappeared.
+//   ^<hash> <before> <after>    A stack trace shared by more threads than
+//                               before.
+//
+// Hashes are hex numbers, and addresses hex numbers prefixed with 0x.
+struct SnapshotDiff {
+  // A stack trace whose group of threads grew.
+  struct Growth {
+    uint64_t hash;
+    // Number of threads with the stack trace in the old and new snapshots.
+    int before;
+    int after;
+  };
+
+  // Threads only in the new snapshot, with the hash of their stack trace.
+  // Sorted by tid.
+  std::vector<std::pair<pid_t, uint64_t>> appeared;
+  // Threads in both snapshots whose stack trace changed, with the hash of the
+  // new one. Sorted by tid.
+  std::vector<std::pair<pid_t, uint64_t>> changed;
+  // Threads only in the old snapshot. Sorted.
+  std::vector<pid_t> disappeared;
+  // Stack traces shared by more threads in the new snapshot than in the old
+  // one, including new stack traces. Sorted by hash.
+  std::vector<Growth> grown;
+  // Stack traces of @appeared and @changed threads that aren't in the old
+  // snapshot, by hash.
+  std::map<uint64_t, std::vector<int64_t>> stacks;
+
+  // Returns the diff from @before to @after.
+  static SnapshotDiff Compute(const StackSnapshot& before,
+                              const StackSnapshot& after);
+  // Parses @delta, as returned by ToString(), into @diff. Returns false on
+  // failure, in which case @error is filled with a descriptive error message.
+  static bool Parse(const std::string& delta,
+                    SnapshotDiff* diff,
+                    std::string* error);
+
+  // Returns true iff no thread changed.
+  bool empty() const {
+    return appeared.empty() && changed.empty() && disappeared.empty();
+  }
+  // Fills @after with the snapshot this diff was computed to, from @before,
+  // the snapshot it was computed from. Returns false if the diff refers to a
+  // stack trace that is neither in the diff nor in @before, i.e. @before is
+  // not the snapshot the diff was computed from.
+  bool Apply(const StackSnapshot& before, StackSnapshot* after) const;
+  // Returns the compact text form of the diff.
+  std::string ToString() const;
+};
+
+}  // namespace threadstacks
+
+#endif  // THREADSTACKS_SNAPSHOT_DIFF_H_
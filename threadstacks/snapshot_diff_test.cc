@@ -0,0 +1,120 @@
+// Copyright: ThoughtSpot Inc 2017
+
+#include "threadstacks/snapshot_diff.h"
+
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "threadstacks/signal_handler.h"
+
+namespace threadstacks {
+namespace {
+
+// Returns a result for the threads @tids, which share a stack trace with the
+// frames @addrs.
+StackTraceCollector::Result MakeResult(const std::vector<int64_t>& addrs,
+                                       const std::vector<pid_t>& tids) {
+  StackTraceCollector::Result result;
+  for (const auto addr : addrs) {
+    result.trace.AddFrame(0, addr);
+  }
+  result.tids = tids;
+  return result;
+}
+
+// Returns the frames of the stack trace of thread @tid in @snapshot.
+std::vector<int64_t> Frames(const StackSnapshot& snapshot, pid_t tid) {
+  const auto id = snapshot.threads.at(tid);
+  const auto* addrs = snapshot.stacks.addresses(id);
+  return std::vector<int64_t>(addrs, addrs + snapshot.stacks.depth(id));
+}
+
+TEST(SnapshotDiffTest, Compute) {
+  const std::vector<int64_t> a = {0x10, 0x20, 0x30};
+  const std::vector<int64_t> b = {0x40, 0x30};
+  const std::vector<int64_t> c = {0x50, 0x20, 0x30};
+  const auto before =
+      StackSnapshot::Of({MakeResult(a, {1, 2, 3}), MakeResult(b, {4, 7})});
+  const auto after = StackSnapshot::Of(
+      {MakeResult(a, {1, 2}), MakeResult(b, {4, 5, 8}), MakeResult(c, {3, 6})});
+  const auto hash_b = after.hash(after.threads.at(4));
+  const auto hash_c = after.hash(after.threads.at(3));
+
+  const auto diff = SnapshotDiff::Compute(before, after);
+  EXPECT_FALSE(diff.empty());
+  ASSERT_EQ(3, diff.appeared.size());
+  EXPECT_EQ(std::make_pair(5, hash_b), diff.appeared[0]);
+  EXPECT_EQ(std::make_pair(6, hash_c), diff.appeared[1]);
+  EXPECT_EQ(std::make_pair(8, hash_b), diff.appeared[2]);
+  ASSERT_EQ(1, diff.changed.size());
+  EXPECT_EQ(std::make_pair(3, hash_c), diff.changed[0]);
+  EXPECT_EQ(std::vector<pid_t>({7}), diff.disappeared);
+  // Only the new stack trace is carried.
+  ASSERT_EQ(1, diff.stacks.size());
+  EXPECT_EQ(c, diff.stacks.at(hash_c));
+  ASSERT_EQ(2, diff.grown.size());
+  for (const auto& growth : diff.grown) {
+    if (growth.hash == hash_b) {
+      EXPECT_EQ(2, growth.before);
+      EXPECT_EQ(3, growth.after);
+    } else {
+      EXPECT_EQ(hash_c, growth.hash);
+      EXPECT_EQ(0, growth.before);
+      EXPECT_EQ(2, growth.after);
+    }
+  }
+
+  // The new snapshot can be rebuilt from the old one and the diff, even after
+  // a round trip through the text form.
+  SnapshotDiff parsed;
+  std::string error;
+  ASSERT_TRUE(SnapshotDiff::Parse(diff.ToString(), &parsed, &error)) << error;
+  EXPECT_EQ(diff.ToString(), parsed.ToString());
+  StackSnapshot rebuilt;
+  ASSERT_TRUE(parsed.Apply(before, &rebuilt));
+  ASSERT_EQ(after.threads.size(), rebuilt.threads.size());
+  for (const auto& e : after.threads) {
+    EXPECT_EQ(Frames(after, e.first), Frames(rebuilt, e.first)) << e.first;
+  }
+  EXPECT_TRUE(SnapshotDiff::Compute(after, rebuilt).empty());
+
+  // Applying the diff to another snapshot fails if stack traces are missing.
+  EXPECT_FALSE(diff.Apply(StackSnapshot(), &rebuilt));
+}
+
+TEST(SnapshotDiffTest, ParseErrors) {
+  SnapshotDiff diff;
+  std::string error;
+  EXPECT_TRUE(SnapshotDiff::Parse("", &diff, &error));
+  EXPECT_TRUE(diff.empty());
+  for (const char* delta : {"?1 2\n", "+1\n", "+1 2 3\n", "-x\n", "^1 2\n",
+                            "#1 0x10 zz\n"}) {
+    EXPECT_FALSE(SnapshotDiff::Parse(delta, &diff, &error)) << delta;
+    EXPECT_FALSE(error.empty());
+    EXPECT_TRUE(diff.empty());
+  }
+}
+
+TEST(SnapshotDiffTest, Collection) {
+  StackTraceCollector collector;
+  StackTraceCollection collection;
+  std::string error;
+  ASSERT_TRUE(collector.Collect(nullptr, &collection, &error)) << error;
+  const auto snapshot = StackSnapshot::Of(collection);
+  EXPECT_EQ(collection.num_threads(), snapshot.threads.size());
+  EXPECT_EQ(collection.size(), snapshot.stacks.size());
+  EXPECT_TRUE(SnapshotDiff::Compute(snapshot, snapshot).empty());
+  EXPECT_TRUE(SnapshotDiff::Compute(snapshot, snapshot).ToString().empty());
+}
+
+}  // namespace
+}  // namespace threadstacks
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  if (not threadstacks::StackTraceSignal::InstallInternalHandler()) {
+    return 1;
+  }
+  return RUN_ALL_TESTS();
+}
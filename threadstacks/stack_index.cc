@@ -0,0 +1,184 @@
+// Copyright: ThoughtSpot Inc 2017
+
+#include "threadstacks/stack_index.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#include "threadstacks/symbol_table.h"
+
+namespace threadstacks {
+namespace {
+
+// Prefix of the symbols of addresses that couldn't be symbolized.
+const char kUnknown[] = "(unknown)";
+
+// Returns the first @n functions of @path, or all of them.
+std::pair<std::vector<int>::const_iterator, std::vector<int>::const_iterator>
+Truncate(const std::vector<int>& path, size_t n) {
+  return {path.begin(), path.begin() + std::min(n, path.size())};
+}
+
+}  // namespace
+
+StackIndex::StackIndex(const StackTraceCollection& collection,
+                       const SymbolTable& symbols) {
+  for (const auto& group : collection) {
+    Add(*group.trace, group.tids, group.num_tids, symbols);
+  }
+  Finish();
+}
+
+StackIndex::StackIndex(const std::vector<StackTraceCollector::Result>& result,
+                       const SymbolTable& symbols) {
+  for (const auto& e : result) {
+    Add(e.trace, e.tids.data(), e.tids.size(), symbols);
+  }
+  Finish();
+}
+
+void StackIndex::Add(const ThreadStack& trace,
+                     const pid_t* tids,
+                     int num_tids,
+                     const SymbolTable& symbols) {
+  std::vector<int> path;
+  path.reserve(trace.depth);
+  char buf[32];
+  for (int i = trace.depth - 1; i >= 0; --i) {
+    const char* symbol = symbols.Lookup(trace.address[i]);
+    std::string name;
+    if (strncmp(symbol, kUnknown, sizeof(kUnknown) - 1) == 0) {
+      snprintf(buf, sizeof(buf), "%#lx", trace.address[i]);
+      name = buf;
+    } else {
+      name = NormalizeFunction(symbol);
+    }
+    auto inserted = ids_.emplace(std::move(name), names_.size());
+    if (inserted.second) {
+      names_.push_back(inserted.first->first);
+    }
+    path.push_back(inserted.first->second);
+  }
+  paths_.push_back(std::move(path));
+  tids_.insert(tids_.end(), tids, tids + num_tids);
+  tid_offsets_.push_back(tids_.size());
+}
+
+void StackIndex::Finish() {
+  containing_.assign(names_.size(), std::vector<int>());
+  top_.assign(names_.size(), std::vector<int>());
+  for (int stack = 0; stack < num_stacks(); ++stack) {
+    const auto& path = paths_[stack];
+    for (const auto function : path) {
+      // Recursive functions appear more than once in a stack trace.
+      auto& stacks = containing_[function];
+      if (stacks.empty() || stacks.back() != stack) {
+        stacks.push_back(stack);
+      }
+    }
+    if (not path.empty()) {
+      top_[path.back()].push_back(stack);
+    }
+  }
+  by_path_.resize(num_stacks());
+  for (int stack = 0; stack < num_stacks(); ++stack) {
+    by_path_[stack] = stack;
+  }
+  std::sort(by_path_.begin(), by_path_.end(),
+            [this](int a, int b) { return paths_[a] < paths_[b]; });
+}
+
+int StackIndex::FindFunction(const std::string& function) const {
+  auto it = ids_.find(NormalizeFunction(function));
+  return it != ids_.end() ? it->second : -1;
+}
+
+std::vector<int> StackIndex::StacksContaining(
+    const std::string& function) const {
+  const int id = FindFunction(function);
+  return id >= 0 ? containing_[id] : std::vector<int>();
+}
+
+std::vector<int> StackIndex::StacksWithTopFrame(
+    const std::string& function) const {
+  const int id = FindFunction(function);
+  return id >= 0 ? top_[id] : std::vector<int>();
+}
+
+std::vector<int> StackIndex::StacksWithPrefix(
+    const std::vector<std::string>& functions) const {
+  std::vector<int> prefix;
+  for (const auto& function : functions) {
+    const int id = FindFunction(function);
+    if (id < 0) {
+      return {};
+    }
+    prefix.push_back(id);
+  }
+  // Stack traces truncated to the length of @prefix are sorted as well, so
+  // those equal to @prefix are contiguous.
+  const size_t n = prefix.size();
+  const auto begin = std::lower_bound(
+      by_path_.begin(), by_path_.end(), prefix,
+      [this, n](int stack, const std::vector<int>& p) {
+        const auto path = Truncate(paths_[stack], n);
+        return std::lexicographical_compare(path.first, path.second,
+                                            p.begin(), p.end());
+      });
+  const auto end = std::upper_bound(
+      begin, by_path_.end(), prefix,
+      [this, n](const std::vector<int>& p, int stack) {
+        const auto path = Truncate(paths_[stack], n);
+        return std::lexicographical_compare(p.begin(), p.end(), path.first,
+                                            path.second);
+      });
+  std::vector<int> stacks(begin, end);
+  std::sort(stacks.begin(), stacks.end());
+  return stacks;
+}
+
+std::vector<pid_t> StackIndex::Threads(const std::vector<int>& stacks) const {
+  std::vector<pid_t> tids;
+  tids.reserve(num_threads(stacks));
+  for (const auto stack : stacks) {
+    tids.insert(tids.end(), tids_.begin() + tid_offsets_[stack],
+                tids_.begin() + tid_offsets_[stack + 1]);
+  }
+  std::sort(tids.begin(), tids.end());
+  return tids;
+}
+
+int StackIndex::num_threads(const std::vector<int>& stacks) const {
+  int n = 0;
+  for (const auto stack : stacks) {
+    n += tid_offsets_[stack + 1] - tid_offsets_[stack];
+  }
+  return n;
+}
+
+// static
+std::string StackIndex::NormalizeFunction(const std::string& symbol) {
+  static const char kConst[] = " const";
+  const size_t const_size = sizeof(kConst) - 1;
+  size_t end = symbol.size();
+  if (end >= const_size &&
+      symbol.compare(end - const_size, const_size, kConst) == 0) {
+    end -= const_size;
+  }
+  if (end == 0 || symbol[end - 1] != ')') {
+    return symbol;
+  }
+  // Finds the '(' that opens the parameter list.
+  int depth = 0;
+  for (size_t i = end; i > 0; --i) {
+    if (symbol[i - 1] == ')') {
+      ++depth;
+    } else if (symbol[i - 1] == '(' && --depth == 0) {
+      return i > 1 ? symbol.substr(0, i - 1) : symbol;
+    }
+  }
+  return symbol;
+}
+
+}  // namespace threadstacks
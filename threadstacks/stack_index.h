@@ -0,0 +1,109 @@
+// Copyright: ThoughtSpot Inc 2017
+
+#ifndef THREADSTACKS_STACK_INDEX_H_
+#define THREADSTACKS_STACK_INDEX_H_
+
+#include <sys/types.h>
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "threadstacks/signal_handler.h"
+
+namespace threadstacks {
+
+class SymbolTable;
+
+// A StackIndex answers "which threads are in function X" style questions
+// about a collection without walking or symbolizing its stack traces again,
+// e.g. for health checks that run every few seconds against thousands of
+// threads.
+//
+// Frames are normalized to the function they are in, i.e. all the addresses
+// within a function map to the same function, named after its symbol without
+// the parameter list (e.g. "RpcClient::Call"). Addresses that can't be
+// symbolized are functions of their own, named after the hex address. The
+// index maps every function to the stack traces that contain it, and to those
+// whose innermost frame is in it, and keeps the stack traces sorted by their
+// functions from the outermost frame in, so that the stack traces sharing a
+// prefix are contiguous. Every query is then a hash lookup or a binary search.
+//
+// Stack traces are identified by their index in the collection they were
+// built from.
+//
+// Note: This class is thread-compatible: queries on a const index are
+// thread-safe.
+class StackIndex {
+ public:
+  // Builds the index of @collection, or of @result. The addresses of the
+  // stack traces must have been symbolized into @symbols, e.g. by
+  // StackTraceCollection::Symbolize(...).
+  StackIndex(const StackTraceCollection& collection,
+             const SymbolTable& symbols);
+  StackIndex(const std::vector<StackTraceCollector::Result>& result,
+             const SymbolTable& symbols);
+  ~StackIndex() = default;
+
+  // Returns the sorted indexes of the stack traces that have a frame in
+  // @function.
+  std::vector<int> StacksContaining(const std::string& function) const;
+  // Returns the sorted indexes of the stack traces whose innermost frame is in
+  // @function.
+  std::vector<int> StacksWithTopFrame(const std::string& function) const;
+  // Returns the sorted indexes of the stack traces whose outermost frames are
+  // in @functions, from the outermost one in, e.g. {"main", "Server::Run"}.
+  std::vector<int> StacksWithPrefix(
+      const std::vector<std::string>& functions) const;
+
+  // Returns the sorted tids of the threads in stack traces @stacks, as
+  // returned by the queries above.
+  std::vector<pid_t> Threads(const std::vector<int>& stacks) const;
+  // Returns the number of threads in stack traces @stacks.
+  int num_threads(const std::vector<int>& stacks) const;
+
+  // Returns the number of stack traces, and of distinct functions.
+  int num_stacks() const { return tid_offsets_.size() - 1; }
+  int num_functions() const { return names_.size(); }
+
+  // Returns @symbol without its parameter list and qualifiers, e.g.
+  // "ns::Foo::Bar" for "ns::Foo::Bar(int, char const*) const".
+  static std::string NormalizeFunction(const std::string& symbol);
+
+ private:
+  // Adds the stack trace @trace of the @num_tids threads @tids.
+  void Add(const ThreadStack& trace,
+           const pid_t* tids,
+           int num_tids,
+           const SymbolTable& symbols);
+  // Builds the posting lists and the sorted paths once all the stack traces
+  // are added.
+  void Finish();
+  // Returns the id of @function, or -1 if no stack trace has a frame in it.
+  int FindFunction(const std::string& function) const;
+
+  // Names of the functions, indexed by id, and the ids by name.
+  std::vector<std::string> names_;
+  std::unordered_map<std::string, int> ids_;
+  // Functions of the frames of every stack trace, from the outermost one in.
+  std::vector<std::vector<int>> paths_;
+  // Tids of the threads in stack trace i are at
+  // @tids_[@tid_offsets_[i], @tid_offsets_[i + 1]).
+  std::vector<pid_t> tids_;
+  std::vector<int> tid_offsets_ = {0};
+  // Sorted stack traces that contain every function, and whose innermost
+  // frame is in every function.
+  std::vector<std::vector<int>> containing_;
+  std::vector<std::vector<int>> top_;
+  // Stack traces, sorted by @paths_.
+  std::vector<int> by_path_;
+
+  // Disable copy c'tor and assignment operator.
+  StackIndex(const StackIndex&) = delete;
+  StackIndex& operator=(const StackIndex&) = delete;
+};
+
+}  // namespace threadstacks
+
+#endif  // THREADSTACKS_STACK_INDEX_H_
@@ -0,0 +1,157 @@
+// Copyright: ThoughtSpot Inc 2017
+
+#include "threadstacks/stack_index.h"
+
+#include <map>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "threadstacks/symbol_table.h"
+
+namespace threadstacks {
+namespace {
+
+// Symbolizes the addresses of @result into @symbols, using @names. Addresses
+// not in @names can't be symbolized.
+void Symbolize(const std::vector<StackTraceCollector::Result>& result,
+               const std::map<int64_t, std::string>& names,
+               SymbolTable* symbols) {
+  for (const auto& e : result) {
+    symbols->Add(e.trace);
+  }
+  symbols->Symbolize([&names](int64_t addr) {
+    auto it = names.find(addr);
+    return it != names.end() ? it->second : std::string("(unknown)");
+  });
+}
+
+TEST(StackIndexTest, NormalizeFunction) {
+  EXPECT_EQ("main", StackIndex::NormalizeFunction("main"));
+  EXPECT_EQ("RpcClient::Call",
+            StackIndex::NormalizeFunction("RpcClient::Call()"));
+  EXPECT_EQ("ns::Foo<int (*)()>::Bar",
+            StackIndex::NormalizeFunction(
+                "ns::Foo<int (*)()>::Bar(std::function<void ()>) const"));
+  EXPECT_EQ("Foo::operator()",
+            StackIndex::NormalizeFunction("Foo::operator()()"));
+}
+
+TEST(StackIndexTest, Queries) {
+  const std::map<int64_t, std::string> names = {
+      {0x10, "main()"},
+      {0x20, "Server::Run()"},
+      {0x21, "Server::Run()"},
+      {0x30, "RpcClient::Call(Request const&)"},
+      {0x31, "RpcClient::Call(Request const&)"},
+      {0x40, "Mutex::Lock()"},
+      {0x50, "Worker::Loop()"},
+      {0x60, "recv"},
+  };
+  // Stack traces, with frames from the innermost one, and their threads.
+  const std::vector<std::pair<std::vector<int64_t>, std::vector<pid_t>>>
+      stacks = {
+          {{0x60, 0x30, 0x20, 0x10}, {5, 1}},
+          // Different addresses in the same functions.
+          {{0x60, 0x31, 0x21, 0x10}, {3}},
+          {{0x40, 0x30, 0x50, 0x10}, {2, 9}},
+          // Recursion, and a frame that can't be symbolized.
+          {{0x40, 0x31, 0x30, 0x20, 0x99}, {4}},
+          {{0x50, 0x10}, {7}},
+      };
+  std::vector<StackTraceCollector::Result> result(stacks.size());
+  for (size_t i = 0; i < stacks.size(); ++i) {
+    for (const auto addr : stacks[i].first) {
+      result[i].trace.AddFrame(0, addr);
+    }
+    result[i].tids = stacks[i].second;
+  }
+  SymbolTable symbols;
+  Symbolize(result, names, &symbols);
+  const StackIndex index(result, symbols);
+  EXPECT_EQ(5, index.num_stacks());
+  EXPECT_EQ(7, index.num_functions());
+
+  EXPECT_EQ(std::vector<int>({0, 1, 2, 3}),
+            index.StacksContaining("RpcClient::Call"));
+  // Symbols work as well.
+  EXPECT_EQ(std::vector<int>({0, 1, 2, 3}),
+            index.StacksContaining("RpcClient::Call(Request const&)"));
+  EXPECT_EQ(std::vector<pid_t>({1, 2, 3, 4, 5, 9}),
+            index.Threads(index.StacksContaining("RpcClient::Call")));
+  EXPECT_EQ(std::vector<int>({3}), index.StacksContaining("0x99"));
+  EXPECT_TRUE(index.StacksContaining("Nope").empty());
+
+  EXPECT_EQ(std::vector<int>({2, 3}), index.StacksWithTopFrame("Mutex::Lock"));
+  EXPECT_EQ(3, index.num_threads(index.StacksWithTopFrame("Mutex::Lock")));
+  EXPECT_TRUE(index.StacksWithTopFrame("RpcClient::Call").empty());
+
+  EXPECT_EQ(std::vector<int>({0, 1, 2, 4}), index.StacksWithPrefix({"main"}));
+  EXPECT_EQ(std::vector<int>({0, 1}),
+            index.StacksWithPrefix({"main", "Server::Run"}));
+  EXPECT_EQ(std::vector<int>({2, 4}),
+            index.StacksWithPrefix({"main", "Worker::Loop"}));
+  EXPECT_EQ(std::vector<int>({2}),
+            index.StacksWithPrefix({"main", "Worker::Loop", "RpcClient::Call",
+                                    "Mutex::Lock"}));
+  EXPECT_TRUE(index
+                  .StacksWithPrefix({"main", "Worker::Loop", "RpcClient::Call",
+                                     "Mutex::Lock", "recv"})
+                  .empty());
+  EXPECT_TRUE(index.StacksWithPrefix({"Nope"}).empty());
+  EXPECT_EQ(5, index.StacksWithPrefix({}).size());
+}
+
+TEST(StackIndexTest, LargeIndex) {
+  // 10k threads in 1k stack traces of 30 frames, over 2k functions.
+  std::vector<StackTraceCollector::Result> result;
+  std::map<int64_t, std::string> names;
+  // Expected answers to the queries, by function.
+  std::map<std::string, std::set<int>> containing;
+  std::map<std::string, std::vector<int>> top_frame;
+  std::map<std::string, std::vector<int>> outermost_frame;
+  for (int stack = 0; stack < 1000; ++stack) {
+    result.emplace_back();
+    auto& trace = result.back().trace;
+    for (int i = 0; i < 30; ++i) {
+      const int64_t addr = 0x1000 + (stack * 7 + i * 13) % 2000;
+      trace.AddFrame(0, addr);
+      names[addr] = "f" + std::to_string(addr) + "()";
+      containing["f" + std::to_string(addr)].insert(stack);
+    }
+    top_frame["f" + std::to_string(trace.address[0])].push_back(stack);
+    outermost_frame["f" + std::to_string(trace.address[trace.depth - 1])]
+        .push_back(stack);
+    for (int i = 0; i < 10; ++i) {
+      result.back().tids.push_back(stack * 10 + i);
+    }
+  }
+  SymbolTable symbols;
+  Symbolize(result, names, &symbols);
+  const StackIndex index(result, symbols);
+  EXPECT_EQ(1000, index.num_stacks());
+  EXPECT_EQ(2000, index.num_functions());
+  for (int i = 0; i < 2000; ++i) {
+    const auto function = "f" + std::to_string(0x1000 + i);
+    const auto stacks = index.StacksContaining(function);
+    EXPECT_EQ(std::vector<int>(containing[function].begin(),
+                               containing[function].end()),
+              stacks) << function;
+    EXPECT_EQ(10 * static_cast<int>(stacks.size()),
+              index.num_threads(stacks)) << function;
+    EXPECT_EQ(top_frame[function], index.StacksWithTopFrame(function))
+        << function;
+    EXPECT_EQ(outermost_frame[function], index.StacksWithPrefix({function}))
+        << function;
+  }
+}
+
+}  // namespace
+}  // namespace threadstacks
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,54 @@
+// Copyright: ThoughtSpot Inc 2017
+
+#include "threadstacks/stack_table.h"
+
+#include <algorithm>
+
+namespace threadstacks {
+
+// static
+uint64_t StackTable::Hash(const int64_t* addrs, int depth) {
+  // FNV-1a over the addresses.
+  uint64_t hash = 14695981039346656037ULL ^ depth;
+  for (int i = 0; i < depth; ++i) {
+    hash = (hash ^ static_cast<uint64_t>(addrs[i])) * 1099511628211ULL;
+  }
+  return hash;
+}
+
+StackId StackTable::Intern(const int64_t* addrs, int depth) {
+  const auto hash = Hash(addrs, depth);
+  auto range = index_.equal_range(hash);
+  for (auto it = range.first; it != range.second; ++it) {
+    const auto id = it->second;
+    if (this->depth(id) == depth &&
+        std::equal(addrs, addrs + depth, addresses(id))) {
+      return id;
+    }
+  }
+  const StackId id = size();
+  addresses_.insert(addresses_.end(), addrs, addrs + depth);
+  offsets_.push_back(addresses_.size());
+  index_.emplace(hash, id);
+  return id;
+}
+
+int64_t StackTable::Find(const int64_t* addrs, int depth) const {
+  auto range = index_.equal_range(Hash(addrs, depth));
+  for (auto it = range.first; it != range.second; ++it) {
+    const auto id = it->second;
+    if (this->depth(id) == depth &&
+        std::equal(addrs, addrs + depth, addresses(id))) {
+      return id;
+    }
+  }
+  return -1;
+}
+
+void StackTable::Clear() {
+  addresses_.clear();
+  offsets_.assign(1, 0);
+  index_.clear();
+}
+
+}  // namespace threadstacks
@@ -0,0 +1,72 @@
+// Copyright: ThoughtSpot Inc 2017
+
+#ifndef THREADSTACKS_STACK_TABLE_H_
+#define THREADSTACKS_STACK_TABLE_H_
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include "threadstacks/stack_tracer.h"
+
+namespace threadstacks {
+
+// Identifies a stack trace interned in a StackTable.
+using StackId = uint32_t;
+
+// A StackTable interns stack traces: every distinct stack trace, i.e. sequence
+// of addresses, is stored once and identified by a dense StackId. Ids are
+// handed out in order starting at 0, and stay valid for the lifetime of the
+// table, so that aggregates keyed by StackId (e.g. counts in a vector) can be
+// compared without comparing stack traces. A copy of a table hands out the
+// same ids for the stack traces it already holds.
+//
+// Note: This class is not thread-safe.
+class StackTable {
+ public:
+  // Returns a hash of the stack trace of @depth addresses in @addrs, which
+  // only depends on the addresses, e.g. to identify the stack trace across
+  // tables.
+  static uint64_t Hash(const int64_t* addrs, int depth);
+
+  StackTable() = default;
+  ~StackTable() = default;
+  StackTable(const StackTable&) = default;
+  StackTable& operator=(const StackTable&) = default;
+
+  // Returns the id of @stack, interning it if it isn't in the table yet.
+  StackId Intern(const ThreadStack& stack) {
+    return Intern(stack.address, stack.depth);
+  }
+  // Same as above, but for the stack trace of @depth addresses in @addrs,
+  // from the innermost frame to the outermost one.
+  StackId Intern(const int64_t* addrs, int depth);
+  // Returns the id of the stack trace of @depth addresses in @addrs, or -1 if
+  // it isn't in the table.
+  int64_t Find(const int64_t* addrs, int depth) const;
+
+  // Returns the number of stack traces in the table.
+  int size() const { return offsets_.size() - 1; }
+  // Returns the depth of stack trace @id.
+  int depth(StackId id) const { return offsets_[id + 1] - offsets_[id]; }
+  // Returns the addresses of stack trace @id, from the innermost frame to the
+  // outermost one.
+  const int64_t* addresses(StackId id) const {
+    return addresses_.data() + offsets_[id];
+  }
+
+  // Removes all the stack traces from the table.
+  void Clear();
+
+ private:
+  // Addresses of all the stack traces, concatenated in the order of ids.
+  std::vector<int64_t> addresses_;
+  // Stack trace i occupies [offsets_[i], offsets_[i + 1]) of @addresses_.
+  std::vector<uint32_t> offsets_{0};
+  // Index from the hash of a stack trace to the ids with that hash.
+  std::unordered_multimap<uint64_t, StackId> index_;
+};
+
+}  // namespace threadstacks
+
+#endif  // THREADSTACKS_STACK_TABLE_H_
@@ -57,19 +57,34 @@ void ThreadStack::Visit(const std::function<void(int /*depth*/, int64_t /*frame_
   }
 }
 
+// static
+bool ThreadStack::Symbolize(int64_t addr, char* buf, int size) {
+  // Note(zasgar): This is a bit hacky, but if symbolization fails we try to symbolize
+  // PC - 1. This is because the address might actually be the return value. Strictly,
+  // this only applies to the last PC so we can probably make this more robust.
+  return absl::Symbolize(reinterpret_cast<char*>(addr), buf, size) ||
+         absl::Symbolize(reinterpret_cast<char*>(addr) - 1, buf, size);
+}
+
+// static
+void ThreadStack::FormatFrame(int depth, int64_t framesize, int64_t addr, const char* symbol, char* buf, int size) {
+  void* pc = reinterpret_cast<void*>(addr);
+  const char * prefix = depth == 0 ? "PC: " : "    ";
+
+  if (framesize <= 0) {
+    snprintf(buf, size, "%s@ %*p  (unknown)  %s\n", prefix,
+             kPrintfPointerFieldWidth, pc, symbol);
+  } else {
+    snprintf(buf, size, "%s@ %*p  %9ld  %s\n", prefix,
+             kPrintfPointerFieldWidth, pc, framesize, symbol);
+  }
+}
+
 void ThreadStack::VisitWithSymbol(const std::function<void(int /*depth*/, int64_t /*frame_size*/, int64_t /*addr*/, const char* /*sym*/)>& visitor) const {
   const char *kUnknown = "(unknown)";
   char buffer[1024];
   for (int i = 0; i < depth; ++i) {
-    // Note(zasgar): This is a bit hacky, but if symbolization fails we try to symbolize
-    // PC - 1. This is because the address might actually be the return value. Strictly,
-    // this only applies to the last PC so we can probably make this more robust.
-    if (absl::Symbolize(reinterpret_cast<char*>(address[i]),
-                        buffer,
-                        sizeof buffer) ||
-        absl::Symbolize(reinterpret_cast<char*>(address[i]) - 1,
-                        buffer,
-                        sizeof buffer)) {
+    if (Symbolize(address[i], buffer, sizeof buffer)) {
       visitor(i, sizes[i], address[i], buffer);
     } else {
       visitor(i, sizes[i], address[i], kUnknown);
@@ -81,21 +96,20 @@ void ThreadStack::PrettyPrint(const std::function<void(const char*)> writer) con
   VisitWithSymbol(
       [&](int depth, int64_t framesize, int64_t addr, const char* symbol) {
         char buf[256];
-        void* pc = reinterpret_cast<void*>(addr);
-        const char * prefix = depth == 0 ? "PC: " : "    ";
-
-        if (framesize <= 0) {
-          snprintf(buf, sizeof(buf), "%s@ %*p  (unknown)  %s\n", prefix,
-                   kPrintfPointerFieldWidth, pc, symbol);
-        } else {
-          snprintf(buf, sizeof(buf), "%s@ %*p  %9ld  %s\n", prefix,
-                   kPrintfPointerFieldWidth, pc, framesize, symbol);
-        }
-
+        FormatFrame(depth, framesize, addr, symbol, buf, sizeof(buf));
         writer(buf);
       });
 }
 
+void ThreadStack::PrettyPrint(const std::function<void(const char*)> writer,
+                              const std::function<const char*(int64_t /*addr*/)>& symbolizer) const {
+  char buf[256];
+  for (int i = 0; i < depth; ++i) {
+    FormatFrame(i, sizes[i], address[i], symbolizer(address[i]), buf, sizeof(buf));
+    writer(buf);
+  }
+}
+
 /**
  * Capture the stack trace starting at the current location
  */
@@ -105,7 +119,8 @@ void BackwardsTrace::Capture() {
     ErrLog("StacktraceCollector: Failed to get current context\n");
     return;
   }
-  Capture(&context, /* skip_count */ 0);
+  // Skip this function's own frame.
+  Capture(&context, /* skip_count */ 1);
 }
 
 /*
@@ -121,17 +136,21 @@ void BackwardsTrace::Capture(void *ucontext, int skip_count) {
     return;
   }
 
-  while(unw_step(&cursor) > 0 && (skip_count-- > 0)) {
-    // Skip frames.
+  // Note that the cursor starts at the frame of @ucontext itself, i.e. at the
+  // interrupted instruction when called from a signal handler.
+  for (; skip_count > 0; --skip_count) {
+    if (unw_step(&cursor) <= 0) {
+      return;
+    }
   }
-  while (unw_step(&cursor) > 0 && stack_.depth < kMaxStackDepth) {
+  do {
     unw_word_t ip;
     if (0 == unw_get_reg(&cursor, UNW_REG_IP, &ip)) {
       stack_.AddFrame(0, ip);
     } else {
       ErrLog("Failed to get instruction pointer...\n");
     }
-  }
+  } while (unw_step(&cursor) > 0 && stack_.depth < kMaxStackDepth);
 }
 
 
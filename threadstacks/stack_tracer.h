@@ -29,6 +29,15 @@ struct ThreadStack {
   void Visit(const std::function<void(int /*depth*/, int64_t /*frame_size*/, int64_t /*addr*/)>& visitor)  const;
   void VisitWithSymbol(const std::function<void(int /*depth*/, int64_t /*frame_size*/, int64_t /*addr*/, const char* /*sym*/)>& visitor) const;
   void PrettyPrint(const std::function<void(const char*)> writer) const;
+  // Same as above, but looks up symbols using @symbolizer instead of
+  // symbolizing every frame.
+  void PrettyPrint(const std::function<void(const char*)> writer,
+                   const std::function<const char*(int64_t /*addr*/)>& symbolizer) const;
+
+  // Symbolizes @addr into @buf of size @size. Returns false on failure.
+  static bool Symbolize(int64_t addr, char* buf, int size);
+  // Formats frame at @depth into a single line in @buf of size @size.
+  static void FormatFrame(int depth, int64_t framesize, int64_t addr, const char* symbol, char* buf, int size);
 };
 
 
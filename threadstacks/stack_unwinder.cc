@@ -0,0 +1,104 @@
+// Copyright: ThoughtSpot Inc 2017
+
+#include "threadstacks/stack_unwinder.h"
+
+#include <algorithm>
+#include <cstring>
+#include <map>
+
+namespace threadstacks {
+namespace {
+
+// Maximum number of stack slots scanned for the first frame, when the frame
+// pointer doesn't point to one.
+constexpr int kMaxScannedSlots = 64;
+
+}  // namespace
+
+ThreadStack UnwindStackCopy(pid_t tid,
+                            uint64_t pc,
+                            uint64_t sp,
+                            uint64_t fp,
+                            const std::string& stack,
+                            const std::vector<Mapping>& mappings) {
+  ThreadStack trace;
+  trace.tid = tid;
+  trace.AddFrame(0, pc);
+  const uint64_t begin = sp;
+  const uint64_t end = begin + stack.size();
+  // Reads the stack slot at @addr into @value. Returns false if @addr is not
+  // an aligned address in the copied stack.
+  auto read_slot = [&](uint64_t addr, uint64_t* value) {
+    if (addr < begin || addr >= end || end - addr < sizeof(*value) ||
+        addr % sizeof(*value) != 0) {
+      return false;
+    }
+    memcpy(value, stack.data() + (addr - begin), sizeof(*value));
+    return true;
+  };
+  auto is_code = [&](uint64_t addr) {
+    return FindMapping(mappings, addr) != nullptr;
+  };
+  // A frame starts with the frame pointer of the caller, followed by the
+  // return address.
+  auto is_frame = [&](uint64_t addr) {
+    uint64_t next_fp;
+    uint64_t ret;
+    return read_slot(addr, &next_fp) && read_slot(addr + sizeof(addr), &ret) &&
+           next_fp > addr && next_fp < end && is_code(ret);
+  };
+  if (not is_frame(fp)) {
+    // The frame pointer is used as a general purpose register by the
+    // innermost frame, so look for the first frame on the stack instead.
+    fp = 0;
+    for (int i = 0; i < kMaxScannedSlots && fp == 0; ++i) {
+      const uint64_t slot = begin + i * sizeof(slot);
+      fp = is_frame(slot) ? slot : 0;
+    }
+  }
+  // Return addresses of the innermost frames without frame pointers lie
+  // between the stack pointer and the first frame.
+  uint64_t value;
+  for (uint64_t slot = begin; slot < fp &&
+                              trace.depth < ThreadStack::kMaxDepth &&
+                              read_slot(slot, &value);
+       slot += sizeof(value)) {
+    if (is_code(value)) {
+      trace.AddFrame(0, value);
+    }
+  }
+  uint64_t next_fp;
+  uint64_t ret;
+  while (fp != 0 && trace.depth < ThreadStack::kMaxDepth &&
+         read_slot(fp, &next_fp) && read_slot(fp + sizeof(fp), &ret) &&
+         is_code(ret)) {
+    trace.AddFrame(0, ret);
+    if (next_fp <= fp) {
+      break;
+    }
+    fp = next_fp;
+  }
+  return trace;
+}
+
+std::vector<StackTraceCollector::Result> GroupStackTraces(
+    const std::vector<ThreadStack>& traces) {
+  std::vector<StackTraceCollector::Result> results;
+  // Index of every unique stack trace in @results.
+  std::map<std::vector<int64_t>, int> index;
+  for (const auto& trace : traces) {
+    std::vector<int64_t> key(trace.address, trace.address + trace.depth);
+    auto inserted = index.emplace(std::move(key), results.size());
+    if (inserted.second) {
+      results.emplace_back();
+      results.back().trace = trace;
+    }
+    results[inserted.first->second].tids.push_back(trace.tid);
+  }
+  for (auto& result : results) {
+    std::sort(result.tids.begin(), result.tids.end());
+  }
+  return results;
+}
+
+}  // namespace threadstacks
@@ -0,0 +1,63 @@
+// Copyright: ThoughtSpot Inc 2017
+
+#ifndef THREADSTACKS_STACK_UNWINDER_H_
+#define THREADSTACKS_STACK_UNWINDER_H_
+
+#include <sys/types.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "threadstacks/elf_symbols.h"
+#include "threadstacks/signal_handler.h"
+#include "threadstacks/stack_tracer.h"
+
+namespace threadstacks {
+
+// Returns the stack trace of thread @tid, unwound from a copy of the top of
+// its stack, e.g. taken from another process or written to a crash file.
+// @pc, @sp and @fp are the registers of the thread, and @stack the copy of its
+// stack, starting at @sp. Return addresses are only recognized as such if
+// they are in one of @mappings (as filled by ReadMappings(...)).
+//
+// The stack is unwound by walking the frame pointer chain, so frames are only
+// found reliably in code built with frame pointers. The innermost frames, e.g.
+// of a libc system call wrapper built without frame pointers, are recovered by
+// scanning the stack between the stack pointer and the first frame for return
+// addresses.
+ThreadStack UnwindStackCopy(pid_t tid,
+                            uint64_t pc,
+                            uint64_t sp,
+                            uint64_t fp,
+                            const std::string& stack,
+                            const std::vector<Mapping>& mappings);
+
+// Returns @traces grouped like the stack traces of
+// StackTraceCollector::Collect(...): one result per unique stack trace, with
+// the sorted tids of the threads that share it.
+std::vector<StackTraceCollector::Result> GroupStackTraces(
+    const std::vector<ThreadStack>& traces);
+
+// Unwinds the stack copies of @threads with UnwindStackCopy(...), and groups
+// them with GroupStackTraces(...). A Thread has the tid, pc, sp, fp and stack
+// of a thread, e.g. CrashFile::Thread. Threads without registers, i.e. whose
+// pc is 0, are skipped.
+template <typename Thread>
+std::vector<StackTraceCollector::Result> UnwindStackCopies(
+    const std::vector<Thread>& threads,
+    const std::vector<Mapping>& mappings) {
+  std::vector<ThreadStack> traces;
+  traces.reserve(threads.size());
+  for (const auto& thread : threads) {
+    if (thread.pc != 0) {
+      traces.push_back(UnwindStackCopy(thread.tid, thread.pc, thread.sp,
+                                       thread.fp, thread.stack, mappings));
+    }
+  }
+  return GroupStackTraces(traces);
+}
+
+}  // namespace threadstacks
+
+#endif  // THREADSTACKS_STACK_UNWINDER_H_
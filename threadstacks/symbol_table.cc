@@ -0,0 +1,113 @@
+// Copyright: ThoughtSpot Inc 2017
+
+#include "threadstacks/symbol_table.h"
+
+#include <algorithm>
+
+#include "common/worker_pool.h"
+
+namespace threadstacks {
+namespace {
+const char* kUnknown = "(unknown)";
+// Minimum number of addresses that are worth symbolizing on a separate
+// thread.
+constexpr int kMinAddressesPerRange = 64;
+}  // namespace
+
+void SymbolTable::Add(const ThreadStack& stack) {
+  pending_.insert(pending_.end(), stack.address, stack.address + stack.depth);
+}
+
+void SymbolTable::Add(const StackTable& stacks,
+                      const std::function<bool(StackId)>& filter) {
+  for (int id = 0; id < stacks.size(); ++id) {
+    if (filter != nullptr && not filter(id)) {
+      continue;
+    }
+    const auto* addrs = stacks.addresses(id);
+    pending_.insert(pending_.end(), addrs, addrs + stacks.depth(id));
+  }
+}
+
+void SymbolTable::MergePending() {
+  addrs_.insert(addrs_.end(), pending_.begin(), pending_.end());
+  pending_.clear();
+  std::sort(addrs_.begin(), addrs_.end());
+  addrs_.erase(std::unique(addrs_.begin(), addrs_.end()), addrs_.end());
+}
+
+void SymbolTable::Symbolize(common::WorkerPool* pool) {
+  MergePending();
+  const int n = addrs_.size();
+  int num_ranges = 1;
+  if (pool != nullptr) {
+    num_ranges = std::max(
+        1, std::min(pool->parallelism(), n / kMinAddressesPerRange));
+  }
+  text_.assign(num_ranges, std::string());
+  // Offsets of symbols in @text_, converted to pointers once all the ranges
+  // are done, as the strings may reallocate while being appended to.
+  std::vector<size_t> offsets(n);
+  auto symbolize_range = [&](int range) {
+    const int begin = static_cast<int64_t>(n) * range / num_ranges;
+    const int end = static_cast<int64_t>(n) * (range + 1) / num_ranges;
+    auto& text = text_[range];
+    char buffer[1024];
+    for (int i = begin; i < end; ++i) {
+      offsets[i] = text.size();
+      text.append(ThreadStack::Symbolize(addrs_[i], buffer, sizeof(buffer))
+                      ? buffer
+                      : kUnknown);
+      text.push_back('\0');
+    }
+  };
+  if (num_ranges == 1) {
+    symbolize_range(0);
+  } else {
+    pool->ParallelFor(num_ranges, symbolize_range);
+  }
+  symbols_.resize(n);
+  for (int range = 0; range < num_ranges; ++range) {
+    const int begin = static_cast<int64_t>(n) * range / num_ranges;
+    const int end = static_cast<int64_t>(n) * (range + 1) / num_ranges;
+    for (int i = begin; i < end; ++i) {
+      symbols_[i] = text_[range].data() + offsets[i];
+    }
+  }
+}
+
+void SymbolTable::Symbolize(
+    const std::function<std::string(int64_t)>& symbolizer) {
+  MergePending();
+  const int n = addrs_.size();
+  text_.assign(1, std::string());
+  auto& text = text_[0];
+  std::vector<size_t> offsets(n);
+  for (int i = 0; i < n; ++i) {
+    offsets[i] = text.size();
+    text.append(symbolizer(addrs_[i]));
+    text.push_back('\0');
+  }
+  symbols_.resize(n);
+  for (int i = 0; i < n; ++i) {
+    symbols_[i] = text.data() + offsets[i];
+  }
+}
+
+const char* SymbolTable::Lookup(int64_t addr) const {
+  auto it = std::lower_bound(addrs_.begin(), addrs_.end(), addr);
+  if (it == addrs_.end() || *it != addr ||
+      symbols_.size() != addrs_.size()) {
+    return kUnknown;
+  }
+  return symbols_[it - addrs_.begin()];
+}
+
+void SymbolTable::Clear() {
+  pending_.clear();
+  addrs_.clear();
+  symbols_.clear();
+  text_.clear();
+}
+
+}  // namespace threadstacks
@@ -0,0 +1,71 @@
+// Copyright: ThoughtSpot Inc 2017
+
+#ifndef THREADSTACKS_SYMBOL_TABLE_H_
+#define THREADSTACKS_SYMBOL_TABLE_H_
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "threadstacks/stack_table.h"
+#include "threadstacks/stack_tracer.h"
+
+namespace threadstacks {
+namespace common {
+class WorkerPool;
+}  // namespace common
+
+// A SymbolTable symbolizes a set of addresses exactly once, so that stack
+// traces which share frames don't symbolize them over and over again.
+// Addresses are first added with Add(...), and then resolved in bulk by
+// Symbolize(...). Lookup(...) is thread-safe once Symbolize(...) returns.
+// Addresses added after Symbolize(...) only become visible to Lookup(...) on
+// the next call to Symbolize(...).
+class SymbolTable {
+ public:
+  SymbolTable() = default;
+  ~SymbolTable() = default;
+
+  // Adds @addr, or all the addresses in @stack, to the table.
+  void Add(int64_t addr) { pending_.push_back(addr); }
+  void Add(const ThreadStack& stack);
+  // Adds all the addresses of the stack traces in @stacks for which @filter
+  // returns true, or of all of them if @filter is null.
+  void Add(const StackTable& stacks,
+           const std::function<bool(StackId)>& filter = nullptr);
+  // Symbolizes all the addresses added so far. If @pool is non-null, disjoint
+  // ranges of the (sorted) addresses are symbolized in parallel.
+  void Symbolize(common::WorkerPool* pool);
+  // Same as above, but symbolizes every address with @symbolizer, e.g. to
+  // symbolize addresses of another process.
+  void Symbolize(const std::function<std::string(int64_t /*addr*/)>& symbolizer);
+  // Returns the symbol of @addr, or "(unknown)" if @addr couldn't be
+  // symbolized or wasn't symbolized by the last call to Symbolize(...).
+  const char* Lookup(int64_t addr) const;
+  // Returns the number of unique addresses symbolized by the last call to
+  // Symbolize(...).
+  int size() const { return addrs_.size(); }
+  // Removes all the addresses from the table.
+  void Clear();
+
+ private:
+  // Merges @pending_ into @addrs_, and sorts and dedups the result.
+  void MergePending();
+
+  // Addresses added since the last call to Symbolize(...). They are kept
+  // apart from @addrs_, so that Lookup(...) can binary search @addrs_ at any
+  // time.
+  std::vector<int64_t> pending_;
+  // Sorted, unique addresses symbolized by the last call to Symbolize(...).
+  std::vector<int64_t> addrs_;
+  // Symbol of each address in @addrs_, pointing into @text_.
+  std::vector<const char*> symbols_;
+  // Symbols of each range of addresses, as consecutive NUL terminated
+  // strings.
+  std::vector<std::string> text_;
+};
+
+}  // namespace threadstacks
+
+#endif  // THREADSTACKS_SYMBOL_TABLE_H_
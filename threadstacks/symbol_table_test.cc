@@ -0,0 +1,76 @@
+// Copyright: ThoughtSpot Inc 2017
+
+#include "threadstacks/symbol_table.h"
+
+#include <string>
+
+#include "gtest/gtest.h"
+
+namespace threadstacks {
+namespace {
+
+// Symbolizes address @addr as "f<addr>".
+std::string Name(int64_t addr) { return "f" + std::to_string(addr); }
+
+TEST(SymbolTableTest, Lookup) {
+  SymbolTable symbols;
+  symbols.Add(30);
+  symbols.Add(10);
+  symbols.Add(30);
+  symbols.Add(20);
+  EXPECT_STREQ("(unknown)", symbols.Lookup(10));
+  symbols.Symbolize(Name);
+  EXPECT_EQ(3, symbols.size());
+  EXPECT_STREQ("f10", symbols.Lookup(10));
+  EXPECT_STREQ("f20", symbols.Lookup(20));
+  EXPECT_STREQ("f30", symbols.Lookup(30));
+  EXPECT_STREQ("(unknown)", symbols.Lookup(15));
+  symbols.Clear();
+  EXPECT_EQ(0, symbols.size());
+  EXPECT_STREQ("(unknown)", symbols.Lookup(10));
+}
+
+TEST(SymbolTableTest, AddAfterSymbolize) {
+  SymbolTable symbols;
+  symbols.Add(20);
+  symbols.Add(40);
+  symbols.Symbolize(Name);
+  // Addresses smaller than the symbolized ones must not throw the lookups of
+  // the latter off.
+  symbols.Add(30);
+  symbols.Add(10);
+  EXPECT_STREQ("f20", symbols.Lookup(20));
+  EXPECT_STREQ("f40", symbols.Lookup(40));
+  EXPECT_STREQ("(unknown)", symbols.Lookup(10));
+  EXPECT_EQ(2, symbols.size());
+  symbols.Symbolize(Name);
+  EXPECT_EQ(4, symbols.size());
+  for (const int64_t addr : {10, 20, 30, 40}) {
+    EXPECT_EQ(Name(addr), symbols.Lookup(addr));
+  }
+}
+
+TEST(SymbolTableTest, AddStackTable) {
+  StackTable stacks;
+  const int64_t a[] = {10, 20};
+  const int64_t b[] = {30, 20};
+  stacks.Intern(a, 2);
+  const StackId idb = stacks.Intern(b, 2);
+  SymbolTable symbols;
+  symbols.Add(stacks, [idb](StackId id) { return id != idb; });
+  symbols.Symbolize(Name);
+  EXPECT_EQ(2, symbols.size());
+  EXPECT_STREQ("(unknown)", symbols.Lookup(30));
+  symbols.Add(stacks);
+  symbols.Symbolize(Name);
+  EXPECT_EQ(3, symbols.size());
+  EXPECT_STREQ("f30", symbols.Lookup(30));
+}
+
+}  // namespace
+}  // namespace threadstacks
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,82 @@
+// Copyright: ThoughtSpot Inc 2017
+
+#include "threadstacks/tag_profile.h"
+
+namespace threadstacks {
+
+constexpr char TagProfile::kOtherTag[];
+
+void TagProfile::Add(const std::string& tag, StackId stack) {
+  std::lock_guard<std::mutex> l(m_);
+  AddLocked(tag, stack);
+}
+
+void TagProfile::OnSamples(int64_t time_ns,
+                           const StackTable& stacks,
+                           const Sampler::Sample* samples,
+                           int num_samples) {
+  std::lock_guard<std::mutex> l(m_);
+  if (num_rounds_ == 0) {
+    start_ns_ = time_ns;
+  }
+  end_ns_ = time_ns;
+  ++num_rounds_;
+  // Reused across samples, to save an allocation per sample.
+  std::string tag;
+  for (int i = 0; i < num_samples; ++i) {
+    tag.assign(samples[i].tag);
+    AddLocked(tag, samples[i].stack);
+  }
+}
+
+void TagProfile::AddLocked(const std::string& tag, StackId stack) {
+  auto it = tags_.find(tag);
+  if (it == tags_.end()) {
+    // One slot is kept for kOtherTag.
+    const bool full = static_cast<int>(tags_.size()) >= options_.max_tags - 1;
+    it = tags_.emplace(full ? kOtherTag : tag, TagCounts()).first;
+  }
+  auto& counts = it->second;
+  if (stack >= counts.counts.size()) {
+    counts.counts.resize(stack + 1, 0);
+  }
+  ++counts.counts[stack];
+  ++counts.num_samples;
+}
+
+std::map<std::string, int64_t> TagProfile::Counts() const {
+  std::lock_guard<std::mutex> l(m_);
+  std::map<std::string, int64_t> counts;
+  for (const auto& e : tags_) {
+    counts[e.first] = e.second.num_samples;
+  }
+  return counts;
+}
+
+Sampler::Profile TagProfile::GetProfile(
+    const std::string& tag,
+    std::shared_ptr<const StackTable> stacks) const {
+  Sampler::Profile profile;
+  profile.stacks = std::move(stacks);
+  std::lock_guard<std::mutex> l(m_);
+  profile.num_rounds = num_rounds_;
+  profile.start_ns = start_ns_;
+  profile.end_ns = end_ns_;
+  auto it = tags_.find(tag);
+  if (it != tags_.end()) {
+    profile.counts = it->second.counts;
+    profile.num_samples = it->second.num_samples;
+  }
+  profile.DropUnknownStacks();
+  return profile;
+}
+
+void TagProfile::Reset() {
+  std::lock_guard<std::mutex> l(m_);
+  tags_.clear();
+  num_rounds_ = 0;
+  start_ns_ = 0;
+  end_ns_ = 0;
+}
+
+}  // namespace threadstacks
@@ -0,0 +1,88 @@
+// Copyright: ThoughtSpot Inc 2017
+
+#ifndef THREADSTACKS_TAG_PROFILE_H_
+#define THREADSTACKS_TAG_PROFILE_H_
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "threadstacks/sampler.h"
+#include "threadstacks/stack_table.h"
+
+namespace threadstacks {
+
+// A TagProfile breaks down the samples of a Sampler by the context tags of the
+// threads (see ContextTag), e.g. to see where the time goes per tenant or per
+// query, without the application keeping profiles of its own. Every tag gets
+// a profile of its own, which can be rendered like the profile of the
+// sampler.
+//
+// The number of tags is bounded by Options::max_tags: once that many tags are
+// counted, samples with new tags are counted under kOtherTag.
+//
+// Note: This class is thread-safe.
+class TagProfile : public Sampler::Listener {
+ public:
+  struct Options {
+    // Maximum number of distinct tags counted, including the empty tag of
+    // untagged threads.
+    int max_tags = 1024;
+  };
+
+  // Tag that samples with tags over Options::max_tags are counted under.
+  static constexpr char kOtherTag[] = "(other)";
+
+  explicit TagProfile(const Options& options) : options_(options) {}
+  ~TagProfile() override = default;
+
+  // Counts a sample of stack trace @stack, taken while the thread had tag
+  // @tag.
+  void Add(const std::string& tag, StackId stack);
+
+  // Sampler::Listener implementation.
+  void OnSamples(int64_t time_ns,
+                 const StackTable& stacks,
+                 const Sampler::Sample* samples,
+                 int num_samples) override;
+
+  // Returns the number of samples of every tag, where "" stands for untagged
+  // threads.
+  std::map<std::string, int64_t> Counts() const;
+  // Returns the profile of the samples with tag @tag. @stacks must hold the
+  // stack traces of the samples, e.g. as the profile of the sampler does.
+  Sampler::Profile GetProfile(const std::string& tag,
+                              std::shared_ptr<const StackTable> stacks) const;
+  // Drops all the counts.
+  void Reset();
+
+ private:
+  struct TagCounts {
+    int64_t num_samples = 0;
+    // Indexed by StackId.
+    std::vector<int64_t> counts;
+  };
+
+  // Same as Add(...), but must be called with @m_ held.
+  void AddLocked(const std::string& tag, StackId stack);
+
+  const Options options_;
+
+  mutable std::mutex m_;
+  std::map<std::string, TagCounts> tags_;
+  // Sampling rounds observed, and the wall time of the first and last one.
+  int64_t num_rounds_ = 0;
+  int64_t start_ns_ = 0;
+  int64_t end_ns_ = 0;
+
+  // Disable copy c'tor and assignment operator.
+  TagProfile(const TagProfile&) = delete;
+  TagProfile& operator=(const TagProfile&) = delete;
+};
+
+}  // namespace threadstacks
+
+#endif  // THREADSTACKS_TAG_PROFILE_H_
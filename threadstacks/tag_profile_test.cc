@@ -0,0 +1,110 @@
+// Copyright: ThoughtSpot Inc 2017
+
+#include "threadstacks/tag_profile.h"
+
+#include <unistd.h>
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "threadstacks/context_tag.h"
+#include "threadstacks/signal_handler.h"
+
+namespace threadstacks {
+namespace {
+
+TEST(TagProfileTest, Counts) {
+  TagProfile::Options options;
+  options.max_tags = 3;
+  TagProfile profile(options);
+  StackTable table;
+  const int64_t a[] = {1, 2};
+  const int64_t b[] = {3};
+  const StackId ida = table.Intern(a, 2);
+  const StackId idb = table.Intern(b, 1);
+  const Sampler::Sample samples[] = {
+      {1, ida, "tenant=a"}, {2, idb, "tenant=a"}, {3, ida, ""}};
+  profile.OnSamples(100, table, samples, 3);
+  profile.OnSamples(200, table, samples, 3);
+  // Over the maximum number of tags.
+  profile.Add("tenant=b", idb);
+  profile.Add("tenant=c", idb);
+
+  const auto counts = profile.Counts();
+  ASSERT_EQ(3, counts.size());
+  EXPECT_EQ(4, counts.at("tenant=a"));
+  EXPECT_EQ(2, counts.at(""));
+  EXPECT_EQ(2, counts.at(TagProfile::kOtherTag));
+
+  auto stacks = std::make_shared<const StackTable>(table);
+  const auto a_profile = profile.GetProfile("tenant=a", stacks);
+  EXPECT_EQ(2, a_profile.num_rounds);
+  EXPECT_EQ(4, a_profile.num_samples);
+  EXPECT_EQ(100, a_profile.start_ns);
+  EXPECT_EQ(200, a_profile.end_ns);
+  ASSERT_EQ(2, a_profile.counts.size());
+  EXPECT_EQ(2, a_profile.counts[ida]);
+  EXPECT_EQ(2, a_profile.counts[idb]);
+  EXPECT_EQ("0x2;0x1 2\n0x3 2\n", a_profile.ToFoldedString(nullptr));
+  EXPECT_EQ(0, profile.GetProfile("tenant=d", stacks).num_samples);
+
+  // A table taken before stack trace @idb was interned.
+  StackTable old_table;
+  old_table.Intern(a, 2);
+  const auto old_profile = profile.GetProfile(
+      "tenant=a", std::make_shared<const StackTable>(old_table));
+  ASSERT_EQ(1, old_profile.counts.size());
+  EXPECT_EQ(2, old_profile.counts[ida]);
+  EXPECT_EQ(2, old_profile.num_samples);
+
+  profile.Reset();
+  EXPECT_TRUE(profile.Counts().empty());
+}
+
+TEST(TagProfileTest, Sampler) {
+  std::atomic<bool> stop{false};
+  std::atomic<bool> ready{false};
+  std::thread worker([&]() {
+    ContextTag tag("query=42");
+    ScopedContextTag scoped(&tag);
+    ready = true;
+    while (not stop) {
+      usleep(1000);
+    }
+  });
+  while (not ready) {
+    usleep(1000);
+  }
+  Sampler sampler{Sampler::Options()};
+  TagProfile profile{TagProfile::Options()};
+  sampler.AddListener(&profile);
+  std::string error;
+  for (int i = 0; i < 3; ++i) {
+    ASSERT_TRUE(sampler.SampleOnce(&error)) << error;
+  }
+  stop = true;
+  worker.join();
+
+  const auto counts = profile.Counts();
+  ASSERT_EQ(1, counts.count("query=42"));
+  EXPECT_EQ(3, counts.at("query=42"));
+  ASSERT_EQ(1, counts.count(""));
+  const auto tagged = profile.GetProfile("query=42",
+                                         sampler.GetProfile().stacks);
+  EXPECT_EQ(3, tagged.num_samples);
+  EXPECT_FALSE(tagged.ToFoldedString(nullptr).empty());
+}
+
+}  // namespace
+}  // namespace threadstacks
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  if (not threadstacks::StackTraceSignal::InstallInternalHandler()) {
+    return 1;
+  }
+  return RUN_ALL_TESTS();
+}
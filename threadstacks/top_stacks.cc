@@ -0,0 +1,161 @@
+// Copyright: ThoughtSpot Inc 2017
+
+#include "threadstacks/top_stacks.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace threadstacks {
+namespace {
+
+// Largest exponent of a forward decay weight, after which the counts are
+// scaled down. exp(100) leaves plenty of headroom in a double.
+constexpr double kMaxExponent = 100;
+
+}  // namespace
+
+TopStacks::TopStacks(const Options& options)
+    : options_(options),
+      tau_ns_(std::max<int64_t>(options.half_life_ns, 1) / std::log(2.0)) {
+  const int capacity = std::max(options_.capacity, 1);
+  counters_.reserve(capacity);
+  heap_.reserve(capacity);
+  index_.reserve(capacity);
+}
+
+void TopStacks::Add(int64_t time_ns, StackId stack) {
+  std::lock_guard<std::mutex> l(m_);
+  AddLocked(stack, Weight(time_ns));
+}
+
+void TopStacks::OnSamples(int64_t time_ns,
+                          const StackTable& stacks,
+                          const Sampler::Sample* samples,
+                          int num_samples) {
+  std::lock_guard<std::mutex> l(m_);
+  // All the samples of a round have the same weight.
+  const double weight = Weight(time_ns);
+  for (int i = 0; i < num_samples; ++i) {
+    AddLocked(samples[i].stack, weight);
+  }
+}
+
+double TopStacks::Weight(int64_t time_ns) {
+  if (not started_) {
+    started_ = true;
+    landmark_ns_ = time_ns;
+  }
+  const double exponent = (time_ns - landmark_ns_) / tau_ns_;
+  if (exponent <= kMaxExponent) {
+    return std::exp(exponent);
+  }
+  // Moves the landmark to @time_ns. The order of the counts, and thus the
+  // heap, is unchanged.
+  const double scale = std::exp(-exponent);
+  for (auto& counter : counters_) {
+    counter.count *= scale;
+    counter.error *= scale;
+  }
+  total_ *= scale;
+  landmark_ns_ = time_ns;
+  return 1;
+}
+
+void TopStacks::AddLocked(StackId stack, double weight) {
+  total_ += weight;
+  auto it = index_.find(stack);
+  if (it != index_.end()) {
+    Counter& counter = counters_[it->second];
+    counter.count += weight;
+    SiftDown(counter.heap_index);
+    return;
+  }
+  if (static_cast<int>(counters_.size()) < std::max(options_.capacity, 1)) {
+    const int index = counters_.size();
+    counters_.push_back({stack, weight, 0, static_cast<int>(heap_.size())});
+    heap_.push_back(index);
+    index_.emplace(stack, index);
+    SiftUp(counters_[index].heap_index);
+    return;
+  }
+  // Replaces the counter with the lowest count.
+  const int index = heap_[0];
+  Counter& counter = counters_[index];
+  index_.erase(counter.stack);
+  index_.emplace(stack, index);
+  counter.stack = stack;
+  counter.error = counter.count;
+  counter.count += weight;
+  SiftDown(0);
+}
+
+void TopStacks::SiftDown(int index) {
+  const int size = heap_.size();
+  while (true) {
+    int smallest = index;
+    for (int child = 2 * index + 1; child <= 2 * index + 2; ++child) {
+      if (child < size && counters_[heap_[child]].count <
+                              counters_[heap_[smallest]].count) {
+        smallest = child;
+      }
+    }
+    if (smallest == index) {
+      return;
+    }
+    Swap(index, smallest);
+    index = smallest;
+  }
+}
+
+void TopStacks::SiftUp(int index) {
+  while (index > 0) {
+    const int parent = (index - 1) / 2;
+    if (counters_[heap_[parent]].count <= counters_[heap_[index]].count) {
+      return;
+    }
+    Swap(index, parent);
+    index = parent;
+  }
+}
+
+void TopStacks::Swap(int a, int b) {
+  std::swap(heap_[a], heap_[b]);
+  counters_[heap_[a]].heap_index = a;
+  counters_[heap_[b]].heap_index = b;
+}
+
+double TopStacks::Top(int n,
+                      int64_t now_ns,
+                      std::vector<Entry>* entries) const {
+  entries->clear();
+  double total;
+  int64_t landmark_ns;
+  {
+    std::lock_guard<std::mutex> l(m_);
+    for (const auto& counter : counters_) {
+      entries->push_back({counter.stack, counter.count, counter.error});
+    }
+    total = total_;
+    landmark_ns = landmark_ns_;
+  }
+  n = std::min<int>(std::max(n, 0), entries->size());
+  std::partial_sort(entries->begin(), entries->begin() + n, entries->end(),
+                    [](const Entry& a, const Entry& b) {
+                      return a.count > b.count;
+                    });
+  entries->resize(n);
+  // Converts the forward-decayed counts to counts decayed to @now_ns.
+  const double scale = std::exp(-(now_ns - landmark_ns) / tau_ns_);
+  for (auto& entry : *entries) {
+    entry.count *= scale;
+    entry.error *= scale;
+  }
+  return total * scale;
+}
+
+int TopStacks::size() const {
+  std::lock_guard<std::mutex> l(m_);
+  return counters_.size();
+}
+
+}  // namespace threadstacks
@@ -0,0 +1,119 @@
+// Copyright: ThoughtSpot Inc 2017
+
+#ifndef THREADSTACKS_TOP_STACKS_H_
+#define THREADSTACKS_TOP_STACKS_H_
+
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "threadstacks/sampler.h"
+#include "threadstacks/stack_table.h"
+
+namespace threadstacks {
+
+// TopStacks keeps the hottest stack traces of a Sampler "right now", rather
+// than since the start of the profile: every sample counts for half as much
+// after each half-life, so the counts reflect a sliding window of a few
+// half-lives.
+//
+// Memory is bounded by the space-saving algorithm: at most Options::capacity
+// stack traces are counted, and a stack trace that isn't counted replaces the
+// one with the lowest count, inheriting its count as an error bound. Any stack
+// trace with more than 1/capacity of the (decayed) samples is guaranteed to be
+// counted.
+//
+// Decay uses forward decay: a sample at time t is added with weight
+// exp(t / tau), relative to a landmark time, so that the counts never need to
+// be decayed themselves, and are only scaled down when the weights get large.
+// Counters are kept in a min-heap by count. Since the hot stack traces end up
+// at its leaves, counting their samples is O(1), and O(log capacity) in the
+// worst case.
+//
+// Note: This class is thread-safe.
+class TopStacks : public Sampler::Listener {
+ public:
+  struct Options {
+    // Maximum number of stack traces counted.
+    int capacity = 1024;
+    // Time after which a sample counts for half as much.
+    int64_t half_life_ns = 10LL * 1000 * 1000 * 1000;
+  };
+
+  // A counted stack trace.
+  struct Entry {
+    StackId stack;
+    // Decayed number of samples, which overestimates the actual one by at
+    // most @error.
+    double count;
+    double error;
+  };
+
+  explicit TopStacks(const Options& options);
+  ~TopStacks() override = default;
+
+  // Counts a sample of stack trace @stack, taken at @time_ns. Samples should
+  // be added roughly in time order.
+  void Add(int64_t time_ns, StackId stack);
+
+  // Sampler::Listener implementation.
+  void OnSamples(int64_t time_ns,
+                 const StackTable& stacks,
+                 const Sampler::Sample* samples,
+                 int num_samples) override;
+
+  // Fills @entries with the (at most) @n stack traces with the highest counts,
+  // decayed to @now_ns, in decreasing order of count. Returns the decayed
+  // number of all the samples, e.g. to turn counts into fractions.
+  double Top(int n, int64_t now_ns, std::vector<Entry>* entries) const;
+
+  // Returns the number of stack traces counted.
+  int size() const;
+
+ private:
+  struct Counter {
+    StackId stack;
+    // Forward-decayed count and error, relative to @landmark_ns_.
+    double count;
+    double error;
+    // Position of the counter in @heap_.
+    int heap_index;
+  };
+
+  // Returns the weight of a sample at @time_ns, scaling the counts down first
+  // if it gets too large. Expects @m_ to be held.
+  double Weight(int64_t time_ns);
+  // Adds @weight to the count of @stack. Expects @m_ to be held.
+  void AddLocked(StackId stack, double weight);
+  // Moves the counter at @index of @heap_ down, or up, until its children
+  // have larger counts, or its parent a smaller one.
+  void SiftDown(int index);
+  void SiftUp(int index);
+  // Swaps the counters at @a and @b of @heap_.
+  void Swap(int a, int b);
+
+  const Options options_;
+  // Inverse of the decay rate, in nanoseconds.
+  const double tau_ns_;
+
+  // Protects the members below.
+  mutable std::mutex m_;
+  bool started_ = false;
+  int64_t landmark_ns_ = 0;
+  // Forward-decayed number of all samples.
+  double total_ = 0;
+  std::vector<Counter> counters_;
+  // Index of the counter of every counted stack trace.
+  std::unordered_map<StackId, int> index_;
+  // Indexes of the counters, as a min-heap by count.
+  std::vector<int> heap_;
+
+  // Disable copy c'tor and assignment operator.
+  TopStacks(const TopStacks&) = delete;
+  TopStacks& operator=(const TopStacks&) = delete;
+};
+
+}  // namespace threadstacks
+
+#endif  // THREADSTACKS_TOP_STACKS_H_
@@ -0,0 +1,110 @@
+// Copyright: ThoughtSpot Inc 2017
+
+#include "threadstacks/top_stacks.h"
+
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "threadstacks/signal_handler.h"
+
+namespace threadstacks {
+namespace {
+
+const int64_t kSecondNs = 1000 * 1000 * 1000;
+
+TEST(TopStacksTest, Decay) {
+  TopStacks::Options options;
+  options.half_life_ns = kSecondNs;
+  TopStacks top(options);
+  // Stack trace 1 was hot a few seconds ago, stack trace 2 is hot now.
+  for (int i = 0; i < 100; ++i) {
+    top.Add(0, 1);
+  }
+  for (int i = 0; i < 40; ++i) {
+    top.Add(3 * kSecondNs, 2);
+  }
+  std::vector<TopStacks::Entry> entries;
+  EXPECT_NEAR(40 + 100 / 8.0, top.Top(10, 3 * kSecondNs, &entries), 1e-9);
+  ASSERT_EQ(2, entries.size());
+  EXPECT_EQ(2, entries[0].stack);
+  EXPECT_NEAR(40, entries[0].count, 1e-9);
+  EXPECT_EQ(0, entries[0].error);
+  EXPECT_EQ(1, entries[1].stack);
+  EXPECT_NEAR(100 / 8.0, entries[1].count, 1e-9);
+
+  // Counts keep decaying until the next samples.
+  top.Top(1, 4 * kSecondNs, &entries);
+  ASSERT_EQ(1, entries.size());
+  EXPECT_NEAR(20, entries[0].count, 1e-9);
+
+  // Long after, with the counts scaled down along the way.
+  for (int64_t t = 4; t < 10000; t += 100) {
+    top.Add(t * kSecondNs, 3);
+  }
+  top.Add(10000 * kSecondNs, 3);
+  top.Top(3, 10000 * kSecondNs, &entries);
+  ASSERT_EQ(3, entries.size());
+  EXPECT_EQ(3, entries[0].stack);
+  EXPECT_NEAR(1, entries[0].count, 1e-9);
+  EXPECT_NEAR(0, entries[2].count, 1e-9);
+}
+
+TEST(TopStacksTest, SpaceSaving) {
+  TopStacks::Options options;
+  options.capacity = 10;
+  options.half_life_ns = kSecondNs;
+  TopStacks top(options);
+  // Three hot stack traces among a thousand rare ones, all in the same round.
+  for (StackId rare = 100; rare < 1100; ++rare) {
+    top.Add(0, rare);
+    for (StackId hot = 0; hot < 3; ++hot) {
+      if (rare % (hot + 2) == 0) {
+        top.Add(0, hot);
+      }
+    }
+  }
+  EXPECT_EQ(10, top.size());
+  std::vector<TopStacks::Entry> entries;
+  EXPECT_NEAR(1000 + 500 + 333 + 250, top.Top(3, 0, &entries), 1e-9);
+  ASSERT_EQ(3, entries.size());
+  const int expected[] = {500, 333, 250};
+  for (int i = 0; i < 3; ++i) {
+    EXPECT_EQ(i, entries[i].stack);
+    // Counts overestimate by at most the error, which is at most the total
+    // over the capacity.
+    EXPECT_LE(expected[i], entries[i].count);
+    EXPECT_GE(expected[i], entries[i].count - entries[i].error);
+    EXPECT_GE(2083 / 10.0, entries[i].error);
+  }
+}
+
+TEST(TopStacksTest, Sampler) {
+  TopStacks top(TopStacks::Options{});
+  Sampler sampler(Sampler::Options{});
+  sampler.AddListener(&top);
+  std::string error;
+  for (int i = 0; i < 3; ++i) {
+    ASSERT_TRUE(sampler.SampleOnce(&error)) << error;
+  }
+  const auto profile = sampler.GetProfile();
+  std::vector<TopStacks::Entry> entries;
+  // Not much time passes between the rounds.
+  EXPECT_NEAR(profile.num_samples,
+              top.Top(1000, profile.end_ns, &entries), 0.1);
+  EXPECT_EQ(top.size(), entries.size());
+  for (const auto& entry : entries) {
+    EXPECT_NEAR(profile.counts[entry.stack], entry.count, 0.1);
+  }
+}
+
+}  // namespace
+}  // namespace threadstacks
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  if (not threadstacks::StackTraceSignal::InstallInternalHandler()) {
+    return 1;
+  }
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,173 @@
+// Copyright: ThoughtSpot Inc 2017
+
+#include "threadstacks/trigger_engine.h"
+
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+
+#include "common/sysutil.h"
+
+namespace threadstacks {
+
+TriggerEngine::TriggerEngine(const Options& options,
+                             CollectionCallback on_collection,
+                             ProfileCallback on_profile)
+    : options_(options),
+      on_collection_(std::move(on_collection)),
+      on_profile_(std::move(on_profile)),
+      limiter_(options.cooldown_ms, options.max_captures_per_minute) {
+  collector_.set_timeout_ms(options_.timeout_ms);
+}
+
+TriggerEngine::~TriggerEngine() { Stop(); }
+
+bool TriggerEngine::Start() {
+  std::lock_guard<std::mutex> l(m_);
+  if (thread_.joinable()) {
+    return false;
+  }
+  stop_ = false;
+  thread_ = std::thread(&TriggerEngine::Run, this);
+  return true;
+}
+
+void TriggerEngine::Stop() {
+  {
+    std::lock_guard<std::mutex> l(m_);
+    stop_ = true;
+  }
+  stop_cv_.notify_all();
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+}
+
+void TriggerEngine::Heartbeat() {
+  heartbeat_ms_.store(common::RateLimiter::NowMs(), std::memory_order_relaxed);
+}
+
+bool TriggerEngine::PollOnce(Event* event) {
+  if (not Check(common::RateLimiter::NowMs(), event)) {
+    return false;
+  }
+  Capture(*event);
+  return true;
+}
+
+void TriggerEngine::Run() {
+  const auto interval = std::chrono::milliseconds(
+      std::max<int64_t>(options_.poll_interval_ms, 1));
+  auto next = std::chrono::steady_clock::now();
+  while (true) {
+    {
+      std::unique_lock<std::mutex> l(m_);
+      if (stop_cv_.wait_until(l, next, [this]() { return stop_; })) {
+        return;
+      }
+    }
+    Event event;
+    PollOnce(&event);
+    // Skip the polls that were missed, e.g. during a capture.
+    next += interval;
+    const auto now = std::chrono::steady_clock::now();
+    if (next < now) {
+      next = now + interval;
+    }
+  }
+}
+
+bool TriggerEngine::Check(int64_t now_ms, Event* event) {
+  // Evaluates every trigger, so that they all re-arm as their symptoms
+  // clear, and reports the first one that fires.
+  bool fired = false;
+  auto check = [&](Reason reason, bool crossed, double value, bool* armed) {
+    if (not crossed) {
+      *armed = true;
+      return;
+    }
+    if (not *armed || fired) {
+      return;
+    }
+    if (not limiter_.Admit(now_ms)) {
+      // Stays armed, so that a lasting symptom is captured after the
+      // cooldown.
+      ++num_suppressed_;
+      return;
+    }
+    *armed = false;
+    fired = true;
+    *event = {reason, common::Sysutil::WallTimeNs(), value};
+  };
+
+  if (options_.cpu_cores > 0) {
+    const int64_t cpu_ns = common::Sysutil::GetProcessCpuTimeNs();
+    if (cpu_ns >= 0 && last_cpu_ns_ >= 0 && now_ms > last_poll_ms_) {
+      const double cores =
+          (cpu_ns - last_cpu_ns_) / 1e6 / (now_ms - last_poll_ms_);
+      check(kCpu, cores >= options_.cpu_cores, cores, &cpu_armed_);
+    }
+    last_cpu_ns_ = cpu_ns;
+  }
+  if (options_.runnable_threads > 0) {
+    const int runnable = CountRunnableThreads();
+    check(kRunnableThreads, runnable >= options_.runnable_threads, runnable,
+          &runnable_armed_);
+  }
+  const int64_t heartbeat_ms = heartbeat_ms_.load(std::memory_order_relaxed);
+  if (options_.stall_ms > 0 && heartbeat_ms >= 0) {
+    const int64_t stalled_ms = now_ms - heartbeat_ms;
+    check(kStall, stalled_ms >= options_.stall_ms, stalled_ms, &stall_armed_);
+  }
+  last_poll_ms_ = now_ms;
+  return fired;
+}
+
+void TriggerEngine::Capture(const Event& event) {
+  ++num_captures_;
+  switch (options_.action) {
+    case kCollect: {
+      std::string error;
+      if (not collector_.Collect(nullptr, &collection_, &error)) {
+        std::cerr << "Failed to collect stack traces: " << error << std::endl;
+        return;
+      }
+      if (on_collection_) {
+        on_collection_(event, collection_);
+      }
+      collection_.Clear();
+      return;
+    }
+    case kSampleBurst: {
+      Sampler sampler(options_.burst_options);
+      sampler.Start();
+      {
+        // Cut short by Stop().
+        std::unique_lock<std::mutex> l(m_);
+        stop_cv_.wait_for(l, std::chrono::milliseconds(options_.burst_ms),
+                          [this]() { return stop_; });
+      }
+      sampler.Stop();
+      if (on_profile_) {
+        on_profile_(event, sampler.GetProfile());
+      }
+      return;
+    }
+  }
+}
+
+// static
+int TriggerEngine::CountRunnableThreads() {
+  // The calling thread is running, but doesn't count.
+  const pid_t self = syscall(SYS_gettid);
+  int runnable = 0;
+  common::Sysutil::VisitThreads([self, &runnable](pid_t tid) {
+    runnable += tid != self && common::Sysutil::GetThreadState(tid) == 'R';
+  });
+  return runnable;
+}
+
+}  // namespace threadstacks
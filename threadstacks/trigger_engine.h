@@ -0,0 +1,173 @@
+// Copyright: ThoughtSpot Inc 2017
+
+#ifndef THREADSTACKS_TRIGGER_ENGINE_H_
+#define THREADSTACKS_TRIGGER_ENGINE_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "common/rate_limiter.h"
+#include "threadstacks/sampler.h"
+#include "threadstacks/signal_handler.h"
+
+namespace threadstacks {
+
+// A TriggerEngine watches the calling process for symptoms worth a capture,
+// and captures its stack traces the moment they show up, rather than when
+// someone gets to send a signal. It polls:
+//  - the CPU usage of the process, from /proc/self/stat,
+//  - the number of runnable threads, from /proc/self/task,
+//  - a stall heartbeat: the time since the application last called
+//    Heartbeat(), e.g. from its event loop.
+// A trigger fires when its threshold is crossed. It fires again only once the
+// symptom has cleared and come back, so that a long spike is captured once.
+// Captures are further rate limited across triggers, so that a flapping
+// symptom can't cause a storm of captures.
+//
+// A capture is either a single collection of all the threads, or a burst of
+// sampling at a high rate, which shows what the process is doing over the
+// spike rather than at a single point in time.
+//
+// Note: The internal stacktrace collection signal handler must be installed
+// for captures to work.
+class TriggerEngine {
+ public:
+  enum Reason {
+    kCpu,
+    kRunnableThreads,
+    kStall,
+  };
+
+  enum Action {
+    // Collects the stack traces of all the threads once.
+    kCollect,
+    // Samples the stack traces of all the threads for a while.
+    kSampleBurst,
+  };
+
+  // A trigger that fired.
+  struct Event {
+    Reason reason;
+    // Wall time of the poll that fired, in nanoseconds since the epoch.
+    int64_t time_ns;
+    // Value that crossed the threshold: CPU cores used, number of runnable
+    // threads, or milliseconds since the last heartbeat.
+    double value;
+  };
+
+  struct Options {
+    // Interval between polls, in milliseconds.
+    int64_t poll_interval_ms = 500;
+    // Thresholds. A zero disables the trigger.
+    // CPU usage over a poll interval, in cores.
+    double cpu_cores = 0;
+    // Number of threads in the runnable state. Note that counting them reads
+    // a file per thread.
+    int runnable_threads = 0;
+    // Time since the last heartbeat, in milliseconds. Only armed by the first
+    // call to Heartbeat().
+    int64_t stall_ms = 0;
+
+    // Minimum time between captures, in milliseconds, and maximum number of
+    // captures per minute. See common::RateLimiter.
+    int64_t cooldown_ms = 60 * 1000;
+    int max_captures_per_minute = 4;
+
+    Action action = kCollect;
+    // Time that collections wait for threads to respond, in milliseconds.
+    int64_t timeout_ms = 1000;
+    // Sampling options and duration of kSampleBurst captures.
+    Sampler::Options burst_options = {100, 1000};
+    int64_t burst_ms = 2000;
+  };
+
+  // Called with the trigger that fired, and the threads it collected, for
+  // kCollect captures.
+  using CollectionCallback = std::function<void(
+      const Event& event, const StackTraceCollection& collection)>;
+  // Called with the trigger that fired, and the profile of the burst, for
+  // kSampleBurst captures.
+  using ProfileCallback =
+      std::function<void(const Event& event, const Sampler::Profile& profile)>;
+
+  // Creates an engine that passes its captures to @on_collection or to
+  // @on_profile, depending on Options::action.
+  TriggerEngine(const Options& options,
+                CollectionCallback on_collection,
+                ProfileCallback on_profile);
+  // Stops polling, if started.
+  ~TriggerEngine();
+
+  // Starts polling on a thread of its own. Returns false if already started.
+  bool Start();
+  // Stops polling, and waits for the polling thread to exit, which includes
+  // waiting for an ongoing capture.
+  void Stop();
+
+  // Records that the application is making progress. Lock-free, and cheap
+  // enough to call on every iteration of an event loop.
+  void Heartbeat();
+
+  // Polls the triggers once on the calling thread, and captures if one fires.
+  // Must not be called while polling is started. Returns true iff a capture
+  // was taken, and fills @event with the trigger that fired.
+  bool PollOnce(Event* event);
+
+  // Returns the number of captures taken, and of triggers that fired but
+  // were rate limited.
+  int64_t num_captures() const { return num_captures_; }
+  int64_t num_suppressed() const { return num_suppressed_; }
+
+ private:
+  // The function run by the polling thread.
+  void Run();
+  // Returns the trigger that fires at monotonic time @now_ms, if any, and
+  // updates the state of the triggers.
+  bool Check(int64_t now_ms, Event* event);
+  // Captures the stack traces for @event.
+  void Capture(const Event& event);
+  // Returns the number of runnable threads of the process, other than the
+  // calling one.
+  static int CountRunnableThreads();
+
+  const Options options_;
+  const CollectionCallback on_collection_;
+  const ProfileCallback on_profile_;
+  common::RateLimiter limiter_;
+  StackTraceCollector collector_;
+  StackTraceCollection collection_;
+
+  // State of the triggers, only accessed by the polling thread. A trigger is
+  // armed until it fires, and re-armed once its symptom clears.
+  bool cpu_armed_ = true;
+  bool runnable_armed_ = true;
+  bool stall_armed_ = true;
+  // CPU time of the process and monotonic time at the last poll, or -1.
+  int64_t last_cpu_ns_ = -1;
+  int64_t last_poll_ms_ = -1;
+
+  // Monotonic time of the last heartbeat in milliseconds, or -1 if none.
+  std::atomic<int64_t> heartbeat_ms_{-1};
+  std::atomic<int64_t> num_captures_{0};
+  std::atomic<int64_t> num_suppressed_{0};
+
+  // Protects the members below.
+  std::mutex m_;
+  // Signalled when @stop_ is set.
+  std::condition_variable stop_cv_;
+  bool stop_ = false;
+  std::thread thread_;
+
+  // Disable copy c'tor and assignment operator.
+  TriggerEngine(const TriggerEngine&) = delete;
+  TriggerEngine& operator=(const TriggerEngine&) = delete;
+};
+
+}  // namespace threadstacks
+
+#endif  // THREADSTACKS_TRIGGER_ENGINE_H_
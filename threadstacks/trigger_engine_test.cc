@@ -0,0 +1,162 @@
+// Copyright: ThoughtSpot Inc 2017
+
+#include "threadstacks/trigger_engine.h"
+
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace threadstacks {
+namespace {
+
+// Returns options with all the triggers disabled, and no rate limit.
+TriggerEngine::Options NoLimits() {
+  TriggerEngine::Options options;
+  options.cooldown_ms = 0;
+  options.max_captures_per_minute = 0;
+  return options;
+}
+
+TEST(TriggerEngineTest, Stall) {
+  auto options = NoLimits();
+  options.stall_ms = 50;
+  int num_collections = 0;
+  TriggerEngine engine(
+      options,
+      [&](const TriggerEngine::Event& event,
+          const StackTraceCollection& collection) {
+        EXPECT_EQ(TriggerEngine::kStall, event.reason);
+        EXPECT_LE(1, collection.num_threads());
+        ++num_collections;
+      },
+      nullptr);
+  TriggerEngine::Event event;
+  // Not armed before the first heartbeat.
+  usleep(100 * 1000);
+  EXPECT_FALSE(engine.PollOnce(&event));
+  engine.Heartbeat();
+  EXPECT_FALSE(engine.PollOnce(&event));
+  usleep(100 * 1000);
+  ASSERT_TRUE(engine.PollOnce(&event));
+  EXPECT_EQ(TriggerEngine::kStall, event.reason);
+  EXPECT_LE(50, event.value);
+  EXPECT_EQ(1, num_collections);
+  // Fires once per stall.
+  EXPECT_FALSE(engine.PollOnce(&event));
+  engine.Heartbeat();
+  EXPECT_FALSE(engine.PollOnce(&event));
+  usleep(100 * 1000);
+  EXPECT_TRUE(engine.PollOnce(&event));
+  EXPECT_EQ(2, num_collections);
+  EXPECT_EQ(2, engine.num_captures());
+  EXPECT_EQ(0, engine.num_suppressed());
+}
+
+TEST(TriggerEngineTest, Cooldown) {
+  auto options = NoLimits();
+  options.stall_ms = 20;
+  options.cooldown_ms = 60 * 1000;
+  TriggerEngine engine(options, nullptr, nullptr);
+  TriggerEngine::Event event;
+  engine.Heartbeat();
+  usleep(50 * 1000);
+  EXPECT_TRUE(engine.PollOnce(&event));
+  engine.Heartbeat();
+  EXPECT_FALSE(engine.PollOnce(&event));
+  usleep(50 * 1000);
+  EXPECT_FALSE(engine.PollOnce(&event));
+  EXPECT_FALSE(engine.PollOnce(&event));
+  EXPECT_EQ(1, engine.num_captures());
+  EXPECT_EQ(2, engine.num_suppressed());
+}
+
+TEST(TriggerEngineTest, Cpu) {
+  auto options = NoLimits();
+  options.cpu_cores = 0.5;
+  TriggerEngine engine(options, nullptr, nullptr);
+  TriggerEngine::Event event;
+  EXPECT_FALSE(engine.PollOnce(&event));
+  usleep(100 * 1000);
+  EXPECT_FALSE(engine.PollOnce(&event));
+  // Spins for 200ms.
+  const auto end =
+      std::chrono::steady_clock::now() + std::chrono::milliseconds(200);
+  while (std::chrono::steady_clock::now() < end) {
+  }
+  ASSERT_TRUE(engine.PollOnce(&event));
+  EXPECT_EQ(TriggerEngine::kCpu, event.reason);
+  EXPECT_LE(0.5, event.value);
+}
+
+TEST(TriggerEngineTest, RunnableThreadsBurst) {
+  auto options = NoLimits();
+  options.runnable_threads = 2;
+  options.action = TriggerEngine::kSampleBurst;
+  options.burst_options.rate_hz = 50;
+  options.burst_ms = 200;
+  Sampler::Profile burst;
+  TriggerEngine engine(options, nullptr,
+                       [&](const TriggerEngine::Event& event,
+                           const Sampler::Profile& profile) {
+                         EXPECT_EQ(TriggerEngine::kRunnableThreads,
+                                   event.reason);
+                         burst = profile;
+                       });
+  TriggerEngine::Event event;
+  EXPECT_FALSE(engine.PollOnce(&event));
+  std::atomic<bool> stop(false);
+  std::vector<std::thread> spinners;
+  for (int i = 0; i < 2; ++i) {
+    spinners.emplace_back([&stop]() {
+      while (not stop) {
+      }
+    });
+  }
+  usleep(50 * 1000);
+  const bool fired = engine.PollOnce(&event);
+  stop = true;
+  for (auto& t : spinners) {
+    t.join();
+  }
+  ASSERT_TRUE(fired);
+  EXPECT_LE(2, event.value);
+  EXPECT_LE(2, burst.num_rounds);
+  EXPECT_LE(3 * burst.num_rounds, burst.num_samples);
+}
+
+TEST(TriggerEngineTest, Start) {
+  auto options = NoLimits();
+  options.poll_interval_ms = 10;
+  options.stall_ms = 30;
+  std::atomic<int> num_collections(0);
+  TriggerEngine engine(options,
+                       [&](const TriggerEngine::Event& event,
+                           const StackTraceCollection& collection) {
+                         ++num_collections;
+                       },
+                       nullptr);
+  ASSERT_TRUE(engine.Start());
+  EXPECT_FALSE(engine.Start());
+  engine.Heartbeat();
+  for (int i = 0; i < 500 && num_collections == 0; ++i) {
+    usleep(10 * 1000);
+  }
+  engine.Stop();
+  EXPECT_EQ(1, num_collections);
+}
+
+}  // namespace
+}  // namespace threadstacks
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  if (not threadstacks::StackTraceSignal::InstallInternalHandler()) {
+    return 1;
+  }
+  return RUN_ALL_TESTS();
+}